@@ -17,9 +17,23 @@
  * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "tut1.h"
 
 tut1_error tut1_init(VkInstance *vk)
+{
+	return tut1_init_ext(vk, NULL, 0);
+}
+
+tut1_error tut1_init_ext(VkInstance *vk, const char *ext_names[], uint32_t ext_count)
+{
+	uint32_t api_version = VK_API_VERSION_1_0;
+	return tut1_init_version(vk, &api_version, ext_names, ext_count);
+}
+
+tut1_error tut1_init_version(VkInstance *vk, uint32_t *api_version, const char *ext_names[], uint32_t ext_count)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
@@ -33,7 +47,7 @@ tut1_error tut1_init(VkInstance *vk)
 	 * In fact, there is nothing related to graphics in this tutorial.
 	 *
 	 * To initialize Vulkan, a set of information needs to be given to it.  Most importantly, this includes Vulkan
-	 * layers and extensions that are desired (none in this tutorial).
+	 * layers and extensions that are desired (none in this tutorial, but later tutorials may ask for some).
 	 *
 	 * Some of Vulkan structs, such as those ending in Info need to have their `sType` set, which is the first
 	 * member of the struct.  Generally, VkSomeStruct has type VK_STRUCTURE_TYPE_SOME_STRUCT, so this is easy to
@@ -58,18 +72,41 @@ tut1_error tut1_init(VkInstance *vk)
 		/*
 		 * the apiVersion field is used to make sure your application is going to work with the driver.  You
 		 * could either use VK_MAKE_VERSION to specify a particular version, e.g. VK_MAKE_VERSION(1, 0, 0), or
-		 * use a predefined value, for example VK_API_VERSION_1_0.
+		 * use a predefined value, for example VK_API_VERSION_1_0.  See below.
 		 */
 		.apiVersion = VK_API_VERSION_1_0,
 	};
 
+	/*
+	 * These tutorials are written for Vulkan 1.0, but some of them can make use of newer features where
+	 * available.  A Vulkan 1.0 loader fails to create an instance with a higher apiVersion, so the version is
+	 * only raised as far as the loader supports.  Only loaders newer than 1.0 have vkEnumerateInstanceVersion,
+	 * which is looked up instead of called directly so this still works with a 1.0 loader.  The version that
+	 * was actually used is returned, and devices can only be used up to the lower of that and their own
+	 * apiVersion.
+	 */
+	if (*api_version > VK_API_VERSION_1_0)
+	{
+		uint32_t loader_version = VK_API_VERSION_1_0;
+		PFN_vkEnumerateInstanceVersion enumerate_instance_version =
+			(PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+		if (enumerate_instance_version == NULL || enumerate_instance_version(&loader_version))
+			loader_version = VK_API_VERSION_1_0;
+		if (*api_version > loader_version)
+			*api_version = loader_version;
+	}
+	app_info.apiVersion = *api_version;
+
 	/*
 	 * The vkInstanceCreateInfo struct takes the previous application information, as well as the names of layers
-	 * and extensions your application needs to use.  This tutorial uses none, so they are left out (set to 0).
+	 * and extensions your application needs to use.  This tutorial uses none, so ext_count is 0 and the layers are
+	 * left out (set to 0).
 	 */
 	VkInstanceCreateInfo info = {
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pApplicationInfo = &app_info,
+		.enabledExtensionCount = ext_count,
+		.ppEnabledExtensionNames = ext_names,
 	};
 
 	/*
@@ -92,6 +129,48 @@ tut1_error tut1_init(VkInstance *vk)
 	return retval;
 }
 
+bool tut1_has_instance_extension(const char *ext_name)
+{
+	/* See Tutorial 5 for how extensions are enumerated */
+	uint32_t count = 0;
+	bool found = false;
+
+	if (vkEnumerateInstanceExtensionProperties(NULL, &count, NULL) || count == 0)
+		return false;
+
+	VkExtensionProperties *extensions = malloc(count * sizeof *extensions);
+	if (extensions == NULL)
+		return false;
+
+	if (vkEnumerateInstanceExtensionProperties(NULL, &count, extensions) >= 0)
+		for (uint32_t i = 0; i < count && !found; ++i)
+			found = strcmp(extensions[i].extensionName, ext_name) == 0;
+
+	free(extensions);
+	return found;
+}
+
+bool tut1_has_device_extension(struct tut1_physical_device *phy_dev, const char *ext_name)
+{
+	/* Same as above, but for the extensions of a device */
+	uint32_t count = 0;
+	bool found = false;
+
+	if (vkEnumerateDeviceExtensionProperties(phy_dev->physical_device, NULL, &count, NULL) || count == 0)
+		return false;
+
+	VkExtensionProperties *extensions = malloc(count * sizeof *extensions);
+	if (extensions == NULL)
+		return false;
+
+	if (vkEnumerateDeviceExtensionProperties(phy_dev->physical_device, NULL, &count, extensions) >= 0)
+		for (uint32_t i = 0; i < count && !found; ++i)
+			found = strcmp(extensions[i].extensionName, ext_name) == 0;
+
+	free(extensions);
+	return found;
+}
+
 void tut1_exit(VkInstance vk)
 {
 	/*
@@ -105,6 +184,104 @@ void tut1_exit(VkInstance vk)
 	vkDestroyInstance(vk, NULL);
 }
 
+/*
+ * How each usage ranks the memory types.  A type must have all the `required` properties to be usable at all.  Among
+ * the usable types, having the `preferred` properties counts the most, then the `nice` ones, and every `avoided`
+ * property counts against the type.
+ */
+static const struct
+{
+	VkMemoryPropertyFlags required;
+	VkMemoryPropertyFlags preferred;
+	VkMemoryPropertyFlags nice;
+	VkMemoryPropertyFlags avoided;
+} memory_usage_ranking[TUT1_MEMORY_USAGE_COUNT] = {
+	/* Any memory works, but device-local memory is fastest, and there's no use wasting host-visible memory on it */
+	[TUT1_MEMORY_DEVICE_LOCAL] = {
+		.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		.avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+	},
+	/*
+	 * The host only writes, so host-cached memory brings nothing, and device-local host-visible memory is often
+	 * scarce and better left for dynamic data.  Host-coherent saves flushing.
+	 */
+	[TUT1_MEMORY_UPLOAD] = {
+		.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		.preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		.avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	},
+	/* Reading uncached memory is painfully slow, so host-cached matters the most */
+	[TUT1_MEMORY_READBACK] = {
+		.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		.preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+		.nice = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	},
+	/* The device reads it over and over, so it's best if it's device-local while still visible to the host */
+	[TUT1_MEMORY_DYNAMIC] = {
+		.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		.nice = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	},
+};
+
+static int memory_type_score(VkMemoryPropertyFlags flags, enum tut1_memory_usage usage)
+{
+	int score = 0;
+
+	if ((flags & memory_usage_ranking[usage].preferred) == memory_usage_ranking[usage].preferred)
+		score += 4;
+	if ((flags & memory_usage_ranking[usage].nice) == memory_usage_ranking[usage].nice)
+		score += 2;
+	for (VkMemoryPropertyFlags avoided = flags & memory_usage_ranking[usage].avoided; avoided; avoided &= avoided - 1)
+		score -= 1;
+
+	return score;
+}
+
+static void rank_memory_types(struct tut1_physical_device *dev)
+{
+	/*
+	 * Vulkan already sorts the memory types such that for any set of properties, the first type that has them is
+	 * the best one.  That's great if we know exactly what properties we need, but often we'd rather have some
+	 * properties than need them.  Instead of searching the memory types over and over every time something is
+	 * allocated, the types are ranked here once for each usage.  Types with the same score keep the order Vulkan
+	 * gave them in, so Vulkan's guarantee still holds.
+	 *
+	 * Lazily allocated memory is never chosen; it is only meant for attachments that never leave the GPU's tile
+	 * memory, which none of the tutorials create.
+	 */
+	for (uint32_t u = 0; u < TUT1_MEMORY_USAGE_COUNT; ++u)
+	{
+		int scores[VK_MAX_MEMORY_TYPES];
+		uint32_t count = 0;
+
+		for (uint32_t i = 0; i < dev->memories.memoryTypeCount; ++i)
+		{
+			VkMemoryPropertyFlags flags = dev->memories.memoryTypes[i].propertyFlags;
+
+			if ((flags & memory_usage_ranking[u].required) != memory_usage_ranking[u].required)
+				continue;
+			if (flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+				continue;
+
+			/* Insertion sort, placing the type after every type that's at least as good */
+			int score = memory_type_score(flags, u);
+			uint32_t pos = count;
+			while (pos > 0 && scores[pos - 1] < score)
+			{
+				dev->memory_types[u][pos] = dev->memory_types[u][pos - 1];
+				scores[pos] = scores[pos - 1];
+				--pos;
+			}
+			dev->memory_types[u][pos] = i;
+			scores[pos] = score;
+			++count;
+		}
+
+		dev->memory_type_count[u] = count;
+	}
+}
+
 tut1_error tut1_enumerate_devices(VkInstance vk, struct tut1_physical_device *devs, uint32_t *count)
 {
 	VkPhysicalDevice phy_devs[*count];
@@ -134,6 +311,7 @@ tut1_error tut1_enumerate_devices(VkInstance vk, struct tut1_physical_device *de
 	for (uint32_t i = 0; i < *count; ++i)
 	{
 		devs[i].physical_device = phy_devs[i];
+		devs[i].instance = vk;
 
 		/*
 		 * Once we have handles to each physical device, we can query information regarding the device. This
@@ -156,6 +334,7 @@ tut1_error tut1_enumerate_devices(VkInstance vk, struct tut1_physical_device *de
 		vkGetPhysicalDeviceProperties(devs[i].physical_device, &devs[i].properties);
 		vkGetPhysicalDeviceFeatures(devs[i].physical_device, &devs[i].features);
 		vkGetPhysicalDeviceMemoryProperties(devs[i].physical_device, &devs[i].memories);
+		rank_memory_types(&devs[i]);
 
 		/*
 		 * Each physical device has certain abilities, such as being able to support graphics operations or
@@ -187,6 +366,38 @@ exit_failed:
 	return retval;
 }
 
+uint32_t tut1_find_memory_type(struct tut1_physical_device *phy_dev, enum tut1_memory_usage usage,
+		const VkMemoryRequirements *mem_req, VkMemoryPropertyFlags required, uint32_t *rank)
+{
+	for (; *rank < phy_dev->memory_type_count[usage]; ++*rank)
+	{
+		uint32_t i = phy_dev->memory_types[usage][*rank];
+
+		/* If Vulkan says this type doesn't support the object, ignore it */
+		if ((mem_req->memoryTypeBits & 1 << i) == 0)
+			continue;
+
+		/* If the heap can't possibly hold the object, ignore it */
+		if (phy_dev->memories.memoryHeaps[phy_dev->memories.memoryTypes[i].heapIndex].size < mem_req->size)
+			continue;
+
+		if ((phy_dev->memories.memoryTypes[i].propertyFlags & required) != required)
+			continue;
+
+		++*rank;
+		return i;
+	}
+
+	return phy_dev->memories.memoryTypeCount;
+}
+
+uint64_t tut1_get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+}
+
 /* The following functions get a readable string out of the Vulkan standard enums */
 
 const char *tut1_VkPhysicalDeviceType_string(VkPhysicalDeviceType type)
@@ -25,17 +25,39 @@
 #include "tut1_error.h"
 
 tut1_error tut1_init(VkInstance *vk);
+/* Same as tut1_init, but enable the given instance extensions too */
+tut1_error tut1_init_ext(VkInstance *vk, const char *ext_names[], uint32_t ext_count);
+/* Same as tut1_init_ext, but ask for up to *api_version of Vulkan.  *api_version is set to the version actually used */
+tut1_error tut1_init_version(VkInstance *vk, uint32_t *api_version, const char *ext_names[], uint32_t ext_count);
 void tut1_exit(VkInstance vk);
 
 #define TUT1_MAX_QUEUE_FAMILY 10
 
+/*
+ * What a piece of memory is going to be used for.  Each usage has its own ranking of the memory types, from the most
+ * to the least suitable.  See tut1_enumerate_devices() for how they are ranked.
+ */
+enum tut1_memory_usage
+{
+	TUT1_MEMORY_DEVICE_LOCAL,	/* used only by the device, such as render targets and textures */
+	TUT1_MEMORY_UPLOAD,		/* written by the host, read by the device, such as staging buffers */
+	TUT1_MEMORY_READBACK,		/* written by the device, read by the host */
+	TUT1_MEMORY_DYNAMIC,		/* rewritten by the host often (e.g. every frame), and read by the device */
+	TUT1_MEMORY_USAGE_COUNT,
+};
+
 struct tut1_physical_device
 {
 	VkPhysicalDevice physical_device;
+	VkInstance instance;		/* the instance the device was enumerated from */
 	VkPhysicalDeviceProperties properties;
 	VkPhysicalDeviceFeatures features;
 	VkPhysicalDeviceMemoryProperties memories;
 
+	/* The memory types usable for each usage, best first */
+	uint32_t memory_types[TUT1_MEMORY_USAGE_COUNT][VK_MAX_MEMORY_TYPES];
+	uint32_t memory_type_count[TUT1_MEMORY_USAGE_COUNT];
+
 	VkQueueFamilyProperties queue_families[TUT1_MAX_QUEUE_FAMILY];
 	uint32_t queue_family_count;
 	bool queue_families_incomplete;
@@ -43,6 +65,21 @@ struct tut1_physical_device
 
 tut1_error tut1_enumerate_devices(VkInstance vk, struct tut1_physical_device *devs, uint32_t *count);
 
+/* Whether the instance or a device supports an extension (see Tutorial 5 for how extensions are enumerated) */
+bool tut1_has_instance_extension(const char *ext_name);
+bool tut1_has_device_extension(struct tut1_physical_device *phy_dev, const char *ext_name);
+
+/*
+ * Find the next memory type for `usage` that can back an object with the given requirements and that has the
+ * `required` properties on top of what `usage` needs.  `rank` should start at 0, and is advanced past the returned
+ * type, so calling this again gives the next best type.  Returns memoryTypeCount once there are no more types.
+ */
+uint32_t tut1_find_memory_type(struct tut1_physical_device *phy_dev, enum tut1_memory_usage usage,
+		const VkMemoryRequirements *mem_req, VkMemoryPropertyFlags required, uint32_t *rank);
+
+/* A monotonic clock in nanoseconds, for measuring how long things take */
+uint64_t tut1_get_time_ns(void);
+
 const char *tut1_VkPhysicalDeviceType_string(VkPhysicalDeviceType type);
 
 #endif
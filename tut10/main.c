@@ -98,10 +98,14 @@ struct render_data
 
 	/* Actual objects used in this tutorial */
 	struct tut7_image images[2];
+	struct tut7_sampler_cache samplers;
 	struct tut7_buffer buffers[3];
 	struct tut7_shader shaders[2];
 	struct tut7_graphics_buffers *gbuffers;
 
+	/* The transformation is written to a new part of this ring every frame, as in Tutorial 9 */
+	struct tut8_uniform_ring transformation_ring;
+
 	/* For rendering */
 	VkRenderPass render_pass;
 	struct tut8_layout layout;
@@ -113,14 +117,14 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		struct tut6_swapchain *swapchain, struct tut7_render_essentials *essentials, struct render_data *render_data)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
 
 	/* Buffers */
 	render_data->buffers[BUFFER_TRANSFORMATION] = (struct tut7_buffer){
-		.size = sizeof render_data->transformation,
+		.size = TUT8_UNIFORM_RING_SIZE,
 		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		.stage = VK_SHADER_STAGE_VERTEX_BIT,
 		.host_visible = true,
+		.dynamic = true,
 	};
 
 	render_data->buffers[BUFFER_VERTICES] = (struct tut7_buffer){
@@ -150,8 +154,15 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
 		.make_view = true,
 		.host_visible = false,
+		.sampler_cache = &render_data->samplers,
 	};
 	render_data->images[IMAGE_TEXTURE2] = render_data->images[IMAGE_TEXTURE1];
+	/*
+	 * The second texture is a nicety; the quad looks fine with just the first one.  So if the device is short on
+	 * memory, let tut7_create_images() skip it instead of pushing other applications' memory out (see Tutorial 7).
+	 * In that case, its image is VK_NULL_HANDLE and the first texture is used in its place.
+	 */
+	render_data->images[IMAGE_TEXTURE2].optional = true;
 
 	retval = tut7_create_images(phy_dev, dev, render_data->images, 2);
 	if (!tut1_error_is_success(&retval))
@@ -184,7 +195,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	};
 
 	/* Fill and copy buffers */
-	retval = tut8_render_fill_buffer(dev, &render_data->buffers[BUFFER_TRANSFORMATION], &render_data->transformation, sizeof render_data->transformation, "transformation");
+	retval = tut8_render_init_uniform_ring(phy_dev, &render_data->transformation_ring, &render_data->buffers[BUFFER_TRANSFORMATION]);
 	if (!tut1_error_is_success(&retval))
 		return retval;
 	/*
@@ -209,9 +220,14 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	retval = generate_texture(phy_dev, dev, essentials, &render_data->images[IMAGE_TEXTURE1], pattern1, "texture1");
 	if (!tut1_error_is_success(&retval))
 		return retval;
-	retval = generate_texture(phy_dev, dev, essentials, &render_data->images[IMAGE_TEXTURE2], pattern2, "texture2");
-	if (!tut1_error_is_success(&retval))
-		return retval;
+	if (render_data->images[IMAGE_TEXTURE2].image == VK_NULL_HANDLE)
+		printf("Not enough memory for texture2; using texture1 in its place\n");
+	else
+	{
+		retval = generate_texture(phy_dev, dev, essentials, &render_data->images[IMAGE_TEXTURE2], pattern2, "texture2");
+		if (!tut1_error_is_success(&retval))
+			return retval;
+	}
 
 	/* Shaders */
 	render_data->shaders[SHADER_VERTEX] = (struct tut7_shader){
@@ -380,22 +396,22 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	}
 
 	/* Descriptor Set */
-	VkDescriptorSetAllocateInfo set_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->layout.set_layout,
-	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->pipeline.set_allocators[0], &render_data->desc_set, 1);
+	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Could not allocate descriptor set from pool\n");
 		return retval;
 	}
 
-	/* In this tutorial, we also have an image to bind to the descriptor set */
+	/*
+	 * In this tutorial, we also have an image to bind to the descriptor set.  Both textures are sampled the same way
+	 * from the same sampler cache, so their samplers are actually one and the same; see tut7_acquire_sampler().  If the optional second texture
+	 * didn't fit in memory, the first one is bound to both bindings.
+	 */
+	struct tut7_image *texture2 = &render_data->images[IMAGE_TEXTURE2];
+	if (texture2->image == VK_NULL_HANDLE)
+		texture2 = &render_data->images[IMAGE_TEXTURE1];
+
 	VkDescriptorImageInfo set_write_image_info[2] = {
 		[0] = {
 			.sampler = render_data->images[IMAGE_TEXTURE1].sampler,
@@ -403,15 +419,15 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 		},
 		[1] = {
-			.sampler = render_data->images[IMAGE_TEXTURE2].sampler,
-			.imageView = render_data->images[IMAGE_TEXTURE2].view,
+			.sampler = texture2->sampler,
+			.imageView = texture2->view,
 			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 		},
 	};
 	VkDescriptorBufferInfo set_write_buffer_info = {
 		.buffer = render_data->buffers[BUFFER_TRANSFORMATION].buffer,
 		.offset = 0,
-		.range = VK_WHOLE_SIZE,
+		.range = sizeof render_data->transformation,
 	};
 	VkWriteDescriptorSet set_write[3] = {
 		[0] = {
@@ -435,7 +451,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 			.dstSet = render_data->desc_set,
 			.dstBinding = 2,
 			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 			.pBufferInfo = &set_write_buffer_info,
 		},
 	};
@@ -451,6 +467,7 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	tut8_free_pipelines(dev, &render_data->pipeline, 1);
 	tut8_free_layouts(dev, &render_data->layout, 1);
 	tut7_free_images(dev, render_data->images, 2);
+	tut7_free_sampler_cache(dev, &render_data->samplers);
 	tut7_free_buffers(dev, render_data->buffers, 3);
 	tut7_free_shaders(dev, render_data->shaders, 2);
 	tut7_free_graphics_buffers(dev, render_data->gbuffers, essentials->image_count, render_data->render_pass);
@@ -500,13 +517,6 @@ exit_failed:
 	return retval;
 }
 
-static uint64_t get_time_ns()
-{
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
-}
-
 static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut6_swapchain *swapchain)
 {
 	int res;
@@ -525,7 +535,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 	if (!tut1_error_is_success(&retval))
 		goto exit_bad_render_data;
 
-	uint64_t animation_time = get_time_ns();
+	uint64_t animation_time = tut1_get_time_ns();
 
 	unsigned int frames = 0;
 	time_t before = time(NULL);
@@ -544,6 +554,17 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 
 		uint32_t image_index;
 
+		/* The transformation ring is used the same as in Tutorial 9 */
+		uint32_t transformation_offset;
+		tut8_render_ring_begin_frame(dev, &render_data.transformation_ring);
+		retval = tut8_render_ring_push(dev, &render_data.transformation_ring, &render_data.transformation,
+				sizeof render_data.transformation, &transformation_offset);
+		if (!tut1_error_is_success(&retval))
+		{
+			tut1_error_printf(&retval, "Failed to write the transformation\n");
+			break;
+		}
+
 		/* We saw all this in Tutorials 8 and 9.  Any changes are commented. */
 		res = tut7_render_start(&essentials, dev, swapchain, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &image_index);
 		if (res)
@@ -571,7 +592,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		vkCmdBindPipeline(essentials.cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data.pipeline.pipeline);
 
 		vkCmdBindDescriptorSets(essentials.cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				render_data.layout.pipeline_layout, 0, 1, &render_data.desc_set, 0, NULL);
+				render_data.layout.pipeline_layout, 0, 1, &render_data.desc_set, 1, &transformation_offset);
 
 		VkDeviceSize vertices_offset = 0;
 		vkCmdBindVertexBuffers(essentials.cmd_buffer, 0, 1, &render_data.buffers[BUFFER_VERTICES].buffer, &vertices_offset);
@@ -603,7 +624,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		 *
 		 * Let's make the quad gradually swing between the textures in a span of 2 seconds.
 		 */
-		uint64_t cur_time = get_time_ns();
+		uint64_t cur_time = tut1_get_time_ns();
 		float mix_value = (cur_time - animation_time) % 2000000000 / 1000000000.0f;
 		if (mix_value > 1)
 			mix_value = 2 - mix_value;
@@ -626,6 +647,10 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		res = tut7_render_finish(&essentials, dev, swapchain, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, image_index);
 		if (res)
 			break;
+
+		retval = tut8_render_ring_end_frame(dev, &render_data.transformation_ring, essentials.exec_fence);
+		if (!tut1_error_is_success(&retval))
+			break;
 	}
 
 exit_bad_render_data:
@@ -110,6 +110,14 @@ struct render_data
 	struct tut7_graphics_buffers *gbuffers;
 	struct tut11_offscreen_buffers obuffers;
 
+	/*
+	 * The transformation lives in a ring, like Tutorials 9 and 10.  The off-screen rendering is recorded only once
+	 * though, so its offset is baked in that recording.  The ring is made just large enough for one
+	 * transformation, so that every time it's pushed, it lands in the same place.
+	 */
+	struct tut8_uniform_ring transformation_ring;
+	uint32_t transformation_offset;
+
 	/* For rendering: two stages of rendering, so two sets of everything! */
 	VkRenderPass render_render_pass;
 	struct tut8_layout render_layout;
@@ -126,14 +134,17 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		struct tut6_swapchain *swapchain, struct tut7_render_essentials *essentials, struct render_data *render_data)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
 
 	/* Buffers */
+	VkDeviceSize ring_alignment = phy_dev->properties.limits.minUniformBufferOffsetAlignment;
+	if (ring_alignment == 0)
+		ring_alignment = 1;
 	render_data->buffers[BUFFER_TRANSFORMATION] = (struct tut7_buffer){
-		.size = sizeof render_data->transformation,
+		.size = (sizeof render_data->transformation + ring_alignment - 1) / ring_alignment * ring_alignment,
 		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		.stage = VK_SHADER_STAGE_VERTEX_BIT,
 		.host_visible = true,
+		.dynamic = true,
 	};
 
 	render_data->buffers[BUFFER_VERTICES] = (struct tut7_buffer){
@@ -186,7 +197,16 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	};
 
 	/* Fill and copy buffers */
-	retval = tut8_render_fill_buffer(dev, &render_data->buffers[BUFFER_TRANSFORMATION], &render_data->transformation, sizeof render_data->transformation, "transformation");
+	retval = tut8_render_init_uniform_ring(phy_dev, &render_data->transformation_ring, &render_data->buffers[BUFFER_TRANSFORMATION]);
+	if (!tut1_error_is_success(&retval))
+		return retval;
+	/*
+	 * The first transformation is pushed now, to know where it lands for prerecording.  The frame is ended in
+	 * render_loop(), with the fence of the off-screen submission that uses it.
+	 */
+	tut8_render_ring_begin_frame(dev, &render_data->transformation_ring);
+	retval = tut8_render_ring_push(dev, &render_data->transformation_ring, &render_data->transformation,
+			sizeof render_data->transformation, &render_data->transformation_offset);
 	if (!tut1_error_is_success(&retval))
 		return retval;
 	retval = tut10_render_init_buffer(phy_dev, dev, essentials, &render_data->buffers[BUFFER_VERTICES], render_data->objects.vertices, "vertex");
@@ -276,7 +296,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	/*
 	 * The resources used here are the transformation matrix, vertex and fragment shaders.
 	 */
-	struct tut8_resources resources = {
+	struct tut8_resources render_resources = {
 		.buffers = render_data->buffers,
 		.buffer_count = 1,
 		.shaders = &render_data->shaders[SHADER_RENDER_VERTEX],
@@ -284,7 +304,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.render_pass = render_data->render_render_pass,
 	};
 	render_data->render_layout = (struct tut8_layout){
-		.resources = &resources,
+		.resources = &render_resources,
 	};
 	/*
 	 * Note: transformation matrix: binding 0.
@@ -336,45 +356,10 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.thread_count = 1,
 	};
 
-	retval = tut8_make_graphics_pipelines(dev, &render_data->render_pipeline, 1);
-	if (!tut1_error_is_success(&retval))
-	{
-		tut1_error_printf(&retval, "Could not create graphics pipeline for rendering\n");
-		return retval;
-	}
-
-	/* Descriptor Set */
-	VkDescriptorSetAllocateInfo set_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->render_pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->render_layout.set_layout,
-	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->render_desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
-	{
-		tut1_error_printf(&retval, "Could not allocate descriptor set from pool for rendering\n");
-		return retval;
-	}
-
-	VkDescriptorBufferInfo set_write_buffer_info = {
-		.buffer = render_data->buffers[BUFFER_TRANSFORMATION].buffer,
-		.offset = 0,
-		.range = VK_WHOLE_SIZE,
-	};
-	VkWriteDescriptorSet set_write[1] = {
-		[0] = {
-			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-			.dstSet = render_data->render_desc_set,
-			.dstBinding = 0,
-			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.pBufferInfo = &set_write_buffer_info,
-		},
-	};
-	vkUpdateDescriptorSets(dev->device, 1, set_write, 0, NULL);
+	/*
+	 * Note that the pipeline is not created yet.  The post-processing pipeline is described first, and then both
+	 * are created together, so they can be compiled in parallel.
+	 */
 
 	/*********************
 	 * THE POSTPROC PART *
@@ -408,7 +393,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	 * The post-processing shaders don't need a transformation matrix, so we don't have to provide that buffer
 	 * here.  It uses the off-screen image as input though!
 	 */
-	resources = (struct tut8_resources){
+	struct tut8_resources postproc_resources = {
 		.images = &render_data->obuffers.color,
 		.image_count = 1,
 		.shaders = &render_data->shaders[SHADER_POSTPROC_VERTEX],
@@ -418,7 +403,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.render_pass = render_data->postproc_render_pass,
 	};
 	render_data->postproc_layout = (struct tut8_layout){
-		.resources = &resources,
+		.resources = &postproc_resources,
 	};
 	retval = tut8_make_graphics_layouts(dev, &render_data->postproc_layout, 1);
 	if (!tut1_error_is_success(&retval))
@@ -428,40 +413,42 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	}
 
 	/* Pipeline */
-	vertex_binding = (VkVertexInputBindingDescription){
+	VkVertexInputBindingDescription postproc_vertex_binding = {
 		.binding = 0,
 		.stride = sizeof *render_data->objects.vertices,
 		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
 	};
 	/* Note: only using position and texture coordinates for post-processing */
-	vertex_attributes[0] = (VkVertexInputAttributeDescription){
-		.location = 0,
-		.binding = 0,
-		.format = VK_FORMAT_R32G32B32_SFLOAT,
-		.offset = 0,
-	};
-	vertex_attributes[1] = (VkVertexInputAttributeDescription){
-		/*
-		 * So far, we always had position at location 0, color at location 1 and when applicable,
-		 * texture coordinates at location 2.  Here, we don't use the color input and we have two
-		 * choices.  One choice would be to set the texture coordinates at location 1; this could be
-		 * slightly more efficient.  The other choice would be to set the texture coordinates at
-		 * location 2 as usual; this would be more uniform among our shaders.  Just to show it's not
-		 * necessary for the locations to be sequential, let's go with the second option.
-		 */
-		.location = 2,
-		.binding = 0,
-		.format = VK_FORMAT_R32G32_SFLOAT,
-		.offset = sizeof(float[3]) + sizeof(float[3]),
+	VkVertexInputAttributeDescription postproc_vertex_attributes[2] = {
+		[0] = {
+			.location = 0,
+			.binding = 0,
+			.format = VK_FORMAT_R32G32B32_SFLOAT,
+			.offset = 0,
+		},
+		[1] = {
+			/*
+			 * So far, we always had position at location 0, color at location 1 and when applicable,
+			 * texture coordinates at location 2.  Here, we don't use the color input and we have two
+			 * choices.  One choice would be to set the texture coordinates at location 1; this could be
+			 * slightly more efficient.  The other choice would be to set the texture coordinates at
+			 * location 2 as usual; this would be more uniform among our shaders.  Just to show it's not
+			 * necessary for the locations to be sequential, let's go with the second option.
+			 */
+			.location = 2,
+			.binding = 0,
+			.format = VK_FORMAT_R32G32_SFLOAT,
+			.offset = sizeof(float[3]) + sizeof(float[3]),
+		},
 	};
 	render_data->postproc_pipeline = (struct tut8_pipeline){
 		.layout = &render_data->postproc_layout,
 		.vertex_input_state = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
 			.vertexBindingDescriptionCount = 1,
-			.pVertexBindingDescriptions = &vertex_binding,
+			.pVertexBindingDescriptions = &postproc_vertex_binding,
 			.vertexAttributeDescriptionCount = 2,
-			.pVertexAttributeDescriptions = vertex_attributes,
+			.pVertexAttributeDescriptions = postproc_vertex_attributes,
 		},
 		.input_assembly_state = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
@@ -473,24 +460,108 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.thread_count = 1,
 	};
 
-	retval = tut8_make_graphics_pipelines(dev, &render_data->postproc_pipeline, 1);
+	/**********************
+	 * THE PIPELINES PART *
+	 **********************/
+
+	/*
+	 * Compiling the pipelines is the slowest part of the startup, and tut8_make_graphics_pipelines_on_pool()
+	 * compiles the pipelines it's given in parallel, on the threads of a compile pool (one per CPU here).  Giving
+	 * it both pipelines at once, the startup takes about as long as the slowest pipeline instead of the sum of
+	 * both.  With two pipelines the difference is small, but a real application with hundreds of pipelines would
+	 * benefit greatly.  A real application would also keep the pool around for the pipelines of the next level,
+	 * instead of freeing it right away.
+	 */
+	struct tut8_pipeline pipelines[2] = {
+		render_data->render_pipeline,
+		render_data->postproc_pipeline,
+	};
+	struct tut8_compile_pool pool;
+
+	retval = tut8_create_compile_pool(&pool, 0);
 	if (!tut1_error_is_success(&retval))
 	{
-		tut1_error_printf(&retval, "Could not create graphics pipeline for post-processing\n");
+		tut1_error_printf(&retval, "Could not create a pool of threads to compile pipelines on\n");
 		return retval;
 	}
 
-	/* Descriptor Set */
-	set_info = (VkDescriptorSetAllocateInfo){
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->postproc_pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->postproc_layout.set_layout,
+	uint64_t start_ns = tut1_get_time_ns();
+	retval = tut8_make_graphics_pipelines_on_pool(dev, &pool, pipelines, 2);
+	uint64_t parallel_time_ns = tut1_get_time_ns() - start_ns;
+
+	tut8_free_compile_pool(&pool);
+
+	render_data->render_pipeline = pipelines[0];
+	render_data->postproc_pipeline = pipelines[1];
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create graphics pipelines\n");
+		return retval;
+	}
+
+	/*
+	 * To see what the parallel compilation bought us, let's compile the same pipelines again, this time with a
+	 * pool of a single thread, i.e. one after the other.  They are not needed for anything else, so their
+	 * thread_count is 0 (no descriptor set allocators), and they are destroyed right away.  Note that the driver
+	 * may remember the shaders it has already compiled, so if anything, this second round has an advantage.
+	 */
+	struct tut8_pipeline serial_pipelines[2] = {
+		pipelines[0],
+		pipelines[1],
 	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->postproc_desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
+	serial_pipelines[0].thread_count = 0;
+	serial_pipelines[1].thread_count = 0;
+
+	retval = tut8_create_compile_pool(&pool, 1);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create a pool of one thread to compile pipelines on\n");
+		return retval;
+	}
+
+	start_ns = tut1_get_time_ns();
+	retval = tut8_make_graphics_pipelines_on_pool(dev, &pool, serial_pipelines, 2);
+	uint64_t serial_time_ns = tut1_get_time_ns() - start_ns;
+
+	tut8_free_compile_pool(&pool);
+	tut8_free_pipelines(dev, serial_pipelines, 2);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create graphics pipelines one after the other\n");
+		return retval;
+	}
+
+	printf("Created 2 pipelines in %.3fms in parallel, and in %.3fms one after the other\n",
+			parallel_time_ns / 1000000.0, serial_time_ns / 1000000.0);
+
+	/* Descriptor Set for rendering */
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->render_pipeline.set_allocators[0], &render_data->render_desc_set, 1);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not allocate descriptor set from pool for rendering\n");
+		return retval;
+	}
+
+	VkDescriptorBufferInfo set_write_buffer_info = {
+		.buffer = render_data->buffers[BUFFER_TRANSFORMATION].buffer,
+		.offset = 0,
+		.range = sizeof render_data->transformation,
+	};
+	VkWriteDescriptorSet set_write[1] = {
+		[0] = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = render_data->render_desc_set,
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+			.pBufferInfo = &set_write_buffer_info,
+		},
+	};
+	vkUpdateDescriptorSets(dev->device, 1, set_write, 0, NULL);
+
+	/* Descriptor Set for post-processing */
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->postproc_pipeline.set_allocators[0], &render_data->postproc_desc_set, 1);
+	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Could not allocate descriptor set from pool for post-processing\n");
 		return retval;
@@ -532,13 +603,6 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	free(render_data->gbuffers);
 }
 
-static uint64_t get_time_ns()
-{
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
-}
-
 static int prerecord(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut7_render_essentials *essentials,
 		struct render_data *render_data, VkCommandBuffer cmd_buffer)
 {
@@ -616,7 +680,7 @@ static int prerecord(struct tut1_physical_device *phy_dev, struct tut2_device *d
 	/* Bind everything */
 	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data->render_pipeline.pipeline);
 	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			render_data->render_layout.pipeline_layout, 0, 1, &render_data->render_desc_set, 0, NULL);
+			render_data->render_layout.pipeline_layout, 0, 1, &render_data->render_desc_set, 1, &render_data->transformation_offset);
 	VkDeviceSize vertices_offset = 0;
 	vkCmdBindVertexBuffers(cmd_buffer, 0, 1, &render_data->buffers[BUFFER_VERTICES].buffer, &vertices_offset);
 	vkCmdBindIndexBuffer(cmd_buffer, render_data->buffers[BUFFER_INDICES].buffer, 0, VK_INDEX_TYPE_UINT16);
@@ -865,7 +929,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 
 	bool first_submission = true;
 
-	uint64_t animation_time = get_time_ns();
+	uint64_t animation_time = tut1_get_time_ns();
 
 	unsigned int frames = 0;
 	time_t before = time(NULL);
@@ -891,6 +955,34 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 				tut1_error_printf(&retval, "Wait for fence failed\n");
 				break;
 			}
+
+			/*
+			 * The transformation doesn't change, but if it did, this is where it would be written.  The
+			 * previous off-screen rendering is done, so the ring takes back its transformation, and the new one
+			 * lands in the same place, which is where the prerecorded command buffer expects it.
+			 */
+			uint32_t transformation_offset;
+			tut8_render_ring_begin_frame(dev, &render_data.transformation_ring);
+			retval = tut8_render_ring_push(dev, &render_data.transformation_ring, &render_data.transformation,
+					sizeof render_data.transformation, &transformation_offset);
+			if (!tut1_error_is_success(&retval))
+			{
+				tut1_error_printf(&retval, "Failed to write the transformation\n");
+				break;
+			}
+			if (transformation_offset != render_data.transformation_offset)
+			{
+				printf("The transformation moved in the ring, but the prerecorded command buffer can't follow\n");
+				break;
+			}
+		}
+
+		/* The transformation is in use until the off-screen rendering's fence is signaled */
+		retval = tut8_render_ring_end_frame(dev, &render_data.transformation_ring, offscreen_fence);
+		if (!tut1_error_is_success(&retval))
+		{
+			tut1_error_printf(&retval, "Failed to flush the transformation\n");
+			break;
 		}
 		/*
 		 * Right from the start, submit the prerecorded command buffer for rendering.  Wait on the
@@ -978,7 +1070,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		/* Push constants */
 
 		/* Put every value swinging back and forth (1 through 16 for pixels, 256 divided by that for color levels). */
-		uint64_t diff_time_ms = (get_time_ns() - animation_time) / 1000000;
+		uint64_t diff_time_ms = (tut1_get_time_ns() - animation_time) / 1000000;
 		render_data.push_constants = (struct push_constants){
 			.pixel_size = (diff_time_ms / 700) % 31 + 1,
 			.hue_levels = (diff_time_ms / 100) % 31 + 1,
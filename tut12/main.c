@@ -20,7 +20,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <time.h>
 #include "tut12.h"
 #include "../tut8/tut8_render.h"
 
@@ -106,7 +105,6 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		struct tut6_swapchain *swapchain, struct tut7_render_essentials *essentials, struct render_data *render_data)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
 
 	/* Buffers */
 	render_data->buffers[BUFFER_TRANSFORMATION] = (struct tut7_buffer){
@@ -283,16 +281,8 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	}
 
 	/* Descriptor Set */
-	VkDescriptorSetAllocateInfo set_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->layout.set_layout,
-	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->pipeline.set_allocators[0], &render_data->desc_set, 1);
+	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Could not allocate descriptor set from pool\n");
 		return retval;
@@ -329,13 +319,6 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	free(render_data->gbuffers);
 }
 
-static uint64_t get_time_ns()
-{
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
-}
-
 static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut6_swapchain *swapchain)
 {
 	int res;
@@ -354,7 +337,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 	if (!tut1_error_is_success(&retval))
 		goto exit_bad_render_data;
 
-	uint64_t animation_time = get_time_ns();
+	uint64_t animation_time = tut1_get_time_ns();
 
 	/* Process events from ncurses and render.  If process_events returns non-zero, it signals application exit. */
 	while (process_events() == 0)
@@ -411,7 +394,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		vkCmdSetScissor(essentials.cmd_buffer, 0, 1, &scissor);
 
 		/* Make the triangle slowly turn (@30 deg/s), for added fun */
-		uint64_t cur_time = get_time_ns();
+		uint64_t cur_time = tut1_get_time_ns();
 		float angle = (cur_time - animation_time) % 12000000000 / 1000000000.0f;
 		angle *= 3.14159f / 6;
 
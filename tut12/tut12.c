@@ -539,41 +539,31 @@ static VkResult create_image(VkDevice device, const VkSwapchainCreateInfoKHR *cr
 	if (res)
 		return res;
 
-	/* Find a suitable memory backing for it (this is similar to tut4_find_suitable_memory) */
-	VkPhysicalDeviceMemoryProperties memories;
-	vkGetPhysicalDeviceMemoryProperties(g_phy_dev->physical_device, &memories);
-
+	/*
+	 * Allocate memory for the image (this is similar to tut4_allocate_memory).  The host reads the image to draw it
+	 * on the terminal without invalidating, so if host-visible, the memory must be host-coherent as well.  If a heap
+	 * is out of memory, the next best memory type is tried.
+	 */
 	VkMemoryRequirements mem_req = {0};
 	vkGetImageMemoryRequirements(device, image->image, &mem_req);
-	VkMemoryPropertyFlags properties = host_visible?
-					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT:
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	enum tut1_memory_usage usage = host_visible?TUT1_MEMORY_READBACK:TUT1_MEMORY_DEVICE_LOCAL;
+	VkMemoryPropertyFlags required = host_visible?VK_MEMORY_PROPERTY_HOST_COHERENT_BIT:0;
 
-	uint32_t mem_index = memories.memoryTypeCount;
+	uint32_t rank = 0;
+	uint32_t mem_index;
+	res = VK_ERROR_INCOMPATIBLE_DRIVER;
 
-	for (uint32_t i = 0; i < memories.memoryTypeCount; ++i)
+	while ((mem_index = tut1_find_memory_type(g_phy_dev, usage, &mem_req, required, &rank)) < g_phy_dev->memories.memoryTypeCount)
 	{
-		if ((mem_req.memoryTypeBits & 1 << i) == 0)
-			continue;
-		if (memories.memoryHeaps[memories.memoryTypes[i].heapIndex].size < mem_req.size)
-			continue;
-		if ((memories.memoryTypes[i].propertyFlags & properties) == properties)
-		{
-			mem_index = i;
+		VkMemoryAllocateInfo mem_info = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = mem_req.size,
+			.memoryTypeIndex = mem_index,
+		};
+		res = vkAllocateMemory(device, &mem_info, allocator, &image->image_mem);
+		if (res != VK_ERROR_OUT_OF_DEVICE_MEMORY)
 			break;
-		}
 	}
-
-	if (mem_index >= memories.memoryTypeCount)
-		return VK_ERROR_INCOMPATIBLE_DRIVER;
-
-	/* Allocate memory for the image */
-	VkMemoryAllocateInfo mem_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = mem_req.size,
-		.memoryTypeIndex = mem_index,
-	};
-	res = vkAllocateMemory(device, &mem_info, allocator, &image->image_mem);
 	if (res)
 		return res;
 
@@ -800,13 +790,6 @@ VkResult vkGetSwapchainImagesKHR(VkDevice device, VkSwapchainKHR swapchain, uint
  * pretending to be a driver, so we have to once again find a way around this.  Luckily, we have a queue dedicated here
  * which we can use for the sake of signal generation.
  */
-static uint64_t get_time_ns(void)
-{
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
-}
-
 static bool surface_size_changed(struct ncurses_swapchain *sw)
 {
 	int width, height;
@@ -819,7 +802,7 @@ VkResult vkAcquireNextImageKHR(VkDevice device, VkSwapchainKHR swapchain, uint64
 	struct ncurses_swapchain *sw = swapchain_cache[SWAPCHAIN_INDEX(swapchain)];
 	uint32_t found_index = sw->image_count;
 
-	uint64_t start_time = get_time_ns();
+	uint64_t start_time = tut1_get_time_ns();
 	do
 	{
 		/*
@@ -834,7 +817,7 @@ VkResult vkAcquireNextImageKHR(VkDevice device, VkSwapchainKHR swapchain, uint64
 				break;
 			}
 		}
-	} while (get_time_ns() - start_time < timeout && found_index == sw->image_count);
+	} while (tut1_get_time_ns() - start_time < timeout && found_index == sw->image_count);
 
 	/* If no image available, this is a timeout */
 	if (found_index == sw->image_count)
@@ -1066,7 +1049,7 @@ static void *render_thread(void *arg)
 	/* Let's render the FPS why not, since the application would have a hard time doing it */
 	unsigned int frames = 0;
 	unsigned int fps = 1;
-	uint64_t before = get_time_ns();
+	uint64_t before = tut1_get_time_ns();
 
 	while (!sw->request_stop)
 	{
@@ -1171,7 +1154,7 @@ static void *render_thread(void *arg)
 		sw->images[submission.image_index].being_rendered = false;
 
 		++frames;
-		uint64_t now = get_time_ns();
+		uint64_t now = tut1_get_time_ns();
 		if (now - before > 1000000000)
 		{
 			fps = frames;
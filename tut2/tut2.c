@@ -23,6 +23,13 @@
 
 tut1_error tut2_get_dev(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkQueueFlags qflags,
 		VkDeviceQueueCreateInfo queue_info[], uint32_t *queue_info_count)
+{
+	return tut2_get_dev_ext(phy_dev, dev, qflags, queue_info, queue_info_count, NULL, 0);
+}
+
+tut1_error tut2_get_dev_ext(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkQueueFlags qflags,
+		VkDeviceQueueCreateInfo queue_info[], uint32_t *queue_info_count,
+		const char *ext_names[], uint32_t ext_count)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
@@ -93,12 +100,15 @@ tut1_error tut2_get_dev(struct tut1_physical_device *phy_dev, struct tut2_device
 	 * Additionally, one could enable layers and extensions similar to vkCreateInstance.  The layers and extensions
 	 * enabled with vkCreateInstance are those that apply the Vulkan API in general, such as a validation layer,
 	 * but the layers and extensions enabled with vkDeviceCreate are more specific to the device itself.  In either
-	 * case, they will be explored in a future tutorial.
+	 * case, they will be explored in a future tutorial.  This tutorial enables none (tut2_get_dev() gives no
+	 * ext_names), but later ones may ask for a device extension or two.
 	 */
 	VkDeviceCreateInfo dev_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 		.queueCreateInfoCount = *queue_info_count,
 		.pQueueCreateInfos = queue_info,
+		.enabledExtensionCount = ext_count,
+		.ppEnabledExtensionNames = ext_names,
 		.pEnabledFeatures = &phy_dev->features,
 	};
 
@@ -152,6 +162,7 @@ tut1_error tut2_get_commands(struct tut1_physical_device *phy_dev, struct tut2_d
 		 * the capabilities we asked of it.
 		 */
 		cmd->qflags = phy_dev->queue_families[queue_info[i].queueFamilyIndex].queueFlags;
+		cmd->queue_family_index = queue_info[i].queueFamilyIndex;
 
 		/*
 		 * The vkCreateCommandPool takes a VkCommandPoolCreateInfo that tells it what queue family the pool
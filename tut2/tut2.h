@@ -25,6 +25,7 @@
 struct tut2_commands
 {
 	VkQueueFlags qflags;
+	uint32_t queue_family_index;
 
 	VkCommandPool pool;
 	VkQueue *queues;
@@ -38,6 +39,13 @@ struct tut2_device
 	VkDevice device;
 	struct tut2_commands *command_pools;
 	uint32_t command_pool_count;
+
+	/* How much memory is allocated from each heap, now and at most; see tut7_get_memory_stats() */
+	VkDeviceSize heap_usage[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heap_peak[VK_MAX_MEMORY_HEAPS];
+
+	/* If VK_EXT_memory_budget is enabled, the function to query the budget with */
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2;
 };
 
 tut1_error tut2_get_dev(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkQueueFlags qflags,
@@ -54,6 +62,24 @@ static inline tut1_error tut2_setup(struct tut1_physical_device *phy_dev, struct
 		res = tut2_get_commands(phy_dev, dev, queue_info, queue_info_count);
 	return res;
 }
+
+/* Like tut2_get_dev() and tut2_setup(), but with a possibility to enable device extensions */
+tut1_error tut2_get_dev_ext(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkQueueFlags qflags,
+		VkDeviceQueueCreateInfo queue_info[], uint32_t *queue_info_count,
+		const char *ext_names[], uint32_t ext_count);
+
+static inline tut1_error tut2_setup_ext(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkQueueFlags qflags,
+		const char *ext_names[], uint32_t ext_count)
+{
+	VkDeviceQueueCreateInfo queue_info[phy_dev->queue_family_count];
+	uint32_t queue_info_count = phy_dev->queue_family_count;
+
+	tut1_error res = tut2_get_dev_ext(phy_dev, dev, qflags, queue_info, &queue_info_count, ext_names, ext_count);
+	if (tut1_error_is_success(&res))
+		res = tut2_get_commands(phy_dev, dev, queue_info, queue_info_count);
+	return res;
+}
+
 void tut2_cleanup(struct tut2_device *dev);
 
 #endif
@@ -56,36 +56,17 @@ int main(int argc, char **argv)
 		goto exit_bad_enumerate;
 	}
 
-	/* Set up devices */
-	for (uint32_t i = 0; i < dev_count; ++i)
-	{
-		res = tut2_setup(&phy_devs[i], &devs[i], VK_QUEUE_COMPUTE_BIT);
-		if (!tut1_error_is_success(&res))
-		{
-			tut1_error_printf(&res, "Could not setup logical device %u, command pools and queues\n", i);
-			goto exit_bad_setup;
-		}
-	}
-
-	/* Load our compute shader */
-	for (uint32_t i = 0; i < dev_count; ++i)
-	{
-		res = tut3_load_shader(&devs[i], argv[1], &shaders[i]);
-		if (!tut1_error_is_success(&res))
-		{
-			tut1_error_printf(&res, "Could not load shader on device %u\n", i);
-			goto exit_bad_shader;
-		}
-	}
-
-	printf("Loaded the shader, awesome!\n");
-
 	/*
-	 * Create the pipelines.  There are as many pipelines created as command buffers (just for example).  If
-	 * there are not actually enough resources for them, as many as possible are created.
+	 * Set up devices, load our compute shader and create the pipelines.  There are as many pipelines created as
+	 * command buffers (just for example).  The devices are independent, so all of this is done on all devices in
+	 * parallel; take a look at tut3_setup_devices() to see how that's done.  If anything fails, the error is
+	 * printed and whatever was set up is already cleaned up.
 	 */
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut3_make_compute_pipeline(&devs[i], &pipelines[i], shaders[i]);
+	res = tut3_setup_devices(phy_devs, devs, shaders, pipelines, dev_count, VK_QUEUE_COMPUTE_BIT, argv[1], NULL, NULL);
+	if (!tut1_error_is_success(&res))
+		goto exit_bad_enumerate;
+
+	printf("Loaded the shader, awesome!\n");
 
 	/*
 	 * Like tutorial 2, we have covered a lot of ground in this tutorial.  Let's keep actual usage of our compute
@@ -104,17 +85,7 @@ int main(int argc, char **argv)
 	retval = 0;
 
 	/* Cleanup after yourself */
-
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut3_destroy_pipeline(&devs[i], &pipelines[i]);
-
-exit_bad_shader:
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut3_free_shader(&devs[i], shaders[i]);
-
-exit_bad_setup:
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut2_cleanup(&devs[i]);
+	tut3_cleanup_devices(devs, shaders, pipelines, dev_count);
 
 exit_bad_enumerate:
 	tut1_exit(vk);
@@ -289,3 +289,143 @@ void tut3_destroy_pipeline(struct tut2_device *dev, struct tut3_pipelines *pipel
 
 	*pipelines = (struct tut3_pipelines){0};
 }
+
+/* How far setting up each device has gone, so that on failure, exactly what was done is undone */
+enum device_setup_stage
+{
+	DEVICE_SETUP_NONE,
+	DEVICE_SETUP_DEVICE,
+	DEVICE_SETUP_SHADER,
+	DEVICE_SETUP_PIPELINES,
+};
+
+struct device_setup
+{
+	uint32_t index;
+	struct tut1_physical_device *phy_dev;
+	struct tut2_device *dev;
+	VkShaderModule *shader;
+	struct tut3_pipelines *pipelines;
+	VkQueueFlags qflags;
+	const char *spirv_file;
+	const char **ext_names;
+	uint32_t ext_count;
+
+	enum device_setup_stage stage;
+	tut1_error error;
+	const char *failure;		/* what failed, printed by tut3_setup_devices() once every thread is done */
+};
+
+static void *device_setup_thread(void *args)
+{
+	struct device_setup *setup = args;
+
+	/* This is exactly what the main() of Tutorial 3 did before, one device at a time */
+	setup->error = setup->ext_count > 0?
+		tut2_setup_ext(setup->phy_dev, setup->dev, setup->qflags, setup->ext_names, setup->ext_count):
+		tut2_setup(setup->phy_dev, setup->dev, setup->qflags);
+	if (!tut1_error_is_success(&setup->error))
+	{
+		setup->failure = "Could not setup logical device, command pools and queues";
+		goto exit_failed;
+	}
+	setup->stage = DEVICE_SETUP_DEVICE;
+
+	setup->error = tut3_load_shader(setup->dev, setup->spirv_file, setup->shader);
+	if (!tut1_error_is_success(&setup->error))
+	{
+		setup->failure = "Could not load shader";
+		goto exit_failed;
+	}
+	setup->stage = DEVICE_SETUP_SHADER;
+
+	setup->error = tut3_make_compute_pipeline(setup->dev, setup->pipelines, *setup->shader);
+	setup->stage = DEVICE_SETUP_PIPELINES;
+	if (!tut1_error_is_success(&setup->error))
+	{
+		setup->failure = "Could not allocate enough pipelines";
+		goto exit_failed;
+	}
+
+exit_failed:
+	return NULL;
+}
+
+tut1_error tut3_setup_devices(struct tut1_physical_device *phy_devs, struct tut2_device *devs, VkShaderModule *shaders,
+		struct tut3_pipelines *pipelines, uint32_t dev_count, VkQueueFlags qflags, const char *spirv_file,
+		const char **ext_names[], const uint32_t ext_counts[])
+{
+	/*
+	 * Creating a device, loading a shader and specially creating pipelines (where the driver compiles the shader)
+	 * can each take a considerable amount of time.  Each device is independent of the others though, so there is no
+	 * reason to set them up one after the other.  Here, each device is given a thread that does all of that.
+	 *
+	 * Vulkan doesn't need any external synchronization here, because no object is shared between the threads.  The
+	 * physical devices are only read, and each thread creates its own device and everything else on that device.
+	 * The threads don't print anything themselves either, or the messages of different devices would be mixed
+	 * together.  Instead, the failures are printed once all threads are done.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	struct device_setup setups[dev_count];
+	pthread_t threads[dev_count];
+	bool created[dev_count];
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		setups[i] = (struct device_setup){
+			.index = i,
+			.phy_dev = &phy_devs[i],
+			.dev = &devs[i],
+			.shader = &shaders[i],
+			.pipelines = &pipelines[i],
+			.qflags = qflags,
+			.spirv_file = spirv_file,
+			.ext_names = ext_names?ext_names[i]:NULL,
+			.ext_count = ext_names?ext_counts[i]:0,
+		};
+
+		/* If a thread can't be created, just do it here */
+		created[i] = pthread_create(&threads[i], NULL, device_setup_thread, &setups[i]) == 0;
+		if (!created[i])
+			device_setup_thread(&setups[i]);
+	}
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		if (created[i])
+			pthread_join(threads[i], NULL);
+		if (!tut1_error_is_success(&setups[i].error))
+		{
+			tut1_error_printf(&setups[i].error, "%s on device %u\n", setups[i].failure, i);
+			retval = setups[i].error;
+		}
+	}
+
+	if (tut1_error_is_success(&retval))
+		goto exit_done;
+
+	/* If anything failed, undo everything that was done, on every device */
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		if (setups[i].stage >= DEVICE_SETUP_PIPELINES)
+			tut3_destroy_pipeline(&devs[i], &pipelines[i]);
+		if (setups[i].stage >= DEVICE_SETUP_SHADER)
+			tut3_free_shader(&devs[i], shaders[i]);
+		if (setups[i].stage >= DEVICE_SETUP_DEVICE)
+			tut2_cleanup(&devs[i]);
+	}
+
+exit_done:
+	return retval;
+}
+
+void tut3_cleanup_devices(struct tut2_device *devs, VkShaderModule *shaders, struct tut3_pipelines *pipelines,
+		uint32_t dev_count)
+{
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		tut3_destroy_pipeline(&devs[i], &pipelines[i]);
+		tut3_free_shader(&devs[i], shaders[i]);
+		tut2_cleanup(&devs[i]);
+	}
+}
@@ -20,6 +20,7 @@
 #ifndef TUT3_H
 #define TUT3_H
 
+#include <pthread.h>
 #include "../tut2/tut2.h"
 
 struct tut3_pipeline
@@ -41,4 +42,15 @@ void tut3_free_shader(struct tut2_device *dev, VkShaderModule shader);
 tut1_error tut3_make_compute_pipeline(struct tut2_device *dev, struct tut3_pipelines *pipeline, VkShaderModule shader);
 void tut3_destroy_pipeline(struct tut2_device *dev, struct tut3_pipelines *pipelines);
 
+/*
+ * Set up every device, load the shader and create the pipelines on it, with all devices going in parallel.  If
+ * ext_names is not NULL, ext_names[i] (ext_counts[i] of them) are the device extensions to enable on device i.  Either
+ * everything is set up, or on error, everything is cleaned up again and the failures are printed.
+ */
+tut1_error tut3_setup_devices(struct tut1_physical_device *phy_devs, struct tut2_device *devs, VkShaderModule *shaders,
+		struct tut3_pipelines *pipelines, uint32_t dev_count, VkQueueFlags qflags, const char *spirv_file,
+		const char **ext_names[], const uint32_t ext_counts[]);
+void tut3_cleanup_devices(struct tut2_device *devs, VkShaderModule *shaders, struct tut3_pipelines *pipelines,
+		uint32_t dev_count);
+
 #endif
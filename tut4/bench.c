@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+static const char *mode_names[TUT4_BENCH_MODE_COUNT] = {
+	[TUT4_BENCH_SWEEP] = "sweep",
+	[TUT4_BENCH_READBACK] = "readback",
+	[TUT4_BENCH_STREAM] = "stream",
+	[TUT4_BENCH_BATCH] = "batch",
+	[TUT4_BENCH_IMPORT] = "import",
+	[TUT4_BENCH_HETERO] = "hetero",
+	[TUT4_BENCH_GRAPH] = "graph",
+	[TUT4_BENCH_PRIMS] = "prims",
+	[TUT4_BENCH_SORT] = "sort",
+	[TUT4_BENCH_GEMM] = "gemm",
+	[TUT4_BENCH_INDIRECT] = "indirect",
+};
+
+static const char *mode_usages[TUT4_BENCH_MODE_COUNT] = {
+	[TUT4_BENCH_SWEEP] = "[max_threads(8) [min_buffer_size(64KB) [max_buffer_size(16MB) [warmup(1) [repetitions(5)"
+		" [csv|json]]]]]]",
+	[TUT4_BENCH_READBACK] = "[buffer_size(64MB) [repetitions(10)]]",
+	[TUT4_BENCH_STREAM] = "input_file output_file [chunk_size(4MB) [slots(3)]]",
+	[TUT4_BENCH_BATCH] = "input_dir output_dir [pixel_size(8) [slots(3) [max_pixels(16M)]]]",
+	[TUT4_BENCH_IMPORT] = "[buffer_size(64MB) [thread_count(8)]]",
+	[TUT4_BENCH_HETERO] = "[buffer_size(64MB) [jobs(10) [cpu_threads(4)]]]",
+	[TUT4_BENCH_GRAPH] = "[buffer_size(1MB) [chains(4) [stages(16)]]]",
+	[TUT4_BENCH_PRIMS] = "[buffer_size(16MB) [repetitions(10) [cpu_threads(4)]]]",
+	[TUT4_BENCH_SORT] = "[min_elements(1K) [max_elements(256M) [with_values(1) [cpu_threads(4)]]]]",
+	[TUT4_BENCH_GEMM] = "[min_size(256) [max_size(2048)]]",
+	[TUT4_BENCH_INDIRECT] = "[buffer_size(4MB) [repetitions(100)]]",
+};
+
+bool tut4_bench_parse_args(struct tut4_bench_options *opts, int argc, char **argv)
+{
+	opts->mode = TUT4_BENCH_NONE;
+	if (argc < 3)
+		return true;
+
+	for (uint32_t i = TUT4_BENCH_NONE + 1; i < TUT4_BENCH_MODE_COUNT; ++i)
+		if (strcmp(argv[2], mode_names[i]) == 0)
+			opts->mode = i;
+
+	switch (opts->mode)
+	{
+	case TUT4_BENCH_SWEEP:
+		return tut4_bench_sweep_args(&opts->sweep, argc, argv);
+	case TUT4_BENCH_READBACK:
+		return tut4_bench_readback_args(&opts->readback, argc, argv);
+	case TUT4_BENCH_STREAM:
+		return tut4_bench_stream_args(&opts->stream, argc, argv);
+	case TUT4_BENCH_BATCH:
+		return tut4_bench_batch_args(&opts->batch, argc, argv);
+	case TUT4_BENCH_IMPORT:
+		return tut4_bench_import_args(&opts->import, argc, argv);
+	case TUT4_BENCH_HETERO:
+		return tut4_bench_hetero_args(&opts->hetero, argc, argv);
+	case TUT4_BENCH_GRAPH:
+		return tut4_bench_graph_args(&opts->graph, argc, argv);
+	case TUT4_BENCH_PRIMS:
+		return tut4_bench_prims_args(&opts->prims, argc, argv);
+	case TUT4_BENCH_SORT:
+		return tut4_bench_sort_args(&opts->sort, argc, argv);
+	case TUT4_BENCH_GEMM:
+		return tut4_bench_gemm_args(&opts->gemm, argc, argv);
+	case TUT4_BENCH_INDIRECT:
+		return tut4_bench_indirect_args(&opts->indirect, argc, argv);
+	default:
+		return true;
+	}
+}
+
+void tut4_bench_print_usage(const char *program)
+{
+	for (uint32_t i = TUT4_BENCH_NONE + 1; i < TUT4_BENCH_MODE_COUNT; ++i)
+		printf("       %s shader_file %s %s\n", program, mode_names[i], mode_usages[i]);
+}
+
+int tut4_bench_run(struct tut4_bench *bench, struct tut4_bench_options *opts)
+{
+	switch (opts->mode)
+	{
+	case TUT4_BENCH_SWEEP:
+		return tut4_bench_sweep(bench, &opts->sweep);
+	case TUT4_BENCH_READBACK:
+		return tut4_bench_readback(bench, &opts->readback);
+	case TUT4_BENCH_STREAM:
+		return tut4_bench_stream(bench, &opts->stream);
+	case TUT4_BENCH_BATCH:
+		return tut4_bench_batch(bench, &opts->batch);
+	case TUT4_BENCH_IMPORT:
+		return tut4_bench_import(bench, &opts->import);
+	case TUT4_BENCH_HETERO:
+		return tut4_bench_hetero(bench, &opts->hetero);
+	case TUT4_BENCH_GRAPH:
+		return tut4_bench_graph(bench, &opts->graph);
+	case TUT4_BENCH_PRIMS:
+		return tut4_bench_prims(bench, &opts->prims);
+	case TUT4_BENCH_SORT:
+		return tut4_bench_sort(bench, &opts->sort);
+	case TUT4_BENCH_GEMM:
+		return tut4_bench_gemm(bench, &opts->gemm);
+	case TUT4_BENCH_INDIRECT:
+		return tut4_bench_indirect(bench, &opts->indirect);
+	default:
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_BENCH_H
+#define TUT4_BENCH_H
+
+#include "tut4.h"
+#include "tut4_batch.h"
+
+/*
+ * Besides the test in main.c, tut4 can run a number of benchmarks, each putting the GPU to use in a different way.
+ * A benchmark is selected by giving its name instead of the thread count, followed by its own arguments:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv <mode> <arguments>...
+ *
+ * Each mode lives in its own bench_<mode>.c, which explains what it measures.  main.c parses the arguments with
+ * tut4_bench_parse_args() before it sets up the devices, so that bad arguments are caught early, and then hands the
+ * devices over to tut4_bench_run().
+ */
+
+#define TUT4_BENCH_MAX_DEVICES 2
+
+enum tut4_bench_mode
+{
+	TUT4_BENCH_NONE = 0,		/* not a benchmark; run the test in main.c */
+	TUT4_BENCH_SWEEP,
+	TUT4_BENCH_READBACK,
+	TUT4_BENCH_STREAM,
+	TUT4_BENCH_BATCH,
+	TUT4_BENCH_IMPORT,
+	TUT4_BENCH_HETERO,
+	TUT4_BENCH_GRAPH,
+	TUT4_BENCH_PRIMS,
+	TUT4_BENCH_SORT,
+	TUT4_BENCH_GEMM,
+	TUT4_BENCH_INDIRECT,
+	TUT4_BENCH_MODE_COUNT,
+};
+
+/* What main.c has set up for the benchmarks to run on */
+struct tut4_bench
+{
+	struct tut1_physical_device *phy_devs;
+	struct tut2_device *devs;
+	struct tut3_pipelines *pipelines;	/* of the shader given on the command line */
+	uint32_t dev_count;
+
+	bool *can_import;			/* per device, whether host memory can be imported */
+	uint32_t api_version;			/* the Vulkan version of the instance */
+	const char *shader_dir;			/* where the shaders of the kernel libraries are */
+};
+
+/* The arguments of each mode.  Buffer sizes are in elements (floats), except for readback and import */
+struct tut4_bench_sweep_options
+{
+	size_t max_threads;
+	size_t min_buffer_size, max_buffer_size;
+	unsigned warmup, repetitions;
+	bool json;
+};
+
+struct tut4_bench_readback_options
+{
+	size_t size;
+	unsigned repetitions;
+};
+
+struct tut4_bench_stream_options
+{
+	const char *input, *output;
+	size_t chunk_size;
+	uint32_t slots;
+};
+
+struct tut4_bench_batch_options
+{
+	const char *input, *output;
+	struct tut4_batch_effect effect;
+	uint32_t slots;
+	size_t max_pixels;
+};
+
+struct tut4_bench_import_options
+{
+	size_t size;
+	size_t thread_count;
+};
+
+struct tut4_bench_hetero_options
+{
+	size_t size;
+	unsigned jobs;
+	uint32_t cpu_threads;
+};
+
+struct tut4_bench_graph_options
+{
+	size_t size;
+	uint32_t chains;
+	uint32_t stages;
+};
+
+struct tut4_bench_prims_options
+{
+	size_t size;
+	unsigned repetitions;
+	uint32_t cpu_threads;
+};
+
+struct tut4_bench_sort_options
+{
+	size_t min_size, max_size;
+	bool values;
+	uint32_t cpu_threads;
+};
+
+struct tut4_bench_gemm_options
+{
+	uint32_t min_size, max_size;
+};
+
+struct tut4_bench_indirect_options
+{
+	size_t size;
+	unsigned repetitions;
+};
+
+struct tut4_bench_options
+{
+	enum tut4_bench_mode mode;
+
+	struct tut4_bench_sweep_options sweep;
+	struct tut4_bench_readback_options readback;
+	struct tut4_bench_stream_options stream;
+	struct tut4_bench_batch_options batch;
+	struct tut4_bench_import_options import;
+	struct tut4_bench_hetero_options hetero;
+	struct tut4_bench_graph_options graph;
+	struct tut4_bench_prims_options prims;
+	struct tut4_bench_sort_options sort;
+	struct tut4_bench_gemm_options gemm;
+	struct tut4_bench_indirect_options indirect;
+};
+
+/*
+ * If argv[2] names a mode, take the mode's arguments from argv[3] onwards, using the defaults for those not given.
+ * Otherwise, the mode is TUT4_BENCH_NONE.  Returns false if the arguments are bad.
+ */
+bool tut4_bench_parse_args(struct tut4_bench_options *opts, int argc, char **argv);
+void tut4_bench_print_usage(const char *program);
+/* Run the benchmark and return the exit status of the program */
+int tut4_bench_run(struct tut4_bench *bench, struct tut4_bench_options *opts);
+
+/* The modes themselves */
+bool tut4_bench_sweep_args(struct tut4_bench_sweep_options *opts, int argc, char **argv);
+int tut4_bench_sweep(struct tut4_bench *bench, struct tut4_bench_sweep_options *opts);
+bool tut4_bench_readback_args(struct tut4_bench_readback_options *opts, int argc, char **argv);
+int tut4_bench_readback(struct tut4_bench *bench, struct tut4_bench_readback_options *opts);
+bool tut4_bench_stream_args(struct tut4_bench_stream_options *opts, int argc, char **argv);
+int tut4_bench_stream(struct tut4_bench *bench, struct tut4_bench_stream_options *opts);
+bool tut4_bench_batch_args(struct tut4_bench_batch_options *opts, int argc, char **argv);
+int tut4_bench_batch(struct tut4_bench *bench, struct tut4_bench_batch_options *opts);
+bool tut4_bench_import_args(struct tut4_bench_import_options *opts, int argc, char **argv);
+int tut4_bench_import(struct tut4_bench *bench, struct tut4_bench_import_options *opts);
+bool tut4_bench_hetero_args(struct tut4_bench_hetero_options *opts, int argc, char **argv);
+int tut4_bench_hetero(struct tut4_bench *bench, struct tut4_bench_hetero_options *opts);
+bool tut4_bench_graph_args(struct tut4_bench_graph_options *opts, int argc, char **argv);
+int tut4_bench_graph(struct tut4_bench *bench, struct tut4_bench_graph_options *opts);
+bool tut4_bench_prims_args(struct tut4_bench_prims_options *opts, int argc, char **argv);
+int tut4_bench_prims(struct tut4_bench *bench, struct tut4_bench_prims_options *opts);
+bool tut4_bench_sort_args(struct tut4_bench_sort_options *opts, int argc, char **argv);
+int tut4_bench_sort(struct tut4_bench *bench, struct tut4_bench_sort_options *opts);
+bool tut4_bench_gemm_args(struct tut4_bench_gemm_options *opts, int argc, char **argv);
+int tut4_bench_gemm(struct tut4_bench *bench, struct tut4_bench_gemm_options *opts);
+bool tut4_bench_indirect_args(struct tut4_bench_indirect_options *opts, int argc, char **argv);
+int tut4_bench_indirect(struct tut4_bench *bench, struct tut4_bench_indirect_options *opts);
+
+/* A small and fast random number generator, for the input data of the benchmarks */
+static inline uint32_t tut4_bench_xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * Streaming works the same way for many small files.  The batch mode applies the post-processing effect of tut11 to
+ * every binary PPM image in <input dir> and writes the results to <output dir>, with decoding, the GPU work and
+ * encoding each in their own thread; see tut4_batch.c:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv batch <input dir> <output dir> <pixel size> <slots> <max pixels>
+ *
+ * Whichever of decoding or encoding is busy closest to 100% of the time is what limits the images/s.
+ */
+
+bool tut4_bench_batch_args(struct tut4_bench_batch_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_batch_options){
+		.effect = {
+			.pixel_size = 8,
+			.hue_levels = 16,
+			.saturation_levels = 8,
+			.intensity_levels = 8,
+		},
+		.slots = 3,
+		.max_pixels = 4096 * 4096,
+	};
+
+	if (argc < 5)
+		bad_args = true;
+	else
+	{
+		opts->input = argv[3];
+		opts->output = argv[4];
+	}
+	if (argc > 5 && (sscanf(argv[5], "%u", &opts->effect.pixel_size) != 1 || opts->effect.pixel_size == 0))
+		bad_args = true;
+	if (argc > 6 && (sscanf(argv[6], "%u", &opts->slots) != 1 || opts->slots == 0))
+		bad_args = true;
+	if (argc > 7 && (sscanf(argv[7], "%zu", &opts->max_pixels) != 1 || opts->max_pixels == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_batch(struct tut4_bench *bench, struct tut4_bench_batch_options *opts)
+{
+	tut1_error res;
+	int retval = EXIT_FAILURE;
+
+	/* Like streaming, the batch goes through the first device only */
+	struct tut4_batch batch;
+
+	res = tut4_prepare_batch(&bench->phy_devs[0], &bench->devs[0], &batch, bench->shader_dir, opts->max_pixels,
+			opts->slots);
+	if (tut1_error_is_success(&res))
+		res = tut4_batch_run(&bench->devs[0], &batch, &opts->effect, opts->input, opts->output);
+	if (!tut1_error_is_success(&res))
+		tut1_error_printf(&res, "Could not process the images in %s into %s\n", opts->input, opts->output);
+	else
+	{
+		double seconds = batch.wall_time_ns / 1000000000.0;
+		printf("Processed %u images (%u skipped) over %u slots: %.3fs, %.1f images/s, %.1fMB/s\n"
+				"  decoding %.1f%%, encoding %.1f%% and waiting for the GPU %.1f%% of the time\n",
+				batch.images, batch.failed, batch.slot_count, seconds, seconds > 0?batch.images / seconds:0,
+				seconds > 0?batch.bytes / (1024.0 * 1024.0) / seconds:0,
+				batch.wall_time_ns?batch.decode_ns * 100.0 / batch.wall_time_ns:0,
+				batch.wall_time_ns?batch.encode_ns * 100.0 / batch.wall_time_ns:0,
+				batch.wall_time_ns?batch.gpu_wait_ns * 100.0 / batch.wall_time_ns:0);
+		retval = 0;
+	}
+
+	tut4_free_batch(&bench->devs[0], &batch);
+	return retval;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "bench.h"
+#include "tut4_gemm.h"
+
+/*
+ * All of the other benchmarks are limited by memory bandwidth.  Matrix multiplication is not; it does N^3
+ * multiplications on N^2 elements, and the kernel in tut4_gemm.c keeps the GPU busy with arithmetic by reusing each
+ * element loaded many times, first from shared memory and then from registers.  The gemm mode multiplies square
+ * matrices of sizes doubling from <min> to <max> with a few tile configurations, and prints the GFLOP/s of each:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv gemm <min> <max>
+ *
+ * Which configuration wins depends on the GPU; try changing the list in gemm_benchmark().
+ */
+
+static uint32_t gemm_next_sample(uint32_t i, uint32_t step, uint32_t count)
+{
+	/* Go forward by `step`, but never skip the last one */
+	if (i == count - 1)
+		return count;
+	return i + step < count - 1?i + step:count - 1;
+}
+
+static bool gemm_verify(struct tut4_gemm_data *data, const float *a, const float *b)
+{
+	/*
+	 * Check C against a double precision multiplication on the CPU.  That takes as long as the GPU takes to do it
+	 * hundreds of times, so for large matrices only a sample of the elements (including the last row and column,
+	 * where the tiles are cut short) are checked.  The GPU adds the products in a different order than the CPU, so
+	 * the results can't be expected to match exactly.  Adding k float products in any order is off by at most
+	 * about k * FLT_EPSILON times the sum of the absolute values of the products, so the difference is compared to
+	 * that.  A tile of K that is dropped or added twice is well beyond this bound.
+	 */
+	uint32_t m = data->m, n = data->n, k = data->k;
+	uint32_t step = (uint64_t)m * n * k > 64 * 1024 * 1024?97:1;
+
+	for (uint32_t row = 0; row < m; row = gemm_next_sample(row, step, m))
+		for (uint32_t col = 0; col < n; col = gemm_next_sample(col, step, n))
+		{
+			double expect = 0, magnitude = 0;
+
+			for (uint32_t i = 0; i < k; ++i)
+			{
+				double product = (double)a[(size_t)row * k + i] * b[(size_t)i * n + col];
+				expect += product;
+				magnitude += product < 0?-product:product;
+			}
+
+			double diff = data->host_c[(size_t)row * n + col] - expect;
+			if ((diff < 0?-diff:diff) > k * FLT_EPSILON * magnitude)
+			{
+				printf("  C[%u][%u] is %f, expected %f\n", row, col, data->host_c[(size_t)row * n + col], expect);
+				return false;
+			}
+		}
+
+	return true;
+}
+
+static tut1_error gemm_run_size(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_gemm *gemm,
+		VkPipeline *pipelines, const struct tut4_gemm_config *configs, uint32_t config_count, VkFence fence,
+		uint32_t size, bool *skipped)
+{
+	/*
+	 * Multiply two size x size random matrices with every configuration.  Each is run once to warm up and verify,
+	 * then enough times for the measurement to be meaningful.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	struct tut4_gemm_data data = {0};
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	float *a = NULL, *b = NULL;
+	uint32_t state = 0x12345678;
+	size_t elements = (size_t)size * size;
+	uint32_t repetitions = size <= 512?20:size <= 1024?5:1;
+
+	*skipped = false;
+
+	retval = tut4_prepare_gemm_data(phy_dev, dev, gemm, &data, size, size, size);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "  %ux%u: skipped", size, size);
+		retval = TUT1_ERROR_NONE;
+		*skipped = true;
+		goto exit_failed;
+	}
+
+	/* Keep a copy of A and B for verification; the staging memory may be uncached and slow to read from */
+	a = malloc(elements * sizeof *a);
+	b = malloc(elements * sizeof *b);
+	if (a == NULL || b == NULL)
+	{
+		printf("  %ux%u: skipped, not enough host memory\n", size, size);
+		*skipped = true;
+		goto exit_failed;
+	}
+
+	for (size_t i = 0; i < elements; ++i)
+	{
+		a[i] = (tut4_bench_xorshift32(&state) & 0xffff) / 32768.0f - 1;
+		b[i] = (tut4_bench_xorshift32(&state) & 0xffff) / 32768.0f - 1;
+	}
+	memcpy(data.host_a, a, elements * sizeof *a);
+	memcpy(data.host_b, b, elements * sizeof *b);
+
+	retval = tut4_gemm_upload(dev, &data, cmd_buffer, queue, fence);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	printf("  %ux%u:", size, size);
+	for (uint32_t c = 0; c < config_count; ++c)
+	{
+		uint64_t time_ns;
+
+		if (pipelines[c] == NULL)
+			continue;
+
+		memset(data.host_c, 0, elements * sizeof *data.host_c);
+
+		retval = tut4_gemm_run(dev, gemm, &data, pipelines[c], &configs[c], 1, cmd_buffer, queue, fence, &time_ns);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+		retval = tut4_gemm_download(dev, &data, cmd_buffer, queue, fence);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+		if (!gemm_verify(&data, a, b))
+		{
+			printf("  %ux%u: wrong result with configuration %u\n", size, size, c);
+			tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+			goto exit_failed;
+		}
+
+		retval = tut4_gemm_run(dev, gemm, &data, pipelines[c], &configs[c], repetitions, cmd_buffer, queue, fence,
+				&time_ns);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		printf(" %9.1f", time_ns?2.0 * elements * size * repetitions / time_ns:0);
+		fflush(stdout);
+	}
+	printf(" GFLOP/s\n");
+
+exit_failed:
+	tut4_free_gemm_data(dev, &data);
+	free(a);
+	free(b);
+	return retval;
+}
+
+static tut1_error gemm_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev, const char *shader_dir,
+		uint32_t min_size, uint32_t max_size)
+{
+	/*
+	 * A few configurations to compare.  The first has no register blocking, so it only benefits from shared
+	 * memory.  The others compute more elements per invocation, which means more reuse of what's loaded from shared
+	 * memory into registers, but fewer invocations to hide latency with.
+	 */
+	const struct tut4_gemm_config configs[] = {
+		{ .threads = 16, .reg = 1, .tile_k = 16 },
+		{ .threads = 16, .reg = 2, .tile_k = 16 },
+		{ .threads = 16, .reg = 4, .tile_k = 8 },
+		{ .threads = 8, .reg = 8, .tile_k = 8 },
+	};
+	const uint32_t config_count = sizeof configs / sizeof *configs;
+
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_gemm gemm = {0};
+	VkPipeline pipelines[sizeof configs / sizeof *configs] = {NULL};
+	VkFence fence = NULL;
+	bool any_supported = false;
+
+	retval = tut4_prepare_gemm(phy_dev, dev, &gemm, shader_dir);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	for (uint32_t c = 0; c < config_count; ++c)
+	{
+		tut1_error err = tut4_gemm_make_pipeline(dev, &gemm, &configs[c], &pipelines[c]);
+
+		printf("  configuration %u: %ux%u threads, %ux%u elements each, tiles of %ux%u and K step %u%s\n", c,
+				configs[c].threads, configs[c].threads, configs[c].reg, configs[c].reg,
+				configs[c].threads * configs[c].reg, configs[c].threads * configs[c].reg, configs[c].tile_k,
+				tut1_error_is_success(&err)?"":" (not supported)");
+		if (tut1_error_is_success(&err))
+			any_supported = true;
+		else
+			pipelines[c] = NULL;
+	}
+	if (!any_supported)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_FEATURE_NOT_PRESENT);
+		tut1_error_printf(&retval, "None of the GEMM configurations are supported by the device; skipping GEMM\n");
+		goto exit_failed;
+	}
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* Every size is twice the previous one; once a size is skipped, the larger ones would be too */
+	for (uint32_t size = min_size; size <= max_size; size *= 2)
+	{
+		bool skipped;
+
+		retval = gemm_run_size(phy_dev, dev, &gemm, pipelines, configs, config_count, fence, size, &skipped);
+		if (!tut1_error_is_success(&retval) || skipped)
+			break;
+	}
+
+exit_failed:
+	vkDestroyFence(dev->device, fence, NULL);
+	for (uint32_t c = 0; c < config_count; ++c)
+		if (pipelines[c])
+			vkDestroyPipeline(dev->device, pipelines[c], NULL);
+	tut4_free_gemm(dev, &gemm);
+	return retval;
+}
+
+bool tut4_bench_gemm_args(struct tut4_bench_gemm_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_gemm_options){
+		.min_size = 256,
+		.max_size = 2048,
+	};
+
+	if (argc > 3 && (sscanf(argv[3], "%u", &opts->min_size) != 1 || opts->min_size == 0))
+		bad_args = true;
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->max_size) != 1 || opts->max_size < opts->min_size))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_gemm(struct tut4_bench *bench, struct tut4_bench_gemm_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		printf("Device %u:\n", i);
+		res = gemm_benchmark(&bench->phy_devs[i], &bench->devs[i], bench->shader_dir, opts->min_size, opts->max_size);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Matrix multiplication benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	return retval;
+}
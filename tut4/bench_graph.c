@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "tut4_graph.h"
+
+/*
+ * Real work is often a chain of kernels rather than one.  The graph mode runs a few independent chains of the
+ * shader, first with a host round trip after every kernel, then as a compute graph in a single submission:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv graph <size> <chains> <stages>
+ *
+ * The graph only places barriers where a kernel actually depends on another, so the chains run side by side and the
+ * GPU never waits for the host; see tut4_graph.c.
+ */
+
+static tut1_error graph_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut3_pipelines *pipelines, size_t size, uint32_t chains, uint32_t stages)
+{
+	/*
+	 * Run `chains` independent chains of `stages` kernels each, where each chain works on its own part of the
+	 * buffer.  First, the way tut4 normally works: each kernel in its own submission, with the host waiting for it
+	 * to finish before submitting the next.  Then, the whole thing as a compute graph in a single submission; see
+	 * tut4_graph.c.  Every kernel adds 1, so either way, each element should end up `stages` higher.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_data test_data = {0};
+	struct tut4_graph graph;
+	VkFence fence = NULL;
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	float *mem = NULL;
+	uint64_t round_trip_ns = 0, graph_ns = 0;
+
+	tut4_init_graph(&graph);
+
+	/* tut4_prepare_test() already splits the buffer in parts, each with its own descriptor set; use those */
+	retval = tut4_prepare_test(phy_dev, dev, pipelines, &test_data, size, chains, false);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, test_data.buffer_mem, 0, VK_WHOLE_SIZE, 0, (void **)&mem);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * Build the graph.  The kernels are added chain after chain, which is the natural way to write it, but the
+	 * graph interleaves the chains so that only one barrier is needed between two stages, not between every two
+	 * kernels.
+	 */
+	for (uint32_t c = 0; c < chains; ++c)
+	{
+		struct tut4_per_cmd_buffer_data *part = &test_data.per_cmd_buffer[c];
+		uint32_t index;
+
+		retval = tut4_graph_add_buffer(&graph, test_data.buffer, part->start_index * sizeof(float),
+				(part->end_index - part->start_index) * sizeof(float), &index);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		for (uint32_t s = 0; s < stages; ++s)
+		{
+			retval = tut4_graph_add_kernel(&graph, &pipelines->pipelines[0], part->set,
+					(part->end_index - part->start_index) / 64, &index, 1, &index, 1);
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+		}
+	}
+
+	for (uint32_t mode = 0; mode < 2; ++mode)
+	{
+		bool use_graph = mode == 1;
+
+		for (size_t i = 0; i < test_data.buffer_size; ++i)
+			mem[i] = i % 1024;
+		res = tut4_flush_memory(dev, test_data.buffer_mem, test_data.buffer_mem_size, test_data.buffer_atom_size,
+				0, size * sizeof(float));
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		uint64_t start_ns = tut1_get_time_ns();
+
+		if (use_graph)
+		{
+			retval = tut4_graph_run(dev, &graph, cmd_buffer, queue, fence);
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+		}
+		else
+		{
+			for (uint32_t s = 0; s < stages; ++s)
+				for (uint32_t c = 0; c < chains; ++c)
+				{
+					struct tut4_per_cmd_buffer_data *part = &test_data.per_cmd_buffer[c];
+					VkCommandBufferBeginInfo begin_info = {
+						.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+						.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+					};
+					VkMemoryBarrier barrier = {
+						.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+						.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+						.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+					};
+					VkSubmitInfo submit_info = {
+						.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+						.commandBufferCount = 1,
+						.pCommandBuffers = &cmd_buffer,
+					};
+
+					vkResetCommandBuffer(cmd_buffer, 0);
+					res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+					tut1_error_set_vkresult(&retval, res);
+					if (res)
+						goto exit_failed;
+					vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines->pipelines[0].pipeline);
+					vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+							pipelines->pipelines[0].pipeline_layout, 0, 1, &part->set, 0, NULL);
+					vkCmdDispatch(cmd_buffer, (part->end_index - part->start_index) / 64, 1, 1);
+					vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+							1, &barrier, 0, NULL, 0, NULL);
+					vkEndCommandBuffer(cmd_buffer);
+
+					res = vkResetFences(dev->device, 1, &fence);
+					tut1_error_set_vkresult(&retval, res);
+					if (res)
+						goto exit_failed;
+					res = vkQueueSubmit(queue, 1, &submit_info, fence);
+					tut1_error_set_vkresult(&retval, res);
+					if (res)
+						goto exit_failed;
+					do
+					{
+						res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+					} while (res == VK_TIMEOUT);
+					tut1_error_set_vkresult(&retval, res);
+					if (res)
+						goto exit_failed;
+				}
+		}
+
+		uint64_t time_ns = tut1_get_time_ns() - start_ns;
+		if (use_graph)
+			graph_ns = time_ns;
+		else
+			round_trip_ns = time_ns;
+
+		res = tut4_invalidate_memory(dev, test_data.buffer_mem, test_data.buffer_mem_size, test_data.buffer_atom_size,
+				0, size * sizeof(float));
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		for (size_t i = 0; i < test_data.buffer_size; ++i)
+			if (mem[i] != i % 1024 + stages)
+			{
+				printf("%s didn't produce expected results at element %zu\n", use_graph?"Graph":"Round trips", i);
+				tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+				goto exit_failed;
+			}
+	}
+
+	printf("%u chains x %u stages over %zu floats:\n", chains, stages, test_data.buffer_size);
+	printf("  one submission per kernel: %.3fms (%u host round trips)\n", round_trip_ns / 1000000.0, chains * stages);
+	printf("  compute graph: %.3fms (1 submission, %d levels, %u barriers with %u buffer barriers)\n",
+			graph_ns / 1000000.0, graph.level_count, graph.barrier_count, graph.buffer_barrier_count);
+
+exit_failed:
+	if (mem)
+		vkUnmapMemory(dev->device, test_data.buffer_mem);
+	vkDestroyFence(dev->device, fence, NULL);
+	tut4_free_graph(&graph);
+	tut4_free_test(dev, &test_data);
+	return retval;
+}
+
+bool tut4_bench_graph_args(struct tut4_bench_graph_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_graph_options){
+		.size = 1024 * 1024 / sizeof(float),
+		.chains = 4,
+		.stages = 16,
+	};
+
+	if (argc > 3)
+	{
+		if (sscanf(argv[3], "%zu", &opts->size) != 1)
+			bad_args = true;
+		else
+			opts->size /= sizeof(float);
+	}
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->chains) != 1 || opts->chains == 0))
+		bad_args = true;
+	if (argc > 5 && (sscanf(argv[5], "%u", &opts->stages) != 1 || opts->stages == 0))
+		bad_args = true;
+	if (opts->size < 64 * opts->chains)
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_graph(struct tut4_bench *bench, struct tut4_bench_graph_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		printf("Device %u: ", i);
+		res = graph_benchmark(&bench->phy_devs[i], &bench->devs[i], &bench->pipelines[i], opts->size, opts->chains,
+				opts->stages);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Graph benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	return retval;
+}
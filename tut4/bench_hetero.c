@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "tut4_hetero.h"
+
+/*
+ * The shader is so simple that the CPU could just as well do it.  The hetero mode splits every job between the CPU
+ * (with SIMD) and the GPUs, proportional to how fast each has been so far:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv hetero <size> <jobs> <cpu threads>
+ *
+ * Watch how the split settles within a few jobs, and how it changes if you start something else on the CPU or the
+ * GPU while it's running.
+ */
+
+static int hetero(struct tut1_physical_device *phy_devs, struct tut2_device *devs, struct tut3_pipelines *pipelines,
+		uint32_t dev_count, size_t size, unsigned jobs, uint32_t cpu_threads)
+{
+	tut1_error res = TUT1_ERROR_NONE;
+	struct tut4_stream streams[TUT4_BENCH_MAX_DEVICES] = {0};
+	struct tut4_hetero hetero = {0};
+	float *data = NULL;
+	int retval = -1;
+
+	data = malloc(size * sizeof *data);
+	if (data == NULL)
+	{
+		perror("Could not allocate the job data");
+		goto exit_failed;
+	}
+
+	/* Each device streams its part of the job, see tut4_prepare_stream() */
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		res = tut4_prepare_stream(&phy_devs[i], &devs[i], &pipelines[i], &streams[i], 4 * 1024 * 1024 / sizeof(float), 3);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Could not prepare streaming on device %u\n", i);
+			goto exit_failed;
+		}
+	}
+
+	res = tut4_prepare_hetero(&hetero, devs, streams, dev_count, cpu_threads);
+	if (!tut1_error_is_success(&res))
+	{
+		tut1_error_printf(&res, "Could not prepare the heterogeneous executor\n");
+		goto exit_failed;
+	}
+
+	/* Calibrate on a sixteenth of the job, but at least 1MB so the GPU overhead doesn't dominate */
+	size_t sample = size / 16 > 256 * 1024?size / 16:size;
+	memset(data, 0, size * sizeof *data);
+	res = tut4_hetero_calibrate(&hetero, data, data, sample);
+	if (!tut1_error_is_success(&res))
+	{
+		tut1_error_printf(&res, "Could not calibrate the heterogeneous executor\n");
+		goto exit_failed;
+	}
+
+	printf("Calibrated: CPU (%u threads) %.1fMB/s", cpu_threads, hetero.workers[0].throughput * sizeof(float) * 1000);
+	for (uint32_t i = 0; i < dev_count; ++i)
+		printf(", device %u %.1fMB/s", i, hetero.workers[i + 1].throughput * sizeof(float) * 1000);
+	printf("\n");
+
+	for (unsigned j = 0; j < jobs; ++j)
+	{
+		for (size_t i = 0; i < size; ++i)
+			data[i] = i % 1024;
+
+		res = tut4_hetero_run(&hetero, data, data, size);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Job %u failed\n", j);
+			goto exit_failed;
+		}
+
+		for (size_t i = 0; i < size; ++i)
+			if (data[i] != i % 1024 + 1)
+			{
+				printf("Job %u didn't produce expected results at element %zu\n", j, i);
+				goto exit_failed;
+			}
+
+		printf("Job %u: %.3fms, %.1fMB/s, load imbalance %.2f, split: CPU %.1f%%", j,
+				hetero.wall_time_ns / 1000000.0,
+				hetero.wall_time_ns?size * sizeof(float) / (1024.0 * 1024.0) / (hetero.wall_time_ns / 1000000000.0):0,
+				hetero.imbalance, hetero.workers[0].count * 100.0 / size);
+		for (uint32_t i = 0; i < dev_count; ++i)
+			printf(", device %u %.1f%%", i, hetero.workers[i + 1].count * 100.0 / size);
+		printf("\n");
+	}
+
+	retval = 0;
+
+exit_failed:
+	tut4_free_hetero(&hetero);
+	for (uint32_t i = 0; i < dev_count; ++i)
+		tut4_free_stream(&devs[i], &streams[i]);
+	free(data);
+	return retval;
+}
+
+bool tut4_bench_hetero_args(struct tut4_bench_hetero_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_hetero_options){
+		.size = 64 * 1024 * 1024 / sizeof(float),
+		.jobs = 10,
+		.cpu_threads = 4,
+	};
+
+	if (argc > 3)
+	{
+		if (sscanf(argv[3], "%zu", &opts->size) != 1 || opts->size < 64 * sizeof(float))
+			bad_args = true;
+		else
+			opts->size /= sizeof(float);
+	}
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->jobs) != 1 || opts->jobs == 0))
+		bad_args = true;
+	if (argc > 5 && (sscanf(argv[5], "%u", &opts->cpu_threads) != 1 || opts->cpu_threads == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_hetero(struct tut4_bench *bench, struct tut4_bench_hetero_options *opts)
+{
+	return hetero(bench->phy_devs, bench->devs, bench->pipelines, bench->dev_count, opts->size, opts->jobs,
+			opts->cpu_threads)?EXIT_FAILURE:0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * If the data is already in host memory, copying it into device memory is a waste.  The import mode compares that
+ * copy with importing the host memory directly as device memory (if VK_EXT_external_memory_host is supported; see
+ * main.c for the extensions this needs):
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv import <size> <threads>
+ *
+ * On integrated GPUs and software renderers, the import is basically free and the copy is pure overhead.  On
+ * discrete GPUs, the shader accesses the imported memory over the bus, so it may be slower to run even though it
+ * saves the copy.
+ */
+
+static tut1_error import_run_once(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut3_pipelines *pipelines, float *host_mem, size_t host_mem_size, size_t thread_count, bool import,
+		uint64_t *prepare_ns, uint64_t *run_ns)
+{
+	/*
+	 * Run the test on data that is already in host memory, either by importing that memory, or by allocating device
+	 * memory and copying the data in.  The time to prepare the test (allocating or importing memory) and the time
+	 * to run it (including the copy and verification) are measured.  The time to produce the data in the first
+	 * place is not, as that's the same either way.
+	 */
+	tut1_error res = TUT1_ERROR_NONE;
+	struct tut4_data test_data = {0};
+	uint64_t start_ns;
+	int err_no;
+
+	start_ns = tut1_get_time_ns();
+	if (import)
+		res = tut4_prepare_test_import(phy_dev, dev, pipelines, &test_data, host_mem, host_mem_size, thread_count);
+	else
+		res = tut4_prepare_test(phy_dev, dev, pipelines, &test_data, host_mem_size / sizeof(float), thread_count, false);
+	*prepare_ns = tut1_get_time_ns() - start_ns;
+	if (!tut1_error_is_success(&res))
+		goto exit_failed;
+
+	tut4_fill_host_buffer(&test_data, host_mem);
+	if (!import)
+		test_data.copy_from = host_mem;
+
+	start_ns = tut1_get_time_ns();
+	if ((err_no = tut4_start_test(&test_data, false)))
+	{
+		tut1_error_set_errno(&res, err_no);
+		goto exit_failed;
+	}
+	tut4_wait_test_end(&test_data);
+	*run_ns = tut1_get_time_ns() - start_ns;
+
+	if (!test_data.success)
+	{
+		res = test_data.error;
+		if (tut1_error_is_success(&res))
+			tut1_error_set_vkresult(&res, VK_ERROR_DEVICE_LOST);
+	}
+
+exit_failed:
+	tut4_free_test(dev, &test_data);
+	return res;
+}
+
+bool tut4_bench_import_args(struct tut4_bench_import_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_import_options){
+		.size = 64 * 1024 * 1024,
+		.thread_count = 8,
+	};
+
+	if (argc > 3 && (sscanf(argv[3], "%zu", &opts->size) != 1 || opts->size == 0))
+		bad_args = true;
+	if (argc > 4 && (sscanf(argv[4], "%zu", &opts->thread_count) != 1 || opts->thread_count == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_import(struct tut4_bench *bench, struct tut4_bench_import_options *opts)
+{
+	tut1_error res = TUT1_ERROR_NONE;
+	int retval = 0;
+	size_t size = opts->size;
+
+	/* The same host memory is imported on every device, so it must satisfy all of them */
+	size_t alignment = 0;
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		size_t this_alignment = tut4_get_import_alignment(&bench->phy_devs[i]);
+		if (this_alignment > alignment)
+			alignment = this_alignment;
+	}
+	size += alignment - 1;
+	size -= size % alignment;
+
+	/* The data lives in aligned host memory, as it would if it were mmap'ed from a file */
+	float *host_mem = NULL;
+	if (posix_memalign((void **)&host_mem, alignment, size))
+	{
+		perror("Could not allocate host memory");
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		uint64_t copy_prepare_ns = 0, copy_run_ns = 0;
+		uint64_t import_prepare_ns = 0, import_run_ns = 0;
+
+		res = import_run_once(&bench->phy_devs[i], &bench->devs[i], &bench->pipelines[i], host_mem, size,
+				opts->thread_count, false, &copy_prepare_ns, &copy_run_ns);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Copy path failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+			continue;
+		}
+		printf("Device %u copy:   %.3fms allocating, %.3fms copying and running, %.3fms total\n", i,
+				copy_prepare_ns / 1000000.0, copy_run_ns / 1000000.0,
+				(copy_prepare_ns + copy_run_ns) / 1000000.0);
+
+		/* If the import is not possible, the copy path above is what the application would fall back to */
+		if (bench->can_import[i])
+			res = import_run_once(&bench->phy_devs[i], &bench->devs[i], &bench->pipelines[i], host_mem, size,
+					opts->thread_count, true, &import_prepare_ns, &import_run_ns);
+		if (!bench->can_import[i])
+			printf("Device %u import: not supported, falling back to copy\n", i);
+		else if (!tut1_error_is_success(&res))
+			tut1_error_printf(&res, "Device %u import: failed, falling back to copy\n", i);
+		else
+			printf("Device %u import: %.3fms importing, %.3fms running, %.3fms total\n", i,
+					import_prepare_ns / 1000000.0, import_run_ns / 1000000.0,
+					(import_prepare_ns + import_run_ns) / 1000000.0);
+	}
+
+	free(host_mem);
+	return retval;
+}
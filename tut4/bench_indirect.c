@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "tut4_indirect.h"
+
+/*
+ * A compute graph is fine as long as the host knows how much work each kernel has.  When that depends on what an
+ * earlier kernel produced, the GPU can dispatch the follow-up kernel itself with vkCmdDispatchIndirect.  The indirect
+ * mode filters a buffer and processes only what passed the filter, once with the host reading back the count in
+ * between, and once with an indirect dispatch; see tut4_indirect.c:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv indirect <size> <reps>
+ *
+ * The difference in time per job is the cost of the round trip to the host.
+ */
+
+static int compare_float(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+	return x < y?-1:x > y;
+}
+
+static tut1_error indirect_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut3_pipelines *pipelines, const char *shader_dir, size_t size, unsigned repetitions)
+{
+	/*
+	 * Filter random numbers between 0 and 1, keeping those above 0.5, and add 1 to the ones that are kept with the
+	 * tut3.comp shader.  First with the host reading back how many were kept and dispatching the follow-up kernel
+	 * itself, then with the GPU dispatching it indirectly; see tut4_indirect.c.  The order of the kept elements
+	 * depends on the order the workgroups ran in, so they are sorted before comparing with what the CPU expects.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_indirect indirect = {0};
+	struct tut4_indirect_job job = {0};
+	VkFence fence = NULL;
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	float *expect = NULL, *result = NULL;
+	size_t expect_count = 0;
+	uint32_t state = 0x12345678;
+	uint64_t times_ns[2] = {0};
+
+	size -= size % 64;
+
+	retval = tut4_prepare_indirect(phy_dev, dev, &indirect, shader_dir, 0.5f);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	retval = tut4_prepare_indirect_job(phy_dev, dev, &indirect, &pipelines->pipelines[0], &job, size);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	expect = malloc(size * sizeof *expect);
+	result = malloc(size * sizeof *result);
+	if (expect == NULL || result == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		job.host_input[i] = (tut4_bench_xorshift32(&state) & 0xffffff) / (float)(1 << 24);
+		if (job.host_input[i] > 0.5f)
+			expect[expect_count++] = job.host_input[i] + 1;
+	}
+	qsort(expect, expect_count, sizeof *expect, compare_float);
+
+	for (uint32_t mode = 0; mode < 2; ++mode)
+	{
+		bool use_indirect = mode == 1;
+
+		/* Once without measuring, so things like shader compilation in the driver are not measured */
+		for (unsigned r = 0; r <= repetitions; ++r)
+		{
+			uint64_t start_ns = tut1_get_time_ns();
+			if (use_indirect)
+				retval = tut4_indirect_run(dev, &job, cmd_buffer, queue, fence);
+			else
+				retval = tut4_indirect_run_readback(dev, &job, cmd_buffer, queue, fence);
+			if (r > 0)
+				times_ns[mode] += tut1_get_time_ns() - start_ns;
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+		}
+
+		if (*job.host_count != expect_count)
+		{
+			printf("%s: the GPU kept %u elements instead of %zu\n", use_indirect?"indirect":"readback",
+					*job.host_count, expect_count);
+			tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+			goto exit_failed;
+		}
+
+		memcpy(result, job.host_output, expect_count * sizeof *result);
+		qsort(result, expect_count, sizeof *result, compare_float);
+		if (memcmp(result, expect, expect_count * sizeof *result) != 0)
+		{
+			printf("%s: the GPU didn't filter or process correctly\n", use_indirect?"indirect":"readback");
+			tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+			goto exit_failed;
+		}
+	}
+
+	printf("%zu of %zu elements kept, readback and resubmit %.1fus, indirect dispatch %.1fus per job (%.1fus saved)\n",
+			expect_count, size, times_ns[0] / 1000.0 / repetitions, times_ns[1] / 1000.0 / repetitions,
+			((double)times_ns[0] - (double)times_ns[1]) / 1000.0 / repetitions);
+
+exit_failed:
+	free(expect);
+	free(result);
+	if (fence)
+		vkDestroyFence(dev->device, fence, NULL);
+	tut4_free_indirect_job(dev, &job);
+	tut4_free_indirect(dev, &indirect);
+	return retval;
+}
+
+bool tut4_bench_indirect_args(struct tut4_bench_indirect_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_indirect_options){
+		.size = 4 * 1024 * 1024 / sizeof(float),
+		.repetitions = 100,
+	};
+
+	if (argc > 3)
+	{
+		if (sscanf(argv[3], "%zu", &opts->size) != 1 || opts->size < 64 * sizeof(float))
+			bad_args = true;
+		else
+			opts->size /= sizeof(float);
+	}
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->repetitions) != 1 || opts->repetitions == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_indirect(struct tut4_bench *bench, struct tut4_bench_indirect_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		printf("Device %u: ", i);
+		res = indirect_benchmark(&bench->phy_devs[i], &bench->devs[i], &bench->pipelines[i], bench->shader_dir,
+				opts->size, opts->repetitions);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Indirect dispatch benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	return retval;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "tut4_prim.h"
+
+/*
+ * The shader only ever looks at one element at a time.  Reductions and scans need the elements to work together,
+ * which the kernels in tut4_prim.c do through shared memory in multiple passes.  Compare them with a multi-threaded
+ * CPU version:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv prims <size> <reps> <cpu threads>
+ *
+ * These kernels read each element only once or twice, so like the tut3.comp shader, they are limited by memory
+ * bandwidth more than anything.
+ */
+
+static bool prims_close(float a, float b)
+{
+	/* The GPU adds the numbers in a different order, so sums may be slightly off once they get large */
+	float diff = a > b?a - b:b - a;
+	float mag = a > 0?a:-a;
+	return a == b || diff <= mag * 1e-4f;
+}
+
+static tut1_error prims_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut3_pipelines *pipelines, const char *shader_dir, uint32_t api_version, size_t size,
+		unsigned repetitions, uint32_t cpu_threads)
+{
+	/*
+	 * Run the reductions and scans of tut4_prim.c on the GPU, and the same on the CPU with cpu_threads threads,
+	 * and compare how many elements per second each goes through.  The GPU time includes submitting the work and
+	 * waiting for it, just as a user of the library would see it.
+	 */
+	static const char *op_names[TUT4_PRIM_OP_COUNT] = {"sum", "min", "max"};
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_prims prims = {0};
+	struct tut4_data input = {0}, output = {0};
+	struct tut4_prim_job job = {0};
+	VkFence fence = NULL;
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	float *input_mem = NULL, *output_mem = NULL, *cpu_output = NULL;
+
+	retval = tut4_prepare_prims(phy_dev, dev, &prims, shader_dir, api_version);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* The input and output are laid out just like the tut4 test buffer, with a single part */
+	retval = tut4_prepare_test(phy_dev, dev, pipelines, &input, size, 1, false);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+	retval = tut4_prepare_test(phy_dev, dev, pipelines, &output, size, 1, true);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+	size = input.buffer_size;
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, input.buffer_mem, 0, VK_WHOLE_SIZE, 0, (void **)&input_mem);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+	res = vkMapMemory(dev->device, output.buffer_mem, 0, VK_WHOLE_SIZE, 0, (void **)&output_mem);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	cpu_output = malloc(size * sizeof *cpu_output);
+	if (cpu_output == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	/* Small integers, so that the sums stay exact for as long as possible */
+	for (size_t i = 0; i < size; ++i)
+		input_mem[i] = (i * 7 + i / 1000) % 5;
+	res = tut4_flush_memory(dev, input.buffer_mem, input.buffer_mem_size, input.buffer_atom_size, 0,
+			size * sizeof *input_mem);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	printf("%zu elements, %u repetitions, CPU with %u threads, GPU with %s\n", size, repetitions, cpu_threads,
+			prims.subgroups?"subgroup operations":"shared memory");
+
+	for (uint32_t op = 0; op < TUT4_PRIM_OP_COUNT; ++op)
+	{
+		for (uint32_t scan = 0; scan < 2; ++scan)
+		{
+			uint64_t gpu_ns = 0, cpu_ns = 0;
+			float gpu_result = 0, cpu_result = 0;
+
+			if (scan)
+				retval = tut4_prepare_scan(phy_dev, dev, &prims, &job, op, input.per_cmd_buffer[0].buffer_view,
+						output.per_cmd_buffer[0].buffer_view, size);
+			else
+				retval = tut4_prepare_reduce(phy_dev, dev, &prims, &job, op, input.per_cmd_buffer[0].buffer_view,
+						size);
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+
+			for (unsigned r = 0; r < repetitions; ++r)
+			{
+				uint64_t start_ns = tut1_get_time_ns();
+				retval = tut4_prim_run(dev, &job, cmd_buffer, queue, fence);
+				gpu_ns += tut1_get_time_ns() - start_ns;
+				if (!tut1_error_is_success(&retval))
+					goto exit_failed;
+
+				start_ns = tut1_get_time_ns();
+				if (scan)
+					tut4_cpu_scan(input_mem, cpu_output, size, op, cpu_threads);
+				else
+					cpu_result = tut4_cpu_reduce(input_mem, size, op, cpu_threads);
+				cpu_ns += tut1_get_time_ns() - start_ns;
+			}
+
+			/* Make sure the GPU got it right */
+			if (scan)
+			{
+				res = tut4_invalidate_memory(dev, output.buffer_mem, output.buffer_mem_size, output.buffer_atom_size,
+						0, size * sizeof *output_mem);
+				tut1_error_set_vkresult(&retval, res);
+				if (res)
+					goto exit_failed;
+
+				for (size_t i = 0; i < size; ++i)
+					if (!prims_close(output_mem[i], cpu_output[i]))
+					{
+						printf("%s scan is wrong at element %zu: %f instead of %f\n", op_names[op], i,
+								output_mem[i], cpu_output[i]);
+						tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+						goto exit_failed;
+					}
+			}
+			else
+			{
+				retval = tut4_prim_result(dev, &job, &gpu_result);
+				if (!tut1_error_is_success(&retval))
+					goto exit_failed;
+
+				if (!prims_close(gpu_result, cpu_result))
+				{
+					printf("%s reduce is wrong: %f instead of %f\n", op_names[op], gpu_result, cpu_result);
+					tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+					goto exit_failed;
+				}
+			}
+
+			printf("  %s %s (%u passes): GPU %.1fM elements/s, CPU %.1fM elements/s\n", op_names[op],
+					scan?"scan":"reduce", job.pass_count,
+					gpu_ns?(double)size * repetitions / (gpu_ns / 1000.0):0,
+					cpu_ns?(double)size * repetitions / (cpu_ns / 1000.0):0);
+
+			tut4_free_prim_job(dev, &job);
+		}
+	}
+
+exit_failed:
+	tut4_free_prim_job(dev, &job);
+	free(cpu_output);
+	if (input_mem)
+		vkUnmapMemory(dev->device, input.buffer_mem);
+	if (output_mem)
+		vkUnmapMemory(dev->device, output.buffer_mem);
+	vkDestroyFence(dev->device, fence, NULL);
+	tut4_free_test(dev, &output);
+	tut4_free_test(dev, &input);
+	tut4_free_prims(dev, &prims);
+	return retval;
+}
+
+bool tut4_bench_prims_args(struct tut4_bench_prims_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_prims_options){
+		.size = 16 * 1024 * 1024 / sizeof(float),
+		.repetitions = 10,
+		.cpu_threads = 4,
+	};
+
+	if (argc > 3)
+	{
+		if (sscanf(argv[3], "%zu", &opts->size) != 1 || opts->size < 64 * sizeof(float))
+			bad_args = true;
+		else
+			opts->size /= sizeof(float);
+	}
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->repetitions) != 1 || opts->repetitions == 0))
+		bad_args = true;
+	if (argc > 5 && (sscanf(argv[5], "%u", &opts->cpu_threads) != 1 || opts->cpu_threads == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_prims(struct tut4_bench *bench, struct tut4_bench_prims_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		printf("Device %u: ", i);
+		res = prims_benchmark(&bench->phy_devs[i], &bench->devs[i], &bench->pipelines[i], bench->shader_dir,
+				bench->api_version, opts->size, opts->repetitions, opts->cpu_threads);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Reduce and scan benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	return retval;
+}
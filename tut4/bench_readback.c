@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+/*
+ * The test in main.c can place its buffer in host-cached memory instead of host-coherent memory (if there is such a
+ * thing), and flush and invalidate the host caches explicitly.  To measure just the difference that makes, the
+ * readback mode has the GPU fill a buffer and reads it back, once from host-coherent and once from host-cached
+ * memory:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv readback <size> <reps>
+ *
+ * On discrete GPUs, host-coherent memory is typically uncached and reading from it is many times slower.
+ */
+
+static tut1_error readback_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev, size_t size,
+		unsigned repetitions, bool cached, double *mbps, bool *got_cached)
+{
+	/*
+	 * Have the GPU fill a buffer, then read it back from the host, over and over.  Only the host reads are timed.
+	 * With `cached`, the buffer is placed in host-cached memory (if any) and the host caches are invalidated before
+	 * each read.  Otherwise, it's placed in host-coherent memory, just like tut4_prepare_test() normally does.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkBuffer buffer = NULL;
+	VkDeviceMemory buffer_mem = NULL;
+	VkFence fence = NULL;
+	VkDeviceSize atom_size = 0;
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	void *mem = NULL;
+	uint32_t *host_copy = NULL;
+	uint64_t total_ns = 0;
+
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	};
+	res = vkCreateBuffer(dev->device, &buffer_info, NULL, &buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The cached case asks for readback memory, which prefers host-cached types.  The other case asks for upload
+	 * memory, which prefers host-coherent and avoids host-cached types, just like tut4_prepare_test() normally does.
+	 */
+	VkMemoryRequirements mem_req;
+	uint32_t mem_index;
+	vkGetBufferMemoryRequirements(dev->device, buffer, &mem_req);
+	retval = tut4_allocate_memory(phy_dev, dev, &mem_req, cached?TUT1_MEMORY_READBACK:TUT1_MEMORY_UPLOAD, 0,
+			&buffer_mem, &mem_index);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkMemoryPropertyFlags mem_flags = phy_dev->memories.memoryTypes[mem_index].propertyFlags;
+	*got_cached = (mem_flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+	if ((mem_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+		atom_size = phy_dev->properties.limits.nonCoherentAtomSize;
+
+	res = vkBindBufferMemory(dev->device, buffer, buffer_mem, 0);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, buffer_mem, 0, VK_WHOLE_SIZE, 0, &mem);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	host_copy = malloc(size);
+	if (host_copy == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	for (unsigned r = 0; r < repetitions; ++r)
+	{
+		VkCommandBufferBeginInfo begin_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		};
+		VkBufferMemoryBarrier buffer_barrier = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.buffer = buffer,
+			.offset = 0,
+			.size = VK_WHOLE_SIZE,
+		};
+		VkSubmitInfo submit_info = {
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &cmd_buffer,
+		};
+
+		vkResetCommandBuffer(cmd_buffer, 0);
+		res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		vkCmdFillBuffer(cmd_buffer, buffer, 0, VK_WHOLE_SIZE, r);
+		vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+				0, NULL, 1, &buffer_barrier, 0, NULL);
+		vkEndCommandBuffer(cmd_buffer);
+
+		res = vkResetFences(dev->device, 1, &fence);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		res = vkQueueSubmit(queue, 1, &submit_info, fence);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		uint64_t start_ns = tut1_get_time_ns();
+		res = tut4_invalidate_memory(dev, buffer_mem, mem_req.size, atom_size, 0, size);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		memcpy(host_copy, mem, size);
+		total_ns += tut1_get_time_ns() - start_ns;
+
+		/* Just in case, make sure what we read is what the GPU wrote */
+		if (host_copy[0] != r || host_copy[size / sizeof *host_copy - 1] != r)
+		{
+			tut1_error_set_vkresult(&retval, VK_ERROR_MEMORY_MAP_FAILED);
+			goto exit_failed;
+		}
+	}
+
+	*mbps = total_ns?(double)size * repetitions / (1024 * 1024) / (total_ns / 1000000000.0):0;
+
+exit_failed:
+	vkDeviceWaitIdle(dev->device);
+	free(host_copy);
+	if (mem)
+		vkUnmapMemory(dev->device, buffer_mem);
+	vkDestroyFence(dev->device, fence, NULL);
+	vkDestroyBuffer(dev->device, buffer, NULL);
+	vkFreeMemory(dev->device, buffer_mem, NULL);
+	return retval;
+}
+
+bool tut4_bench_readback_args(struct tut4_bench_readback_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_readback_options){
+		.size = 64 * 1024 * 1024,
+		.repetitions = 10,
+	};
+
+	if (argc > 3 && (sscanf(argv[3], "%zu", &opts->size) != 1 || opts->size < sizeof(uint32_t)))
+		bad_args = true;
+	if (argc > 4 && (sscanf(argv[4], "%u", &opts->repetitions) != 1 || opts->repetitions == 0))
+		bad_args = true;
+	opts->size -= opts->size % sizeof(uint32_t);
+
+	return !bad_args;
+}
+
+int tut4_bench_readback(struct tut4_bench *bench, struct tut4_bench_readback_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		double coherent_mbps = 0, cached_mbps = 0;
+		bool is_cached = false, got_cached = false;
+
+		res = readback_benchmark(&bench->phy_devs[i], &bench->devs[i], opts->size, opts->repetitions, false,
+				&coherent_mbps, &is_cached);
+		if (tut1_error_is_success(&res))
+			res = readback_benchmark(&bench->phy_devs[i], &bench->devs[i], opts->size, opts->repetitions, true,
+					&cached_mbps, &got_cached);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Readback benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+			continue;
+		}
+
+		printf("Device %u readback: %.1fMB/s host-coherent%s, %.1fMB/s %s\n", i,
+				coherent_mbps, is_cached?" (also cached)":"",
+				cached_mbps, got_cached?"host-cached":"host-cached (none available, same as above)");
+	}
+
+	return retval;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "tut4_radix.h"
+
+/*
+ * Sorting needs the elements to work together even more.  The sort mode runs the radix sort in tut4_radix.c over
+ * sizes from <min> to <max> elements, with or without a value attached to each key, and checks it against the same
+ * sort on the CPU with multiple threads:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv sort <min> <max> <with values> <cpu threads>
+ *
+ * For small sizes, the CPU wins easily; there are 24 dispatches to go through no matter how few keys there are.
+ */
+
+static tut1_error sort_run_once(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_radix *radix,
+		VkFence fence, size_t count, bool has_values, uint32_t cpu_threads, bool *skipped)
+{
+	/*
+	 * Sort `count` random keys (with their original index as value) on the GPU and with the same algorithm on the
+	 * CPU with cpu_threads threads, and compare both the results and the time it took.  Since the sort is stable, the values must match as
+	 * well.  Sizes that don't fit in memory or in a texel buffer are skipped.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	struct tut4_radix_sort sort = {0};
+	VkCommandBuffer cmd_buffer = dev->command_pools[0].buffers[0];
+	VkQueue queue = dev->command_pools[0].queues[0];
+	uint32_t *input = NULL, *cpu_keys = NULL, *cpu_values = NULL, *tmp_keys = NULL, *tmp_values = NULL;
+	uint32_t state = 0x12345678;
+	unsigned repetitions = count < 1024 * 1024?10:count < 32 * 1024 * 1024?3:1;
+	uint64_t gpu_ns = 0, cpu_ns = 0;
+
+	*skipped = false;
+
+	input = malloc(count * sizeof *input);
+	cpu_keys = malloc(count * sizeof *cpu_keys);
+	tmp_keys = malloc(count * sizeof *tmp_keys);
+	if (has_values)
+	{
+		cpu_values = malloc(count * sizeof *cpu_values);
+		tmp_values = malloc(count * sizeof *tmp_values);
+	}
+	if (input == NULL || cpu_keys == NULL || tmp_keys == NULL || (has_values && (cpu_values == NULL || tmp_values == NULL)))
+	{
+		printf("  %zu elements: skipped, not enough host memory\n", count);
+		*skipped = true;
+		goto exit_failed;
+	}
+
+	retval = tut4_prepare_radix_sort(phy_dev, dev, radix, &sort, count, has_values);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "  %zu elements: skipped", count);
+		retval = TUT1_ERROR_NONE;
+		*skipped = true;
+		goto exit_failed;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		input[i] = tut4_bench_xorshift32(&state);
+
+	for (unsigned r = 0; r < repetitions; ++r)
+	{
+		memcpy(sort.host_keys, input, count * sizeof *input);
+		if (has_values)
+			for (size_t i = 0; i < count; ++i)
+				sort.host_values[i] = i;
+
+		uint64_t start_ns = tut1_get_time_ns();
+		retval = tut4_radix_sort_run(dev, &sort, cmd_buffer, queue, fence);
+		gpu_ns += tut1_get_time_ns() - start_ns;
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		memcpy(cpu_keys, input, count * sizeof *input);
+		if (has_values)
+			for (size_t i = 0; i < count; ++i)
+				cpu_values[i] = i;
+
+		start_ns = tut1_get_time_ns();
+		tut4_cpu_radix_sort(cpu_keys, cpu_values, tmp_keys, tmp_values, count, cpu_threads);
+		cpu_ns += tut1_get_time_ns() - start_ns;
+	}
+
+	if (memcmp(sort.host_keys, cpu_keys, count * sizeof *cpu_keys) != 0
+		|| (has_values && memcmp(sort.host_values, cpu_values, count * sizeof *cpu_values) != 0))
+	{
+		printf("  %zu elements: the GPU didn't sort correctly\n", count);
+		tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+		goto exit_failed;
+	}
+
+	printf("  %zu elements: GPU %.3fms (%.1fM keys/s), CPU %.3fms (%.1fM keys/s)\n", count,
+			gpu_ns / 1000000.0 / repetitions, gpu_ns?(double)count * repetitions / (gpu_ns / 1000.0):0,
+			cpu_ns / 1000000.0 / repetitions, cpu_ns?(double)count * repetitions / (cpu_ns / 1000.0):0);
+
+exit_failed:
+	tut4_free_radix_sort(dev, &sort);
+	free(input);
+	free(cpu_keys);
+	free(cpu_values);
+	free(tmp_keys);
+	free(tmp_values);
+	return retval;
+}
+
+static tut1_error sort_benchmark(struct tut1_physical_device *phy_dev, struct tut2_device *dev, const char *shader_dir,
+		size_t min_size, size_t max_size, bool has_values, uint32_t cpu_threads)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_radix radix = {0};
+	VkFence fence = NULL;
+
+	retval = tut4_prepare_radix(phy_dev, dev, &radix, shader_dir);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	res = vkCreateFence(dev->device, &fence_info, NULL, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	printf("  CPU with %u threads\n", cpu_threads);
+
+	/* Every size is four times the previous one; once a size is skipped, the larger ones would be too */
+	for (size_t size = min_size; size <= max_size; size *= 4)
+	{
+		bool skipped;
+
+		retval = sort_run_once(phy_dev, dev, &radix, fence, size, has_values, cpu_threads, &skipped);
+		if (!tut1_error_is_success(&retval) || skipped)
+			break;
+	}
+
+exit_failed:
+	vkDestroyFence(dev->device, fence, NULL);
+	tut4_free_radix(dev, &radix);
+	return retval;
+}
+
+bool tut4_bench_sort_args(struct tut4_bench_sort_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_sort_options){
+		.min_size = 1024,
+		.max_size = 256 * 1024 * 1024,
+		.values = true,
+		.cpu_threads = 4,
+	};
+
+	if (argc > 3 && (sscanf(argv[3], "%zu", &opts->min_size) != 1 || opts->min_size == 0))
+		bad_args = true;
+	if (argc > 4 && (sscanf(argv[4], "%zu", &opts->max_size) != 1 || opts->max_size < opts->min_size))
+		bad_args = true;
+	if (argc > 5)
+	{
+		int temp;
+		if (sscanf(argv[5], "%d", &temp) != 1)
+			bad_args = true;
+		else
+			opts->values = temp;
+	}
+	if (argc > 6 && (sscanf(argv[6], "%u", &opts->cpu_threads) != 1 || opts->cpu_threads == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_sort(struct tut4_bench *bench, struct tut4_bench_sort_options *opts)
+{
+	tut1_error res;
+	int retval = 0;
+
+	for (uint32_t i = 0; i < bench->dev_count; ++i)
+	{
+		printf("Device %u:\n", i);
+		res = sort_benchmark(&bench->phy_devs[i], &bench->devs[i], bench->shader_dir, opts->min_size, opts->max_size,
+				opts->values, opts->cpu_threads);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Sort benchmark failed on device %u\n", i);
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	return retval;
+}
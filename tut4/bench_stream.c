@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "tut4_stream.h"
+
+/*
+ * If the data doesn't fit in memory at all, it needs to be streamed through the GPU instead:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv stream <input> <output> <chunk size> <slots>
+ *
+ * which memory-maps the input file, runs the shader over it chunk by chunk and writes the results to the output
+ * file.  A ring of <slots> staging buffers keeps the GPU busy with one chunk while the host copies the next one in
+ * and the previous ones out; see tut4_prepare_stream().  Try it with 1 slot and then more, and compare the MB/s and
+ * how much of the time the host spent waiting for the GPU.
+ */
+
+bool tut4_bench_stream_args(struct tut4_bench_stream_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_stream_options){
+		.chunk_size = 4 * 1024 * 1024 / sizeof(float),
+		.slots = 3,
+	};
+
+	if (argc < 5)
+		bad_args = true;
+	else
+	{
+		opts->input = argv[3];
+		opts->output = argv[4];
+	}
+	if (argc > 5)
+	{
+		if (sscanf(argv[5], "%zu", &opts->chunk_size) != 1)
+			bad_args = true;
+		else
+			opts->chunk_size /= sizeof(float);
+	}
+	if (argc > 6 && (sscanf(argv[6], "%u", &opts->slots) != 1 || opts->slots == 0))
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_stream(struct tut4_bench *bench, struct tut4_bench_stream_options *opts)
+{
+	tut1_error res;
+	int retval = EXIT_FAILURE;
+
+	/* Streaming is done on the first device only; the data goes through the GPU one chunk at a time anyway */
+	struct tut4_stream stream;
+
+	res = tut4_prepare_stream(&bench->phy_devs[0], &bench->devs[0], &bench->pipelines[0], &stream, opts->chunk_size,
+			opts->slots);
+	if (tut1_error_is_success(&res))
+		res = tut4_stream_file(&bench->devs[0], &stream, opts->input, opts->output);
+	if (!tut1_error_is_success(&res))
+		tut1_error_printf(&res, "Could not stream %s through the GPU to %s\n", opts->input, opts->output);
+	else
+	{
+		double seconds = stream.wall_time_ns / 1000000000.0;
+		printf("Streamed %.1fMB in %u chunks of %zuKB over %u slots: %.3fs, %.1fMB/s, %.1f%% of the time waiting for the GPU\n",
+				stream.bytes / (1024.0 * 1024.0), stream.chunks, stream.chunk_size * sizeof(float) / 1024,
+				stream.slot_count, seconds, seconds > 0?stream.bytes / (1024.0 * 1024.0) / seconds:0,
+				stream.wall_time_ns?stream.wait_time_ns * 100.0 / stream.wall_time_ns:0);
+		retval = 0;
+	}
+
+	tut4_free_stream(&bench->devs[0], &stream);
+	return retval;
+}
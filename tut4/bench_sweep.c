@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "bench.h"
+
+/*
+ * To see how the test in main.c scales on your machine, run the sweep mode instead:
+ *
+ *     $ ./tut4/tut4 shaders/tut3.comp.spv sweep <max threads> <min size> <max size> <warmup> <reps> csv
+ *
+ * which runs the test with every thread count from 1 to <max threads> and buffer sizes doubling from <min size> to
+ * <max size>.  For each, it prints the (median) throughput, the 50th and 99th percentile of the time it took from
+ * submitting a command buffer to seeing its fence signaled, and how many CPU cores' worth of time the process used.
+ * The results are printed in a machine readable format (csv or json), so save the output, and you can tell if a
+ * driver update or a change in the code made things better or worse.
+ */
+
+struct sweep_result
+{
+	size_t buffer_size;		/* the number of elements actually processed, after rounding to the threads */
+	double throughput_mbps;
+	double cpu_utilization;
+	uint64_t *latencies_ns;
+	size_t latency_count;
+};
+
+static uint64_t get_cpu_time_ns()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LLU
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LLU;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y?-1:x > y;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y?-1:x > y;
+}
+
+static double percentile_us(uint64_t *sorted, size_t count, double p)
+{
+	if (count == 0)
+		return 0;
+	return sorted[(size_t)(p * (count - 1) + 0.5)] / 1000.0;
+}
+
+static tut1_error sweep_run_once(struct tut1_physical_device *phy_devs, struct tut2_device *devs,
+		struct tut3_pipelines *pipelines, uint32_t dev_count, size_t thread_count, size_t buffer_size,
+		struct sweep_result *result)
+{
+	tut1_error res = TUT1_ERROR_NONE;
+	struct tut4_data test_data[TUT4_BENCH_MAX_DEVICES] = {0};
+	uint64_t start_ns, cpu_start_ns, wall_ns;
+	size_t processed = 0;
+
+	/* Don't use more devices than threads, or some devices would get no threads at all */
+	if (dev_count > thread_count)
+		dev_count = thread_count;
+
+	/* This is the same division of work as the normal mode */
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		size_t this_buffer_size = buffer_size / dev_count;
+		size_t this_thread_count = thread_count / dev_count;
+
+		if (i == dev_count - 1)
+		{
+			this_buffer_size = buffer_size - buffer_size / dev_count * (dev_count - 1);
+			this_thread_count = thread_count - thread_count / dev_count * (dev_count - 1);
+		}
+
+		/*
+		 * tut4_prepare_test() rounds the buffer down to a multiple of 64 elements per thread, so a smaller buffer
+		 * would end up empty.  Give every thread at least 64 elements instead.
+		 */
+		if (this_buffer_size < 64 * this_thread_count)
+			this_buffer_size = 64 * this_thread_count;
+
+		res = tut4_prepare_test(&phy_devs[i], &devs[i], &pipelines[i], &test_data[i], this_buffer_size, this_thread_count,
+				false);
+		if (!tut1_error_is_success(&res))
+			goto exit_failed;
+	}
+
+	start_ns = tut1_get_time_ns();
+	cpu_start_ns = get_cpu_time_ns();
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		int err_no = tut4_start_test(&test_data[i], false);
+		if (err_no)
+		{
+			/* Wait for the ones already started before bailing out */
+			for (uint32_t j = 0; j < i; ++j)
+				tut4_wait_test_end(&test_data[j]);
+			tut1_error_set_errno(&res, err_no);
+			goto exit_failed;
+		}
+	}
+	for (uint32_t i = 0; i < dev_count; ++i)
+		tut4_wait_test_end(&test_data[i]);
+
+	/*
+	 * The test thread also initializes and verifies the buffer, which is included in these times.  That is the
+	 * same for every configuration though, so it's still fair for comparison.
+	 */
+	wall_ns = tut1_get_time_ns() - start_ns;
+	result->cpu_utilization = wall_ns?(double)(get_cpu_time_ns() - cpu_start_ns) / wall_ns:0;
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		if (!test_data[i].success)
+		{
+			res = test_data[i].error;
+			if (tut1_error_is_success(&res))
+				tut1_error_set_vkresult(&res, VK_ERROR_DEVICE_LOST);
+			goto exit_failed;
+		}
+
+		processed += test_data[i].buffer_size;
+
+		/* Gather the latencies of all the submissions */
+		for (uint32_t j = 0; j < test_data[i].per_cmd_buffer_count; ++j)
+		{
+			struct tut4_per_cmd_buffer_data *per_cmd_buffer = &test_data[i].per_cmd_buffer[j];
+			uint64_t *latencies = realloc(result->latencies_ns,
+					(result->latency_count + per_cmd_buffer->latency_count) * sizeof *latencies);
+			if (latencies == NULL)
+			{
+				tut1_error_set_errno(&res, errno);
+				goto exit_failed;
+			}
+			memcpy(latencies + result->latency_count, per_cmd_buffer->latencies_ns,
+					per_cmd_buffer->latency_count * sizeof *latencies);
+			result->latencies_ns = latencies;
+			result->latency_count += per_cmd_buffer->latency_count;
+		}
+	}
+
+	/* Every element is read and written once per iteration */
+	result->buffer_size = processed;
+	result->throughput_mbps = (double)processed * sizeof(float) * TUT4_TEST_ITERATIONS / (1024 * 1024)
+		/ (wall_ns / 1000000000.0);
+
+exit_failed:
+	for (uint32_t i = 0; i < dev_count; ++i)
+		tut4_free_test(&devs[i], &test_data[i]);
+	return res;
+}
+
+static int sweep(struct tut1_physical_device *phy_devs, struct tut2_device *devs, struct tut3_pipelines *pipelines,
+		uint32_t dev_count, struct tut4_bench_sweep_options *opts)
+{
+	bool first = true;
+
+	if (opts->json)
+		printf("[\n");
+	else
+		printf("threads,buffer_bytes,repetitions,throughput_mbps,p50_latency_us,p99_latency_us,cpu_utilization\n");
+
+	for (size_t threads = 1; threads <= opts->max_threads; ++threads)
+		for (size_t size = opts->min_buffer_size; size <= opts->max_buffer_size; size *= 2)
+		{
+			struct sweep_result result = {0};
+			double throughputs[opts->repetitions];
+			double cpu_utilization = 0;
+			size_t processed = 0;
+
+			/* Warm up the caches, the driver and the GPU clocks; the results are thrown away */
+			for (unsigned r = 0; r < opts->warmup + opts->repetitions; ++r)
+			{
+				struct sweep_result this_result = {0};
+				tut1_error res = sweep_run_once(phy_devs, devs, pipelines, dev_count, threads, size, &this_result);
+				if (!tut1_error_is_success(&res))
+				{
+					tut1_error_printf(&res, "Sweep failed with %zu threads and buffer size %zu\n",
+							threads, size * sizeof(float));
+					free(this_result.latencies_ns);
+					free(result.latencies_ns);
+					return -1;
+				}
+
+				if (r < opts->warmup)
+				{
+					free(this_result.latencies_ns);
+					continue;
+				}
+
+				throughputs[r - opts->warmup] = this_result.throughput_mbps;
+				processed = this_result.buffer_size;
+				cpu_utilization += this_result.cpu_utilization / opts->repetitions;
+
+				/* Latency percentiles are taken over all submissions of all repetitions */
+				uint64_t *latencies = realloc(result.latencies_ns,
+						(result.latency_count + this_result.latency_count) * sizeof *latencies);
+				if (latencies == NULL)
+				{
+					perror("Sweep failed");
+					free(this_result.latencies_ns);
+					free(result.latencies_ns);
+					return -1;
+				}
+				memcpy(latencies + result.latency_count, this_result.latencies_ns,
+						this_result.latency_count * sizeof *latencies);
+				result.latencies_ns = latencies;
+				result.latency_count += this_result.latency_count;
+				free(this_result.latencies_ns);
+			}
+
+			/*
+			 * Report the median throughput, which is less sensitive to the occasional hiccup.  The buffer size is
+			 * the one actually used, which may differ from `size` after rounding to the threads.
+			 */
+			qsort(throughputs, opts->repetitions, sizeof *throughputs, compare_double);
+			qsort(result.latencies_ns, result.latency_count, sizeof *result.latencies_ns, compare_u64);
+
+			double throughput = throughputs[opts->repetitions / 2];
+			double p50 = percentile_us(result.latencies_ns, result.latency_count, 0.5);
+			double p99 = percentile_us(result.latencies_ns, result.latency_count, 0.99);
+
+			if (opts->json)
+				printf("%s  {\"threads\": %zu, \"buffer_bytes\": %zu, \"repetitions\": %u, "
+						"\"throughput_mbps\": %.3f, \"p50_latency_us\": %.3f, \"p99_latency_us\": %.3f, "
+						"\"cpu_utilization\": %.3f}", first?"":",\n", threads, processed * sizeof(float),
+						opts->repetitions, throughput, p50, p99, cpu_utilization);
+			else
+				printf("%zu,%zu,%u,%.3f,%.3f,%.3f,%.3f\n", threads, processed * sizeof(float), opts->repetitions,
+						throughput, p50, p99, cpu_utilization);
+			fflush(stdout);
+
+			first = false;
+			free(result.latencies_ns);
+
+			/* Don't let size overflow when doubling it */
+			if (size > opts->max_buffer_size / 2)
+				break;
+		}
+
+	if (opts->json)
+		printf("\n]\n");
+
+	return 0;
+}
+
+bool tut4_bench_sweep_args(struct tut4_bench_sweep_options *opts, int argc, char **argv)
+{
+	bool bad_args = false;
+
+	*opts = (struct tut4_bench_sweep_options){
+		.max_threads = 8,
+		.min_buffer_size = 64 * 1024 / sizeof(float),
+		.max_buffer_size = 16 * 1024 * 1024 / sizeof(float),
+		.warmup = 1,
+		.repetitions = 5,
+		.json = false,
+	};
+
+	if (argc > 3 && sscanf(argv[3], "%zu", &opts->max_threads) != 1)
+		bad_args = true;
+	if (argc > 4 && sscanf(argv[4], "%zu", &opts->min_buffer_size) != 1)
+		bad_args = true;
+	if (argc > 5 && sscanf(argv[5], "%zu", &opts->max_buffer_size) != 1)
+		bad_args = true;
+	if (argc > 6 && sscanf(argv[6], "%u", &opts->warmup) != 1)
+		bad_args = true;
+	if (argc > 7 && sscanf(argv[7], "%u", &opts->repetitions) != 1)
+		bad_args = true;
+	if (argc > 8)
+	{
+		if (strcmp(argv[8], "json") == 0)
+			opts->json = true;
+		else if (strcmp(argv[8], "csv") != 0)
+			bad_args = true;
+	}
+
+	if (argc > 4)
+		opts->min_buffer_size /= sizeof(float);
+	if (argc > 5)
+		opts->max_buffer_size /= sizeof(float);
+	if (opts->max_threads == 0 || opts->repetitions == 0 || opts->min_buffer_size == 0)
+		bad_args = true;
+
+	return !bad_args;
+}
+
+int tut4_bench_sweep(struct tut4_bench *bench, struct tut4_bench_sweep_options *opts)
+{
+	return sweep(bench->phy_devs, bench->devs, bench->pipelines, bench->dev_count, opts)?EXIT_FAILURE:0;
+}
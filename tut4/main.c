@@ -20,21 +20,123 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "tut4.h"
+#include "bench.h"
 
-#define MAX_DEVICES 2
+#define MAX_DEVICES TUT4_BENCH_MAX_DEVICES
+
+static void print_thread_times(struct tut4_data *test_data)
+{
+	/*
+	 * Compare how long each thread was alive with how long the GPU was actually busy with its work.  If the GPU
+	 * time is much smaller than the wall time, the thread spent its time elsewhere: submitting, waiting behind
+	 * other threads' work in a shared queue, or waking up after the fence was signaled.
+	 */
+	for (uint32_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
+	{
+		struct tut4_per_cmd_buffer_data *per_cmd_buffer = &test_data->per_cmd_buffer[i];
+		double wall_ms = per_cmd_buffer->wall_time_ns / 1000000.0;
+		double gpu_ms = per_cmd_buffer->gpu_time_ns / 1000000.0;
+
+		if (per_cmd_buffer->timestamp_valid_bits == 0)
+			printf("  thread %u: %.3fms wall time, GPU time not available on this queue\n", i, wall_ms);
+		else
+			printf("  thread %u: %.3fms wall time, %.3fms GPU busy (%.1f%%)\n", i, wall_ms, gpu_ms,
+					wall_ms > 0?gpu_ms * 100 / wall_ms:0);
+	}
+}
+
+static tut1_error measure_device_throughputs(struct tut1_physical_device *phy_devs, struct tut2_device *devs,
+		struct tut3_pipelines *pipelines, uint32_t dev_count, size_t thread_count, size_t buffer_size,
+		double *throughputs)
+{
+	/*
+	 * When there are multiple devices, giving them equal parts of the work means the fastest one sits idle waiting
+	 * for the slowest.  Instead, run a small test on all devices at the same time (so that they are measured under
+	 * the same conditions as the real test, for example sharing the CPU and the memory bus), and see how many
+	 * elements per second each gets through.  The real test is then split in proportion to that.
+	 */
+	tut1_error res = TUT1_ERROR_NONE;
+	struct tut4_data test_data[MAX_DEVICES] = {0};
+	uint32_t prepared = 0;
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+		throughputs[i] = 1;
+
+	/* With a single device, there is nothing to split */
+	if (dev_count < 2)
+		goto exit_done;
+
+	/* An eighth of the real test on each device, but at least one workgroup per thread */
+	size_t sample_size = buffer_size / 8;
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		size_t this_thread_count = i == dev_count - 1?thread_count - thread_count / dev_count * (dev_count - 1):
+			thread_count / dev_count;
+		size_t this_sample_size = sample_size;
+
+		if (this_thread_count == 0)
+			this_thread_count = 1;
+		if (this_sample_size < 64 * this_thread_count)
+			this_sample_size = 64 * this_thread_count;
+
+		res = tut4_prepare_test(&phy_devs[i], &devs[i], &pipelines[i], &test_data[i], this_sample_size, this_thread_count,
+				false);
+		prepared = i + 1;
+		if (!tut1_error_is_success(&res))
+			goto exit_failed;
+	}
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		int err_no = tut4_start_test(&test_data[i], false);
+		if (err_no)
+		{
+			for (uint32_t j = 0; j < i; ++j)
+				tut4_wait_test_end(&test_data[j]);
+			tut1_error_set_errno(&res, err_no);
+			goto exit_failed;
+		}
+	}
+	for (uint32_t i = 0; i < dev_count; ++i)
+		tut4_wait_test_end(&test_data[i]);
+
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		if (!test_data[i].success)
+		{
+			res = test_data[i].error;
+			if (tut1_error_is_success(&res))
+				tut1_error_set_vkresult(&res, VK_ERROR_DEVICE_LOST);
+			goto exit_failed;
+		}
+
+		/* wall_time_ns only covers the GPU work, not the buffer initialization and verification on the host */
+		if (test_data[i].wall_time_ns > 0)
+			throughputs[i] = (double)test_data[i].buffer_size / test_data[i].wall_time_ns;
+	}
+
+exit_failed:
+	for (uint32_t i = 0; i < prepared; ++i)
+		tut4_free_test(&devs[i], &test_data[i]);
+exit_done:
+	return res;
+}
 
 int main(int argc, char **argv)
 {
 	tut1_error res;
 	int retval = EXIT_FAILURE;
 	VkInstance vk;
+	uint32_t api_version = VK_API_VERSION_1_1;
 	struct tut1_physical_device phy_devs[MAX_DEVICES];
 	struct tut2_device devs[MAX_DEVICES];
 	uint32_t dev_count = MAX_DEVICES;
 	VkShaderModule shaders[MAX_DEVICES] = {NULL};
 	struct tut3_pipelines pipelines[MAX_DEVICES];
-	struct tut4_data test_data[MAX_DEVICES];
+	struct tut4_data test_data[MAX_DEVICES] = {0};
+	bool tested[MAX_DEVICES] = {false};
 	int success = 0;
 
 	/* How many threads to do the work on */
@@ -43,10 +145,31 @@ int main(int argc, char **argv)
 	bool busy_threads = false;
 	/* Default to 1MB of buffer data to work on */
 	size_t buffer_size = 1024 * 1024 / sizeof(float);
+	/* If non-zero, also run the test with a work-stealing scheduler with this many chunks per thread */
+	size_t chunks_per_thread = 0;
+	/* Whether the buffer should preferably be in host-cached memory */
+	bool host_cached = false;
+
+	/* If a benchmark's name is given instead of thread_count, run that instead; see bench.h */
+	struct tut4_bench_options bench_opts = {0};
+	bool can_import[MAX_DEVICES] = {false};
+
+	/* The shaders of the kernel libraries are next to the shader given on the command line */
+	char shader_dir[1024] = ".";
+	const char *slash = argc > 1?strrchr(argv[1], '/'):NULL;
+	if (slash)
+		snprintf(shader_dir, sizeof shader_dir, "%.*s", (int)(slash - argv[1]), argv[1]);
 
 	bool bad_args = false;
 	if (argc < 2)
 		bad_args = true;
+	else if (!tut4_bench_parse_args(&bench_opts, argc, argv))
+		bad_args = true;
+
+	/* Skip over the regular arguments if running a benchmark */
+	if (bench_opts.mode != TUT4_BENCH_NONE)
+		argc = 2;
+
 	if (argc > 2 && sscanf(argv[2], "%zu", &thread_count) != 1)
 		bad_args = true;
 	if (argc > 3)
@@ -64,15 +187,44 @@ int main(int argc, char **argv)
 		else
 			buffer_size /= sizeof(float);
 	}
+	if (argc > 5 && sscanf(argv[5], "%zu", &chunks_per_thread) != 1)
+		bad_args = true;
+	if (argc > 6)
+	{
+		int temp;
+		if (sscanf(argv[6], "%d", &temp) != 1)
+			bad_args = true;
+		else
+			host_cached = temp;
+	}
 
 	if (bad_args)
 	{
-		printf("Usage: %s shader_file [thread_count(8) [busy_threads(0) [buffer_size(1MB)]]]\n\n", argv[0]);
+		printf("Usage: %s shader_file [thread_count(8) [busy_threads(0) [buffer_size(1MB) [chunks_per_thread(0)"
+			" [host_cached(0)]]]]]\n", argv[0]);
+		tut4_bench_print_usage(argv[0]);
+		printf("\n");
 		return EXIT_FAILURE;
 	}
 
-	/* Fire up Vulkan */
-	res = tut1_init(&vk);
+	/*
+	 * Fire up Vulkan.  The device extensions needed to import host memory (see below) require
+	 * VK_KHR_external_memory_capabilities on the instance, which in turn requires
+	 * VK_KHR_get_physical_device_properties2.  If the instance doesn't have them, the import mode only runs the
+	 * copy path.
+	 *
+	 * Vulkan 1.1 is asked for so the reduce and scan benchmark can use subgroup operations.  If the loader only
+	 * knows 1.0, tut1_init_version() lowers api_version and the benchmark falls back to shared memory.
+	 */
+	const char *import_instance_extensions[] = {
+		"VK_KHR_get_physical_device_properties2",
+		"VK_KHR_external_memory_capabilities",
+	};
+	bool instance_can_import = bench_opts.mode == TUT4_BENCH_IMPORT
+		&& tut1_has_instance_extension(import_instance_extensions[0])
+		&& tut1_has_instance_extension(import_instance_extensions[1]);
+	res = tut1_init_version(&vk, &api_version, import_instance_extensions,
+			instance_can_import?sizeof import_instance_extensions / sizeof *import_instance_extensions:0);
 	if (!tut1_error_is_success(&res))
 	{
 		tut1_error_printf(&res, "Could not initialize Vulkan\n");
@@ -87,67 +239,124 @@ int main(int argc, char **argv)
 		goto exit_bad_enumerate;
 	}
 
-	/* Set up devices */
+	/*
+	 * To import host memory, VK_EXT_external_memory_host needs to be enabled on the device, and so does
+	 * VK_KHR_external_memory which it builds on.  Without them, the import mode only runs the copy path.
+	 */
+	const char *import_extensions[] = {
+		"VK_KHR_external_memory",
+		VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+	};
+	const char **ext_names[MAX_DEVICES];
+	uint32_t ext_counts[MAX_DEVICES];
 	for (uint32_t i = 0; i < dev_count; ++i)
 	{
-		res = tut2_setup(&phy_devs[i], &devs[i], VK_QUEUE_COMPUTE_BIT);
-		if (!tut1_error_is_success(&res))
-		{
-			tut1_error_printf(&res, "Could not setup logical device %u, command pools and queues\n", i);
-			goto exit_bad_setup;
-		}
+		can_import[i] = instance_can_import
+			&& tut1_has_device_extension(&phy_devs[i], import_extensions[0])
+			&& tut1_has_device_extension(&phy_devs[i], import_extensions[1]);
+		ext_names[i] = import_extensions;
+		ext_counts[i] = can_import[i]?sizeof import_extensions / sizeof *import_extensions:0;
 	}
 
-	/* Load our compute shader */
-	for (uint32_t i = 0; i < dev_count; ++i)
+	/*
+	 * Set up the devices, load our compute shader and create the pipelines, on all devices in parallel.  There are
+	 * as many pipelines created as command buffers (just for example).  In this test, we are not going to handle
+	 * the case where some pipelines are not created.
+	 */
+	res = tut3_setup_devices(phy_devs, devs, shaders, pipelines, dev_count, VK_QUEUE_COMPUTE_BIT, argv[1],
+			ext_names, ext_counts);
+	if (!tut1_error_is_success(&res))
+		goto exit_bad_enumerate;
+
+	if (bench_opts.mode != TUT4_BENCH_NONE)
 	{
-		res = tut3_load_shader(&devs[i], argv[1], &shaders[i]);
-		if (!tut1_error_is_success(&res))
-		{
-			tut1_error_printf(&res, "Could not load shader on device %u\n", i);
-			goto exit_bad_shader;
-		}
+		struct tut4_bench bench = {
+			.phy_devs = phy_devs,
+			.devs = devs,
+			.pipelines = pipelines,
+			.dev_count = dev_count,
+			.can_import = can_import,
+			.api_version = api_version,
+			.shader_dir = shader_dir,
+		};
+
+		retval = tut4_bench_run(&bench, &bench_opts);
+		goto exit_bad_pipeline;
 	}
 
 	/*
-	 * Create the pipelines.  There are as many pipelines created as command buffers (just for example).  If
-	 * there are not actually enough resources for them, as many as possible are created.  In this test, we are
-	 * not going to handle the case where some pipelines are not created.
+	 * Prepare our test.  The threads are divided near-equally among the physical devices, which are likely to be
+	 * just 1 in your case, but who knows.  The buffer is divided according to how fast each device is, so that they
+	 * all finish at around the same time; see measure_device_throughputs().
 	 */
-	for (uint32_t i = 0; i < dev_count; ++i)
+	double throughputs[MAX_DEVICES];
+	double total_throughput = 0;
+	size_t assigned_buffer_size = 0;
+
+	res = measure_device_throughputs(phy_devs, devs, pipelines, dev_count, thread_count, buffer_size, throughputs);
+	if (!tut1_error_is_success(&res))
 	{
-		res = tut3_make_compute_pipeline(&devs[i], &pipelines[i], shaders[i]);
-		if (!tut1_error_is_success(&res))
-		{
-			tut1_error_printf(&res, "Could not allocate enough pipelines on device %u\n", i);
-			goto exit_bad_pipeline;
-		}
+		tut1_error_printf(&res, "Could not measure the devices' throughput\n");
+		goto exit_bad_pipeline;
 	}
+	for (uint32_t i = 0; i < dev_count; ++i)
+		total_throughput += throughputs[i];
 
-	/*
-	 * Prepare our test.  Both the buffers and threads are divided near-equally among the physical devices, which
-	 * are likely to be just 1 in your case, but who knows.
-	 */
 	for (uint32_t i = 0; i < dev_count; ++i)
 	{
-		size_t this_buffer_size = buffer_size / dev_count;
+		size_t this_buffer_size = buffer_size * (throughputs[i] / total_throughput);
 		size_t this_thread_count = thread_count / dev_count;
 
 		/* Make sure the last device gets all the left-over */
 		if (i == dev_count - 1)
-		{
-			this_buffer_size = buffer_size - buffer_size / dev_count * (dev_count - 1);
 			this_thread_count = thread_count - thread_count / dev_count * (dev_count - 1);
+
+		/*
+		 * Every thread works on a multiple of the workgroup size (64 elements), so each device's share is rounded
+		 * down to a multiple of that per thread, just like in measure_device_throughputs().  What is left over from
+		 * rounding goes to the last device, as does the share of a device that is left out of the test because its
+		 * share rounds down to nothing (it's too slow to be worth it, or it has no threads).  Only what the last
+		 * device itself can't fit in whole workgroups is left over in the end, and that is reported below.
+		 */
+		size_t granularity = 64 * this_thread_count;
+		if (i == dev_count - 1)
+			this_buffer_size = buffer_size - assigned_buffer_size;
+		if (granularity > 0)
+			this_buffer_size -= this_buffer_size % granularity;
+		if (this_buffer_size == 0 || granularity == 0)
+		{
+			printf("Device %u is too slow to get a share of the buffer; leaving it out\n", i);
+			continue;
 		}
+		assigned_buffer_size += this_buffer_size;
+
+		if (dev_count > 1)
+			printf("Device %u gets %.1f%% of the buffer\n", i, this_buffer_size * 100.0 / buffer_size);
 
-		res = tut4_prepare_test(&phy_devs[i], &devs[i], &pipelines[i], &test_data[i], this_buffer_size, this_thread_count);
+		res = tut4_prepare_test(&phy_devs[i], &devs[i], &pipelines[i], &test_data[i], this_buffer_size, this_thread_count,
+				host_cached);
 		if (!tut1_error_is_success(&res))
 		{
 			tut1_error_printf(&res, "Could not allocate resources on device %u\n", i);
 			goto exit_bad_test_prepare;
 		}
+		tested[i] = true;
+
+		if (chunks_per_thread == 0)
+			continue;
+
+		res = tut4_prepare_chunks(&devs[i], &test_data[i], this_thread_count * chunks_per_thread);
+		if (!tut1_error_is_success(&res))
+		{
+			tut1_error_printf(&res, "Could not allocate chunks on device %u\n", i);
+			goto exit_bad_test_prepare;
+		}
 	}
 
+	if (assigned_buffer_size < buffer_size)
+		printf("%zu elements don't fill a whole workgroup per thread; they are left out of the test\n",
+				buffer_size - assigned_buffer_size);
+
 	/*
 	 * Ok, this was a LOT of initializing!  But we are finally ready to run something.  tut4_start_test() creates
 	 * a test thread for us, which further spawns the corresponding device's thread_count threads that do the
@@ -155,6 +364,8 @@ int main(int argc, char **argv)
 	 */
 	for (uint32_t i = 0; i < dev_count; ++i)
 	{
+		if (!tested[i])
+			continue;
 		if (tut4_start_test(&test_data[i], busy_threads))
 		{
 			printf("Could not start the test threads for device %u\n", i);
@@ -165,11 +376,12 @@ int main(int argc, char **argv)
 	printf("Running the tests...\n");
 
 	for (uint32_t i = 0; i < dev_count; ++i)
-		tut4_wait_test_end(&test_data[i]);
+		if (tested[i])
+			tut4_wait_test_end(&test_data[i]);
 
 	success = 1;
 	for (uint32_t i = 0; i < dev_count; ++i)
-		if (!test_data[i].success)
+		if (tested[i] && !test_data[i].success)
 		{
 			if (!tut1_error_is_success(&test_data[i].error))
 				tut1_error_printf(&test_data[i].error, "Error starting test on device %u\n", i);
@@ -178,6 +390,69 @@ int main(int argc, char **argv)
 			success = 0;
 		}
 
+	for (uint32_t i = 0; i < dev_count; ++i)
+	{
+		if (!tested[i])
+			continue;
+		printf("Static split (device %u): %.3fms wall time, load imbalance %.2f\n", i,
+				test_data[i].wall_time_ns / 1000000.0, tut4_load_imbalance(&test_data[i]));
+		printf("  host: %.3fms initializing, %.3fms verifying\n", test_data[i].host_init_ns / 1000000.0,
+				test_data[i].host_verify_ns / 1000000.0);
+		print_thread_times(&test_data[i]);
+	}
+
+	/*
+	 * If asked, run the test again, but this time with the buffer cut in smaller chunks that the threads pick up as
+	 * they go, stealing from each other when they run out.  See tut4_prepare_chunks() for why.
+	 */
+	if (chunks_per_thread > 0 && success)
+	{
+		for (uint32_t i = 0; i < dev_count; ++i)
+		{
+			if (!tested[i])
+				continue;
+			if (tut4_start_chunked_test(&test_data[i], busy_threads))
+			{
+				printf("Could not start the work-stealing test threads for device %u\n", i);
+				perror("Error");
+			}
+		}
+
+		printf("Running the tests with work stealing...\n");
+
+		for (uint32_t i = 0; i < dev_count; ++i)
+			if (tested[i])
+				tut4_wait_test_end(&test_data[i]);
+
+		for (uint32_t i = 0; i < dev_count; ++i)
+		{
+			struct tut4_data *t = &test_data[i];
+			uint32_t stolen = 0;
+
+			if (!tested[i])
+				continue;
+
+			if (!t->success)
+			{
+				if (!tut1_error_is_success(&t->error))
+					tut1_error_printf(&t->error, "Error starting work-stealing test on device %u\n", i);
+				else
+					printf("The work-stealing test didn't produce expected results (device %u)\n", i);
+				success = 0;
+				continue;
+			}
+
+			for (uint32_t j = 0; j < t->per_cmd_buffer_count; ++j)
+				stolen += t->per_cmd_buffer[j].chunks_stolen;
+
+			printf("Work stealing (device %u): %.3fms wall time, load imbalance %.2f, %u/%u chunks stolen\n", i,
+					t->wall_time_ns / 1000000.0, tut4_load_imbalance(t), stolen, t->chunk_count);
+			printf("  host: %.3fms initializing, %.3fms verifying\n", t->host_init_ns / 1000000.0,
+					t->host_verify_ns / 1000000.0);
+			print_thread_times(t);
+		}
+	}
+
 	if (success)
 		printf("Everything went well :) We just wasted your GPU doing something stupid\n");
 
@@ -214,6 +489,27 @@ int main(int argc, char **argv)
 	 * is no more any speedup.  That is when the amount of time spent in each CPU thread becomes less than the time
 	 * spent in the GPU for that thread's task, so whether the CPU spent time doing something before waiting for
 	 * the GPU doesn't make a difference in the execution time.
+	 *
+	 * Finally, give a fifth argument to also run the test with the buffer split in that many chunks per thread,
+	 * where threads that finish early steal work from the others:
+	 *
+	 *     $ ./tut4/tut4 shaders/tut3.comp.spv <threads> <fake> <size> <chunks>
+	 *
+	 * With all threads and queues equally fast, the static split is already balanced and the chunks only add the
+	 * overhead of re-recording the command buffers.  But if some queues are slower than others (say they are on a
+	 * different queue family, or the GPU is shared with another application), or you have more threads than CPU
+	 * cores, compare the load imbalance and wall time of the two runs.
+	 *
+	 * A sixth argument of 1 places the buffer in host-cached memory instead of host-coherent memory (if there is
+	 * such a thing), and flushes and invalidates the host caches explicitly.  The verification time reported for
+	 * the host is where you would see the difference; the readback benchmark measures just that.
+	 *
+	 * If you have more than one device, the work is split between them in proportion to how fast each device went
+	 * through a smaller test run just before.  The devices are also set up in parallel, see tut3_setup_devices().
+	 *
+	 * Instead of a thread count, you can also give the name of one of the benchmarks in the bench_*.c files,
+	 * each of which puts the GPU to use in a different way.  Run tut4 without arguments to see them all; bench.h
+	 * is a good place to start reading.  To see how the test above scales on your machine, try the sweep mode.
 	 */
 
 	retval = 0;
@@ -225,16 +521,7 @@ exit_bad_test_prepare:
 		tut4_free_test(&devs[i], &test_data[i]);
 
 exit_bad_pipeline:
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut3_destroy_pipeline(&devs[i], &pipelines[i]);
-
-exit_bad_shader:
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut3_free_shader(&devs[i], shaders[i]);
-
-exit_bad_setup:
-	for (uint32_t i = 0; i < dev_count; ++i)
-		tut2_cleanup(&devs[i]);
+	tut3_cleanup_devices(devs, shaders, pipelines, dev_count);
 
 exit_bad_enumerate:
 	tut1_exit(vk);
@@ -19,12 +19,19 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
 #include "tut4.h"
 
-tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
-		struct tut4_data *test_data, size_t buffer_size, size_t thread_count)
+static tut1_error find_import_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		VkMemoryRequirements *mem_req, void *host_mem, uint32_t *mem_index);
+
+static tut1_error prepare_test(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_data *test_data, size_t buffer_size, size_t thread_count, bool prefer_host_cached,
+		void *host_mem, size_t host_mem_size)
 {
 	/*
 	 * In this tutorial, we will finally submit some work to the GPU!  For that, we need a couple of things.  To be
@@ -89,8 +96,11 @@ tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_d
 
 	*test_data = (struct tut4_data){
 		.buffer_size = buffer_size,
+		.phy_dev = phy_dev,
 		.dev = dev,
 		.pipelines = pipelines,
+		.host_mem = host_mem,
+		.host_mem_size = host_mem_size,
 	};
 
 	/* At first, make sure there are enough command buffers for the threads */
@@ -121,6 +131,14 @@ tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_d
 		.usage = VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
 	};
 
+	/* A buffer that is going to be bound to imported memory needs to say so.  See tut4_prepare_test_import() */
+	VkExternalMemoryBufferCreateInfo external_info = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+		.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+	};
+	if (host_mem)
+		buffer_info.pNext = &external_info;
+
 	res = vkCreateBuffer(dev->device, &buffer_info, NULL, &test_data->buffer);
 	tut1_error_set_vkresult(&retval, res);
 	if (res)
@@ -141,6 +159,11 @@ tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_d
 	 * want to be prepared to do the above flushes and cache invalidations if there is still host-cached memory
 	 * available instead.
 	 *
+	 * In fact, host-coherent memory on a discrete GPU is often uncached (and write-combined), which is fine for the
+	 * host writing into it sequentially, but reading it back is painfully slow; every read goes over the bus.  If
+	 * you read back a lot of data, you would want host-cached memory and do the flushes and invalidations
+	 * yourself.  That's what `prefer_host_cached` does.
+	 *
 	 * Do note that host-visible memories are still device memories, which means that at the end of the day, there
 	 * should be somebody ensuring coherency between host and device accesses.  This is done with a memory barrier,
 	 * which we will get to in a future tutorial.  Luckily for you, submitting a command buffer to a queue already
@@ -148,24 +171,57 @@ tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_d
 	 * read back the memory (as is the case in this tutorial), a barrier is necessary.
 	 */
 	vkGetBufferMemoryRequirements(dev->device, test_data->buffer, &mem_req);
-	mem_index = tut4_find_suitable_memory(phy_dev, dev, &mem_req,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	if (mem_index >= phy_dev->memories.memoryTypeCount)
+	if (host_mem)
 	{
-		tut1_error_set_vkresult(&retval, VK_ERROR_OUT_OF_DEVICE_MEMORY);
-		goto exit_failed;
-	}
+		retval = find_import_memory(phy_dev, dev, &mem_req, host_mem, &mem_index);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+		if (mem_req.size > host_mem_size)
+		{
+			tut1_error_set_vkresult(&retval, VK_ERROR_FEATURE_NOT_PRESENT);
+			goto exit_failed;
+		}
 
-	mem_info = (VkMemoryAllocateInfo){
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = mem_req.size,
-		.memoryTypeIndex = mem_index,
-	};
+		/*
+		 * To import host memory instead of allocating new memory, the host pointer is chained to the allocation
+		 * info.  The allocation size is the size of the host allocation; the buffer's requirements are already
+		 * rounded up to a page by tut4_prepare_test_import().
+		 */
+		VkImportMemoryHostPointerInfoEXT import_info = {
+			.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+			.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+			.pHostPointer = host_mem,
+		};
+		mem_info = (VkMemoryAllocateInfo){
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = &import_info,
+			.allocationSize = test_data->host_mem_size,
+			.memoryTypeIndex = mem_index,
+		};
 
-	res = vkAllocateMemory(dev->device, &mem_info, NULL, &test_data->buffer_mem);
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
-		goto exit_failed;
+		res = vkAllocateMemory(dev->device, &mem_info, NULL, &test_data->buffer_mem);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+	else
+	{
+		/*
+		 * The host writes the buffer before the test and reads it back after.  With `prefer_host_cached`, the
+		 * reading matters more, and the memory is picked as such.  Either way, tut4_allocate_memory() goes down
+		 * the list of suitable memory types if the best one is out of memory.
+		 */
+		retval = tut4_allocate_memory(phy_dev, dev, &mem_req,
+				prefer_host_cached?TUT1_MEMORY_READBACK:TUT1_MEMORY_UPLOAD, 0,
+				&test_data->buffer_mem, &mem_index);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	/* Remember whether we need to flush and invalidate, and how */
+	test_data->buffer_mem_size = mem_req.size;
+	if ((phy_dev->memories.memoryTypes[mem_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+		test_data->buffer_atom_size = phy_dev->properties.limits.nonCoherentAtomSize;
 
 	/*
 	 * We have the buffer and we have the underlying memory.  Let's bind them!  The memory is used only for this
@@ -202,6 +258,26 @@ tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_d
 	if (res)
 		goto exit_failed;
 
+	/*
+	 * To know how long the GPU actually spent on each thread's work, as opposed to how long the thread waited for
+	 * it, we can ask the GPU to write down timestamps before and after the dispatch.  Timestamps are "queries",
+	 * and queries are allocated from query pools, just like descriptor sets from descriptor pools.  Each thread
+	 * gets a pair of queries, one for the start and one for the end of its work.
+	 *
+	 * The creation of the pool needs the type of the queries (timestamp) and how many of them there are.  The
+	 * pipeline statistics flags are only for another type of query, and we don't care about them.
+	 */
+	VkQueryPoolCreateInfo query_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = 2 * thread_count,
+	};
+
+	res = vkCreateQueryPool(dev->device, &query_pool_info, NULL, &test_data->query_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
 	/* See `worker_thread()` for an explanation of why a mutex is needed */
 	if ((err_no = pthread_mutex_init(&test_data->cmd_pool_mutex, NULL)))
 	{
@@ -330,10 +406,297 @@ exit_failed:
 	return retval;
 }
 
+tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_data *test_data, size_t buffer_size, size_t thread_count, bool prefer_host_cached)
+{
+	return prepare_test(phy_dev, dev, pipelines, test_data, buffer_size, thread_count, prefer_host_cached, NULL, 0);
+}
+
+size_t tut4_get_import_alignment(struct tut1_physical_device *phy_dev)
+{
+	/*
+	 * Host memory to be imported must be aligned to minImportedHostPointerAlignment, and its size a multiple of it
+	 * too.  That limit is only reported through vkGetPhysicalDeviceProperties2KHR, which comes with the
+	 * VK_KHR_get_physical_device_properties2 instance extension.  main.c enables it along with the other import
+	 * extensions if the instance has it.  Without it (or VK_EXT_external_memory_host itself), there is no way to
+	 * know, and the page size is the best bet; it is what the limit is in practice.
+	 */
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t alignment = page_size > 0?page_size:4096;
+
+	if (!tut1_has_instance_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+			|| !tut1_has_device_extension(phy_dev, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+		return alignment;
+
+	PFN_vkGetPhysicalDeviceProperties2KHR get_properties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)
+		vkGetInstanceProcAddr(phy_dev->instance, "vkGetPhysicalDeviceProperties2KHR");
+	if (get_properties2 == NULL)
+		return alignment;
+
+	/* The limits of extensions are chained to the core properties, each in its own struct */
+	VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_properties = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+	};
+	VkPhysicalDeviceProperties2KHR properties = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+		.pNext = &host_properties,
+	};
+	get_properties2(phy_dev->physical_device, &properties);
+
+	if (host_properties.minImportedHostPointerAlignment > 0)
+		alignment = host_properties.minImportedHostPointerAlignment;
+	return alignment;
+}
+
+static tut1_error find_import_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		VkMemoryRequirements *mem_req, void *host_mem, uint32_t *mem_index)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	/*
+	 * Extension functions are not exported by the loader like the core functions, so they need to be looked up.  If
+	 * the device was not created with the extension enabled, this returns NULL.
+	 */
+	PFN_vkGetMemoryHostPointerPropertiesEXT get_host_pointer_properties =
+		(PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(dev->device, "vkGetMemoryHostPointerPropertiesEXT");
+	if (get_host_pointer_properties == NULL)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_EXTENSION_NOT_PRESENT);
+		goto exit_failed;
+	}
+
+	/* Ask which memory types this particular host pointer could be imported as */
+	VkMemoryHostPointerPropertiesEXT host_pointer_properties = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+	};
+	res = get_host_pointer_properties(dev->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, host_mem,
+			&host_pointer_properties);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The memory type needs to support both the buffer and the host pointer.  It also needs to be host-coherent,
+	 * because the host is going to access the memory through its own pointer instead of a vkMapMemory'ed one, and
+	 * vkFlushMappedMemoryRanges and vkInvalidateMappedMemoryRanges only work on mapped memory.
+	 */
+	VkMemoryRequirements import_req = *mem_req;
+	import_req.memoryTypeBits &= host_pointer_properties.memoryTypeBits;
+
+	*mem_index = tut4_find_suitable_memory(phy_dev, dev, &import_req,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	if (*mem_index >= phy_dev->memories.memoryTypeCount)
+		tut1_error_set_vkresult(&retval, VK_ERROR_FEATURE_NOT_PRESENT);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_test_import(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_data *test_data, void *host_mem, size_t host_mem_size, size_t thread_count)
+{
+	/*
+	 * tut4_prepare_test() allocates device memory, and start_test() maps it and writes the data into it.  If the
+	 * data is already in host memory, for example because it was read from a file or produced by another part of
+	 * the application, that's one whole copy of the data that's wasted.
+	 *
+	 * The VK_EXT_external_memory_host extension lets the device use host memory directly.  The host allocation is
+	 * "imported" as device memory, and the buffer is bound to it like any other memory.  The GPU then reads and
+	 * writes the host memory over the bus, and the host sees the results in its own buffer with no copies either
+	 * way.  On integrated GPUs and software implementations such as lavapipe, this is essentially free.
+	 *
+	 * The host allocation must be aligned to minImportedHostPointerAlignment, and its size a multiple of it too
+	 * (see tut4_get_import_alignment()).  If it's not, the import fails and the caller can fall back to
+	 * tut4_prepare_test().
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	size_t alignment = tut4_get_import_alignment(phy_dev);
+
+	/* The buffer can only use the whole aligned blocks the host memory covers */
+	host_mem_size -= host_mem_size % alignment;
+
+	if ((uintptr_t)host_mem % alignment != 0 || host_mem_size == 0)
+	{
+		*test_data = (struct tut4_data){0};
+		tut1_error_set_vkresult(&retval, VK_ERROR_INVALID_EXTERNAL_HANDLE);
+		return retval;
+	}
+
+	return prepare_test(phy_dev, dev, pipelines, test_data, host_mem_size / sizeof(float), thread_count, false,
+			host_mem, host_mem_size);
+}
+
+tut1_error tut4_begin_commands(VkCommandBuffer cmd_buffer)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	vkResetCommandBuffer(cmd_buffer, 0);
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	tut1_error_set_vkresult(&retval, vkBeginCommandBuffer(cmd_buffer, &begin_info));
+
+	return retval;
+}
+
+tut1_error tut4_submit_and_wait(struct tut2_device *dev, VkCommandBuffer cmd_buffer, VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	res = vkEndCommandBuffer(cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkResetFences(dev->device, 1, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	res = vkQueueSubmit(queue, 1, &submit_info, fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	do
+	{
+		res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+	} while (res == VK_TIMEOUT);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_chunks(struct tut2_device *dev, struct tut4_data *test_data, size_t chunk_count)
+{
+	/*
+	 * The test above splits the buffer statically: thread i works on buffer_size / thread_count elements starting
+	 * from i * (buffer_size / thread_count).  That is fine as long as every thread and every queue is equally
+	 * fast, but in practice one slow queue (maybe shared with someone else, or on a different queue family) or one
+	 * thread that is descheduled by the OS stalls the whole test; everybody else finishes and then waits for it.
+	 *
+	 * The alternative is to cut the buffer in many smaller chunks, more than there are threads, and let the threads
+	 * pick up chunks as they go.  Here, we create the chunks.  Each chunk is just like what each thread had before:
+	 * a buffer view over a part of the buffer, and a descriptor set to give that buffer view to the shader.  The
+	 * chunks are then divided between the threads when the test starts, and threads that run out of work steal
+	 * chunks from the others.  See `chunked_worker_thread()`.
+	 *
+	 * The descriptor sets are allocated with the layout of the first pipeline.  All pipelines are created from the
+	 * same shader and with identical set layouts, and Vulkan considers descriptor sets compatible with any pipeline
+	 * layout whose set layout is defined identically.  So a chunk can be used with any thread's pipeline.
+	 */
+
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDescriptorPoolCreateInfo set_pool_info;
+	VkDescriptorPoolSize pool_size;
+	size_t buffer_size = test_data->buffer_size;
+	size_t units;
+
+	/*
+	 * Chunks also need to be multiples of 64 elements.  buffer_size is already a multiple of 64, so the buffer is
+	 * split in units of 64 elements, and the units are spread evenly over the chunks.  That way, chunks differ in
+	 * size by at most 64 elements.  Rounding each chunk down to 64 elements and giving the rest to the last chunk
+	 * instead could make the last chunk a good part of the whole work, which is exactly what the chunks are there
+	 * to avoid.
+	 */
+	units = buffer_size / 64;
+	if (chunk_count == 0 || chunk_count > units)
+		chunk_count = units;
+
+	pool_size = (VkDescriptorPoolSize){
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = chunk_count,
+	};
+	set_pool_info = (VkDescriptorPoolCreateInfo){
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = chunk_count,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &test_data->chunk_set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	test_data->chunks = malloc(chunk_count * sizeof *test_data->chunks);
+	if (test_data->chunks == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	memset(test_data->chunks, 0, chunk_count * sizeof *test_data->chunks);
+	test_data->chunk_count = chunk_count;
+
+	for (uint32_t i = 0; i < chunk_count; ++i)
+	{
+		struct tut4_chunk *chunk = &test_data->chunks[i];
+
+		chunk->start_index = i * units / chunk_count * 64;
+		chunk->end_index = (i + 1) * units / chunk_count * 64;
+
+		/* This is exactly as in tut4_prepare_test() */
+		VkBufferViewCreateInfo buffer_view_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+			.buffer = test_data->buffer,
+			.format = VK_FORMAT_R32_SFLOAT,
+			.offset = chunk->start_index * sizeof(float),
+			.range = (chunk->end_index - chunk->start_index) * sizeof(float),
+		};
+
+		res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &chunk->buffer_view);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		VkDescriptorSetAllocateInfo set_info = {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = test_data->chunk_set_pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts = &test_data->pipelines->pipelines[0].set_layout,
+		};
+
+		res = vkAllocateDescriptorSets(dev->device, &set_info, &chunk->set);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		VkWriteDescriptorSet set_write = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = chunk->set,
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &chunk->buffer_view,
+		};
+
+		vkUpdateDescriptorSets(dev->device, 1, &set_write, 0, NULL);
+	}
+
+exit_failed:
+	return retval;
+}
+
 void tut4_free_test(struct tut2_device *dev, struct tut4_data *test_data)
 {
 	vkDeviceWaitIdle(dev->device);
 
+	for (uint32_t i = 0; i < test_data->chunk_count; ++i)
+		vkDestroyBufferView(dev->device, test_data->chunks[i].buffer_view, NULL);
+	vkDestroyDescriptorPool(dev->device, test_data->chunk_set_pool, NULL);
+	free(test_data->chunks);
+
 	for (uint32_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
 	{
 		struct tut4_per_cmd_buffer_data *per_cmd_buffer_data = &test_data->per_cmd_buffer[i];
@@ -345,9 +708,12 @@ void tut4_free_test(struct tut2_device *dev, struct tut4_data *test_data)
 		 */
 		vkDestroyFence(dev->device, per_cmd_buffer_data->fence, NULL);
 		vkDestroyBufferView(dev->device, per_cmd_buffer_data->buffer_view, NULL);
+
+		free(per_cmd_buffer_data->latencies_ns);
 	}
 
 	vkDestroyDescriptorPool(dev->device, test_data->set_pool, NULL);
+	vkDestroyQueryPool(dev->device, test_data->query_pool, NULL);
 	vkDestroyBuffer(dev->device, test_data->buffer, NULL);
 
 	/*
@@ -393,19 +759,129 @@ uint32_t tut4_find_suitable_memory(struct tut1_physical_device *phy_dev, struct
 	return phy_dev->memories.memoryTypeCount;
 }
 
-#define TEST_ITERATIONS 100
+tut1_error tut4_allocate_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		VkMemoryRequirements *mem_req, enum tut1_memory_usage memory_usage, VkMemoryPropertyFlags required,
+		VkDeviceMemory *mem, uint32_t *mem_index)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	uint32_t rank = 0;
+
+	/*
+	 * The size of a heap is not the same as how much of it is free.  Other allocations (ours or other
+	 * applications') take their share, so an allocation can fail with VK_ERROR_OUT_OF_DEVICE_MEMORY even though the
+	 * heap is large enough on paper.  When that happens, there is no reason to give up; the next best memory type
+	 * (often in another heap) is slower, but it works.  The types are already ranked by tut1_enumerate_devices(),
+	 * so we just go down the list.
+	 */
+	while ((*mem_index = tut1_find_memory_type(phy_dev, memory_usage, mem_req, required, &rank))
+			< phy_dev->memories.memoryTypeCount)
+	{
+		VkMemoryAllocateInfo mem_info = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = mem_req->size,
+			.memoryTypeIndex = *mem_index,
+		};
+
+		res = vkAllocateMemory(dev->device, &mem_info, NULL, mem);
+		if (res != VK_ERROR_OUT_OF_DEVICE_MEMORY)
+			break;
+	}
+
+	tut1_error_set_vkresult(&retval, res);
+	return retval;
+}
 
-static uint64_t get_time_ns()
+tut1_error tut4_create_buffer(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkDeviceSize size,
+		VkBufferUsageFlags usage, enum tut1_memory_usage memory_usage,
+		VkBuffer *buffer, VkDeviceMemory *buffer_mem, VkDeviceSize *mem_size, VkDeviceSize *atom_size)
 {
-	struct timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	/*
+	 * This is just like in tut4_prepare_test(), with the memory allocated for the given usage.  If mem_size and
+	 * atom_size are not NULL, they are set to the size of the allocation and the nonCoherentAtomSize to use with
+	 * tut4_flush_memory() and tut4_invalidate_memory().
+	 */
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+	};
+
+	res = vkCreateBuffer(dev->device, &buffer_info, NULL, buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkMemoryRequirements mem_req;
+	uint32_t mem_index;
+	vkGetBufferMemoryRequirements(dev->device, *buffer, &mem_req);
+	retval = tut4_allocate_memory(phy_dev, dev, &mem_req, memory_usage, 0, buffer_mem, &mem_index);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	if (mem_size)
+		*mem_size = mem_req.size;
+	if (atom_size)
+		*atom_size = (phy_dev->memories.memoryTypes[mem_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0?
+			phy_dev->properties.limits.nonCoherentAtomSize:0;
+
+	res = vkBindBufferMemory(dev->device, *buffer, *buffer_mem, 0);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
 }
 
-static void *worker_thread(void *args)
+static VkMappedMemoryRange get_non_coherent_range(VkDeviceMemory mem, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, VkDeviceSize size)
 {
-	struct tut4_per_cmd_buffer_data *per_cmd_buffer = args;
+	/*
+	 * The ranges given to vkFlushMappedMemoryRanges and vkInvalidateMappedMemoryRanges must start at a multiple
+	 * of nonCoherentAtomSize, and their size must be either a multiple of it too, or reach the end of the memory.
+	 * The host caches work in units of cache lines, and that's basically what nonCoherentAtomSize tells us.
+	 */
+	VkDeviceSize end = offset + size;
 
+	offset -= offset % atom_size;
+	end += atom_size - 1;
+	end -= end % atom_size;
+
+	return (VkMappedMemoryRange){
+		.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+		.memory = mem,
+		.offset = offset,
+		.size = end >= mem_size?VK_WHOLE_SIZE:end - offset,
+	};
+}
+
+VkResult tut4_flush_memory(struct tut2_device *dev, VkDeviceMemory mem, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, VkDeviceSize size)
+{
+	if (atom_size == 0)
+		return VK_SUCCESS;
+
+	VkMappedMemoryRange range = get_non_coherent_range(mem, mem_size, atom_size, offset, size);
+	return vkFlushMappedMemoryRanges(dev->device, 1, &range);
+}
+
+VkResult tut4_invalidate_memory(struct tut2_device *dev, VkDeviceMemory mem, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, VkDeviceSize size)
+{
+	if (atom_size == 0)
+		return VK_SUCCESS;
+
+	VkMappedMemoryRange range = get_non_coherent_range(mem, mem_size, atom_size, offset, size);
+	return vkInvalidateMappedMemoryRanges(dev->device, 1, &range);
+}
+
+#define TEST_ITERATIONS TUT4_TEST_ITERATIONS
+
+static tut1_error record_dispatch(struct tut4_per_cmd_buffer_data *per_cmd_buffer, VkDescriptorSet set,
+		size_t element_count)
+{
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
 	int err_no;
@@ -440,7 +916,7 @@ static void *worker_thread(void *args)
 	res = vkBeginCommandBuffer(per_cmd_buffer->cmd_buffer, &begin_info);
 	tut1_error_set_vkresult(&retval, res);
 	if (res)
-		goto exit_failed;
+		goto exit_failed_unlock;
 
 	/*
 	 * We need to bind the pipeline to the command buffer, which needs to be done while recording!  The only
@@ -463,7 +939,20 @@ static void *worker_thread(void *args)
 	 * will ignore that for now.
 	 */
 	vkCmdBindDescriptorSets(per_cmd_buffer->cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-			per_cmd_buffer->pipeline_layout, 0, 1, &per_cmd_buffer->set, 0, NULL);
+			per_cmd_buffer->pipeline_layout, 0, 1, &set, 0, NULL);
+
+	/*
+	 * Queries need to be reset before they are used, and since the same command buffer is submitted over and
+	 * over, the reset is recorded in the command buffer itself.  Then, a timestamp is written when the previous
+	 * commands have reached the top of the pipe (i.e. right away), and another one after the dispatch is done
+	 * with, i.e. when it reaches the bottom of the pipe.
+	 */
+	if (per_cmd_buffer->timestamp_valid_bits)
+	{
+		vkCmdResetQueryPool(per_cmd_buffer->cmd_buffer, per_cmd_buffer->query_pool, per_cmd_buffer->query_index, 2);
+		vkCmdWriteTimestamp(per_cmd_buffer->cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				per_cmd_buffer->query_pool, per_cmd_buffer->query_index);
+	}
 
 	/*
 	 * To dispatch work to be done, we need to tell how many workgroups to dispatch.  In a shader, you can specify
@@ -495,17 +984,25 @@ static void *worker_thread(void *args)
 	 *
 	 * Needless to say, our storage texel buffer is 1-dimensional, so only work in the X axis is dispatched.
 	 */
-	vkCmdDispatch(per_cmd_buffer->cmd_buffer, (per_cmd_buffer->end_index - per_cmd_buffer->start_index) / 64, 1, 1);
+	vkCmdDispatch(per_cmd_buffer->cmd_buffer, element_count / 64, 1, 1);
+
+	if (per_cmd_buffer->timestamp_valid_bits)
+		vkCmdWriteTimestamp(per_cmd_buffer->cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				per_cmd_buffer->query_pool, per_cmd_buffer->query_index + 1);
 
 	/* Stop recording */
 	vkEndCommandBuffer(per_cmd_buffer->cmd_buffer);
 
+exit_failed_unlock:
 	if ((err_no = pthread_mutex_unlock(per_cmd_buffer->cmd_pool_mutex)))
-	{
 		tut1_error_set_errno(&retval, err_no);
-		goto exit_failed;
-	}
 
+exit_failed:
+	return retval;
+}
+
+static void submit_iterations(struct tut4_per_cmd_buffer_data *per_cmd_buffer)
+{
 	for (uint32_t i = 0; i < TEST_ITERATIONS; ++i)
 	{
 		VkSubmitInfo submit_info;
@@ -533,6 +1030,7 @@ static void *worker_thread(void *args)
 			.pCommandBuffers = &per_cmd_buffer->cmd_buffer,
 		};
 
+		uint64_t submit_time_ns = tut1_get_time_ns();
 		vkQueueSubmit(per_cmd_buffer->queue, 1, &submit_info, per_cmd_buffer->fence);
 
 		/*
@@ -546,8 +1044,8 @@ static void *worker_thread(void *args)
 			 * busy loop for 32ms/thread_count, pretending that the thread is actually doing something
 			 * CPU-bound.
 			 */
-			uint64_t end_time_ns = get_time_ns() + per_cmd_buffer->busy_time_ns;
-			while (get_time_ns() < end_time_ns);
+			uint64_t end_time_ns = tut1_get_time_ns() + per_cmd_buffer->busy_time_ns;
+			while (tut1_get_time_ns() < end_time_ns);
 		}
 
 		/*
@@ -559,15 +1057,386 @@ static void *worker_thread(void *args)
 		 * so we are just going to patiently wait for it until it does.
 		 */
 		while (vkWaitForFences(per_cmd_buffer->device, 1, &per_cmd_buffer->fence, true, 1000000) == VK_TIMEOUT);
+
+		/*
+		 * Keep track of how long it took from submission until we saw the work finished.  Note that this
+		 * includes the fake busy time, if any, as the host couldn't have noticed the completion earlier.
+		 */
+		if (per_cmd_buffer->latency_count < per_cmd_buffer->latency_capacity)
+			per_cmd_buffer->latencies_ns[per_cmd_buffer->latency_count++] = tut1_get_time_ns() - submit_time_ns;
+
+		/*
+		 * The fence is signaled, so the timestamps are already written and reading them doesn't stall.  The
+		 * results are in "ticks", which are converted to nanoseconds with the timestampPeriod of the device.
+		 * Only the lower timestampValidBits of the timestamps are meaningful, so the difference is masked to
+		 * take care of the counter wrapping around.
+		 */
+		if (per_cmd_buffer->timestamp_valid_bits)
+		{
+			uint64_t timestamps[2];
+			uint64_t mask = per_cmd_buffer->timestamp_valid_bits >= 64?
+				~(uint64_t)0:((uint64_t)1 << per_cmd_buffer->timestamp_valid_bits) - 1;
+
+			if (vkGetQueryPoolResults(per_cmd_buffer->device, per_cmd_buffer->query_pool, per_cmd_buffer->query_index,
+						2, sizeof timestamps, timestamps, sizeof *timestamps, VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+				per_cmd_buffer->gpu_time_ns += ((timestamps[1] - timestamps[0]) & mask) * per_cmd_buffer->timestamp_period;
+		}
 	}
+}
+
+static void *worker_thread(void *args)
+{
+	struct tut4_per_cmd_buffer_data *per_cmd_buffer = args;
+	uint64_t start_time_ns = tut1_get_time_ns();
+
+	tut1_error retval = record_dispatch(per_cmd_buffer, per_cmd_buffer->set,
+			per_cmd_buffer->end_index - per_cmd_buffer->start_index);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
 
+	submit_iterations(per_cmd_buffer);
+
+	per_cmd_buffer->chunks_done = 1;
 	per_cmd_buffer->success = 1;
 
 exit_failed:
+	per_cmd_buffer->wall_time_ns = tut1_get_time_ns() - start_time_ns;
 	per_cmd_buffer->error = retval;
 	return NULL;
 }
 
+/*
+ * The chunks of each worker are kept in a tiny double-ended queue: the worker takes chunks from the head of its own
+ * queue, and once that is empty, it steals chunks from the tail of other workers' queues.  Taking from opposite ends
+ * means the owner and the thieves only fight over the very last chunk.  Both ends are packed in a single 64-bit
+ * value, so that taking a chunk is a single atomic compare-and-swap and no locks are needed.
+ */
+#define CHUNK_RANGE(head, tail) ((uint64_t)(head) << 32 | (uint32_t)(tail))
+#define CHUNK_HEAD(range) ((uint32_t)((range) >> 32))
+#define CHUNK_TAIL(range) ((uint32_t)(range))
+
+static bool take_chunk(struct tut4_per_cmd_buffer_data *worker, bool from_tail, uint32_t *chunk)
+{
+	uint64_t range = __atomic_load_n(&worker->chunk_range, __ATOMIC_ACQUIRE);
+
+	do
+	{
+		uint32_t head = CHUNK_HEAD(range);
+		uint32_t tail = CHUNK_TAIL(range);
+		uint64_t new_range;
+
+		if (head >= tail)
+			return false;
+
+		if (from_tail)
+		{
+			*chunk = tail - 1;
+			new_range = CHUNK_RANGE(head, tail - 1);
+		}
+		else
+		{
+			*chunk = head;
+			new_range = CHUNK_RANGE(head + 1, tail);
+		}
+
+		/* On failure, range is updated with what someone else put there, so we just retry */
+		if (__atomic_compare_exchange_n(&worker->chunk_range, &range, new_range, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return true;
+	} while (true);
+}
+
+static bool get_next_chunk(struct tut4_per_cmd_buffer_data *per_cmd_buffer, uint32_t *chunk)
+{
+	struct tut4_data *test_data = per_cmd_buffer->test_data;
+	uint32_t self = per_cmd_buffer - test_data->per_cmd_buffer;
+
+	/* Work on our own chunks first */
+	if (take_chunk(per_cmd_buffer, false, chunk))
+		return true;
+
+	/* Then help the others, starting from our neighbor so not everybody robs worker 0 */
+	for (uint32_t i = 1; i < test_data->per_cmd_buffer_count; ++i)
+	{
+		struct tut4_per_cmd_buffer_data *victim = &test_data->per_cmd_buffer[(self + i) % test_data->per_cmd_buffer_count];
+		if (take_chunk(victim, true, chunk))
+		{
+			++per_cmd_buffer->chunks_stolen;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void *chunked_worker_thread(void *args)
+{
+	struct tut4_per_cmd_buffer_data *per_cmd_buffer = args;
+	struct tut4_data *test_data = per_cmd_buffer->test_data;
+	uint64_t start_time_ns = tut1_get_time_ns();
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t chunk_index;
+
+	/*
+	 * Each chunk is processed just like a worker thread processed its part of the buffer in the static split.  The
+	 * only difference is that the command buffer needs to be re-recorded for every chunk, as the chunk has a
+	 * different descriptor set bound and possibly a different size.
+	 */
+	while (get_next_chunk(per_cmd_buffer, &chunk_index))
+	{
+		struct tut4_chunk *chunk = &test_data->chunks[chunk_index];
+
+		retval = record_dispatch(per_cmd_buffer, chunk->set, chunk->end_index - chunk->start_index);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		submit_iterations(per_cmd_buffer);
+		++per_cmd_buffer->chunks_done;
+	}
+
+	per_cmd_buffer->success = 1;
+
+exit_failed:
+	per_cmd_buffer->wall_time_ns = tut1_get_time_ns() - start_time_ns;
+	per_cmd_buffer->error = retval;
+	return NULL;
+}
+
+/*
+ * Before and after the GPU does its job, the host needs to initialize and verify the buffer.  With a large buffer,
+ * doing that one float at a time on a single thread can easily take longer than the GPU work itself, which makes
+ * the test measure the wrong thing.  So the host work is vectorized with SSE or AVX where available, with a scalar
+ * fallback, and divided between as many threads as there are workers.
+ *
+ * The mapped memory is only guaranteed to be aligned to minMemoryMapAlignment and the ranges start anywhere, so
+ * unaligned loads and stores are used.
+ */
+static void fill_floats_scalar(float *mem, size_t count, float value)
+{
+	for (size_t i = 0; i < count; ++i)
+		mem[i] = value;
+}
+
+static bool verify_floats_scalar(const float *mem, size_t count, float value)
+{
+	for (size_t i = 0; i < count; ++i)
+		if (mem[i] != value)
+			return false;
+	return true;
+}
+
+/* This is what the tut3.comp shader does, done on the CPU instead */
+static void add_floats_scalar(float *to, const float *from, size_t count, float value)
+{
+	for (size_t i = 0; i < count; ++i)
+		to[i] = from[i] + value;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse")))
+static void fill_floats_sse(float *mem, size_t count, float value)
+{
+	__m128 v = _mm_set1_ps(value);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(mem + i, v);
+	fill_floats_scalar(mem + i, count - i, value);
+}
+
+__attribute__((target("sse")))
+static bool verify_floats_sse(const float *mem, size_t count, float value)
+{
+	__m128 v = _mm_set1_ps(value);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+		if (_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(mem + i), v)))
+			return false;
+	return verify_floats_scalar(mem + i, count - i, value);
+}
+
+__attribute__((target("avx")))
+static void fill_floats_avx(float *mem, size_t count, float value)
+{
+	__m256 v = _mm256_set1_ps(value);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(mem + i, v);
+	fill_floats_scalar(mem + i, count - i, value);
+}
+
+__attribute__((target("avx")))
+static bool verify_floats_avx(const float *mem, size_t count, float value)
+{
+	__m256 v = _mm256_set1_ps(value);
+	size_t i = 0;
+
+	/* NEQ_UQ is true for NaNs too, so garbage in the buffer is not mistaken for a match */
+	for (; i + 8 <= count; i += 8)
+		if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(mem + i), v, _CMP_NEQ_UQ)))
+			return false;
+	return verify_floats_scalar(mem + i, count - i, value);
+}
+
+__attribute__((target("sse")))
+static void add_floats_sse(float *to, const float *from, size_t count, float value)
+{
+	__m128 v = _mm_set1_ps(value);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(to + i, _mm_add_ps(_mm_loadu_ps(from + i), v));
+	add_floats_scalar(to + i, from + i, count - i, value);
+}
+
+__attribute__((target("avx")))
+static void add_floats_avx(float *to, const float *from, size_t count, float value)
+{
+	__m256 v = _mm256_set1_ps(value);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(to + i, _mm256_add_ps(_mm256_loadu_ps(from + i), v));
+	add_floats_scalar(to + i, from + i, count - i, value);
+}
+#endif
+
+static void (*fill_floats)(float *mem, size_t count, float value) = fill_floats_scalar;
+static bool (*verify_floats)(const float *mem, size_t count, float value) = verify_floats_scalar;
+static void (*add_floats)(float *to, const float *from, size_t count, float value) = add_floats_scalar;
+static pthread_once_t simd_select_once = PTHREAD_ONCE_INIT;
+
+static void simd_select(void)
+{
+	/* Pick the best implementation the CPU we are running on supports, not the one we were compiled for */
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+	{
+		fill_floats = fill_floats_avx;
+		verify_floats = verify_floats_avx;
+		add_floats = add_floats_avx;
+	}
+	else if (__builtin_cpu_supports("sse"))
+	{
+		fill_floats = fill_floats_sse;
+		verify_floats = verify_floats_sse;
+		add_floats = add_floats_sse;
+	}
+#endif
+}
+
+struct host_work
+{
+	struct tut4_data *test_data;
+	float *mem;
+	size_t start_index, end_index;
+	bool verify;
+	bool correct;
+};
+
+static void *host_thread(void *args)
+{
+	struct host_work *work = args;
+	struct tut4_data *test_data = work->test_data;
+
+	/*
+	 * Every part of the buffer that ran through a separate command buffer (a thread's part with the static split, a
+	 * chunk with work stealing) gets its own initial value.  This thread only touches the intersection of those
+	 * parts with its own slice of the buffer.
+	 */
+	uint32_t part_count = test_data->work_stealing?test_data->chunk_count:test_data->per_cmd_buffer_count;
+
+	work->correct = true;
+	for (uint32_t i = 0; i < part_count; ++i)
+	{
+		size_t start = test_data->work_stealing?test_data->chunks[i].start_index:test_data->per_cmd_buffer[i].start_index;
+		size_t end = test_data->work_stealing?test_data->chunks[i].end_index:test_data->per_cmd_buffer[i].end_index;
+
+		if (start < work->start_index)
+			start = work->start_index;
+		if (end > work->end_index)
+			end = work->end_index;
+		if (start >= end)
+			continue;
+
+		if (!work->verify)
+			fill_floats(work->mem + start, end - start, i);
+		else if (!verify_floats(work->mem + start, end - start, TEST_ITERATIONS + i))
+			work->correct = false;
+	}
+
+	return NULL;
+}
+
+static bool host_process_buffer(struct tut4_data *test_data, float *mem, bool verify)
+{
+	uint32_t thread_count = test_data->per_cmd_buffer_count;
+	pthread_t threads[thread_count];
+	bool created[thread_count];
+	struct host_work work[thread_count];
+	size_t slice = test_data->buffer_size / thread_count;
+	bool correct = true;
+
+	pthread_once(&simd_select_once, simd_select);
+
+	/*
+	 * Have each thread (but the first) start on a 64-byte boundary, so that no two threads share a cache line.  The
+	 * mapping is only guaranteed to be aligned to minMemoryMapAlignment, so the boundaries are found from the actual
+	 * address: the slices are kept a multiple of 16 floats, and shifted by however many floats it takes for `mem`
+	 * to reach a 64-byte boundary.
+	 */
+	size_t skew = (64 - (uintptr_t)mem % 64) % 64 / sizeof(float);
+	slice -= slice % 16;
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		size_t start = i == 0?0:i * slice + skew;
+		size_t end = i == thread_count - 1?test_data->buffer_size:(i + 1) * slice + skew;
+
+		if (start > test_data->buffer_size)
+			start = test_data->buffer_size;
+		if (end > test_data->buffer_size)
+			end = test_data->buffer_size;
+
+		work[i] = (struct host_work){
+			.test_data = test_data,
+			.mem = mem,
+			.start_index = start,
+			.end_index = end,
+			.verify = verify,
+		};
+
+		/* If a thread can't be created, just do its work here */
+		created[i] = pthread_create(&threads[i], NULL, host_thread, &work[i]) == 0;
+		if (!created[i])
+			host_thread(&work[i]);
+	}
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		if (created[i])
+			pthread_join(threads[i], NULL);
+		if (!work[i].correct)
+			correct = false;
+	}
+
+	return correct;
+}
+
+void tut4_add_floats(float *to, const float *from, size_t count, float value)
+{
+	pthread_once(&simd_select_once, simd_select);
+	add_floats(to, from, count, value);
+}
+
+void tut4_fill_host_buffer(struct tut4_data *test_data, float *mem)
+{
+	host_process_buffer(test_data, mem, false);
+}
+
 static void *start_test(void *args)
 {
 	struct tut4_data *test_data = args;
@@ -589,6 +1458,8 @@ static void *start_test(void *args)
 	int err_no;
 	pthread_t threads[test_data->per_cmd_buffer_count];
 	uint32_t pool_index, buffer_index;
+	uint64_t test_start_ns;
+	uint64_t host_start_ns = tut1_get_time_ns();
 
 	memset(threads, 0, test_data->per_cmd_buffer_count * sizeof *threads);
 
@@ -598,33 +1469,84 @@ static void *start_test(void *args)
 	 * is all of the memory.  The virtual address corresponding to the device address is given back.
 	 */
 	void *mem = NULL;
-	res = vkMapMemory(test_data->dev->device, test_data->buffer_mem, 0, test_data->buffer_size * sizeof(float), 0, &mem);
+
+	/*
+	 * If the memory was imported from the host (see tut4_prepare_test_import()), the data is already where the GPU
+	 * is going to read it from, and there is nothing to do.
+	 */
+	if (test_data->host_mem)
+		goto skip_init;
+
+	res = vkMapMemory(test_data->dev->device, test_data->buffer_mem, 0, VK_WHOLE_SIZE, 0, &mem);
 	tut1_error_set_vkresult(&retval, res);
 	if (res)
 		goto exit_failed;
 
-	for (uint32_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
+	/*
+	 * If the data is given in host memory, it needs to be copied in.  Otherwise, it's generated in place.  This is
+	 * done in parallel, see host_process_buffer().
+	 */
+	if (test_data->copy_from)
+		memcpy(mem, test_data->copy_from, test_data->buffer_size * sizeof(float));
+	else
+		host_process_buffer(test_data, mem, false);
+
+	/* If the memory is not host-coherent, the writes need to be flushed out of the host caches */
+	res = tut4_flush_memory(test_data->dev, test_data->buffer_mem, test_data->buffer_mem_size, test_data->buffer_atom_size,
+			0, test_data->buffer_size * sizeof(float));
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
 	{
-		struct tut4_per_cmd_buffer_data *per_cmd_buffer_data = &test_data->per_cmd_buffer[i];
-
-		for (size_t j = per_cmd_buffer_data->start_index; j < per_cmd_buffer_data->end_index; ++j)
-			((float *)mem)[j] = i;
+		vkUnmapMemory(test_data->dev->device, test_data->buffer_mem);
+		goto exit_failed;
 	}
 
 	/* Finally, we unmap the memory because we don't really want it right now */
 	vkUnmapMemory(test_data->dev->device, test_data->buffer_mem);
 
+skip_init:
+	test_data->host_init_ns = tut1_get_time_ns() - host_start_ns;
+
 	/* Let's create our threads then! */
 	pool_index = 0;
 	buffer_index = 0;
 	for (size_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
 	{
+		uint32_t thread_count = test_data->per_cmd_buffer_count;
+
+		size_t latency_capacity = TEST_ITERATIONS * (test_data->work_stealing?test_data->chunk_count:1);
+
+		/* Make room to record the latency of every submission this thread is going to make */
+		if (test_data->per_cmd_buffer[i].latency_capacity < latency_capacity)
+		{
+			uint64_t *latencies = realloc(test_data->per_cmd_buffer[i].latencies_ns,
+					latency_capacity * sizeof *latencies);
+			if (latencies == NULL)
+			{
+				tut1_error_set_errno(&retval, errno);
+				goto exit_failed;
+			}
+			test_data->per_cmd_buffer[i].latencies_ns = latencies;
+			test_data->per_cmd_buffer[i].latency_capacity = latency_capacity;
+		}
+
+		test_data->per_cmd_buffer[i].latency_count = 0;
+		test_data->per_cmd_buffer[i].gpu_time_ns = 0;
+		test_data->per_cmd_buffer[i].query_pool = test_data->query_pool;
+		test_data->per_cmd_buffer[i].query_index = 2 * i;
+		test_data->per_cmd_buffer[i].timestamp_valid_bits = test_data->phy_dev->queue_families[
+			test_data->dev->command_pools[pool_index].queue_family_index].timestampValidBits;
+		test_data->per_cmd_buffer[i].timestamp_period = test_data->phy_dev->properties.limits.timestampPeriod;
+		test_data->per_cmd_buffer[i].test_data = test_data;
+		test_data->per_cmd_buffer[i].chunks_done = 0;
+		test_data->per_cmd_buffer[i].chunks_stolen = 0;
+		test_data->per_cmd_buffer[i].success = 0;
 		test_data->per_cmd_buffer[i].device = test_data->dev->device;
 		test_data->per_cmd_buffer[i].queue = test_data->dev->command_pools[pool_index].queues[buffer_index];
 		test_data->per_cmd_buffer[i].cmd_buffer = test_data->dev->command_pools[pool_index].buffers[buffer_index];
 		test_data->per_cmd_buffer[i].pipeline = test_data->pipelines->pipelines[i].pipeline;
 		test_data->per_cmd_buffer[i].pipeline_layout = test_data->pipelines->pipelines[i].pipeline_layout;
-		test_data->per_cmd_buffer[i].busy_time_ns = test_data->busy_threads?32000000 / test_data->per_cmd_buffer_count:0;
+		test_data->per_cmd_buffer[i].busy_time_ns = test_data->busy_threads?32000000 / thread_count:0;
 		++buffer_index;
 		if (buffer_index >= test_data->dev->command_pools[pool_index].buffer_count)
 		{
@@ -632,7 +1554,30 @@ static void *start_test(void *args)
 			buffer_index = 0;
 		}
 
-		if ((err_no = pthread_create(&threads[i], NULL, worker_thread, &test_data->per_cmd_buffer[i])))
+		if (test_data->work_stealing)
+		{
+			/*
+			 * Each worker initially owns a contiguous range of the chunks, which is just the static split with
+			 * a finer granularity.  The total fake busy time stays the same as the static split, but it's
+			 * spread over the chunks instead of the threads.
+			 */
+			uint32_t head = (uint64_t)i * test_data->chunk_count / thread_count;
+			uint32_t tail = (uint64_t)(i + 1) * test_data->chunk_count / thread_count;
+
+			test_data->per_cmd_buffer[i].chunk_range = CHUNK_RANGE(head, tail);
+			test_data->per_cmd_buffer[i].busy_time_ns = test_data->busy_threads?32000000 / test_data->chunk_count:0;
+		}
+	}
+
+	/*
+	 * The threads are created only after all chunk ranges are set, otherwise an early thread could find the
+	 * others empty and quit before they are given their chunks.
+	 */
+	test_start_ns = tut1_get_time_ns();
+	for (size_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
+	{
+		if ((err_no = pthread_create(&threads[i], NULL, test_data->work_stealing?chunked_worker_thread:worker_thread,
+						&test_data->per_cmd_buffer[i])))
 		{
 			tut1_error_set_errno(&retval, err_no);
 			goto exit_failed;
@@ -643,6 +1588,8 @@ static void *start_test(void *args)
 	for (size_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
 		pthread_join(threads[i], NULL);
 
+	test_data->wall_time_ns = tut1_get_time_ns() - test_start_ns;
+
 	/*
 	 * I already explained that a memory barrier would be needed to make sure device writes are visible to host.
 	 * We are going to read back our buffer to make sure the execution was done correctly, so we need this barrier.
@@ -691,25 +1638,49 @@ static void *start_test(void *args)
 	/* ... up to here */
 
 	/* And make sure they did all the computations correctly, there were no races or cache problems etc */
-	res = vkMapMemory(test_data->dev->device, test_data->buffer_mem, 0, test_data->buffer_size * sizeof(float), 0, &mem);
+	host_start_ns = tut1_get_time_ns();
+	if (test_data->host_mem)
+	{
+		/* Imported memory is always host-coherent and the results are right there in the host's buffer */
+		mem = test_data->host_mem;
+		goto skip_map;
+	}
+
+	res = vkMapMemory(test_data->dev->device, test_data->buffer_mem, 0, VK_WHOLE_SIZE, 0, &mem);
 	tut1_error_set_vkresult(&retval, res);
 	if (res)
 		goto exit_failed;
 
+	/*
+	 * The barrier above made the device writes available to the host, but if the memory is not host-coherent,
+	 * there may still be stale data in the host caches which need to be invalidated.
+	 */
+	res = tut4_invalidate_memory(test_data->dev, test_data->buffer_mem, test_data->buffer_mem_size,
+			test_data->buffer_atom_size, 0, test_data->buffer_size * sizeof(float));
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+	{
+		vkUnmapMemory(test_data->dev->device, test_data->buffer_mem);
+		goto exit_failed;
+	}
+
+skip_map:
 	test_data->success = 1;
 	for (uint32_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
 	{
 		struct tut4_per_cmd_buffer_data *per_cmd_buffer_data = &test_data->per_cmd_buffer[i];
 		if (!per_cmd_buffer_data->success)
 			test_data->success = 0;
-
-		/* Test to see if the worker threads did their job correctly */
-		for (size_t j = per_cmd_buffer_data->start_index; j < per_cmd_buffer_data->end_index; ++j)
-			if (((float *)mem)[j] != TEST_ITERATIONS + i)
-				test_data->success = 0;
 	}
 
-	vkUnmapMemory(test_data->dev->device, test_data->buffer_mem);
+	/* Test to see if the worker threads did their job correctly */
+	if (!host_process_buffer(test_data, mem, true))
+		test_data->success = 0;
+
+	if (!test_data->host_mem)
+		vkUnmapMemory(test_data->dev->device, test_data->buffer_mem);
+
+	test_data->host_verify_ns = tut1_get_time_ns() - host_start_ns;
 
 exit_failed:
 	test_data->error = retval;
@@ -719,6 +1690,18 @@ exit_failed:
 int tut4_start_test(struct tut4_data *test_data, bool busy_threads)
 {
 	test_data->busy_threads = busy_threads;
+	test_data->work_stealing = false;
+	return pthread_create(&test_data->test_thread, NULL, start_test, test_data);
+}
+
+int tut4_start_chunked_test(struct tut4_data *test_data, bool busy_threads)
+{
+	/* This needs tut4_prepare_chunks() to have been called */
+	if (test_data->chunk_count == 0)
+		return EINVAL;
+
+	test_data->busy_threads = busy_threads;
+	test_data->work_stealing = true;
 	return pthread_create(&test_data->test_thread, NULL, start_test, test_data);
 }
 
@@ -726,3 +1709,26 @@ void tut4_wait_test_end(struct tut4_data *test_data)
 {
 	pthread_join(test_data->test_thread, NULL);
 }
+
+double tut4_load_imbalance(struct tut4_data *test_data)
+{
+	/*
+	 * The load imbalance is measured as how much longer the slowest thread took compared to the average.  1 means
+	 * perfect balance, while 2 for example means that there was a thread that took twice as long as the average,
+	 * and all the other threads spent a good deal of time waiting for it.
+	 */
+	uint64_t max_ns = 0, total_ns = 0;
+
+	for (uint32_t i = 0; i < test_data->per_cmd_buffer_count; ++i)
+	{
+		uint64_t t = test_data->per_cmd_buffer[i].wall_time_ns;
+		total_ns += t;
+		if (t > max_ns)
+			max_ns = t;
+	}
+
+	if (total_ns == 0)
+		return 1;
+
+	return (double)max_ns * test_data->per_cmd_buffer_count / total_ns;
+}
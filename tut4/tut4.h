@@ -23,6 +23,23 @@
 #include <pthread.h>
 #include "../tut3/tut3.h"
 
+/* How many times each part of the buffer goes through the shader */
+#define TUT4_TEST_ITERATIONS 100
+
+struct tut4_data;
+
+/*
+ * A chunk is a piece of the buffer with its own buffer view and descriptor set, so that any worker thread can pick it
+ * up and run the shader on it.  See tut4_prepare_chunks().
+ */
+struct tut4_chunk
+{
+	VkBufferView buffer_view;
+	VkDescriptorSet set;
+
+	size_t start_index, end_index;
+};
+
 struct tut4_per_cmd_buffer_data
 {
 	VkBufferView buffer_view;
@@ -41,6 +58,26 @@ struct tut4_per_cmd_buffer_data
 	VkPipelineLayout pipeline_layout;
 	uint64_t busy_time_ns;
 
+	/* GPU timestamps, a pair of queries per worker; timestamp_valid_bits is 0 if the queue doesn't support them */
+	VkQueryPool query_pool;
+	uint32_t query_index;
+	uint32_t timestamp_valid_bits;
+	float timestamp_period;
+
+	/*
+	 * work-stealing data: the range of chunks still owned by this worker, packed as (head << 32 | tail), and a
+	 * pointer back to the test so the other workers' ranges can be found.
+	 */
+	uint64_t chunk_range;
+	struct tut4_data *test_data;
+
+	/* statistics */
+	uint64_t wall_time_ns;
+	uint64_t gpu_time_ns;
+	uint32_t chunks_done, chunks_stolen;
+	uint64_t *latencies_ns;
+	size_t latency_count, latency_capacity;
+
 	int success;
 	tut1_error error;
 };
@@ -49,7 +86,13 @@ struct tut4_data
 {
 	VkBuffer buffer;
 	VkDeviceMemory buffer_mem;
+	VkDeviceSize buffer_mem_size;
+	VkDeviceSize buffer_atom_size;
+	void *host_mem;			/* if not NULL, the host memory that buffer_mem is imported from */
+	size_t host_mem_size;
+	const float *copy_from;		/* if not NULL, the buffer is initialized from here instead of generated */
 	VkDescriptorPool set_pool;
+	VkQueryPool query_pool;
 	size_t buffer_size;
 
 	pthread_mutex_t cmd_pool_mutex;
@@ -57,24 +100,87 @@ struct tut4_data
 	struct tut4_per_cmd_buffer_data *per_cmd_buffer;
 	uint32_t per_cmd_buffer_count;
 
+	VkDescriptorPool chunk_set_pool;
+	struct tut4_chunk *chunks;
+	uint32_t chunk_count;
+
 	/* test thread data */
+	struct tut1_physical_device *phy_dev;
 	struct tut2_device *dev;
 	struct tut3_pipelines *pipelines;
 	bool busy_threads;
+	bool work_stealing;
 	pthread_t test_thread;
+	uint64_t wall_time_ns;
+	uint64_t host_init_ns, host_verify_ns;
 
 	int success;
 	tut1_error error;
 };
 
 tut1_error tut4_prepare_test(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
-		struct tut4_data *test_data, size_t buffer_size, size_t thread_count);
+		struct tut4_data *test_data, size_t buffer_size, size_t thread_count, bool prefer_host_cached);
+tut1_error tut4_prepare_chunks(struct tut2_device *dev, struct tut4_data *test_data, size_t chunk_count);
 void tut4_free_test(struct tut2_device *dev, struct tut4_data *test_data);
 
+/*
+ * Like tut4_prepare_test(), but instead of allocating memory, import host_mem with VK_EXT_external_memory_host.  The
+ * host memory must be aligned to tut4_get_import_alignment() and must outlive the test.  The buffer covers as many
+ * floats as fit in the whole aligned blocks of host_mem.  The data is not generated by the test; fill it in with tut4_fill_host_buffer() after preparing.
+ * If the device doesn't support importing this memory, an error is returned and tut4_prepare_test() can be used
+ * instead.
+ */
+tut1_error tut4_prepare_test_import(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_data *test_data, void *host_mem, size_t host_mem_size, size_t thread_count);
+void tut4_fill_host_buffer(struct tut4_data *test_data, float *mem);
+/* minImportedHostPointerAlignment if it can be queried, or the page size otherwise */
+size_t tut4_get_import_alignment(struct tut1_physical_device *phy_dev);
+
+/* The tut3.comp shader on the CPU: to[i] = from[i] + value, vectorized where possible.  to and from may be the same */
+void tut4_add_floats(float *to, const float *from, size_t count, float value);
+
+/*
+ * Reset and begin a one-time command buffer, and later end it, submit it to the queue and wait for it to finish.  These
+ * are for the kernels that are run once, one after the other, such as those in tut4_gemm.c and tut4_indirect.c.
+ */
+tut1_error tut4_begin_commands(VkCommandBuffer cmd_buffer);
+tut1_error tut4_submit_and_wait(struct tut2_device *dev, VkCommandBuffer cmd_buffer, VkQueue queue, VkFence fence);
+
+/*
+ * Find the first memory type with the given properties.  Allocations generally go through tut4_allocate_memory()
+ * instead; this is for when a specific memory type is needed, such as for importing host memory.
+ */
 uint32_t tut4_find_suitable_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
 		VkMemoryRequirements *mem_req, VkMemoryPropertyFlags properties);
 
+/*
+ * Allocate memory for an object, trying the memory types ranked for `memory_usage` (that also have the `required`
+ * properties) in order, and moving on to the next type if a heap is out of memory.  The chosen type is returned in
+ * mem_index.
+ */
+tut1_error tut4_allocate_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		VkMemoryRequirements *mem_req, enum tut1_memory_usage memory_usage, VkMemoryPropertyFlags required,
+		VkDeviceMemory *mem, uint32_t *mem_index);
+
+/* Create a buffer and bind it to newly allocated memory suitable for `memory_usage` */
+tut1_error tut4_create_buffer(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkDeviceSize size,
+		VkBufferUsageFlags usage, enum tut1_memory_usage memory_usage,
+		VkBuffer *buffer, VkDeviceMemory *buffer_mem, VkDeviceSize *mem_size, VkDeviceSize *atom_size);
+
+/*
+ * Make host writes visible to the device, or device writes visible to the host, for memory that is not host-coherent.
+ * The memory must be mapped whole.  The range is expanded to multiples of atom_size, which should be the
+ * nonCoherentAtomSize of the device.  If atom_size is 0, the memory is taken as host-coherent and nothing is done.
+ */
+VkResult tut4_flush_memory(struct tut2_device *dev, VkDeviceMemory mem, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, VkDeviceSize size);
+VkResult tut4_invalidate_memory(struct tut2_device *dev, VkDeviceMemory mem, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, VkDeviceSize size);
+
 int tut4_start_test(struct tut4_data *test_data, bool busy_threads);
+int tut4_start_chunked_test(struct tut4_data *test_data, bool busy_threads);
 void tut4_wait_test_end(struct tut4_data *test_data);
 
+double tut4_load_imbalance(struct tut4_data *test_data);
+
 #endif
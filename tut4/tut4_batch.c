@@ -0,0 +1,873 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "tut4_batch.h"
+
+/*
+ * tut11 applies its post-processing effect to what it renders, in a fragment shader, as long as the window is open.
+ * The same effect can just as well be applied to images that come from files, without a window, in a compute shader.
+ * That makes for a typical batch job: read an image, decode it, upload it, run the shader, read it back, encode it
+ * and write it, for every image in a directory.
+ *
+ * Like in tut4_stream.c, done one step at a time, every part of the system is idle most of the time.  Here there
+ * are also two CPU-heavy steps, decoding and encoding, that can run in parallel with each other and with the GPU.  So
+ * the work is split between three threads connected by a ring of slots:
+ *
+ * - The decoder thread reads images into the staging buffer of the next free slot,
+ * - The submitting thread (the one calling tut4_batch_run()) records and submits the GPU work of decoded slots, each
+ *   slot on a different queue where possible, and
+ * - The encoder thread waits for the GPU to finish with submitted slots, writes the results out and frees the slots.
+ *
+ * Every thread goes through the slots in the same order, and images go through the slots in order too, so each
+ * thread only needs to wait for the slot it's interested in to reach the state it expects.  A single mutex and
+ * condition variable are enough for that; the work itself is done outside the lock.
+ *
+ * The images are binary PPM files, a format simple enough to decode in a few lines, so as not to need an image
+ * library.  The decoding and encoding is then mostly converting between RGB and the RGBA the shader works on.
+ */
+
+struct push_constants
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixel_size;
+	float hue_levels;
+	float saturation_levels;
+	float intensity_levels;
+};
+
+static tut1_error prepare_slot(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_batch *batch,
+		struct tut4_batch_slot *slot)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize image_size = batch->max_pixels * 4;
+
+	/* See tut4_prepare_stream() for the choice of memory */
+	retval = tut4_create_buffer(phy_dev, dev, 2 * image_size,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			TUT1_MEMORY_READBACK,
+			&slot->staging, &slot->staging_mem, &slot->staging_mem_size, &slot->staging_atom_size);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, slot->staging_mem, 0, VK_WHOLE_SIZE, 0, (void **)&slot->staging_map);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		retval = tut4_create_buffer(phy_dev, dev, image_size,
+				VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				TUT1_MEMORY_DEVICE_LOCAL, &slot->buffers[i], &slot->buffer_mems[i], NULL, NULL);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		/*
+		 * The shader sees the pixels as vec4s, with the format of the view taking care of converting between
+		 * 8-bit unsigned normalized values and floats, just like it would for an image.
+		 */
+		VkBufferViewCreateInfo buffer_view_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+			.buffer = slot->buffers[i],
+			.format = VK_FORMAT_R8G8B8A8_UNORM,
+			.offset = 0,
+			.range = image_size,
+		};
+
+		res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &slot->buffer_views[i]);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+	VkDescriptorSetAllocateInfo set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = batch->set_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &batch->set_layout,
+	};
+
+	res = vkAllocateDescriptorSets(dev->device, &set_info, &slot->set);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkWriteDescriptorSet set_writes[2];
+	for (uint32_t i = 0; i < 2; ++i)
+		set_writes[i] = (VkWriteDescriptorSet){
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = slot->set,
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &slot->buffer_views[i],
+		};
+
+	vkUpdateDescriptorSets(dev->device, 2, set_writes, 0, NULL);
+
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+
+	res = vkCreateFence(dev->device, &fence_info, NULL, &slot->fence);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_batch(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_batch *batch,
+		const char *shader_dir, size_t max_pixels, uint32_t slot_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	char path[1024];
+	uint32_t cmd_buffer_count = 0;
+	uint32_t pool_index = 0, buffer_index = 0;
+	int err_no;
+
+	*batch = (struct tut4_batch){
+		.max_pixels = max_pixels,
+	};
+
+	if ((err_no = pthread_mutex_init(&batch->mutex, NULL)))
+	{
+		tut1_error_set_errno(&retval, err_no);
+		goto exit_failed;
+	}
+	if ((err_no = pthread_cond_init(&batch->cond, NULL)))
+	{
+		pthread_mutex_destroy(&batch->mutex);
+		tut1_error_set_errno(&retval, err_no);
+		goto exit_failed;
+	}
+	batch->sync_ready = true;
+
+	/* Each slot needs its own command buffer, and a whole image must fit in a texel buffer */
+	for (uint32_t i = 0; i < dev->command_pool_count; ++i)
+		cmd_buffer_count += dev->command_pools[i].buffer_count;
+	if (slot_count > cmd_buffer_count)
+		slot_count = cmd_buffer_count;
+	if (slot_count == 0 || max_pixels == 0 || max_pixels > phy_dev->properties.limits.maxTexelBufferElements)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	snprintf(path, sizeof path, "%s/tut4_postproc.comp.spv", shader_dir);
+	retval = tut3_load_shader(dev, path, &batch->shader);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* Two storage texel buffers, the input and output images, and the effect parameters as push constants */
+	VkDescriptorSetLayoutBinding set_layout_bindings[2];
+	for (uint32_t i = 0; i < 2; ++i)
+		set_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		};
+
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 2,
+		.pBindings = set_layout_bindings,
+	};
+
+	res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &batch->set_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct push_constants),
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &batch->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &batch->pipeline_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = batch->shader,
+			.pName = "main",
+		},
+		.layout = batch->pipeline_layout,
+	};
+
+	res = vkCreateComputePipelines(dev->device, NULL, 1, &pipeline_info, NULL, &batch->pipeline);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = 2 * slot_count,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = slot_count,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &batch->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	batch->slots = calloc(slot_count, sizeof *batch->slots);
+	if (batch->slots == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	batch->slot_count = slot_count;
+
+	for (uint32_t i = 0; i < slot_count; ++i)
+	{
+		struct tut4_batch_slot *slot = &batch->slots[i];
+
+		retval = prepare_slot(phy_dev, dev, batch, slot);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		/* Spread the slots over the queues, exactly like in tut4_prepare_stream() */
+		do
+		{
+			if (buffer_index < dev->command_pools[pool_index].buffer_count)
+			{
+				slot->cmd_buffer = dev->command_pools[pool_index].buffers[buffer_index];
+				slot->queue = dev->command_pools[pool_index].queues[buffer_index];
+			}
+			if (++pool_index >= dev->command_pool_count)
+			{
+				pool_index = 0;
+				++buffer_index;
+			}
+		} while (slot->cmd_buffer == NULL);
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_batch(struct tut2_device *dev, struct tut4_batch *batch)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	for (uint32_t i = 0; i < batch->slot_count; ++i)
+	{
+		struct tut4_batch_slot *slot = &batch->slots[i];
+
+		if (slot->staging_map)
+			vkUnmapMemory(dev->device, slot->staging_mem);
+
+		vkDestroyFence(dev->device, slot->fence, NULL);
+		for (uint32_t j = 0; j < 2; ++j)
+		{
+			vkDestroyBufferView(dev->device, slot->buffer_views[j], NULL);
+			vkDestroyBuffer(dev->device, slot->buffers[j], NULL);
+			vkFreeMemory(dev->device, slot->buffer_mems[j], NULL);
+		}
+		vkDestroyBuffer(dev->device, slot->staging, NULL);
+		vkFreeMemory(dev->device, slot->staging_mem, NULL);
+	}
+
+	vkDestroyDescriptorPool(dev->device, batch->set_pool, NULL);
+	vkDestroyPipeline(dev->device, batch->pipeline, NULL);
+	vkDestroyPipelineLayout(dev->device, batch->pipeline_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev->device, batch->set_layout, NULL);
+	if (batch->shader)
+		tut3_free_shader(dev, batch->shader);
+
+	free(batch->slots);
+
+	if (batch->sync_ready)
+	{
+		pthread_cond_destroy(&batch->cond);
+		pthread_mutex_destroy(&batch->mutex);
+	}
+
+	*batch = (struct tut4_batch){0};
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void free_names(char **names, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		free(names[i]);
+	free(names);
+}
+
+static tut1_error list_images(const char *dir, char ***names, size_t *count)
+{
+	/* Find the .ppm files in the directory, and sort them so they are processed in a predictable order */
+	tut1_error retval = TUT1_ERROR_NONE;
+	DIR *d;
+	struct dirent *entry;
+	size_t capacity = 0;
+
+	*names = NULL;
+	*count = 0;
+
+	d = opendir(dir);
+	if (d == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	while ((entry = readdir(d)) != NULL)
+	{
+		size_t len = strlen(entry->d_name);
+		if (len < 5 || strcmp(entry->d_name + len - 4, ".ppm") != 0)
+			continue;
+
+		if (*count >= capacity)
+		{
+			size_t new_capacity = capacity?capacity * 2:64;
+			char **new_names = realloc(*names, new_capacity * sizeof *new_names);
+			if (new_names == NULL)
+			{
+				tut1_error_set_errno(&retval, errno);
+				goto exit_failed_close;
+			}
+			*names = new_names;
+			capacity = new_capacity;
+		}
+
+		(*names)[*count] = strdup(entry->d_name);
+		if ((*names)[*count] == NULL)
+		{
+			tut1_error_set_errno(&retval, errno);
+			goto exit_failed_close;
+		}
+		++*count;
+	}
+
+	qsort(*names, *count, sizeof **names, compare_names);
+
+exit_failed_close:
+	closedir(d);
+	if (!tut1_error_is_success(&retval))
+	{
+		free_names(*names, *count);
+		*names = NULL;
+		*count = 0;
+	}
+exit_failed:
+	return retval;
+}
+
+static bool read_ppm_number(FILE *fin, uint32_t *number)
+{
+	/* The header is made of numbers separated by whitespace, where a # starts a comment until the end of line */
+	int c = getc(fin);
+
+	while (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#')
+	{
+		if (c == '#')
+			while (c != '\n' && c != EOF)
+				c = getc(fin);
+		c = getc(fin);
+	}
+
+	if (c < '0' || c > '9')
+		return false;
+
+	*number = 0;
+	while (c >= '0' && c <= '9')
+	{
+		if (*number > 100000000)
+			return false;
+		*number = *number * 10 + c - '0';
+		c = getc(fin);
+	}
+
+	/* The single whitespace character after the number is consumed, which is what must follow the last one */
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool decode_ppm(const char *path, uint8_t *rgba, size_t max_pixels, uint32_t *width, uint32_t *height)
+{
+	bool success = false;
+	uint32_t max_value;
+	uint8_t *row = NULL;
+	FILE *fin;
+
+	fin = fopen(path, "rb");
+	if (fin == NULL)
+		goto exit_failed;
+
+	if (getc(fin) != 'P' || getc(fin) != '6'
+		|| !read_ppm_number(fin, width) || !read_ppm_number(fin, height) || !read_ppm_number(fin, &max_value))
+		goto exit_failed_close;
+
+	/* Only 8-bit images are supported */
+	if (*width == 0 || *height == 0 || max_value != 255 || (size_t)*width * *height > max_pixels)
+		goto exit_failed_close;
+
+	row = malloc(*width * 3);
+	if (row == NULL)
+		goto exit_failed_close;
+
+	for (uint32_t y = 0; y < *height; ++y)
+	{
+		uint8_t *to = rgba + (size_t)y * *width * 4;
+
+		if (fread(row, 3, *width, fin) != *width)
+			goto exit_failed_close;
+
+		for (uint32_t x = 0; x < *width; ++x)
+		{
+			to[x * 4 + 0] = row[x * 3 + 0];
+			to[x * 4 + 1] = row[x * 3 + 1];
+			to[x * 4 + 2] = row[x * 3 + 2];
+			to[x * 4 + 3] = 255;
+		}
+	}
+
+	success = true;
+
+exit_failed_close:
+	free(row);
+	fclose(fin);
+exit_failed:
+	return success;
+}
+
+static bool encode_ppm(const char *path, const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+	bool success = false;
+	uint8_t *row = NULL;
+	FILE *fout;
+
+	fout = fopen(path, "wb");
+	if (fout == NULL)
+		goto exit_failed;
+
+	row = malloc(width * 3);
+	if (row == NULL)
+		goto exit_failed_close;
+
+	if (fprintf(fout, "P6\n%u %u\n255\n", width, height) < 0)
+		goto exit_failed_close;
+
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const uint8_t *from = rgba + (size_t)y * width * 4;
+
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			row[x * 3 + 0] = from[x * 4 + 0];
+			row[x * 3 + 1] = from[x * 4 + 1];
+			row[x * 3 + 2] = from[x * 4 + 2];
+		}
+
+		if (fwrite(row, 3, width, fout) != width)
+			goto exit_failed_close;
+	}
+
+	success = true;
+
+exit_failed_close:
+	free(row);
+	if (fclose(fout) != 0)
+		success = false;
+exit_failed:
+	return success;
+}
+
+struct batch_work
+{
+	struct tut2_device *dev;
+	struct tut4_batch *batch;
+	const struct tut4_batch_effect *effect;
+	const char *input_dir;
+	const char *output_dir;
+	char **names;
+	size_t count;
+
+	tut1_error decoder_error;
+	tut1_error encoder_error;
+};
+
+static bool wait_slot(struct tut4_batch *batch, struct tut4_batch_slot *slot, enum tut4_batch_slot_state state)
+{
+	/* Wait for the slot to reach a state, unless another thread has given up */
+	bool aborted;
+
+	pthread_mutex_lock(&batch->mutex);
+	while (slot->state != state && !batch->abort)
+		pthread_cond_wait(&batch->cond, &batch->mutex);
+	aborted = batch->abort;
+	pthread_mutex_unlock(&batch->mutex);
+
+	return !aborted;
+}
+
+static void set_slot_state(struct tut4_batch *batch, struct tut4_batch_slot *slot, enum tut4_batch_slot_state state)
+{
+	pthread_mutex_lock(&batch->mutex);
+	slot->state = state;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+static void abort_batch(struct tut4_batch *batch)
+{
+	pthread_mutex_lock(&batch->mutex);
+	batch->abort = true;
+	pthread_cond_broadcast(&batch->cond);
+	pthread_mutex_unlock(&batch->mutex);
+}
+
+static void *decoder_thread(void *args)
+{
+	struct batch_work *work = args;
+	struct tut4_batch *batch = work->batch;
+	char path[1024];
+	VkResult res;
+
+	for (size_t i = 0; i < work->count; ++i)
+	{
+		struct tut4_batch_slot *slot = &batch->slots[i % batch->slot_count];
+
+		if (!wait_slot(batch, slot, TUT4_BATCH_SLOT_FREE))
+			break;
+
+		/* The slot is free, so nobody else touches it until it's marked as decoded */
+		snprintf(path, sizeof path, "%s/%s", work->input_dir, work->names[i]);
+
+		uint64_t start_ns = tut1_get_time_ns();
+		slot->image = i;
+		slot->valid = decode_ppm(path, slot->staging_map, batch->max_pixels, &slot->width, &slot->height);
+		batch->decode_ns += tut1_get_time_ns() - start_ns;
+
+		if (slot->valid)
+		{
+			res = tut4_flush_memory(work->dev, slot->staging_mem, slot->staging_mem_size, slot->staging_atom_size, 0,
+					(VkDeviceSize)slot->width * slot->height * 4);
+			tut1_error_set_vkresult(&work->decoder_error, res);
+			if (res)
+			{
+				abort_batch(batch);
+				break;
+			}
+		}
+
+		set_slot_state(batch, slot, TUT4_BATCH_SLOT_DECODED);
+	}
+
+	return NULL;
+}
+
+static void *encoder_thread(void *args)
+{
+	struct batch_work *work = args;
+	struct tut4_batch *batch = work->batch;
+	char path[1024];
+	VkResult res;
+
+	for (size_t i = 0; i < work->count; ++i)
+	{
+		struct tut4_batch_slot *slot = &batch->slots[i % batch->slot_count];
+
+		if (!wait_slot(batch, slot, TUT4_BATCH_SLOT_SUBMITTED))
+			break;
+
+		if (!slot->valid)
+		{
+			printf("Skipped %s: not an 8-bit binary PPM, or larger than %zu pixels\n", work->names[i], batch->max_pixels);
+			++batch->failed;
+			set_slot_state(batch, slot, TUT4_BATCH_SLOT_FREE);
+			continue;
+		}
+
+		uint64_t wait_start_ns = tut1_get_time_ns();
+		do
+		{
+			res = vkWaitForFences(work->dev->device, 1, &slot->fence, true, 1000000000);
+		} while (res == VK_TIMEOUT);
+		batch->gpu_wait_ns += tut1_get_time_ns() - wait_start_ns;
+
+		if (res == VK_SUCCESS)
+			res = tut4_invalidate_memory(work->dev, slot->staging_mem, slot->staging_mem_size, slot->staging_atom_size,
+					batch->max_pixels * 4, (VkDeviceSize)slot->width * slot->height * 4);
+		tut1_error_set_vkresult(&work->encoder_error, res);
+		if (res)
+		{
+			abort_batch(batch);
+			break;
+		}
+
+		snprintf(path, sizeof path, "%s/%s", work->output_dir, work->names[i]);
+
+		uint64_t start_ns = tut1_get_time_ns();
+		if (encode_ppm(path, slot->staging_map + batch->max_pixels * 4, slot->width, slot->height))
+		{
+			batch->bytes += (uint64_t)slot->width * slot->height * 3;
+			++batch->images;
+		}
+		else
+		{
+			printf("Could not write %s\n", path);
+			++batch->failed;
+		}
+		batch->encode_ns += tut1_get_time_ns() - start_ns;
+
+		set_slot_state(batch, slot, TUT4_BATCH_SLOT_FREE);
+	}
+
+	return NULL;
+}
+
+static tut1_error submit_slot(struct tut2_device *dev, struct tut4_batch *batch, const struct tut4_batch_effect *effect,
+		struct tut4_batch_slot *slot)
+{
+	/*
+	 * Exactly like submit_chunk() in tut4_stream.c: copy in, run the shader, copy out, with barriers in between.
+	 * The input image is at the beginning of the staging buffer, and the output image is max_pixels pixels after.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize image_size = (VkDeviceSize)slot->width * slot->height * 4;
+	uint32_t tile_size = 8 * effect->pixel_size;
+	struct push_constants constants = {
+		.width = slot->width,
+		.height = slot->height,
+		.pixel_size = effect->pixel_size,
+		.hue_levels = effect->hue_levels,
+		.saturation_levels = effect->saturation_levels,
+		.intensity_levels = effect->intensity_levels,
+	};
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkBufferCopy in_region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = image_size,
+	};
+	VkBufferCopy out_region = {
+		.srcOffset = 0,
+		.dstOffset = batch->max_pixels * 4,
+		.size = image_size,
+	};
+	VkBufferMemoryBarrier to_shader = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->buffers[0],
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	VkBufferMemoryBarrier to_transfer = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->buffers[1],
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	VkBufferMemoryBarrier to_host = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->staging,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+
+	vkResetCommandBuffer(slot->cmd_buffer, 0);
+	res = vkBeginCommandBuffer(slot->cmd_buffer, &begin_info);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	vkCmdCopyBuffer(slot->cmd_buffer, slot->staging, slot->buffers[0], 1, &in_region);
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, NULL, 1, &to_shader, 0, NULL);
+
+	/* Each workgroup handles a tile of 8x8 big pixels */
+	vkCmdBindPipeline(slot->cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, batch->pipeline);
+	vkCmdBindDescriptorSets(slot->cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, batch->pipeline_layout, 0, 1, &slot->set,
+			0, NULL);
+	vkCmdPushConstants(slot->cmd_buffer, batch->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof constants,
+			&constants);
+	vkCmdDispatch(slot->cmd_buffer, (slot->width + tile_size - 1) / tile_size, (slot->height + tile_size - 1) / tile_size, 1);
+
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, NULL, 1, &to_transfer, 0, NULL);
+	vkCmdCopyBuffer(slot->cmd_buffer, slot->buffers[1], slot->staging, 1, &out_region);
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+			0, NULL, 1, &to_host, 0, NULL);
+
+	res = vkEndCommandBuffer(slot->cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &slot->cmd_buffer,
+	};
+
+	res = vkResetFences(dev->device, 1, &slot->fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkQueueSubmit(slot->queue, 1, &submit_info, slot->fence);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_batch_run(struct tut2_device *dev, struct tut4_batch *batch, const struct tut4_batch_effect *effect,
+		const char *input_dir, const char *output_dir)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	pthread_t decoder, encoder;
+	bool decoder_created = false, encoder_created = false;
+	int err_no;
+	struct batch_work work = {
+		.dev = dev,
+		.batch = batch,
+		.effect = effect,
+		.input_dir = input_dir,
+		.output_dir = output_dir,
+		.decoder_error = TUT1_ERROR_NONE,
+		.encoder_error = TUT1_ERROR_NONE,
+	};
+
+	batch->images = 0;
+	batch->failed = 0;
+	batch->bytes = 0;
+	batch->wall_time_ns = 0;
+	batch->decode_ns = 0;
+	batch->encode_ns = 0;
+	batch->gpu_wait_ns = 0;
+	batch->abort = false;
+	for (uint32_t i = 0; i < batch->slot_count; ++i)
+		batch->slots[i].state = TUT4_BATCH_SLOT_FREE;
+
+	if (effect->pixel_size == 0)
+	{
+		tut1_error_set_errno(&retval, EINVAL);
+		goto exit_failed;
+	}
+
+	retval = list_images(input_dir, &work.names, &work.count);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	uint64_t start_ns = tut1_get_time_ns();
+
+	if ((err_no = pthread_create(&decoder, NULL, decoder_thread, &work)))
+	{
+		tut1_error_set_errno(&retval, err_no);
+		goto exit_failed_join;
+	}
+	decoder_created = true;
+
+	if ((err_no = pthread_create(&encoder, NULL, encoder_thread, &work)))
+	{
+		tut1_error_set_errno(&retval, err_no);
+		goto exit_failed_join;
+	}
+	encoder_created = true;
+
+	/* This thread is the one submitting to the GPU */
+	for (size_t i = 0; i < work.count; ++i)
+	{
+		struct tut4_batch_slot *slot = &batch->slots[i % batch->slot_count];
+
+		if (!wait_slot(batch, slot, TUT4_BATCH_SLOT_DECODED))
+			break;
+
+		if (slot->valid)
+		{
+			retval = submit_slot(dev, batch, effect, slot);
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed_join;
+		}
+
+		set_slot_state(batch, slot, TUT4_BATCH_SLOT_SUBMITTED);
+	}
+
+exit_failed_join:
+	if (!tut1_error_is_success(&retval))
+		abort_batch(batch);
+	if (decoder_created)
+		pthread_join(decoder, NULL);
+	if (encoder_created)
+		pthread_join(encoder, NULL);
+
+	batch->wall_time_ns = tut1_get_time_ns() - start_ns;
+
+	if (tut1_error_is_success(&retval))
+		retval = work.decoder_error;
+	if (tut1_error_is_success(&retval))
+		retval = work.encoder_error;
+
+	/* On failure, make sure the GPU is not still using the slots before they are reused */
+	if (!tut1_error_is_success(&retval))
+		vkDeviceWaitIdle(dev->device);
+
+	free_names(work.names, work.count);
+exit_failed:
+	return retval;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TUT4_BATCH_H
+#define TUT4_BATCH_H
+
+#include "tut4.h"
+
+/* The parameters of the effect, as in tut11_postproc.frag */
+struct tut4_batch_effect
+{
+	uint32_t pixel_size;
+	float hue_levels;
+	float saturation_levels;
+	float intensity_levels;
+};
+
+enum tut4_batch_slot_state
+{
+	TUT4_BATCH_SLOT_FREE = 0,	/* waiting for the decoder */
+	TUT4_BATCH_SLOT_DECODED,	/* waiting to be submitted */
+	TUT4_BATCH_SLOT_SUBMITTED,	/* on the GPU, or waiting for the encoder */
+};
+
+/*
+ * A slot of the pipeline, like a slot of tut4_stream.  The staging buffer holds the input image followed by the
+ * output image, and the device buffers hold the same two.  The images are 8-bit RGBA.
+ */
+struct tut4_batch_slot
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	VkDeviceSize staging_mem_size;
+	VkDeviceSize staging_atom_size;
+	uint8_t *staging_map;
+
+	VkBuffer buffers[2];
+	VkDeviceMemory buffer_mems[2];
+	VkBufferView buffer_views[2];
+	VkDescriptorSet set;
+
+	VkCommandBuffer cmd_buffer;
+	VkQueue queue;
+	VkFence fence;
+
+	/* which image is in this slot, and where it is in the pipeline; protected by the batch's mutex */
+	enum tut4_batch_slot_state state;
+	size_t image;
+	bool valid;		/* whether the image could be decoded */
+	uint32_t width, height;
+};
+
+struct tut4_batch
+{
+	VkShaderModule shader;
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipeline;
+	VkDescriptorPool set_pool;
+
+	struct tut4_batch_slot *slots;
+	uint32_t slot_count;
+	size_t max_pixels;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool sync_ready;	/* whether mutex and cond are initialized */
+	bool abort;
+
+	/* statistics of the last tut4_batch_run() */
+	uint32_t images;		/* how many images were processed and written out */
+	uint32_t failed;
+	uint64_t bytes;
+	uint64_t wall_time_ns;
+	uint64_t decode_ns;		/* how long the decoder thread was busy decoding */
+	uint64_t encode_ns;		/* how long the encoder thread was busy encoding */
+	uint64_t gpu_wait_ns;		/* how long the encoder thread was blocked waiting for the GPU */
+};
+
+/* Images up to max_pixels pixels can be processed, up to slot_count of them at the same time */
+tut1_error tut4_prepare_batch(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_batch *batch,
+		const char *shader_dir, size_t max_pixels, uint32_t slot_count);
+void tut4_free_batch(struct tut2_device *dev, struct tut4_batch *batch);
+
+/*
+ * Apply the effect to every binary PPM (P6) image in input_dir, and write the results with the same names in
+ * output_dir.  Images that can't be read or are too large are skipped, and counted in `failed`.
+ */
+tut1_error tut4_batch_run(struct tut2_device *dev, struct tut4_batch *batch, const struct tut4_batch_effect *effect,
+		const char *input_dir, const char *output_dir);
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_gemm.h"
+
+/*
+ * The tut3.comp shader does one addition per 8 bytes it moves, so it can only ever go as fast as memory does.  A
+ * matrix multiplication of N x N matrices on the other hand does 2 * N^3 floating point operations on 3 * N^2
+ * elements, so with large enough N, it's the arithmetic that is the limit, provided the elements are reused enough
+ * times once loaded.  That's what the tiling in tut4_gemm.comp is for.
+ *
+ * How large the tiles should be depends on the GPU: larger tiles mean more reuse, but need more shared memory and
+ * registers, which means fewer workgroups can run at the same time.  So the tile sizes are specialization constants,
+ * and the benchmark tries a few.
+ */
+
+struct push_constants
+{
+	uint32_t m, n, k;
+};
+
+tut1_error tut4_prepare_gemm(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_gemm *gemm,
+		const char *shader_dir)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	char path[1024];
+	VkPhysicalDeviceLimits *limits = &phy_dev->properties.limits;
+
+	*gemm = (struct tut4_gemm){
+		.max_invocations = limits->maxComputeWorkGroupInvocations,
+		.max_size = {limits->maxComputeWorkGroupSize[0], limits->maxComputeWorkGroupSize[1]},
+		.max_group_count = {limits->maxComputeWorkGroupCount[0], limits->maxComputeWorkGroupCount[1]},
+		.max_shared_memory = limits->maxComputeSharedMemorySize,
+		.max_texel_elements = limits->maxTexelBufferElements,
+	};
+
+	snprintf(path, sizeof path, "%s/tut4_gemm.comp.spv", shader_dir);
+	retval = tut3_load_shader(dev, path, &gemm->shader);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* Three storage texel buffers for A, B and C, and the matrix dimensions as push constants */
+	VkDescriptorSetLayoutBinding set_layout_bindings[3];
+	for (uint32_t i = 0; i < 3; ++i)
+		set_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		};
+
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 3,
+		.pBindings = set_layout_bindings,
+	};
+
+	res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &gemm->set_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct push_constants),
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &gemm->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &gemm->pipeline_layout);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_gemm(struct tut2_device *dev, struct tut4_gemm *gemm)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyPipelineLayout(dev->device, gemm->pipeline_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev->device, gemm->set_layout, NULL);
+	if (gemm->shader)
+		tut3_free_shader(dev, gemm->shader);
+
+	*gemm = (struct tut4_gemm){0};
+}
+
+tut1_error tut4_gemm_make_pipeline(struct tut2_device *dev, struct tut4_gemm *gemm, const struct tut4_gemm_config *config,
+		VkPipeline *pipeline)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	uint32_t tile = config->threads * config->reg;
+
+	*pipeline = NULL;
+
+	/* The workgroup must fit in the limits of the device, and so must the shared memory for the two tiles */
+	if (config->threads == 0 || config->reg == 0 || config->tile_k == 0
+		|| config->threads * config->threads > gemm->max_invocations
+		|| config->threads > gemm->max_size[0] || config->threads > gemm->max_size[1]
+		|| 2 * tile * config->tile_k * sizeof(float) > gemm->max_shared_memory)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_FEATURE_NOT_PRESENT);
+		goto exit_failed;
+	}
+
+	int32_t spec_data[4] = {config->threads, config->threads, config->reg, config->tile_k};
+	VkSpecializationMapEntry spec_entries[4];
+	for (uint32_t i = 0; i < 4; ++i)
+		spec_entries[i] = (VkSpecializationMapEntry){
+			.constantID = i,
+			.offset = i * sizeof *spec_data,
+			.size = sizeof *spec_data,
+		};
+	VkSpecializationInfo spec_info = {
+		.mapEntryCount = 4,
+		.pMapEntries = spec_entries,
+		.dataSize = sizeof spec_data,
+		.pData = spec_data,
+	};
+
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = gemm->shader,
+			.pName = "main",
+			.pSpecializationInfo = &spec_info,
+		},
+		.layout = gemm->pipeline_layout,
+	};
+
+	res = vkCreateComputePipelines(dev->device, NULL, 1, &pipeline_info, NULL, pipeline);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_gemm_data(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_gemm *gemm,
+		struct tut4_gemm_data *data, uint32_t m, uint32_t n, uint32_t k)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	size_t sizes[3] = {(size_t)m * k, (size_t)k * n, (size_t)m * n};
+
+	*data = (struct tut4_gemm_data){
+		.m = m,
+		.n = n,
+		.k = k,
+		.timestamp_valid_bits = phy_dev->queue_families[dev->command_pools[0].queue_family_index].timestampValidBits,
+		.timestamp_period = phy_dev->properties.limits.timestampPeriod,
+	};
+
+	for (uint32_t i = 0; i < 3; ++i)
+		if (sizes[i] == 0 || sizes[i] > gemm->max_texel_elements || sizes[i] > INT32_MAX)
+		{
+			tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+			goto exit_failed;
+		}
+
+	/*
+	 * The shader reads every element of A and B many times, so unlike in tut4_prepare_test(), the matrices are
+	 * placed in device-local memory.  A host-visible staging buffer holds all three matrices back to back, and
+	 * the data is copied in and out of it.
+	 */
+	retval = tut4_create_buffer(phy_dev, dev, (sizes[0] + sizes[1] + sizes[2]) * sizeof(float),
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			TUT1_MEMORY_READBACK,
+			&data->staging, &data->staging_mem, &data->staging_mem_size, &data->staging_atom_size);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, data->staging_mem, 0, VK_WHOLE_SIZE, 0, (void **)&data->staging_map);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	data->host_a = data->staging_map;
+	data->host_b = data->host_a + sizes[0];
+	data->host_c = data->host_b + sizes[1];
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		retval = tut4_create_buffer(phy_dev, dev, sizes[i] * sizeof(float),
+				VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				TUT1_MEMORY_DEVICE_LOCAL, &data->buffers[i], &data->buffer_mems[i], NULL, NULL);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		VkBufferViewCreateInfo buffer_view_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+			.buffer = data->buffers[i],
+			.format = VK_FORMAT_R32_SFLOAT,
+			.offset = 0,
+			.range = sizes[i] * sizeof(float),
+		};
+
+		res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &data->buffer_views[i]);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = 3,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 1,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &data->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkDescriptorSetAllocateInfo set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = data->set_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &gemm->set_layout,
+	};
+
+	res = vkAllocateDescriptorSets(dev->device, &set_info, &data->set);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkWriteDescriptorSet set_writes[3];
+	for (uint32_t i = 0; i < 3; ++i)
+		set_writes[i] = (VkWriteDescriptorSet){
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = data->set,
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &data->buffer_views[i],
+		};
+
+	vkUpdateDescriptorSets(dev->device, 3, set_writes, 0, NULL);
+
+	if (data->timestamp_valid_bits)
+	{
+		VkQueryPoolCreateInfo query_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 2,
+		};
+
+		res = vkCreateQueryPool(dev->device, &query_pool_info, NULL, &data->query_pool);
+		tut1_error_set_vkresult(&retval, res);
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_gemm_data(struct tut2_device *dev, struct tut4_gemm_data *data)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyQueryPool(dev->device, data->query_pool, NULL);
+	vkDestroyDescriptorPool(dev->device, data->set_pool, NULL);
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		vkDestroyBufferView(dev->device, data->buffer_views[i], NULL);
+		vkDestroyBuffer(dev->device, data->buffers[i], NULL);
+		vkFreeMemory(dev->device, data->buffer_mems[i], NULL);
+	}
+	if (data->staging_map)
+		vkUnmapMemory(dev->device, data->staging_mem);
+	vkDestroyBuffer(dev->device, data->staging, NULL);
+	vkFreeMemory(dev->device, data->staging_mem, NULL);
+
+	*data = (struct tut4_gemm_data){0};
+}
+
+tut1_error tut4_gemm_upload(struct tut2_device *dev, struct tut4_gemm_data *data, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize a_size = (VkDeviceSize)data->m * data->k * sizeof(float);
+	VkDeviceSize b_size = (VkDeviceSize)data->k * data->n * sizeof(float);
+
+	res = tut4_flush_memory(dev, data->staging_mem, data->staging_mem_size, data->staging_atom_size, 0, a_size + b_size);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	retval = tut4_begin_commands(cmd_buffer);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkBufferCopy a_region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = a_size,
+	};
+	VkBufferCopy b_region = {
+		.srcOffset = a_size,
+		.dstOffset = 0,
+		.size = b_size,
+	};
+	vkCmdCopyBuffer(cmd_buffer, data->staging, data->buffers[0], 1, &a_region);
+	vkCmdCopyBuffer(cmd_buffer, data->staging, data->buffers[1], 1, &b_region);
+
+	/* The shader reads what was copied */
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+	};
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &barrier, 0, NULL, 0, NULL);
+
+	retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_gemm_download(struct tut2_device *dev, struct tut4_gemm_data *data, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize c_offset = (VkDeviceSize)(data->m * data->k + data->k * data->n) * sizeof(float);
+	VkDeviceSize c_size = (VkDeviceSize)data->m * data->n * sizeof(float);
+
+	retval = tut4_begin_commands(cmd_buffer);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkMemoryBarrier shader_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+	};
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			1, &shader_barrier, 0, NULL, 0, NULL);
+
+	VkBufferCopy c_region = {
+		.srcOffset = 0,
+		.dstOffset = c_offset,
+		.size = c_size,
+	};
+	vkCmdCopyBuffer(cmd_buffer, data->buffers[2], data->staging, 1, &c_region);
+
+	VkMemoryBarrier host_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	};
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+			1, &host_barrier, 0, NULL, 0, NULL);
+
+	retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	res = tut4_invalidate_memory(dev, data->staging_mem, data->staging_mem_size, data->staging_atom_size, c_offset, c_size);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_gemm_run(struct tut2_device *dev, struct tut4_gemm *gemm, struct tut4_gemm_data *data, VkPipeline pipeline,
+		const struct tut4_gemm_config *config, uint32_t repetitions, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence, uint64_t *time_ns)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t tile = config->threads * config->reg;
+	uint32_t groups_x = (data->n + tile - 1) / tile;
+	uint32_t groups_y = (data->m + tile - 1) / tile;
+	struct push_constants constants = {
+		.m = data->m,
+		.n = data->n,
+		.k = data->k,
+	};
+
+	*time_ns = 0;
+
+	if (groups_x > gemm->max_group_count[0] || groups_y > gemm->max_group_count[1])
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	retval = tut4_begin_commands(cmd_buffer);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gemm->pipeline_layout, 0, 1, &data->set, 0, NULL);
+	vkCmdPushConstants(cmd_buffer, gemm->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof constants, &constants);
+
+	/*
+	 * All repetitions are in one command buffer, so the time is not dominated by submission for small matrices.
+	 * They all write the same C, so there is a barrier between them, which is needed anyway for the writes not to
+	 * race.  The timestamps are taken around all of them, see record_dispatch() in tut4.c.
+	 */
+	if (data->query_pool)
+	{
+		vkCmdResetQueryPool(cmd_buffer, data->query_pool, 0, 2);
+		vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, data->query_pool, 0);
+	}
+
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	for (uint32_t r = 0; r < repetitions; ++r)
+	{
+		if (r > 0)
+			vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+					1, &barrier, 0, NULL, 0, NULL);
+		vkCmdDispatch(cmd_buffer, groups_x, groups_y, 1);
+	}
+
+	if (data->query_pool)
+		vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, data->query_pool, 1);
+
+	uint64_t start_ns = tut1_get_time_ns();
+	retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+	*time_ns = tut1_get_time_ns() - start_ns;
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	if (data->query_pool)
+	{
+		uint64_t timestamps[2];
+		uint64_t mask = data->timestamp_valid_bits >= 64?~(uint64_t)0:((uint64_t)1 << data->timestamp_valid_bits) - 1;
+
+		if (vkGetQueryPoolResults(dev->device, data->query_pool, 0, 2, sizeof timestamps, timestamps, sizeof *timestamps,
+					VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+			*time_ns = ((timestamps[1] - timestamps[0]) & mask) * data->timestamp_period;
+	}
+
+exit_failed:
+	return retval;
+}
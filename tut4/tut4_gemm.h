@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_GEMM_H
+#define TUT4_GEMM_H
+
+#include "tut4.h"
+
+/*
+ * How the work is divided: each workgroup is threads x threads invocations, each computing reg x reg elements of C,
+ * so a workgroup computes a (threads * reg) x (threads * reg) tile of C, going over K tile_k at a time.
+ */
+struct tut4_gemm_config
+{
+	uint32_t threads;
+	uint32_t reg;
+	uint32_t tile_k;
+};
+
+struct tut4_gemm
+{
+	VkShaderModule shader;
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+
+	/* the limits the configurations are checked against */
+	uint32_t max_invocations;
+	uint32_t max_size[2];
+	uint32_t max_group_count[2];
+	uint32_t max_shared_memory;
+	uint32_t max_texel_elements;
+};
+
+/*
+ * The matrices of C = A * B.  The host writes A and B in host_a and host_b, and tut4_gemm_upload() copies them to
+ * device-local memory.  tut4_gemm_download() brings C back to host_c.
+ */
+struct tut4_gemm_data
+{
+	uint32_t m, n, k;
+
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	VkDeviceSize staging_mem_size;
+	VkDeviceSize staging_atom_size;
+	float *staging_map;
+
+	VkBuffer buffers[3];
+	VkDeviceMemory buffer_mems[3];
+	VkBufferView buffer_views[3];
+
+	VkDescriptorPool set_pool;
+	VkDescriptorSet set;
+
+	/* GPU timestamps, if the queue family of command pool 0 supports them */
+	VkQueryPool query_pool;
+	uint32_t timestamp_valid_bits;
+	float timestamp_period;
+
+	float *host_a, *host_b, *host_c;
+};
+
+tut1_error tut4_prepare_gemm(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_gemm *gemm,
+		const char *shader_dir);
+void tut4_free_gemm(struct tut2_device *dev, struct tut4_gemm *gemm);
+
+/* Specialize the shader with a configuration.  If the device can't run it, VK_ERROR_FEATURE_NOT_PRESENT is returned */
+tut1_error tut4_gemm_make_pipeline(struct tut2_device *dev, struct tut4_gemm *gemm, const struct tut4_gemm_config *config,
+		VkPipeline *pipeline);
+
+tut1_error tut4_prepare_gemm_data(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_gemm *gemm,
+		struct tut4_gemm_data *data, uint32_t m, uint32_t n, uint32_t k);
+void tut4_free_gemm_data(struct tut2_device *dev, struct tut4_gemm_data *data);
+
+/* These use cmd_buffer and queue, which should come from command pool 0 for the timestamps to work */
+tut1_error tut4_gemm_upload(struct tut2_device *dev, struct tut4_gemm_data *data, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence);
+tut1_error tut4_gemm_download(struct tut2_device *dev, struct tut4_gemm_data *data, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence);
+/* Run the multiplication `repetitions` times, and get how long it took on the GPU (or the host, without timestamps) */
+tut1_error tut4_gemm_run(struct tut2_device *dev, struct tut4_gemm *gemm, struct tut4_gemm_data *data, VkPipeline pipeline,
+		const struct tut4_gemm_config *config, uint32_t repetitions, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence, uint64_t *time_ns);
+
+#endif
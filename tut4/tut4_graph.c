@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_graph.h"
+
+/*
+ * In tut4, every run of the shader is a command buffer of its own, and the host waits on a fence before submitting
+ * the next one.  That's fine when there is only one kernel, but real work is often a chain of kernels, each working
+ * on what the previous ones produced.  Waiting on the host between them means the GPU idles for a whole round trip
+ * (submission, fence signal, host wakeup) between every two kernels.
+ *
+ * Instead, all the kernels can be recorded in a single command buffer.  The catch is that the GPU is free to run
+ * the commands of a command buffer in parallel, or overlap them, unless told otherwise with pipeline barriers.  The
+ * simple way out is a barrier between every two dispatches, but that serializes kernels that have nothing to do
+ * with each other, and those could have kept the GPU busy together.
+ *
+ * The graph below takes the kernels with the buffers they read and write, and works out from that which kernel
+ * depends on which:
+ *
+ * - Read after write: a kernel reading a buffer needs to wait for the last kernel that wrote it, and the writes
+ *   need to be made visible to it.  This is a memory dependency.
+ * - Write after read: a kernel writing a buffer needs to wait for the kernels that read the previous contents, so
+ *   it doesn't overwrite them too soon.  Nothing needs to be made visible though, so this is only an execution
+ *   dependency.
+ * - Write after write: a kernel writing a buffer needs to wait for the last kernel that wrote it, so the writes
+ *   happen in order.  This is again a memory dependency.
+ *
+ * Every kernel gets a "level", which is one more than the highest level of the kernels it depends on.  Kernels of
+ * the same level don't depend on each other, so they can all be dispatched back to back without barriers.  A single
+ * barrier between two levels then takes care of all the dependencies at once, and it only needs to include the
+ * buffers that were written before and are used after.
+ */
+
+void tut4_init_graph(struct tut4_graph *graph)
+{
+	*graph = (struct tut4_graph){0};
+}
+
+void tut4_free_graph(struct tut4_graph *graph)
+{
+	free(graph->buffers);
+	free(graph->kernels);
+	*graph = (struct tut4_graph){0};
+}
+
+static tut1_error grow(void **array, uint32_t *capacity, uint32_t count, size_t element_size)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	if (count < *capacity)
+		goto exit_done;
+
+	uint32_t new_capacity = *capacity?*capacity * 2:16;
+	void *new_array = realloc(*array, new_capacity * element_size);
+	if (new_array == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_done;
+	}
+
+	*array = new_array;
+	*capacity = new_capacity;
+
+exit_done:
+	return retval;
+}
+
+tut1_error tut4_graph_add_buffer(struct tut4_graph *graph, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+		uint32_t *index)
+{
+	tut1_error retval = grow((void **)&graph->buffers, &graph->buffer_capacity, graph->buffer_count,
+			sizeof *graph->buffers);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	*index = graph->buffer_count++;
+	graph->buffers[*index] = (struct tut4_graph_buffer){
+		.buffer = buffer,
+		.offset = offset,
+		.size = size,
+		.last_write_level = -1,
+		.last_read_level = -1,
+	};
+
+exit_failed:
+	return retval;
+}
+
+static tut1_error add_kernel(struct tut4_graph *graph, struct tut4_graph_kernel *new_kernel,
+		const uint32_t *reads, uint32_t read_count, const uint32_t *writes, uint32_t write_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	int32_t level = 0;
+
+	if (read_count > TUT4_GRAPH_MAX_ACCESSES || write_count > TUT4_GRAPH_MAX_ACCESSES)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+	for (uint32_t i = 0; i < read_count; ++i)
+		if (reads[i] >= graph->buffer_count)
+		{
+			tut1_error_set_errno(&retval, EINVAL);
+			goto exit_failed;
+		}
+	for (uint32_t i = 0; i < write_count; ++i)
+		if (writes[i] >= graph->buffer_count)
+		{
+			tut1_error_set_errno(&retval, EINVAL);
+			goto exit_failed;
+		}
+
+	retval = grow((void **)&graph->kernels, &graph->kernel_capacity, graph->kernel_count, sizeof *graph->kernels);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* Find the level of this kernel from its dependencies, as explained above */
+	for (uint32_t i = 0; i < read_count; ++i)
+	{
+		struct tut4_graph_buffer *buffer = &graph->buffers[reads[i]];
+		if (buffer->last_write_level + 1 > level)
+			level = buffer->last_write_level + 1;
+	}
+	for (uint32_t i = 0; i < write_count; ++i)
+	{
+		struct tut4_graph_buffer *buffer = &graph->buffers[writes[i]];
+		if (buffer->last_write_level + 1 > level)
+			level = buffer->last_write_level + 1;
+		if (buffer->last_read_level + 1 > level)
+			level = buffer->last_read_level + 1;
+	}
+
+	/* Then remember what it did, for the kernels that come after */
+	for (uint32_t i = 0; i < read_count; ++i)
+	{
+		struct tut4_graph_buffer *buffer = &graph->buffers[reads[i]];
+		if (level > buffer->last_read_level)
+			buffer->last_read_level = level;
+	}
+	for (uint32_t i = 0; i < write_count; ++i)
+	{
+		struct tut4_graph_buffer *buffer = &graph->buffers[writes[i]];
+		buffer->last_write_level = level;
+		buffer->last_read_level = -1;
+	}
+
+	struct tut4_graph_kernel *kernel = &graph->kernels[graph->kernel_count++];
+	*kernel = *new_kernel;
+	kernel->read_count = read_count;
+	kernel->write_count = write_count;
+	kernel->level = level;
+	memcpy(kernel->reads, reads, read_count * sizeof *reads);
+	memcpy(kernel->writes, writes, write_count * sizeof *writes);
+
+	if (level + 1 > graph->level_count)
+		graph->level_count = level + 1;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_graph_add_kernel(struct tut4_graph *graph, struct tut3_pipeline *pipeline, VkDescriptorSet set,
+		uint32_t group_count, const uint32_t *reads, uint32_t read_count, const uint32_t *writes, uint32_t write_count)
+{
+	struct tut4_graph_kernel kernel = {
+		.pipeline = pipeline->pipeline,
+		.pipeline_layout = pipeline->pipeline_layout,
+		.set = set,
+		.group_count = group_count,
+	};
+
+	return add_kernel(graph, &kernel, reads, read_count, writes, write_count);
+}
+
+tut1_error tut4_graph_add_indirect_kernel(struct tut4_graph *graph, struct tut3_pipeline *pipeline, VkDescriptorSet set,
+		uint32_t indirect_buffer, VkDeviceSize indirect_offset, const uint32_t *reads, uint32_t read_count,
+		const uint32_t *writes, uint32_t write_count)
+{
+	/*
+	 * The GPU reads the dispatch command before the kernel runs, so as far as dependencies go, the indirect buffer
+	 * is read by the kernel like any other.  It's added to the reads here, unless it's already there.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t all_reads[TUT4_GRAPH_MAX_ACCESSES + 1];
+	bool found = false;
+
+	if (read_count > TUT4_GRAPH_MAX_ACCESSES)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	memcpy(all_reads, reads, read_count * sizeof *reads);
+	for (uint32_t i = 0; i < read_count; ++i)
+		if (reads[i] == indirect_buffer)
+			found = true;
+	if (!found)
+		all_reads[read_count++] = indirect_buffer;
+
+	struct tut4_graph_kernel kernel = {
+		.pipeline = pipeline->pipeline,
+		.pipeline_layout = pipeline->pipeline_layout,
+		.set = set,
+		.indirect = true,
+		.indirect_buffer = indirect_buffer,
+		.indirect_offset = indirect_offset,
+	};
+
+	retval = add_kernel(graph, &kernel, all_reads, read_count, writes, write_count);
+
+exit_failed:
+	return retval;
+}
+
+static bool is_indirect_at_level(struct tut4_graph *graph, int32_t level, uint32_t index)
+{
+	for (uint32_t k = 0; k < graph->kernel_count; ++k)
+		if (graph->kernels[k].level == level && graph->kernels[k].indirect && graph->kernels[k].indirect_buffer == index)
+			return true;
+	return false;
+}
+
+static void record_level_barrier(struct tut4_graph *graph, VkCommandBuffer cmd_buffer, int32_t level)
+{
+	/*
+	 * Every kernel of this level depends on something in the previous levels, so a barrier is needed.  The buffer
+	 * memory barriers are only for the buffers that this level uses and that have writes not yet made visible.
+	 * Writes to other buffers are left pending; a later barrier will take care of them if and when they are used,
+	 * since the execution dependency of a barrier covers everything recorded before it.
+	 *
+	 * If there are no such buffers, the dependencies are all write-after-read, and the barrier is only an
+	 * execution dependency.
+	 *
+	 * Indirect dispatches are special in that the dispatch command is not read by the shader, but by the GPU
+	 * before the shader even starts, in what Vulkan calls the "draw indirect" stage (even for dispatches).  If a
+	 * buffer is used that way, the writes need to be made visible to that stage and access too.
+	 */
+	uint32_t barrier_count = 0;
+	VkBufferMemoryBarrier barriers[graph->buffer_count];
+	VkPipelineStageFlags dst_stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+	for (uint32_t k = 0; k < graph->kernel_count; ++k)
+	{
+		struct tut4_graph_kernel *kernel = &graph->kernels[k];
+		if (kernel->level != level)
+			continue;
+
+		for (uint32_t a = 0; a < kernel->read_count + kernel->write_count; ++a)
+		{
+			uint32_t index = a < kernel->read_count?kernel->reads[a]:kernel->writes[a - kernel->read_count];
+			struct tut4_graph_buffer *buffer = &graph->buffers[index];
+
+			if (!buffer->pending_write)
+				continue;
+
+			VkAccessFlags dst_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			if (is_indirect_at_level(graph, level, index))
+			{
+				dst_access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+				dst_stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+			}
+
+			barriers[barrier_count++] = (VkBufferMemoryBarrier){
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = dst_access,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.buffer = buffer->buffer,
+				.offset = buffer->offset,
+				.size = buffer->size,
+			};
+			buffer->pending_write = false;
+		}
+	}
+
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stages, 0,
+			0, NULL, barrier_count, barriers, 0, NULL);
+
+	++graph->barrier_count;
+	graph->buffer_barrier_count += barrier_count;
+}
+
+void tut4_graph_record(struct tut4_graph *graph, VkCommandBuffer cmd_buffer, bool to_host)
+{
+	VkPipeline bound_pipeline = NULL;
+	bool any_writes = false;
+
+	graph->barrier_count = 0;
+	graph->buffer_barrier_count = 0;
+	for (uint32_t i = 0; i < graph->buffer_count; ++i)
+		graph->buffers[i].pending_write = false;
+
+	/*
+	 * The kernels are recorded level by level.  Within a level, they keep the order they were added in, which is
+	 * as good as any.
+	 */
+	for (int32_t level = 0; level < graph->level_count; ++level)
+	{
+		if (level > 0)
+			record_level_barrier(graph, cmd_buffer, level);
+
+		for (uint32_t k = 0; k < graph->kernel_count; ++k)
+		{
+			struct tut4_graph_kernel *kernel = &graph->kernels[k];
+			if (kernel->level != level)
+				continue;
+
+			/* Many kernels run the same pipeline, so there is no need to bind it again every time */
+			if (kernel->pipeline != bound_pipeline)
+			{
+				vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline);
+				bound_pipeline = kernel->pipeline;
+			}
+			vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel->pipeline_layout, 0, 1,
+					&kernel->set, 0, NULL);
+			if (kernel->indirect)
+			{
+				struct tut4_graph_buffer *buffer = &graph->buffers[kernel->indirect_buffer];
+				vkCmdDispatchIndirect(cmd_buffer, buffer->buffer, buffer->offset + kernel->indirect_offset);
+			}
+			else
+				vkCmdDispatch(cmd_buffer, kernel->group_count, 1, 1);
+
+			for (uint32_t i = 0; i < kernel->write_count; ++i)
+				graph->buffers[kernel->writes[i]].pending_write = true;
+			any_writes = any_writes || kernel->write_count > 0;
+		}
+	}
+
+	/*
+	 * Finally, if the host is going to read the results, the shader writes need to be made visible to it.  A global
+	 * memory barrier is simplest here, as it covers every buffer at once.
+	 */
+	if (to_host && any_writes)
+	{
+		VkMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		};
+
+		vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+				1, &barrier, 0, NULL, 0, NULL);
+		++graph->barrier_count;
+	}
+}
+
+tut1_error tut4_graph_run(struct tut2_device *dev, struct tut4_graph *graph, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	vkResetCommandBuffer(cmd_buffer, 0);
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	tut4_graph_record(graph, cmd_buffer, true);
+
+	res = vkEndCommandBuffer(cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* One submission and one wait for the whole graph, however many kernels it has */
+	res = vkResetFences(dev->device, 1, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	res = vkQueueSubmit(queue, 1, &submit_info, fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	do
+	{
+		res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+	} while (res == VK_TIMEOUT);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_GRAPH_H
+#define TUT4_GRAPH_H
+
+#include "tut4.h"
+
+/* The most buffers a single kernel can read, and separately write */
+#define TUT4_GRAPH_MAX_ACCESSES 4
+
+/*
+ * A buffer of the graph is a range of a VkBuffer.  Different ranges of the same VkBuffer are independent buffers as
+ * far as the graph is concerned, so they must not overlap.
+ */
+struct tut4_graph_buffer
+{
+	VkBuffer buffer;
+	VkDeviceSize offset, size;
+
+	/* dependency tracking while kernels are added; levels are -1 if there are none */
+	int32_t last_write_level;
+	int32_t last_read_level;	/* of the reads since the last write */
+
+	/* while recording, whether there are shader writes that are not yet made visible */
+	bool pending_write;
+};
+
+struct tut4_graph_kernel
+{
+	VkPipeline pipeline;
+	VkPipelineLayout pipeline_layout;
+	VkDescriptorSet set;
+	uint32_t group_count;
+
+	/* if indirect, the group count is instead read by the GPU from a VkDispatchIndirectCommand in a graph buffer */
+	bool indirect;
+	uint32_t indirect_buffer;
+	VkDeviceSize indirect_offset;
+
+	uint32_t reads[TUT4_GRAPH_MAX_ACCESSES];
+	uint32_t read_count;
+	uint32_t writes[TUT4_GRAPH_MAX_ACCESSES];
+	uint32_t write_count;
+
+	/* the kernel runs after every kernel with a lower level, and together with the ones with the same level */
+	int32_t level;
+};
+
+struct tut4_graph
+{
+	struct tut4_graph_buffer *buffers;
+	uint32_t buffer_count, buffer_capacity;
+
+	struct tut4_graph_kernel *kernels;
+	uint32_t kernel_count, kernel_capacity;
+
+	int32_t level_count;
+
+	/* statistics of the last tut4_graph_record() */
+	uint32_t barrier_count;
+	uint32_t buffer_barrier_count;
+};
+
+void tut4_init_graph(struct tut4_graph *graph);
+void tut4_free_graph(struct tut4_graph *graph);
+
+tut1_error tut4_graph_add_buffer(struct tut4_graph *graph, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+		uint32_t *index);
+
+/*
+ * Add a kernel that runs `pipeline` with `set` bound to set 0 over group_count workgroups (in X), and which reads and
+ * writes the given buffers (indices returned by tut4_graph_add_buffer()).  A buffer that is both read and written
+ * should be in both lists.  Kernels that touch the same buffers run in the order they are added.
+ */
+tut1_error tut4_graph_add_kernel(struct tut4_graph *graph, struct tut3_pipeline *pipeline, VkDescriptorSet set,
+		uint32_t group_count, const uint32_t *reads, uint32_t read_count, const uint32_t *writes, uint32_t write_count);
+
+/*
+ * Like tut4_graph_add_kernel(), except the group count is taken from the VkDispatchIndirectCommand at
+ * indirect_offset in the indirect_buffer (also an index returned by tut4_graph_add_buffer()) when the kernel runs.
+ * That command is usually written by an earlier kernel of the graph; the indirect buffer is treated as a read of
+ * this kernel, so it doesn't need to be in `reads`.  The VkBuffer must have been created with
+ * VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT.
+ */
+tut1_error tut4_graph_add_indirect_kernel(struct tut4_graph *graph, struct tut3_pipeline *pipeline, VkDescriptorSet set,
+		uint32_t indirect_buffer, VkDeviceSize indirect_offset, const uint32_t *reads, uint32_t read_count,
+		const uint32_t *writes, uint32_t write_count);
+
+/*
+ * Record the whole graph in cmd_buffer, which must be in the recording state.  If to_host is set, the results are
+ * also made visible to the host once the command buffer has finished executing.
+ */
+void tut4_graph_record(struct tut4_graph *graph, VkCommandBuffer cmd_buffer, bool to_host);
+
+/* Record the graph, submit it and wait for it to finish */
+tut1_error tut4_graph_run(struct tut2_device *dev, struct tut4_graph *graph, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_hetero.h"
+
+/*
+ * The jobs are split in multiples of this many elements.  The GPU needs multiples of 64, and this also keeps the CPU
+ * threads' parts on separate cache lines.
+ */
+#define HETERO_GRANULARITY 64
+
+tut1_error tut4_prepare_hetero(struct tut4_hetero *hetero, struct tut2_device *devs, struct tut4_stream *streams,
+		uint32_t dev_count, uint32_t cpu_threads)
+{
+	/*
+	 * The tut3.comp shader is so simple that the CPU can do the same job with SIMD instructions, at a speed that is
+	 * not necessarily much worse than the GPU, especially once the data has to travel over the bus to get to the GPU
+	 * and back.  With a software implementation such as lavapipe, the "GPU" is the CPU anyway.  So instead of
+	 * leaving the CPU idle while the GPU works, or the other way around, we can split every job between them.
+	 *
+	 * The question is how to split.  An equal split finishes only as fast as the slowest worker.  Ideally, every
+	 * worker finishes at the same time, which means each should get a share of the job proportional to how fast it
+	 * is.  How fast each one is can't be known in advance though; it depends on the hardware, the size of the job,
+	 * what else is running on the machine, and so on.  So we measure it: tut4_hetero_calibrate() gives the same
+	 * job to every worker alone, and then every tut4_hetero_run() observes how long each worker took for its share,
+	 * and adjusts the shares for the next job.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	*hetero = (struct tut4_hetero){
+		.smoothing = 0.5,
+	};
+
+	hetero->workers = malloc((dev_count + 1) * sizeof *hetero->workers);
+	if (hetero->workers == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	hetero->worker_count = dev_count + 1;
+
+	hetero->workers[0] = (struct tut4_hetero_worker){
+		.cpu_threads = cpu_threads?cpu_threads:1,
+	};
+	for (uint32_t i = 0; i < dev_count; ++i)
+		hetero->workers[i + 1] = (struct tut4_hetero_worker){
+			.dev = &devs[i],
+			.stream = &streams[i],
+		};
+
+	/* Until measured, assume everyone is equally fast */
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+	{
+		hetero->workers[i].throughput = 1;
+		hetero->workers[i].share = 1.0 / hetero->worker_count;
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_hetero(struct tut4_hetero *hetero)
+{
+	free(hetero->workers);
+	*hetero = (struct tut4_hetero){0};
+}
+
+struct cpu_work
+{
+	const float *from;
+	float *to;
+	size_t count;
+};
+
+static void *cpu_thread(void *args)
+{
+	struct cpu_work *work = args;
+	tut4_add_floats(work->to, work->from, work->count, 1);
+	return NULL;
+}
+
+static void cpu_process(struct tut4_hetero_worker *worker)
+{
+	/* The CPU worker further divides its part between its own threads, just like host_process_buffer() in tut4.c */
+	uint32_t thread_count = worker->cpu_threads;
+	pthread_t threads[thread_count];
+	bool created[thread_count];
+	struct cpu_work work[thread_count];
+	size_t slice = worker->count / thread_count;
+
+	slice -= slice % HETERO_GRANULARITY;
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		size_t start = i * slice;
+		size_t end = i == thread_count - 1?worker->count:(i + 1) * slice;
+
+		work[i] = (struct cpu_work){
+			.from = worker->from + start,
+			.to = worker->to + start,
+			.count = end - start,
+		};
+
+		created[i] = pthread_create(&threads[i], NULL, cpu_thread, &work[i]) == 0;
+		if (!created[i])
+			cpu_thread(&work[i]);
+	}
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		if (created[i])
+			pthread_join(threads[i], NULL);
+}
+
+static void *worker_thread(void *args)
+{
+	struct tut4_hetero_worker *worker = args;
+	uint64_t start_ns = tut1_get_time_ns();
+
+	worker->error = TUT1_ERROR_NONE;
+
+	if (worker->count > 0 && worker->stream)
+		worker->error = tut4_stream_buffer(worker->dev, worker->stream, worker->from, worker->to, worker->count);
+	else if (worker->count > 0)
+		cpu_process(worker);
+
+	worker->time_ns = tut1_get_time_ns() - start_ns;
+	return NULL;
+}
+
+static tut1_error run_workers(struct tut4_hetero *hetero)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t count = hetero->worker_count;
+	bool created[count];
+
+	/* Each worker gets a thread, even the CPU, so they all run at the same time */
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		created[i] = pthread_create(&hetero->workers[i].thread, NULL, worker_thread, &hetero->workers[i]) == 0;
+		if (!created[i])
+			worker_thread(&hetero->workers[i]);
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (created[i])
+			pthread_join(hetero->workers[i].thread, NULL);
+		if (!tut1_error_is_success(&hetero->workers[i].error))
+			retval = hetero->workers[i].error;
+	}
+
+	return retval;
+}
+
+static void update_throughput(struct tut4_hetero *hetero, struct tut4_hetero_worker *worker, bool replace)
+{
+	/*
+	 * A worker that was given nothing tells us nothing new.  Otherwise, the observed throughput is blended into
+	 * the estimate, so that one hiccup doesn't throw the split off completely, but real changes (say another
+	 * application starts using the GPU) are followed within a few jobs.
+	 */
+	if (worker->count == 0 || worker->time_ns == 0)
+		return;
+
+	double observed = (double)worker->count / worker->time_ns;
+	if (replace)
+		worker->throughput = observed;
+	else
+		worker->throughput = hetero->smoothing * observed + (1 - hetero->smoothing) * worker->throughput;
+}
+
+static void update_shares(struct tut4_hetero *hetero)
+{
+	double total = 0;
+
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+		total += hetero->workers[i].throughput;
+
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+		hetero->workers[i].share = total > 0?hetero->workers[i].throughput / total:1.0 / hetero->worker_count;
+}
+
+tut1_error tut4_hetero_calibrate(struct tut4_hetero *hetero, const float *from, float *to, size_t count)
+{
+	/*
+	 * Give the whole sample to each worker in turn, so each is measured on its own without the others competing
+	 * for the memory bus (or in the case of lavapipe, the CPU).  Do it twice and only keep the second, so the first
+	 * time things like page faults and shader compilation in the driver are not measured.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	count -= count % HETERO_GRANULARITY;
+
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+	{
+		struct tut4_hetero_worker *worker = &hetero->workers[i];
+
+		worker->from = from;
+		worker->to = to;
+		worker->count = count;
+
+		for (uint32_t r = 0; r < 2; ++r)
+		{
+			worker_thread(worker);
+			retval = worker->error;
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+		}
+
+		update_throughput(hetero, worker, true);
+	}
+
+	update_shares(hetero);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_hetero_run(struct tut4_hetero *hetero, const float *from, float *to, size_t count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	size_t start = 0;
+	uint64_t max_ns = 0, total_ns = 0;
+	uint32_t busy = 0;
+
+	/*
+	 * Split the job according to the shares.  Every part is rounded down to the granularity, and whatever is left
+	 * over from rounding goes to the last worker.  The parts are disjoint ranges of the same buffer, so merging the
+	 * results is nothing more than waiting for everyone to finish.
+	 */
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+	{
+		struct tut4_hetero_worker *worker = &hetero->workers[i];
+		size_t part = i == hetero->worker_count - 1?count - start:(size_t)(worker->share * count);
+
+		/*
+		 * Nobody is left out completely though, or a worker that once looked slow would never be measured again
+		 * and could never win back its share.
+		 */
+		if (i != hetero->worker_count - 1)
+		{
+			part -= part % HETERO_GRANULARITY;
+			if (part < HETERO_GRANULARITY)
+				part = HETERO_GRANULARITY;
+		}
+		if (part > count - start)
+			part = count - start;
+
+		worker->from = from + start;
+		worker->to = to + start;
+		worker->count = part;
+		start += part;
+	}
+
+	uint64_t start_ns = tut1_get_time_ns();
+	retval = run_workers(hetero);
+	hetero->wall_time_ns = tut1_get_time_ns() - start_ns;
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* See how well the split worked, same as tut4_load_imbalance() */
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+	{
+		struct tut4_hetero_worker *worker = &hetero->workers[i];
+
+		if (worker->count == 0)
+			continue;
+
+		total_ns += worker->time_ns;
+		if (worker->time_ns > max_ns)
+			max_ns = worker->time_ns;
+		++busy;
+	}
+	hetero->imbalance = total_ns?(double)max_ns * busy / total_ns:1;
+
+	/* Learn from this job for the next one */
+	for (uint32_t i = 0; i < hetero->worker_count; ++i)
+		update_throughput(hetero, &hetero->workers[i], false);
+	update_shares(hetero);
+
+exit_failed:
+	return retval;
+}
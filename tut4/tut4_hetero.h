@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_HETERO_H
+#define TUT4_HETERO_H
+
+#include "tut4_stream.h"
+
+/*
+ * A worker of the heterogeneous executor is either a Vulkan device (with a stream to push its part of the job
+ * through), or the CPU (with `stream` being NULL).
+ */
+struct tut4_hetero_worker
+{
+	struct tut2_device *dev;
+	struct tut4_stream *stream;
+
+	double throughput;		/* observed elements per nanosecond, smoothed over the jobs */
+	double share;			/* the fraction of the next job given to this worker */
+
+	/* the part of the current job, and how long it took */
+	const float *from;
+	float *to;
+	size_t count;
+	uint64_t time_ns;
+
+	uint32_t cpu_threads;
+	pthread_t thread;
+	tut1_error error;
+};
+
+struct tut4_hetero
+{
+	struct tut4_hetero_worker *workers;
+	uint32_t worker_count;
+
+	/* how much weight the last job has in the throughput estimate, between 0 (never change) and 1 (forget the past) */
+	double smoothing;
+
+	/* statistics of the last job */
+	uint64_t wall_time_ns;
+	double imbalance;
+};
+
+/* The CPU is worker 0, and device i (streaming through streams[i]) is worker i + 1 */
+tut1_error tut4_prepare_hetero(struct tut4_hetero *hetero, struct tut2_device *devs, struct tut4_stream *streams,
+		uint32_t dev_count, uint32_t cpu_threads);
+tut1_error tut4_hetero_calibrate(struct tut4_hetero *hetero, const float *from, float *to, size_t count);
+tut1_error tut4_hetero_run(struct tut4_hetero *hetero, const float *from, float *to, size_t count);
+void tut4_free_hetero(struct tut4_hetero *hetero);
+
+#endif
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_indirect.h"
+
+/*
+ * Sometimes how much work a kernel has depends on the output of a previous kernel.  Take filtering for example:
+ * one kernel picks the elements that pass a test and packs them together, and the next kernel processes only those.
+ * How many passed is only known once the first kernel is done, on the GPU.  The straightforward way is for the host
+ * to wait for the first kernel, read the count, and record and submit the next kernel with the right number of
+ * workgroups.  That's a whole round trip between the host and the GPU in the middle of the work, which is exactly what
+ * tut4_graph.c tries to avoid.
+ *
+ * vkCmdDispatchIndirect solves this by taking the group counts from a buffer when the GPU gets to execute the
+ * command, in the form of a VkDispatchIndirectCommand (which is just x, y and z).  A tiny kernel with a single
+ * invocation turns the count into that command, and the follow-up kernel is dispatched indirectly from it, all in the
+ * same command buffer.  The host only waits once at the very end.
+ *
+ * The buffer holding the command needs VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, and the barrier between the kernel
+ * writing it and the indirect dispatch needs to include the VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT stage; see
+ * record_level_barrier() in tut4_graph.c.
+ */
+
+tut1_error tut4_prepare_indirect(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut4_indirect *indirect, const char *shader_dir, float threshold)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	char path[1024];
+
+	*indirect = (struct tut4_indirect){
+		.threshold = threshold,
+	};
+
+	snprintf(path, sizeof path, "%s/tut4_compact.comp.spv", shader_dir);
+	retval = tut3_load_shader(dev, path, &indirect->compact_shader);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	snprintf(path, sizeof path, "%s/tut4_indirect_args.comp.spv", shader_dir);
+	retval = tut3_load_shader(dev, path, &indirect->args_shader);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/*
+	 * Both kernels take storage texel buffers only; the compact kernel uses three (input, output and the counter)
+	 * and the args kernel uses two (the counter and the command).  They can share the same layout, as long as each
+	 * set has what its kernel actually uses.
+	 */
+	VkDescriptorSetLayoutBinding set_layout_bindings[3];
+	for (uint32_t i = 0; i < 3; ++i)
+		set_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		};
+
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 3,
+		.pBindings = set_layout_bindings,
+	};
+
+	res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &indirect->set_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &indirect->set_layout,
+	};
+
+	res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &indirect->pipeline_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The threshold is a specialization constant of the compact kernel, and the args kernel needs to know the
+	 * workgroup size of the follow-up kernel, which is 64 for tut3.comp.
+	 */
+	uint32_t group_size = 64;
+	VkSpecializationMapEntry spec_entry = {
+		.constantID = 0,
+		.offset = 0,
+		.size = 4,
+	};
+	VkSpecializationInfo spec_infos[2] = {
+		{
+			.mapEntryCount = 1,
+			.pMapEntries = &spec_entry,
+			.dataSize = sizeof threshold,
+			.pData = &threshold,
+		},
+		{
+			.mapEntryCount = 1,
+			.pMapEntries = &spec_entry,
+			.dataSize = sizeof group_size,
+			.pData = &group_size,
+		},
+	};
+	VkComputePipelineCreateInfo pipeline_infos[2];
+	VkPipeline pipelines[2];
+
+	for (uint32_t i = 0; i < 2; ++i)
+		pipeline_infos[i] = (VkComputePipelineCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = i == 0?indirect->compact_shader:indirect->args_shader,
+				.pName = "main",
+				.pSpecializationInfo = &spec_infos[i],
+			},
+			.layout = indirect->pipeline_layout,
+		};
+
+	res = vkCreateComputePipelines(dev->device, NULL, 2, pipeline_infos, NULL, pipelines);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	indirect->compact = (struct tut3_pipeline){
+		.set_layout = indirect->set_layout,
+		.pipeline_layout = indirect->pipeline_layout,
+		.pipeline = pipelines[0],
+	};
+	indirect->args = (struct tut3_pipeline){
+		.set_layout = indirect->set_layout,
+		.pipeline_layout = indirect->pipeline_layout,
+		.pipeline = pipelines[1],
+	};
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_indirect(struct tut2_device *dev, struct tut4_indirect *indirect)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyPipeline(dev->device, indirect->compact.pipeline, NULL);
+	vkDestroyPipeline(dev->device, indirect->args.pipeline, NULL);
+	vkDestroyPipelineLayout(dev->device, indirect->pipeline_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev->device, indirect->set_layout, NULL);
+	if (indirect->compact_shader)
+		tut3_free_shader(dev, indirect->compact_shader);
+	if (indirect->args_shader)
+		tut3_free_shader(dev, indirect->args_shader);
+
+	*indirect = (struct tut4_indirect){0};
+}
+
+static tut1_error create_buffer(struct tut1_physical_device *phy_dev, struct tut2_device *dev, size_t count,
+		VkBufferUsageFlags usage, VkFormat format, struct tut4_indirect_buffer *buffer)
+{
+	/*
+	 * Everything is in host-visible memory, like in tut4_prepare_test(), since the readback version needs to read
+	 * the counter and it's the latency that's being compared, not the bandwidth.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	retval = tut4_create_buffer(phy_dev, dev, count * 4, usage | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
+			TUT1_MEMORY_READBACK, &buffer->buffer, &buffer->buffer_mem,
+			&buffer->buffer_mem_size, &buffer->buffer_atom_size);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	VkBufferViewCreateInfo buffer_view_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+		.buffer = buffer->buffer,
+		.format = format,
+		.offset = 0,
+		.range = count * 4,
+	};
+
+	res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &buffer->buffer_view);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, buffer->buffer_mem, 0, VK_WHOLE_SIZE, 0, &buffer->map);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+static void free_buffer(struct tut2_device *dev, struct tut4_indirect_buffer *buffer)
+{
+	if (buffer->map)
+		vkUnmapMemory(dev->device, buffer->buffer_mem);
+	vkDestroyBufferView(dev->device, buffer->buffer_view, NULL);
+	vkDestroyBuffer(dev->device, buffer->buffer, NULL);
+	vkFreeMemory(dev->device, buffer->buffer_mem, NULL);
+
+	*buffer = (struct tut4_indirect_buffer){0};
+}
+
+tut1_error tut4_prepare_indirect_job(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut4_indirect *indirect, struct tut3_pipeline *process, struct tut4_indirect_job *job, size_t count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	uint32_t graph_buffers[TUT4_INDIRECT_BUFFER_COUNT];
+
+	*job = (struct tut4_indirect_job){
+		.count = count,
+		.process = process,
+	};
+	tut4_init_graph(&job->filter_graph);
+	tut4_init_graph(&job->full_graph);
+
+	if (count == 0 || count % 64 != 0 || count > phy_dev->properties.limits.maxTexelBufferElements
+		|| count / 64 > phy_dev->properties.limits.maxComputeWorkGroupCount[0])
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	/* The counter is reset with vkCmdFillBuffer, and the command is read by vkCmdDispatchIndirect */
+	retval = create_buffer(phy_dev, dev, count, 0, VK_FORMAT_R32_SFLOAT, &job->buffers[TUT4_INDIRECT_INPUT]);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+	retval = create_buffer(phy_dev, dev, count, 0, VK_FORMAT_R32_SFLOAT, &job->buffers[TUT4_INDIRECT_OUTPUT]);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+	retval = create_buffer(phy_dev, dev, 1, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_FORMAT_R32_UINT,
+			&job->buffers[TUT4_INDIRECT_COUNTER]);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+	retval = create_buffer(phy_dev, dev, 3, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_FORMAT_R32_UINT,
+			&job->buffers[TUT4_INDIRECT_COMMAND]);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	job->host_input = job->buffers[TUT4_INDIRECT_INPUT].map;
+	job->host_output = job->buffers[TUT4_INDIRECT_OUTPUT].map;
+	job->host_count = job->buffers[TUT4_INDIRECT_COUNTER].map;
+
+	/* Three sets: the compact kernel's, the args kernel's and the follow-up kernel's */
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = 3 + 2 + 1,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 3,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &job->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkDescriptorSetLayout set_layouts[3] = {indirect->set_layout, indirect->set_layout, process->set_layout};
+	VkDescriptorSet sets[3];
+	VkDescriptorSetAllocateInfo set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = job->set_pool,
+		.descriptorSetCount = 3,
+		.pSetLayouts = set_layouts,
+	};
+
+	res = vkAllocateDescriptorSets(dev->device, &set_info, sets);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	job->compact_set = sets[0];
+	job->args_set = sets[1];
+	job->process_set = sets[2];
+
+	struct
+	{
+		VkDescriptorSet set;
+		uint32_t binding;
+		enum tut4_indirect_buffer_index buffer;
+	} bindings[] = {
+		{ job->compact_set, 0, TUT4_INDIRECT_INPUT },
+		{ job->compact_set, 1, TUT4_INDIRECT_OUTPUT },
+		{ job->compact_set, 2, TUT4_INDIRECT_COUNTER },
+		{ job->args_set, 0, TUT4_INDIRECT_COUNTER },
+		{ job->args_set, 1, TUT4_INDIRECT_COMMAND },
+		{ job->process_set, 0, TUT4_INDIRECT_OUTPUT },
+	};
+	const uint32_t binding_count = sizeof bindings / sizeof *bindings;
+	VkWriteDescriptorSet set_writes[sizeof bindings / sizeof *bindings];
+
+	for (uint32_t i = 0; i < binding_count; ++i)
+		set_writes[i] = (VkWriteDescriptorSet){
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = bindings[i].set,
+			.dstBinding = bindings[i].binding,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &job->buffers[bindings[i].buffer].buffer_view,
+		};
+
+	vkUpdateDescriptorSets(dev->device, binding_count, set_writes, 0, NULL);
+
+	/*
+	 * The full graph is the compact kernel, the args kernel that reads the counter and writes the command, and the
+	 * follow-up kernel dispatched indirectly from that command.  The filter graph is only the first of these; the
+	 * readback version dispatches the follow-up kernel itself.
+	 */
+	for (uint32_t g = 0; g < 2; ++g)
+	{
+		struct tut4_graph *graph = g == 0?&job->filter_graph:&job->full_graph;
+
+		for (uint32_t i = 0; i < TUT4_INDIRECT_BUFFER_COUNT; ++i)
+		{
+			retval = tut4_graph_add_buffer(graph, job->buffers[i].buffer, 0, VK_WHOLE_SIZE, &graph_buffers[i]);
+			if (!tut1_error_is_success(&retval))
+				goto exit_failed;
+		}
+
+		uint32_t compact_writes[2] = {graph_buffers[TUT4_INDIRECT_OUTPUT], graph_buffers[TUT4_INDIRECT_COUNTER]};
+		retval = tut4_graph_add_kernel(graph, &indirect->compact, job->compact_set, count / 64,
+				&graph_buffers[TUT4_INDIRECT_INPUT], 1, compact_writes, 2);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		if (g == 0)
+			continue;
+
+		retval = tut4_graph_add_kernel(graph, &indirect->args, job->args_set, 1,
+				&graph_buffers[TUT4_INDIRECT_COUNTER], 1, &graph_buffers[TUT4_INDIRECT_COMMAND], 1);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		retval = tut4_graph_add_indirect_kernel(graph, process, job->process_set, graph_buffers[TUT4_INDIRECT_COMMAND], 0,
+				&graph_buffers[TUT4_INDIRECT_OUTPUT], 1, &graph_buffers[TUT4_INDIRECT_OUTPUT], 1);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_indirect_job(struct tut2_device *dev, struct tut4_indirect_job *job)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	tut4_free_graph(&job->filter_graph);
+	tut4_free_graph(&job->full_graph);
+	vkDestroyDescriptorPool(dev->device, job->set_pool, NULL);
+	for (uint32_t i = 0; i < TUT4_INDIRECT_BUFFER_COUNT; ++i)
+		free_buffer(dev, &job->buffers[i]);
+
+	*job = (struct tut4_indirect_job){0};
+}
+
+static void record_counter_reset(struct tut4_indirect_job *job, VkCommandBuffer cmd_buffer)
+{
+	/* The counter starts at zero, and the compact kernel needs to see that */
+	VkBufferMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = job->buffers[TUT4_INDIRECT_COUNTER].buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+
+	vkCmdFillBuffer(cmd_buffer, job->buffers[TUT4_INDIRECT_COUNTER].buffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, NULL, 1, &barrier, 0, NULL);
+}
+
+static VkResult flush_input(struct tut2_device *dev, struct tut4_indirect_job *job)
+{
+	struct tut4_indirect_buffer *input = &job->buffers[TUT4_INDIRECT_INPUT];
+	return tut4_flush_memory(dev, input->buffer_mem, input->buffer_mem_size, input->buffer_atom_size, 0,
+			job->count * sizeof(float));
+}
+
+static VkResult invalidate_buffer(struct tut2_device *dev, struct tut4_indirect_job *job,
+		enum tut4_indirect_buffer_index index, size_t size)
+{
+	struct tut4_indirect_buffer *buffer = &job->buffers[index];
+	if (size == 0)
+		return VK_SUCCESS;
+	return tut4_invalidate_memory(dev, buffer->buffer_mem, buffer->buffer_mem_size, buffer->buffer_atom_size, 0, size);
+}
+
+tut1_error tut4_indirect_run(struct tut2_device *dev, struct tut4_indirect_job *job, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	res = flush_input(dev, job);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	retval = tut4_begin_commands(cmd_buffer);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	record_counter_reset(job, cmd_buffer);
+	tut4_graph_record(&job->full_graph, cmd_buffer, true);
+
+	retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	res = invalidate_buffer(dev, job, TUT4_INDIRECT_COUNTER, sizeof(uint32_t));
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = invalidate_buffer(dev, job, TUT4_INDIRECT_OUTPUT, *job->host_count * sizeof(float));
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_indirect_run_readback(struct tut2_device *dev, struct tut4_indirect_job *job, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	res = flush_input(dev, job);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* First, the filter alone */
+	retval = tut4_begin_commands(cmd_buffer);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	record_counter_reset(job, cmd_buffer);
+	tut4_graph_record(&job->filter_graph, cmd_buffer, true);
+
+	retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* Then the host reads the count, and dispatches the follow-up kernel over that many elements */
+	res = invalidate_buffer(dev, job, TUT4_INDIRECT_COUNTER, sizeof(uint32_t));
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	uint32_t group_count = (*job->host_count + 63) / 64;
+	if (group_count > 0)
+	{
+		VkMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		};
+
+		retval = tut4_begin_commands(cmd_buffer);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, job->process->pipeline);
+		vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, job->process->pipeline_layout, 0, 1,
+				&job->process_set, 0, NULL);
+		vkCmdDispatch(cmd_buffer, group_count, 1, 1);
+		vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+				1, &barrier, 0, NULL, 0, NULL);
+
+		retval = tut4_submit_and_wait(dev, cmd_buffer, queue, fence);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	res = invalidate_buffer(dev, job, TUT4_INDIRECT_OUTPUT, *job->host_count * sizeof(float));
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
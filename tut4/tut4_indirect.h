@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TUT4_INDIRECT_H
+#define TUT4_INDIRECT_H
+
+#include "tut4_graph.h"
+
+enum tut4_indirect_buffer_index
+{
+	TUT4_INDIRECT_INPUT = 0,	/* the floats to filter */
+	TUT4_INDIRECT_OUTPUT = 1,	/* the floats that passed the filter, processed by the follow-up kernel */
+	TUT4_INDIRECT_COUNTER = 2,	/* how many passed */
+	TUT4_INDIRECT_COMMAND = 3,	/* the VkDispatchIndirectCommand of the follow-up kernel */
+	TUT4_INDIRECT_BUFFER_COUNT
+};
+
+/* The shaders and pipelines that filter the input, and produce the dispatch command for the follow-up kernel */
+struct tut4_indirect
+{
+	VkShaderModule compact_shader;
+	VkShaderModule args_shader;
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+
+	/* these share set_layout and pipeline_layout, and are in the form tut4_graph_add_kernel() takes */
+	struct tut3_pipeline compact;
+	struct tut3_pipeline args;
+
+	float threshold;
+};
+
+struct tut4_indirect_buffer
+{
+	VkBuffer buffer;
+	VkDeviceMemory buffer_mem;
+	VkDeviceSize buffer_mem_size;
+	VkDeviceSize buffer_atom_size;
+	VkBufferView buffer_view;
+	void *map;
+};
+
+/*
+ * A job filters `count` floats written by the host to host_input, and runs the follow-up kernel (tut3.comp, adding
+ * 1) on the ones that pass.  After either run function, host_count of them are found in host_output.
+ */
+struct tut4_indirect_job
+{
+	size_t count;
+	struct tut4_indirect_buffer buffers[TUT4_INDIRECT_BUFFER_COUNT];
+
+	VkDescriptorPool set_pool;
+	VkDescriptorSet compact_set;
+	VkDescriptorSet args_set;
+	VkDescriptorSet process_set;
+
+	struct tut3_pipeline *process;
+
+	/* The filter alone, and the filter followed by the indirect dispatch of the follow-up kernel */
+	struct tut4_graph filter_graph;
+	struct tut4_graph full_graph;
+
+	float *host_input;
+	float *host_output;
+	uint32_t *host_count;
+};
+
+/* Load the shaders from shader_dir and create the pipelines.  Elements above threshold pass the filter */
+tut1_error tut4_prepare_indirect(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut4_indirect *indirect, const char *shader_dir, float threshold);
+void tut4_free_indirect(struct tut2_device *dev, struct tut4_indirect *indirect);
+
+/* count must be a multiple of 64.  `process` is the follow-up kernel, with a single storage texel buffer binding */
+tut1_error tut4_prepare_indirect_job(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut4_indirect *indirect, struct tut3_pipeline *process, struct tut4_indirect_job *job, size_t count);
+void tut4_free_indirect_job(struct tut2_device *dev, struct tut4_indirect_job *job);
+
+/* Filter and process in one submission, with the GPU deciding how many workgroups the follow-up kernel needs */
+tut1_error tut4_indirect_run(struct tut2_device *dev, struct tut4_indirect_job *job, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence);
+/* The same, but filter in one submission, read back the count, and then process in another submission */
+tut1_error tut4_indirect_run_readback(struct tut2_device *dev, struct tut4_indirect_job *job, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence);
+
+#endif
@@ -0,0 +1,737 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_prim.h"
+
+/*
+ * Reductions (the sum, min or max of all elements) and scans (every element replaced with the sum, min or max of
+ * all elements before it) are the bread and butter of data-parallel work.  On the GPU, a single workgroup can work
+ * on a block of elements together through shared memory, which is much faster than going through the buffer.  But
+ * workgroups can't talk to each other within a dispatch, so larger inputs take multiple passes:
+ *
+ * - Reduce: each workgroup reduces its block to a single value.  This leaves 512 times fewer values, which are
+ *   reduced again by another dispatch, and so on until one value is left.
+ * - Scan: each workgroup scans its block, and writes the total of the block separately.  The block totals are then
+ *   scanned (recursively, if there are more than a block's worth of them), and finally the scanned totals are
+ *   added to the elements of each block.
+ *
+ * Within a workgroup, the invocations are further divided in subgroups (warps or wavefronts, as the vendors call
+ * them) which run in lockstep.  With Vulkan 1.1, subgroup operations (GL_KHR_shader_subgroup_arithmetic) can
+ * reduce or scan the values of a subgroup directly, without going through shared memory and without barriers.
+ * Shared memory is then only needed to combine the results of the subgroups.  Not every device supports these
+ * operations in compute shaders though, so the shared memory shaders are kept as a fallback.
+ */
+
+static const char *shader_names[TUT4_PRIM_KERNEL_COUNT] = {
+	[TUT4_PRIM_REDUCE] = "tut4_reduce.comp.spv",
+	[TUT4_PRIM_SCAN] = "tut4_scan.comp.spv",
+	[TUT4_PRIM_SCAN_ADD] = "tut4_scan_add.comp.spv",
+};
+
+static const char *subgroup_shader_names[TUT4_PRIM_KERNEL_COUNT] = {
+	[TUT4_PRIM_REDUCE] = "tut4_reduce_subgroup.comp.spv",
+	[TUT4_PRIM_SCAN] = "tut4_scan_subgroup.comp.spv",
+	[TUT4_PRIM_SCAN_ADD] = "tut4_scan_add.comp.spv",
+};
+
+static bool has_subgroup_arithmetic(struct tut1_physical_device *phy_dev, uint32_t api_version)
+{
+	/*
+	 * Both the instance and the device need to be at least Vulkan 1.1.  The subgroup properties are then queried
+	 * by chaining VkPhysicalDeviceSubgroupProperties to vkGetPhysicalDeviceProperties2().  The function is a 1.1
+	 * one, so it's looked up at run time so these tutorials still link against a 1.0 loader.
+	 */
+	if (api_version < VK_API_VERSION_1_1 || phy_dev->properties.apiVersion < VK_API_VERSION_1_1)
+		return false;
+
+	PFN_vkGetPhysicalDeviceProperties2 get_properties2 = (PFN_vkGetPhysicalDeviceProperties2)
+		vkGetInstanceProcAddr(phy_dev->instance, "vkGetPhysicalDeviceProperties2");
+	if (get_properties2 == NULL)
+		return false;
+
+	VkPhysicalDeviceSubgroupProperties subgroup_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+	};
+	VkPhysicalDeviceProperties2 props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &subgroup_props,
+	};
+	get_properties2(phy_dev->physical_device, &props);
+
+	VkSubgroupFeatureFlags needed = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+	return (subgroup_props.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0
+		&& (subgroup_props.supportedOperations & needed) == needed;
+}
+
+tut1_error tut4_prepare_prims(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		const char *shader_dir, uint32_t api_version)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	*prims = (struct tut4_prims){
+		.max_group_count = phy_dev->properties.limits.maxComputeWorkGroupCount[0],
+		.view_alignment = phy_dev->properties.limits.minTexelBufferOffsetAlignment,
+		.subgroups = has_subgroup_arithmetic(phy_dev, api_version),
+	};
+
+	const char **names = prims->subgroups?subgroup_shader_names:shader_names;
+	for (uint32_t k = 0; k < TUT4_PRIM_KERNEL_COUNT; ++k)
+	{
+		char path[1024];
+		snprintf(path, sizeof path, "%s/%s", shader_dir, names[k]);
+
+		retval = tut3_load_shader(dev, path, &prims->shaders[k]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	/*
+	 * All kernels use the same layout: up to three storage texel buffers (the input, the output and the block
+	 * totals), and the number of elements as a push constant.  Each kernel uses only some of the bindings, and the
+	 * unused ones don't need to be written in the descriptor sets.
+	 */
+	VkDescriptorSetLayoutBinding set_layout_bindings[3];
+	for (uint32_t i = 0; i < 3; ++i)
+		set_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		};
+
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 3,
+		.pBindings = set_layout_bindings,
+	};
+
+	res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &prims->set_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(uint32_t),
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &prims->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &prims->pipeline_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The operation is a specialization constant in the shaders, so instead of branching on it at run time, each
+	 * operation gets a pipeline of its own where the compiler has already thrown away the other operations.  All
+	 * pipelines are created with a single call, which gives the driver a chance to compile them in parallel.
+	 */
+	int32_t ops[TUT4_PRIM_OP_COUNT] = {TUT4_PRIM_SUM, TUT4_PRIM_MIN, TUT4_PRIM_MAX};
+	VkSpecializationMapEntry spec_entry = {
+		.constantID = 0,
+		.offset = 0,
+		.size = sizeof *ops,
+	};
+	VkSpecializationInfo spec_infos[TUT4_PRIM_OP_COUNT];
+	VkComputePipelineCreateInfo pipeline_infos[TUT4_PRIM_KERNEL_COUNT * TUT4_PRIM_OP_COUNT];
+
+	for (uint32_t o = 0; o < TUT4_PRIM_OP_COUNT; ++o)
+		spec_infos[o] = (VkSpecializationInfo){
+			.mapEntryCount = 1,
+			.pMapEntries = &spec_entry,
+			.dataSize = sizeof *ops,
+			.pData = &ops[o],
+		};
+
+	for (uint32_t k = 0; k < TUT4_PRIM_KERNEL_COUNT; ++k)
+		for (uint32_t o = 0; o < TUT4_PRIM_OP_COUNT; ++o)
+			pipeline_infos[k * TUT4_PRIM_OP_COUNT + o] = (VkComputePipelineCreateInfo){
+				.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+				.stage = {
+					.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+					.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+					.module = prims->shaders[k],
+					.pName = "main",
+					.pSpecializationInfo = &spec_infos[o],
+				},
+				.layout = prims->pipeline_layout,
+			};
+
+	res = vkCreateComputePipelines(dev->device, NULL, TUT4_PRIM_KERNEL_COUNT * TUT4_PRIM_OP_COUNT, pipeline_infos, NULL,
+			&prims->pipelines[0][0]);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_prims(struct tut2_device *dev, struct tut4_prims *prims)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	for (uint32_t k = 0; k < TUT4_PRIM_KERNEL_COUNT; ++k)
+	{
+		for (uint32_t o = 0; o < TUT4_PRIM_OP_COUNT; ++o)
+			vkDestroyPipeline(dev->device, prims->pipelines[k][o], NULL);
+		if (prims->shaders[k])
+			tut3_free_shader(dev, prims->shaders[k]);
+	}
+	vkDestroyPipelineLayout(dev->device, prims->pipeline_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev->device, prims->set_layout, NULL);
+
+	*prims = (struct tut4_prims){0};
+}
+
+static uint32_t block_count(size_t count)
+{
+	return (count + TUT4_PRIM_BLOCK_SIZE - 1) / TUT4_PRIM_BLOCK_SIZE;
+}
+
+static uint32_t get_levels(struct tut4_prims *prims, size_t count, size_t counts[TUT4_PRIM_MAX_LEVELS + 1])
+{
+	/*
+	 * counts[k] is the number of elements at level k, and counts[k + 1] is the number of blocks (and therefore
+	 * workgroups) of that level.  The last level is the one with a single block.  Returns 0 if the input is too
+	 * large, either for a single dispatch or for the number of levels.
+	 */
+	uint32_t levels = 0;
+
+	if (count == 0)
+		return 0;
+
+	counts[0] = count;
+	do
+	{
+		if (levels >= TUT4_PRIM_MAX_LEVELS || block_count(counts[levels]) > prims->max_group_count)
+			return 0;
+		counts[levels + 1] = block_count(counts[levels]);
+		++levels;
+	} while (counts[levels] > 1);
+
+	return levels;
+}
+
+static VkDeviceSize add_region(struct tut4_prims *prims, VkDeviceSize *scratch_size, size_t count)
+{
+	/* Each region of the scratch buffer is seen through its own view, so it needs to be aligned for that */
+	VkDeviceSize alignment = prims->view_alignment?prims->view_alignment:1;
+	VkDeviceSize offset = (*scratch_size + alignment - 1) / alignment * alignment;
+
+	*scratch_size = offset + count * sizeof(float);
+	return offset;
+}
+
+static tut1_error prepare_job(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		struct tut4_prim_job *job, VkDeviceSize scratch_size, VkDeviceSize *region_offsets, size_t *region_counts,
+		uint32_t region_count)
+{
+	/* Create the scratch buffer with a view per region, and a descriptor pool for the passes */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = scratch_size,
+		.usage = VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT,
+	};
+
+	res = vkCreateBuffer(dev->device, &buffer_info, NULL, &job->scratch);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The scratch buffer is small (1/512th of the input, give or take), and the result of a reduction is read from
+	 * it by the host, so it's placed in host-visible memory.  If that memory is also device-local, even better.
+	 */
+	VkMemoryRequirements mem_req;
+	uint32_t mem_index;
+	vkGetBufferMemoryRequirements(dev->device, job->scratch, &mem_req);
+	retval = tut4_allocate_memory(phy_dev, dev, &mem_req, TUT1_MEMORY_DYNAMIC, 0, &job->scratch_mem, &mem_index);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	job->scratch_mem_size = mem_req.size;
+	job->scratch_atom_size = (phy_dev->memories.memoryTypes[mem_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0?
+		phy_dev->properties.limits.nonCoherentAtomSize:0;
+
+	res = vkBindBufferMemory(dev->device, job->scratch, job->scratch_mem, 0);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkMapMemory(dev->device, job->scratch_mem, 0, VK_WHOLE_SIZE, 0, (void **)&job->scratch_map);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	for (uint32_t i = 0; i < region_count; ++i)
+	{
+		VkBufferViewCreateInfo buffer_view_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+			.buffer = job->scratch,
+			.format = VK_FORMAT_R32_SFLOAT,
+			.offset = region_offsets[i],
+			.range = region_counts[i] * sizeof(float),
+		};
+
+		res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &job->views[i]);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		++job->view_count;
+	}
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = 3 * 2 * TUT4_PRIM_MAX_LEVELS,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 2 * TUT4_PRIM_MAX_LEVELS,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &job->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+static tut1_error add_pass(struct tut2_device *dev, struct tut4_prims *prims, struct tut4_prim_job *job,
+		enum tut4_prim_kernel kernel, size_t count, VkBufferView src, VkBufferView dst, VkBufferView totals)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	struct tut4_prim_pass *pass = &job->passes[job->pass_count];
+	VkBufferView views[3] = {src, dst, totals};
+	VkWriteDescriptorSet set_writes[3];
+	uint32_t write_count = 0;
+
+	*pass = (struct tut4_prim_pass){
+		.pipeline = prims->pipelines[kernel][job->op],
+		.count = count,
+		.group_count = block_count(count),
+	};
+
+	VkDescriptorSetAllocateInfo set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = job->set_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &prims->set_layout,
+	};
+
+	res = vkAllocateDescriptorSets(dev->device, &set_info, &pass->set);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* Only the bindings the kernel uses are written */
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		if (views[i] == NULL)
+			continue;
+
+		set_writes[write_count++] = (VkWriteDescriptorSet){
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = pass->set,
+			.dstBinding = i,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &views[i],
+		};
+	}
+
+	vkUpdateDescriptorSets(dev->device, write_count, set_writes, 0, NULL);
+	++job->pass_count;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_reduce(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		struct tut4_prim_job *job, enum tut4_prim_op op, VkBufferView input, size_t count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	size_t counts[TUT4_PRIM_MAX_LEVELS + 1];
+	VkDeviceSize offsets[TUT4_PRIM_MAX_LEVELS];
+	VkDeviceSize scratch_size = 0;
+
+	*job = (struct tut4_prim_job){
+		.kernel = TUT4_PRIM_REDUCE,
+		.op = op,
+		.count = count,
+		.pipeline_layout = prims->pipeline_layout,
+	};
+
+	uint32_t levels = get_levels(prims, count, counts);
+	if (levels == 0)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	/* Level k reduces counts[k] elements into counts[k + 1] values in region k of the scratch buffer */
+	for (uint32_t k = 0; k < levels; ++k)
+		offsets[k] = add_region(prims, &scratch_size, counts[k + 1]);
+
+	retval = prepare_job(phy_dev, dev, prims, job, scratch_size, offsets, counts + 1, levels);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	for (uint32_t k = 0; k < levels; ++k)
+	{
+		retval = add_pass(dev, prims, job, TUT4_PRIM_REDUCE, counts[k], k == 0?input:job->views[k - 1],
+				job->views[k], NULL);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	job->result_offset = offsets[levels - 1];
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prepare_scan(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		struct tut4_prim_job *job, enum tut4_prim_op op, VkBufferView input, VkBufferView output, size_t count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	size_t counts[TUT4_PRIM_MAX_LEVELS + 1];
+	VkDeviceSize offsets[2 * TUT4_PRIM_MAX_LEVELS];
+	size_t region_counts[2 * TUT4_PRIM_MAX_LEVELS];
+	VkDeviceSize scratch_size = 0;
+
+	*job = (struct tut4_prim_job){
+		.kernel = TUT4_PRIM_SCAN,
+		.op = op,
+		.count = count,
+		.pipeline_layout = prims->pipeline_layout,
+	};
+
+	uint32_t levels = get_levels(prims, count, counts);
+	if (levels == 0)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	/*
+	 * Level k scans counts[k] elements, and writes counts[k + 1] block totals to region 2k of the scratch buffer.
+	 * Level 0 scans the input into the output, and every other level scans the block totals of the previous level
+	 * into region 2k - 1.
+	 */
+	for (uint32_t k = 0; k < levels; ++k)
+	{
+		region_counts[2 * k] = counts[k + 1];
+		offsets[2 * k] = add_region(prims, &scratch_size, counts[k + 1]);
+		if (k + 1 < levels)
+		{
+			region_counts[2 * k + 1] = counts[k + 1];
+			offsets[2 * k + 1] = add_region(prims, &scratch_size, counts[k + 1]);
+		}
+	}
+
+	retval = prepare_job(phy_dev, dev, prims, job, scratch_size, offsets, region_counts, 2 * levels - 1);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	/* Scan down the levels... */
+	for (uint32_t k = 0; k < levels; ++k)
+	{
+		retval = add_pass(dev, prims, job, TUT4_PRIM_SCAN, counts[k],
+				k == 0?input:job->views[2 * k - 2],
+				k == 0?output:job->views[2 * k - 1],
+				job->views[2 * k]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	/* ...and add the scanned block totals back up the levels */
+	for (uint32_t k = levels - 1; k-- > 0;)
+	{
+		retval = add_pass(dev, prims, job, TUT4_PRIM_SCAN_ADD, counts[k], NULL,
+				k == 0?output:job->views[2 * k - 1],
+				job->views[2 * k + 1]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_prim_job(struct tut2_device *dev, struct tut4_prim_job *job)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyDescriptorPool(dev->device, job->set_pool, NULL);
+	for (uint32_t i = 0; i < job->view_count; ++i)
+		vkDestroyBufferView(dev->device, job->views[i], NULL);
+	if (job->scratch_map)
+		vkUnmapMemory(dev->device, job->scratch_mem);
+	vkDestroyBuffer(dev->device, job->scratch, NULL);
+	vkFreeMemory(dev->device, job->scratch_mem, NULL);
+
+	*job = (struct tut4_prim_job){0};
+}
+
+void tut4_prim_record(struct tut4_prim_job *job, VkCommandBuffer cmd_buffer)
+{
+	/*
+	 * Every pass reads what the previous one wrote, so there is a barrier between every two.  At the end, the
+	 * results are made visible to the host.
+	 */
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	VkMemoryBarrier host_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	};
+
+	for (uint32_t i = 0; i < job->pass_count; ++i)
+	{
+		struct tut4_prim_pass *pass = &job->passes[i];
+
+		if (i > 0)
+			vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+					1, &barrier, 0, NULL, 0, NULL);
+
+		vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline);
+		vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, job->pipeline_layout, 0, 1, &pass->set,
+				0, NULL);
+		vkCmdPushConstants(cmd_buffer, job->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof pass->count,
+				&pass->count);
+		vkCmdDispatch(cmd_buffer, pass->group_count, 1, 1);
+	}
+
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+			1, &host_barrier, 0, NULL, 0, NULL);
+}
+
+tut1_error tut4_prim_run(struct tut2_device *dev, struct tut4_prim_job *job, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	vkResetCommandBuffer(cmd_buffer, 0);
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	tut4_prim_record(job, cmd_buffer);
+
+	res = vkEndCommandBuffer(cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkResetFences(dev->device, 1, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	res = vkQueueSubmit(queue, 1, &submit_info, fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	do
+	{
+		res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+	} while (res == VK_TIMEOUT);
+	tut1_error_set_vkresult(&retval, res);
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_prim_result(struct tut2_device *dev, struct tut4_prim_job *job, float *result)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	res = tut4_invalidate_memory(dev, job->scratch_mem, job->scratch_mem_size, job->scratch_atom_size,
+			job->result_offset, sizeof *result);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	*result = job->scratch_map[job->result_offset / sizeof *result];
+
+exit_failed:
+	return retval;
+}
+
+/*
+ * The CPU versions, to compare against.  The reduction is easy to split: every thread reduces its part, and the
+ * partial results are reduced at the end.  The scan takes two rounds of threads: first every thread reduces its part,
+ * then the partial results are scanned (there are few of them), and finally every thread scans its part starting
+ * from the scanned partial result that belongs to it.
+ */
+static float cpu_identity(enum tut4_prim_op op)
+{
+	return op == TUT4_PRIM_SUM?0:op == TUT4_PRIM_MIN?__builtin_inff():-__builtin_inff();
+}
+
+static float cpu_combine(enum tut4_prim_op op, float a, float b)
+{
+	return op == TUT4_PRIM_SUM?a + b:op == TUT4_PRIM_MIN?(a < b?a:b):(a > b?a:b);
+}
+
+struct cpu_work
+{
+	const float *input;
+	float *output;
+	size_t count;
+	enum tut4_prim_op op;
+	float value;
+};
+
+static void *cpu_reduce_thread(void *args)
+{
+	struct cpu_work *work = args;
+	float value = cpu_identity(work->op);
+
+	for (size_t i = 0; i < work->count; ++i)
+		value = cpu_combine(work->op, value, work->input[i]);
+
+	work->value = value;
+	return NULL;
+}
+
+static void *cpu_scan_thread(void *args)
+{
+	struct cpu_work *work = args;
+	float value = work->value;
+
+	for (size_t i = 0; i < work->count; ++i)
+	{
+		float next = cpu_combine(work->op, value, work->input[i]);
+		work->output[i] = value;
+		value = next;
+	}
+
+	return NULL;
+}
+
+static void cpu_run_threads(void *(*func)(void *), struct cpu_work *work, uint32_t thread_count)
+{
+	pthread_t threads[thread_count];
+	bool created[thread_count];
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		created[i] = pthread_create(&threads[i], NULL, func, &work[i]) == 0;
+		if (!created[i])
+			func(&work[i]);
+	}
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		if (created[i])
+			pthread_join(threads[i], NULL);
+}
+
+static void cpu_split(struct cpu_work *work, uint32_t thread_count, const float *input, float *output, size_t count,
+		enum tut4_prim_op op)
+{
+	size_t slice = count / thread_count;
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		size_t start = i * slice;
+		size_t end = i == thread_count - 1?count:(i + 1) * slice;
+
+		work[i] = (struct cpu_work){
+			.input = input + start,
+			.output = output?output + start:NULL,
+			.count = end - start,
+			.op = op,
+		};
+	}
+}
+
+float tut4_cpu_reduce(const float *data, size_t count, enum tut4_prim_op op, uint32_t thread_count)
+{
+	if (thread_count == 0)
+		thread_count = 1;
+
+	struct cpu_work work[thread_count];
+	float value = cpu_identity(op);
+
+	cpu_split(work, thread_count, data, NULL, count, op);
+	cpu_run_threads(cpu_reduce_thread, work, thread_count);
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		value = cpu_combine(op, value, work[i].value);
+
+	return value;
+}
+
+void tut4_cpu_scan(const float *input, float *output, size_t count, enum tut4_prim_op op, uint32_t thread_count)
+{
+	if (thread_count == 0)
+		thread_count = 1;
+
+	struct cpu_work work[thread_count];
+	float value = cpu_identity(op);
+
+	cpu_split(work, thread_count, input, output, count, op);
+	cpu_run_threads(cpu_reduce_thread, work, thread_count);
+
+	/* Turn the partial results into where each thread starts from */
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		float next = cpu_combine(op, value, work[i].value);
+		work[i].value = value;
+		value = next;
+	}
+
+	cpu_run_threads(cpu_scan_thread, work, thread_count);
+}
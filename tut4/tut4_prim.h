@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_PRIM_H
+#define TUT4_PRIM_H
+
+#include "tut4.h"
+
+/* The number of elements each workgroup of the reduce and scan shaders works on */
+#define TUT4_PRIM_BLOCK_SIZE 512
+
+/* The most passes of the same kind a job needs; with 512 elements per block, 4 levels are enough for 2^36 elements */
+#define TUT4_PRIM_MAX_LEVELS 4
+
+enum tut4_prim_op
+{
+	TUT4_PRIM_SUM = 0,
+	TUT4_PRIM_MIN = 1,
+	TUT4_PRIM_MAX = 2,
+	TUT4_PRIM_OP_COUNT
+};
+
+enum tut4_prim_kernel
+{
+	TUT4_PRIM_REDUCE = 0,
+	TUT4_PRIM_SCAN = 1,
+	TUT4_PRIM_SCAN_ADD = 2,
+	TUT4_PRIM_KERNEL_COUNT
+};
+
+/* The shaders and pipelines of the library; one pipeline per kernel and operation */
+struct tut4_prims
+{
+	VkShaderModule shaders[TUT4_PRIM_KERNEL_COUNT];
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipelines[TUT4_PRIM_KERNEL_COUNT][TUT4_PRIM_OP_COUNT];
+
+	uint32_t max_group_count;
+	VkDeviceSize view_alignment;
+
+	/* Whether the reduce and scan shaders are the ones using subgroup operations */
+	bool subgroups;
+};
+
+struct tut4_prim_pass
+{
+	VkPipeline pipeline;
+	VkDescriptorSet set;
+	uint32_t count;
+	uint32_t group_count;
+};
+
+/*
+ * A reduction or a scan over a given buffer, with the scratch memory and descriptor sets for all of its passes.  Once
+ * prepared, it can be recorded and run as many times as needed, for example after the input is changed.
+ */
+struct tut4_prim_job
+{
+	enum tut4_prim_kernel kernel;
+	enum tut4_prim_op op;
+	size_t count;
+
+	VkBuffer scratch;
+	VkDeviceMemory scratch_mem;
+	VkDeviceSize scratch_mem_size;
+	VkDeviceSize scratch_atom_size;
+	float *scratch_map;
+
+	VkBufferView views[2 * TUT4_PRIM_MAX_LEVELS];
+	uint32_t view_count;
+
+	VkDescriptorPool set_pool;
+	VkPipelineLayout pipeline_layout;
+
+	struct tut4_prim_pass passes[2 * TUT4_PRIM_MAX_LEVELS];
+	uint32_t pass_count;
+
+	/* For a reduction, where in the scratch buffer the result ends up */
+	VkDeviceSize result_offset;
+};
+
+/*
+ * Load the shaders from shader_dir and create the pipelines.  api_version is the version the instance was created
+ * with (see tut1_init_version()); with 1.1 or later, the subgroup variants of the shaders are used if the device
+ * supports them.
+ */
+tut1_error tut4_prepare_prims(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		const char *shader_dir, uint32_t api_version);
+void tut4_free_prims(struct tut2_device *dev, struct tut4_prims *prims);
+
+/*
+ * Prepare a reduction of `count` floats seen through `input`, a R32_SFLOAT storage texel buffer view like the ones
+ * tut4_prepare_test() creates.  The result is read with tut4_prim_result().
+ */
+tut1_error tut4_prepare_reduce(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		struct tut4_prim_job *job, enum tut4_prim_op op, VkBufferView input, size_t count);
+/* Prepare an exclusive scan of `count` floats from `input` into `output`, both views like the above */
+tut1_error tut4_prepare_scan(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_prims *prims,
+		struct tut4_prim_job *job, enum tut4_prim_op op, VkBufferView input, VkBufferView output, size_t count);
+void tut4_free_prim_job(struct tut2_device *dev, struct tut4_prim_job *job);
+
+/*
+ * Record all passes of the job in cmd_buffer, which must be in the recording state.  The results are made visible to
+ * the host once the command buffer has finished executing.
+ */
+void tut4_prim_record(struct tut4_prim_job *job, VkCommandBuffer cmd_buffer);
+/* Record the job, submit it and wait for it to finish */
+tut1_error tut4_prim_run(struct tut2_device *dev, struct tut4_prim_job *job, VkCommandBuffer cmd_buffer, VkQueue queue,
+		VkFence fence);
+/* Get the result of a reduction after it has run */
+tut1_error tut4_prim_result(struct tut2_device *dev, struct tut4_prim_job *job, float *result);
+
+/* The same on the CPU, with the work divided between thread_count threads.  The scan may be done in place */
+float tut4_cpu_reduce(const float *data, size_t count, enum tut4_prim_op op, uint32_t thread_count);
+void tut4_cpu_scan(const float *input, float *output, size_t count, enum tut4_prim_op op, uint32_t thread_count);
+
+#endif
@@ -0,0 +1,651 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tut4_radix.h"
+
+/*
+ * A radix sort sorts the keys by one digit at a time, starting from the least significant one.  Each pass has to be
+ * stable, i.e. keys with the same digit keep their order from the previous pass, so that by the end, keys are sorted
+ * by all digits.  With 4-bit digits, each pass is three kernels:
+ *
+ * - Count: the keys are divided in blocks, one block per workgroup, and each workgroup counts how many keys of its
+ *   block have each of the 16 digits.
+ * - Scan: an exclusive scan over those counts, laid out digit by digit and then block by block, gives where the
+ *   first key of each digit of each block goes in the output.  All keys with digit 0 come first, in the order of
+ *   the blocks, then the keys with digit 1, and so on.
+ * - Scatter: each workgroup goes through its block again, 256 keys (a "chunk") at a time.  It sorts the chunk by the
+ *   digit in shared memory (which tells each key how many keys of the same digit are before it in the chunk), and
+ *   then writes every key to where the keys of its digit of this block go, after those of the previous chunks.
+ *
+ * The keys (and values) ping-pong between two buffers, and after an even number of passes, they are back where they
+ * started.  Both buffers are device-local, since every pass reads and writes all of the keys.  The host's copy is in
+ * a separate host-visible buffer, which is copied in once before the first pass and copied back once after the last.
+ *
+ * The block size is chosen so that there are not more workgroups than a dispatch can have.  Larger blocks mean fewer
+ * counts to scan, but less parallelism in the count and scatter kernels.
+ */
+
+#define CHUNK_SIZE 256
+#define MIN_BLOCK_CHUNKS 16
+
+struct push_constants
+{
+	uint32_t count;
+	uint32_t shift;
+	uint32_t block_chunks;
+	uint32_t block_count;
+};
+
+static const char *shader_names[TUT4_RADIX_KERNEL_COUNT] = {
+	[TUT4_RADIX_COUNT] = "tut4_radix_count.comp.spv",
+	[TUT4_RADIX_SCAN] = "tut4_radix_scan.comp.spv",
+	[TUT4_RADIX_SCATTER] = "tut4_radix_scatter.comp.spv",
+};
+
+tut1_error tut4_prepare_radix(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_radix *radix,
+		const char *shader_dir)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	*radix = (struct tut4_radix){
+		.max_group_count = phy_dev->properties.limits.maxComputeWorkGroupCount[0],
+		.max_texel_elements = phy_dev->properties.limits.maxTexelBufferElements,
+	};
+
+	for (uint32_t k = 0; k < TUT4_RADIX_KERNEL_COUNT; ++k)
+	{
+		char path[1024];
+		snprintf(path, sizeof path, "%s/%s", shader_dir, shader_names[k]);
+
+		retval = tut3_load_shader(dev, path, &radix->shaders[k]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	/*
+	 * Like in tut3_make_compute_pipeline(), every binding is a storage texel buffer, except there are five: the keys
+	 * in, the counts, the keys out, the values in and the values out.  The count and scan kernels use only the first
+	 * two.
+	 */
+	VkDescriptorSetLayoutBinding set_layout_bindings[5];
+	for (uint32_t i = 0; i < 5; ++i)
+		set_layout_bindings[i] = (VkDescriptorSetLayoutBinding){
+			.binding = i,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		};
+
+	VkDescriptorSetLayoutCreateInfo set_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 5,
+		.pBindings = set_layout_bindings,
+	};
+
+	res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &radix->set_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct push_constants),
+	};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &radix->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
+	};
+
+	res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &radix->pipeline_layout);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* The scatter kernel is created twice, with has_values false and true */
+	VkBool32 has_values = VK_TRUE;
+	VkSpecializationMapEntry spec_entry = {
+		.constantID = 0,
+		.offset = 0,
+		.size = sizeof has_values,
+	};
+	VkSpecializationInfo spec_info = {
+		.mapEntryCount = 1,
+		.pMapEntries = &spec_entry,
+		.dataSize = sizeof has_values,
+		.pData = &has_values,
+	};
+	VkComputePipelineCreateInfo pipeline_infos[TUT4_RADIX_KERNEL_COUNT + 1];
+	VkPipeline pipelines[TUT4_RADIX_KERNEL_COUNT + 1];
+
+	for (uint32_t k = 0; k < TUT4_RADIX_KERNEL_COUNT + 1; ++k)
+		pipeline_infos[k] = (VkComputePipelineCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.stage = {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = radix->shaders[k < TUT4_RADIX_KERNEL_COUNT?k:TUT4_RADIX_SCATTER],
+				.pName = "main",
+				.pSpecializationInfo = k < TUT4_RADIX_KERNEL_COUNT?NULL:&spec_info,
+			},
+			.layout = radix->pipeline_layout,
+		};
+
+	res = vkCreateComputePipelines(dev->device, NULL, TUT4_RADIX_KERNEL_COUNT + 1, pipeline_infos, NULL, pipelines);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	memcpy(radix->pipelines, pipelines, sizeof radix->pipelines);
+	radix->scatter_with_values = pipelines[TUT4_RADIX_KERNEL_COUNT];
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_radix(struct tut2_device *dev, struct tut4_radix *radix)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyPipeline(dev->device, radix->scatter_with_values, NULL);
+	for (uint32_t k = 0; k < TUT4_RADIX_KERNEL_COUNT; ++k)
+	{
+		vkDestroyPipeline(dev->device, radix->pipelines[k], NULL);
+		if (radix->shaders[k])
+			tut3_free_shader(dev, radix->shaders[k]);
+	}
+	vkDestroyPipelineLayout(dev->device, radix->pipeline_layout, NULL);
+	vkDestroyDescriptorSetLayout(dev->device, radix->set_layout, NULL);
+
+	*radix = (struct tut4_radix){0};
+}
+
+static tut1_error create_buffer(struct tut1_physical_device *phy_dev, struct tut2_device *dev, size_t count,
+		enum tut1_memory_usage memory_usage, struct tut4_radix_buffer *buffer)
+{
+	/* This is just like in tut4_prepare_test(), except the buffer holds uints */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = count * sizeof(uint32_t),
+		.usage = VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+			| VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	};
+
+	res = vkCreateBuffer(dev->device, &buffer_info, NULL, &buffer->buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkMemoryRequirements mem_req;
+	uint32_t mem_index;
+	vkGetBufferMemoryRequirements(dev->device, buffer->buffer, &mem_req);
+	retval = tut4_allocate_memory(phy_dev, dev, &mem_req, memory_usage, 0, &buffer->buffer_mem, &mem_index);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	buffer->buffer_mem_size = mem_req.size;
+	buffer->buffer_atom_size = (phy_dev->memories.memoryTypes[mem_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0?
+		phy_dev->properties.limits.nonCoherentAtomSize:0;
+
+	res = vkBindBufferMemory(dev->device, buffer->buffer, buffer->buffer_mem, 0);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkBufferViewCreateInfo buffer_view_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+		.buffer = buffer->buffer,
+		.format = VK_FORMAT_R32_UINT,
+		.offset = 0,
+		.range = count * sizeof(uint32_t),
+	};
+
+	res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &buffer->buffer_view);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	if (memory_usage != TUT1_MEMORY_DEVICE_LOCAL)
+	{
+		res = vkMapMemory(dev->device, buffer->buffer_mem, 0, VK_WHOLE_SIZE, 0, (void **)&buffer->map);
+		tut1_error_set_vkresult(&retval, res);
+	}
+
+exit_failed:
+	return retval;
+}
+
+static void free_buffer(struct tut2_device *dev, struct tut4_radix_buffer *buffer)
+{
+	if (buffer->map)
+		vkUnmapMemory(dev->device, buffer->buffer_mem);
+	vkDestroyBufferView(dev->device, buffer->buffer_view, NULL);
+	vkDestroyBuffer(dev->device, buffer->buffer, NULL);
+	vkFreeMemory(dev->device, buffer->buffer_mem, NULL);
+
+	*buffer = (struct tut4_radix_buffer){0};
+}
+
+tut1_error tut4_prepare_radix_sort(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_radix *radix,
+		struct tut4_radix_sort *sort, size_t count, bool has_values)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	*sort = (struct tut4_radix_sort){
+		.count = count,
+		.has_values = has_values,
+		.pipeline_layout = radix->pipeline_layout,
+		.pipelines = {
+			[TUT4_RADIX_COUNT] = radix->pipelines[TUT4_RADIX_COUNT],
+			[TUT4_RADIX_SCAN] = radix->pipelines[TUT4_RADIX_SCAN],
+			[TUT4_RADIX_SCATTER] = has_values?radix->scatter_with_values:radix->pipelines[TUT4_RADIX_SCATTER],
+		},
+	};
+
+	/* The whole array is seen through one texel buffer view, and the shaders index it with ints */
+	if (count == 0 || count > radix->max_texel_elements || count > INT32_MAX)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	size_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	sort->block_chunks = (chunks + radix->max_group_count - 1) / radix->max_group_count;
+	if (sort->block_chunks < MIN_BLOCK_CHUNKS)
+		sort->block_chunks = MIN_BLOCK_CHUNKS;
+	sort->block_count = (chunks + sort->block_chunks - 1) / sort->block_chunks;
+
+	/*
+	 * The ping-pong buffers and the counts are read and written by every pass, so they had better be device-local.
+	 * If one of them was host-visible, half the passes would go over the bus and the sort would be measuring that
+	 * instead.  The host writes the keys and values, and reads them back sorted, in staging buffers that are
+	 * host-visible (and preferably host-cached, see tut4_prepare_test()), and are touched by the GPU only once each
+	 * way.
+	 */
+	for (uint32_t i = 0; i < (has_values?2:1); ++i)
+	{
+		struct tut4_radix_buffer *buffers = i == 0?sort->keys:sort->values;
+		struct tut4_radix_buffer *staging = i == 0?&sort->staging_keys:&sort->staging_values;
+
+		retval = create_buffer(phy_dev, dev, count, TUT1_MEMORY_DEVICE_LOCAL, &buffers[0]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+		retval = create_buffer(phy_dev, dev, count, TUT1_MEMORY_DEVICE_LOCAL, &buffers[1]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+		retval = create_buffer(phy_dev, dev, count, TUT1_MEMORY_READBACK, staging);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	retval = create_buffer(phy_dev, dev, (size_t)sort->block_count * 16, TUT1_MEMORY_DEVICE_LOCAL, &sort->counts);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	sort->host_keys = sort->staging_keys.map;
+	sort->host_values = sort->staging_values.map;
+
+	/* Two descriptor sets, one for each direction of the ping-pong */
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = 2 * 5,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 2,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &sort->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkDescriptorSetLayout set_layouts[2] = {radix->set_layout, radix->set_layout};
+	VkDescriptorSetAllocateInfo set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = sort->set_pool,
+		.descriptorSetCount = 2,
+		.pSetLayouts = set_layouts,
+	};
+
+	res = vkAllocateDescriptorSets(dev->device, &set_info, sort->sets);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		/*
+		 * Without values, the scatter kernel never touches the values, but the bindings still need something
+		 * valid in them, so they get the keys.
+		 */
+		struct tut4_radix_buffer *values = has_values?sort->values:sort->keys;
+		VkBufferView views[5] = {
+			sort->keys[i].buffer_view,
+			sort->counts.buffer_view,
+			sort->keys[1 - i].buffer_view,
+			values[i].buffer_view,
+			values[1 - i].buffer_view,
+		};
+		VkWriteDescriptorSet set_writes[5];
+
+		for (uint32_t b = 0; b < 5; ++b)
+			set_writes[b] = (VkWriteDescriptorSet){
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = sort->sets[i],
+				.dstBinding = b,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+				.pTexelBufferView = &views[b],
+			};
+
+		vkUpdateDescriptorSets(dev->device, 5, set_writes, 0, NULL);
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_radix_sort(struct tut2_device *dev, struct tut4_radix_sort *sort)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	vkDestroyDescriptorPool(dev->device, sort->set_pool, NULL);
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		free_buffer(dev, &sort->keys[i]);
+		free_buffer(dev, &sort->values[i]);
+	}
+	free_buffer(dev, &sort->counts);
+	free_buffer(dev, &sort->staging_keys);
+	free_buffer(dev, &sort->staging_values);
+
+	*sort = (struct tut4_radix_sort){0};
+}
+
+void tut4_radix_sort_record(struct tut4_radix_sort *sort, VkCommandBuffer cmd_buffer)
+{
+	/* Every kernel works on what the previous one wrote, so there is a barrier after each */
+	VkMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	VkMemoryBarrier copy_in_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+	};
+	VkMemoryBarrier copy_out_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+	};
+	VkMemoryBarrier host_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	};
+	uint32_t group_counts[TUT4_RADIX_KERNEL_COUNT] = {
+		[TUT4_RADIX_COUNT] = sort->block_count,
+		[TUT4_RADIX_SCAN] = 1,
+		[TUT4_RADIX_SCATTER] = sort->block_count,
+	};
+	VkBufferCopy region = {
+		.size = sort->count * sizeof(uint32_t),
+	};
+
+	/* Bring in the host's keys and values to where the first pass reads them */
+	vkCmdCopyBuffer(cmd_buffer, sort->staging_keys.buffer, sort->keys[0].buffer, 1, &region);
+	if (sort->has_values)
+		vkCmdCopyBuffer(cmd_buffer, sort->staging_values.buffer, sort->values[0].buffer, 1, &region);
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			1, &copy_in_barrier, 0, NULL, 0, NULL);
+
+	for (uint32_t pass = 0; pass < TUT4_RADIX_PASSES; ++pass)
+	{
+		struct push_constants constants = {
+			.count = sort->count,
+			.shift = pass * TUT4_RADIX_BITS,
+			.block_chunks = sort->block_chunks,
+			.block_count = sort->block_count,
+		};
+
+		vkCmdBindDescriptorSets(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort->pipeline_layout, 0, 1,
+				&sort->sets[pass % 2], 0, NULL);
+		vkCmdPushConstants(cmd_buffer, sort->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof constants,
+				&constants);
+
+		for (uint32_t k = 0; k < TUT4_RADIX_KERNEL_COUNT; ++k)
+		{
+			vkCmdBindPipeline(cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, sort->pipelines[k]);
+			vkCmdDispatch(cmd_buffer, group_counts[k], 1, 1);
+			vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+					1, &barrier, 0, NULL, 0, NULL);
+		}
+	}
+
+	/* And send the sorted keys and values back */
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			1, &copy_out_barrier, 0, NULL, 0, NULL);
+	vkCmdCopyBuffer(cmd_buffer, sort->keys[0].buffer, sort->staging_keys.buffer, 1, &region);
+	if (sort->has_values)
+		vkCmdCopyBuffer(cmd_buffer, sort->values[0].buffer, sort->staging_values.buffer, 1, &region);
+	vkCmdPipelineBarrier(cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+			1, &host_barrier, 0, NULL, 0, NULL);
+}
+
+tut1_error tut4_radix_sort_run(struct tut2_device *dev, struct tut4_radix_sort *sort, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	for (uint32_t i = 0; i < (sort->has_values?2:1); ++i)
+	{
+		struct tut4_radix_buffer *buffer = i == 0?&sort->staging_keys:&sort->staging_values;
+		res = tut4_flush_memory(dev, buffer->buffer_mem, buffer->buffer_mem_size, buffer->buffer_atom_size, 0,
+				sort->count * sizeof(uint32_t));
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+	vkResetCommandBuffer(cmd_buffer, 0);
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	res = vkBeginCommandBuffer(cmd_buffer, &begin_info);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	tut4_radix_sort_record(sort, cmd_buffer);
+
+	res = vkEndCommandBuffer(cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkResetFences(dev->device, 1, &fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	res = vkQueueSubmit(queue, 1, &submit_info, fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	do
+	{
+		res = vkWaitForFences(dev->device, 1, &fence, true, 1000000000);
+	} while (res == VK_TIMEOUT);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	for (uint32_t i = 0; i < (sort->has_values?2:1); ++i)
+	{
+		struct tut4_radix_buffer *buffer = i == 0?&sort->staging_keys:&sort->staging_values;
+		res = tut4_invalidate_memory(dev, buffer->buffer_mem, buffer->buffer_mem_size, buffer->buffer_atom_size, 0,
+				sort->count * sizeof(uint32_t));
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+exit_failed:
+	return retval;
+}
+
+/*
+ * The CPU version, to compare against, uses the same algorithm except with 8-bit digits, since the CPU has no trouble
+ * with 256 counters.  Each thread takes a slice of the keys, like the blocks of the GPU version.  Every pass takes two
+ * rounds of threads: first every thread counts the digits of its slice, then the counts are scanned digit by digit
+ * and then thread by thread (there are few of them), and finally every thread moves its keys to where its share of
+ * each digit starts.  Since the slices are in order, the sort stays stable.
+ */
+struct cpu_sort_work
+{
+	const uint32_t *from_keys;
+	const uint32_t *from_values;
+	uint32_t *to_keys;
+	uint32_t *to_values;
+	size_t start;
+	size_t end;
+	uint32_t shift;
+	size_t offsets[256];
+};
+
+static void *cpu_count_thread(void *args)
+{
+	struct cpu_sort_work *work = args;
+
+	memset(work->offsets, 0, sizeof work->offsets);
+	for (size_t i = work->start; i < work->end; ++i)
+		++work->offsets[(work->from_keys[i] >> work->shift) & 255];
+
+	return NULL;
+}
+
+static void *cpu_scatter_thread(void *args)
+{
+	struct cpu_sort_work *work = args;
+
+	for (size_t i = work->start; i < work->end; ++i)
+	{
+		size_t to = work->offsets[(work->from_keys[i] >> work->shift) & 255]++;
+		work->to_keys[to] = work->from_keys[i];
+		if (work->to_values)
+			work->to_values[to] = work->from_values[i];
+	}
+
+	return NULL;
+}
+
+static void cpu_run_threads(void *(*func)(void *), struct cpu_sort_work *work, uint32_t thread_count)
+{
+	pthread_t threads[thread_count];
+	bool created[thread_count];
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+	{
+		created[i] = pthread_create(&threads[i], NULL, func, &work[i]) == 0;
+		if (!created[i])
+			func(&work[i]);
+	}
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		if (created[i])
+			pthread_join(threads[i], NULL);
+}
+
+void tut4_cpu_radix_sort(uint32_t *keys, uint32_t *values, uint32_t *tmp_keys, uint32_t *tmp_values, size_t count,
+		uint32_t thread_count)
+{
+	if (thread_count == 0)
+		thread_count = 1;
+
+	struct cpu_sort_work work[thread_count];
+	size_t slice = count / thread_count;
+
+	for (uint32_t i = 0; i < thread_count; ++i)
+		work[i] = (struct cpu_sort_work){
+			.start = i * slice,
+			.end = i == thread_count - 1?count:(i + 1) * slice,
+		};
+
+	/* Four passes, so the results end up back in keys and values */
+	uint32_t *from_keys = keys, *to_keys = tmp_keys;
+	uint32_t *from_values = values, *to_values = tmp_values;
+
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		for (uint32_t i = 0; i < thread_count; ++i)
+		{
+			work[i].from_keys = from_keys;
+			work[i].from_values = from_values;
+			work[i].to_keys = to_keys;
+			work[i].to_values = values?to_values:NULL;
+			work[i].shift = shift;
+		}
+
+		cpu_run_threads(cpu_count_thread, work, thread_count);
+
+		size_t sum = 0;
+		for (uint32_t d = 0; d < 256; ++d)
+			for (uint32_t i = 0; i < thread_count; ++i)
+			{
+				size_t digit_count = work[i].offsets[d];
+				work[i].offsets[d] = sum;
+				sum += digit_count;
+			}
+
+		cpu_run_threads(cpu_scatter_thread, work, thread_count);
+
+		uint32_t *t = from_keys;
+		from_keys = to_keys;
+		to_keys = t;
+		t = from_values;
+		from_values = to_values;
+		to_values = t;
+	}
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_RADIX_H
+#define TUT4_RADIX_H
+
+#include "tut4.h"
+
+/* The keys are sorted 4 bits at a time, so 8 passes sort 32-bit keys */
+#define TUT4_RADIX_BITS 4
+#define TUT4_RADIX_PASSES (32 / TUT4_RADIX_BITS)
+
+enum tut4_radix_kernel
+{
+	TUT4_RADIX_COUNT = 0,
+	TUT4_RADIX_SCAN = 1,
+	TUT4_RADIX_SCATTER = 2,
+	TUT4_RADIX_KERNEL_COUNT
+};
+
+/* The shaders and pipelines of the sort; the scatter kernel has a variant that moves values along with the keys */
+struct tut4_radix
+{
+	VkShaderModule shaders[TUT4_RADIX_KERNEL_COUNT];
+	VkDescriptorSetLayout set_layout;
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipelines[TUT4_RADIX_KERNEL_COUNT];
+	VkPipeline scatter_with_values;
+
+	uint32_t max_group_count;
+	uint32_t max_texel_elements;
+};
+
+struct tut4_radix_buffer
+{
+	VkBuffer buffer;
+	VkDeviceMemory buffer_mem;
+	VkDeviceSize buffer_mem_size;
+	VkDeviceSize buffer_atom_size;
+	VkBufferView buffer_view;
+	uint32_t *map;
+};
+
+/*
+ * A sort of `count` keys, and optionally as many values.  The keys and values are written to `host_keys` and
+ * `host_values` by the host, and after tut4_radix_sort_run() the sorted keys and values are found in the same place.
+ */
+struct tut4_radix_sort
+{
+	size_t count;
+	bool has_values;
+	uint32_t block_count;
+	uint32_t block_chunks;
+
+	/* the keys and values ping-pong between [0] and [1] every pass, ending in [0]; both are device-local */
+	struct tut4_radix_buffer keys[2];
+	struct tut4_radix_buffer values[2];
+	struct tut4_radix_buffer counts;
+
+	/* host-visible copies of the keys and values, copied to [0] before the sort and back after it */
+	struct tut4_radix_buffer staging_keys;
+	struct tut4_radix_buffer staging_values;
+
+	VkDescriptorPool set_pool;
+	VkDescriptorSet sets[2];
+
+	VkPipelineLayout pipeline_layout;
+	VkPipeline pipelines[TUT4_RADIX_KERNEL_COUNT];
+
+	/* host access to staging_keys and staging_values */
+	uint32_t *host_keys;
+	uint32_t *host_values;
+};
+
+/* Load the shaders from shader_dir and create the pipelines */
+tut1_error tut4_prepare_radix(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_radix *radix,
+		const char *shader_dir);
+void tut4_free_radix(struct tut2_device *dev, struct tut4_radix *radix);
+
+tut1_error tut4_prepare_radix_sort(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut4_radix *radix,
+		struct tut4_radix_sort *sort, size_t count, bool has_values);
+void tut4_free_radix_sort(struct tut2_device *dev, struct tut4_radix_sort *sort);
+
+/* Record all passes of the sort in cmd_buffer, which must be in the recording state */
+void tut4_radix_sort_record(struct tut4_radix_sort *sort, VkCommandBuffer cmd_buffer);
+/* Make the host's keys and values visible, sort them, and make the results visible to the host again */
+tut1_error tut4_radix_sort_run(struct tut2_device *dev, struct tut4_radix_sort *sort, VkCommandBuffer cmd_buffer,
+		VkQueue queue, VkFence fence);
+
+/*
+ * The same on the CPU, for comparison, with the work divided between thread_count threads.  tmp_keys and tmp_values
+ * (if values is not NULL) must have room for count.
+ */
+void tut4_cpu_radix_sort(uint32_t *keys, uint32_t *values, uint32_t *tmp_keys, uint32_t *tmp_values, size_t count,
+		uint32_t thread_count);
+
+#endif
@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tut4_stream.h"
+
+tut1_error tut4_prepare_stream(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_stream *stream, size_t chunk_size, uint32_t slot_count)
+{
+	/*
+	 * tut4_prepare_test() allocates one host-visible buffer for the whole data set.  That works as long as the data
+	 * fits in memory, both the host's and the device's.  When it doesn't, the data needs to be streamed through the
+	 * GPU in chunks: upload a chunk, run the shader on it, read it back, and move on to the next.
+	 *
+	 * Done naively, the GPU sits idle while the host copies data in and out, and the host sits idle while the GPU
+	 * is working.  Instead, we use a ring of "slots", each with its own staging buffer, device buffer and command
+	 * buffer.  While the GPU works on the chunk in one slot, the host fills the next slot with the next chunk and
+	 * drains the output of older slots.  With enough slots, the host copies are hidden behind the GPU work (or the
+	 * other way around, whichever is slower).
+	 *
+	 * The slots are given command buffers from different queues where possible, so the copies of one chunk can
+	 * overlap the dispatch of another on the GPU as well.  Different slots touch different buffers, so there is no
+	 * need for synchronization between the queues.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	uint32_t cmd_buffer_count = 0;
+	uint32_t pool_index = 0, buffer_index = 0;
+
+	*stream = (struct tut4_stream){
+		.pipeline = pipelines->pipelines[0].pipeline,
+		.pipeline_layout = pipelines->pipelines[0].pipeline_layout,
+	};
+
+	/* Each slot needs its own command buffer */
+	for (uint32_t i = 0; i < dev->command_pool_count; ++i)
+		cmd_buffer_count += dev->command_pools[i].buffer_count;
+	if (slot_count > cmd_buffer_count)
+		slot_count = cmd_buffer_count;
+	if (slot_count == 0)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	/*
+	 * The chunk is seen by the shader through a texel buffer view, so it can't be larger than the maximum number of
+	 * elements a texel buffer can have.  It also needs to be a multiple of 64 like before, and it can't be larger
+	 * than what a single dispatch can handle.
+	 */
+	chunk_size -= chunk_size % 64;
+	if (chunk_size > phy_dev->properties.limits.maxTexelBufferElements)
+		chunk_size = phy_dev->properties.limits.maxTexelBufferElements / 64 * 64;
+	if (chunk_size > (size_t)phy_dev->properties.limits.maxComputeWorkGroupCount[0] * 64)
+		chunk_size = (size_t)phy_dev->properties.limits.maxComputeWorkGroupCount[0] * 64;
+	if (chunk_size == 0)
+		chunk_size = 64;
+	stream->chunk_size = chunk_size;
+
+	VkDescriptorPoolSize pool_size = {
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+		.descriptorCount = slot_count,
+	};
+	VkDescriptorPoolCreateInfo set_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = slot_count,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+
+	res = vkCreateDescriptorPool(dev->device, &set_pool_info, NULL, &stream->set_pool);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	stream->slots = malloc(slot_count * sizeof *stream->slots);
+	if (stream->slots == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	memset(stream->slots, 0, slot_count * sizeof *stream->slots);
+	stream->slot_count = slot_count;
+
+	for (uint32_t i = 0; i < slot_count; ++i)
+	{
+		struct tut4_stream_slot *slot = &stream->slots[i];
+
+		/*
+		 * The staging buffer is written by the host sequentially and read back by the host, so host-cached memory
+		 * is preferred; see tut4_prepare_test() for why.  The device buffer should preferably be device-local,
+		 * as that's where the shader would run fastest, but any memory would do.
+		 */
+		retval = tut4_create_buffer(phy_dev, dev, chunk_size * sizeof(float),
+				VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				TUT1_MEMORY_READBACK,
+				&slot->staging, &slot->staging_mem, &slot->staging_mem_size, &slot->staging_atom_size);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		retval = tut4_create_buffer(phy_dev, dev, chunk_size * sizeof(float),
+				VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				TUT1_MEMORY_DEVICE_LOCAL,
+				&slot->buffer, &slot->buffer_mem, NULL, NULL);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		/* The staging buffer stays mapped for as long as the stream lives; there's no reason to unmap it */
+		res = vkMapMemory(dev->device, slot->staging_mem, 0, VK_WHOLE_SIZE, 0, &slot->staging_map);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		/* The buffer view and descriptor set are exactly as in tut4_prepare_test() */
+		VkBufferViewCreateInfo buffer_view_info = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO,
+			.buffer = slot->buffer,
+			.format = VK_FORMAT_R32_SFLOAT,
+			.offset = 0,
+			.range = chunk_size * sizeof(float),
+		};
+
+		res = vkCreateBufferView(dev->device, &buffer_view_info, NULL, &slot->buffer_view);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		VkDescriptorSetAllocateInfo set_info = {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+			.descriptorPool = stream->set_pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts = &pipelines->pipelines[0].set_layout,
+		};
+
+		res = vkAllocateDescriptorSets(dev->device, &set_info, &slot->set);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		VkWriteDescriptorSet set_write = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = slot->set,
+			.dstBinding = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+			.pTexelBufferView = &slot->buffer_view,
+		};
+
+		vkUpdateDescriptorSets(dev->device, 1, &set_write, 0, NULL);
+
+		VkFenceCreateInfo fence_info = {
+			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		};
+
+		res = vkCreateFence(dev->device, &fence_info, NULL, &slot->fence);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		/*
+		 * Take the command buffers from all pools in turn, so that consecutive slots end up on different queue
+		 * families (if there are more than one) and then on different queues of the same family.
+		 */
+		do
+		{
+			if (buffer_index < dev->command_pools[pool_index].buffer_count)
+			{
+				slot->cmd_buffer = dev->command_pools[pool_index].buffers[buffer_index];
+				slot->queue = dev->command_pools[pool_index].queues[buffer_index];
+			}
+			if (++pool_index >= dev->command_pool_count)
+			{
+				pool_index = 0;
+				++buffer_index;
+			}
+		} while (slot->cmd_buffer == NULL);
+	}
+
+exit_failed:
+	return retval;
+}
+
+void tut4_free_stream(struct tut2_device *dev, struct tut4_stream *stream)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	for (uint32_t i = 0; i < stream->slot_count; ++i)
+	{
+		struct tut4_stream_slot *slot = &stream->slots[i];
+
+		if (slot->staging_map)
+			vkUnmapMemory(dev->device, slot->staging_mem);
+
+		vkDestroyFence(dev->device, slot->fence, NULL);
+		vkDestroyBufferView(dev->device, slot->buffer_view, NULL);
+		vkDestroyBuffer(dev->device, slot->buffer, NULL);
+		vkFreeMemory(dev->device, slot->buffer_mem, NULL);
+		vkDestroyBuffer(dev->device, slot->staging, NULL);
+		vkFreeMemory(dev->device, slot->staging_mem, NULL);
+	}
+
+	vkDestroyDescriptorPool(dev->device, stream->set_pool, NULL);
+	free(stream->slots);
+
+	*stream = (struct tut4_stream){0};
+}
+
+static tut1_error submit_chunk(struct tut2_device *dev, struct tut4_stream *stream, struct tut4_stream_slot *slot,
+		const float *from, size_t offset, size_t element_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize size = element_count * sizeof(float);
+
+	/*
+	 * The dispatch works on multiples of 64 elements.  The last chunk may not be a multiple of 64, so the rest of
+	 * it is worked on as well.  That's harmless, because the slot's buffers are always a full chunk large, and the
+	 * extra results are never written to the output.
+	 */
+	uint32_t group_count = (element_count + 63) / 64;
+
+	memcpy(slot->staging_map, from, size);
+
+	res = tut4_flush_memory(dev, slot->staging_mem, slot->staging_mem_size, slot->staging_atom_size, 0, size);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * The command buffer copies the chunk to the device buffer, runs the shader on it and copies it back.  Between
+	 * each step, a barrier makes sure the previous step is finished and its writes are visible to the next:
+	 *
+	 * - copy -> shader: the transfer writes need to be visible to shader reads and writes,
+	 * - shader -> copy: the shader writes need to be visible to the transfer reads,
+	 * - copy -> host: the transfer writes need to be visible to the host, which is going to read the staging buffer
+	 *   after the fence is signaled.
+	 *
+	 * Host writes to the staging buffer are made visible to the device by the submission itself.
+	 */
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkBufferCopy region = {
+		.srcOffset = 0,
+		.dstOffset = 0,
+		.size = size,
+	};
+	VkBufferMemoryBarrier to_shader = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	VkBufferMemoryBarrier to_transfer = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	VkBufferMemoryBarrier to_host = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = slot->staging,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+
+	vkResetCommandBuffer(slot->cmd_buffer, 0);
+	res = vkBeginCommandBuffer(slot->cmd_buffer, &begin_info);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	vkCmdCopyBuffer(slot->cmd_buffer, slot->staging, slot->buffer, 1, &region);
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			0, NULL, 1, &to_shader, 0, NULL);
+
+	vkCmdBindPipeline(slot->cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, stream->pipeline);
+	vkCmdBindDescriptorSets(slot->cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, stream->pipeline_layout, 0, 1, &slot->set, 0, NULL);
+	vkCmdDispatch(slot->cmd_buffer, group_count, 1, 1);
+
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, NULL, 1, &to_transfer, 0, NULL);
+	vkCmdCopyBuffer(slot->cmd_buffer, slot->buffer, slot->staging, 1, &region);
+	vkCmdPipelineBarrier(slot->cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+			0, NULL, 1, &to_host, 0, NULL);
+
+	res = vkEndCommandBuffer(slot->cmd_buffer);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &slot->cmd_buffer,
+	};
+
+	res = vkResetFences(dev->device, 1, &slot->fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = vkQueueSubmit(slot->queue, 1, &submit_info, slot->fence);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	slot->busy = true;
+	slot->offset = offset;
+	slot->element_count = element_count;
+
+exit_failed:
+	return retval;
+}
+
+static tut1_error drain_slot(struct tut2_device *dev, struct tut4_stream *stream, struct tut4_stream_slot *slot, float *to)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+	VkDeviceSize size = slot->element_count * sizeof(float);
+
+	if (!slot->busy)
+		goto exit_failed;
+
+	/* Wait for the chunk to go through the GPU, and keep track of how long the host was blocked on it */
+	uint64_t wait_start_ns = tut1_get_time_ns();
+	do
+	{
+		res = vkWaitForFences(dev->device, 1, &slot->fence, true, 1000000000);
+	} while (res == VK_TIMEOUT);
+	stream->wait_time_ns += tut1_get_time_ns() - wait_start_ns;
+
+	slot->busy = false;
+
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	res = tut4_invalidate_memory(dev, slot->staging_mem, slot->staging_mem_size, slot->staging_atom_size, 0, size);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	memcpy(to + slot->offset, slot->staging_map, size);
+	++stream->chunks;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut4_stream_buffer(struct tut2_device *dev, struct tut4_stream *stream, const float *from, float *to,
+		size_t element_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t next_slot = 0;
+
+	stream->bytes = 0;
+	stream->wall_time_ns = 0;
+	stream->wait_time_ns = 0;
+	stream->chunks = 0;
+
+	uint64_t start_ns = tut1_get_time_ns();
+
+	/*
+	 * Go through the chunks, each time taking the next slot in the ring.  If the slot still has an older chunk in
+	 * flight, that chunk is written out first; by then, that chunk has had slot_count - 1 other chunks' worth of
+	 * time to go through the GPU, so with enough slots, the wait should be short or nothing at all.
+	 */
+	for (size_t offset = 0; offset < element_count; offset += stream->chunk_size)
+	{
+		struct tut4_stream_slot *slot = &stream->slots[next_slot];
+		size_t count = element_count - offset < stream->chunk_size?element_count - offset:stream->chunk_size;
+
+		retval = drain_slot(dev, stream, slot, to);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		retval = submit_chunk(dev, stream, slot, from + offset, offset, count);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		next_slot = (next_slot + 1) % stream->slot_count;
+	}
+
+	/* Write out whatever is left in flight, oldest first */
+	for (uint32_t i = 0; i < stream->slot_count; ++i)
+	{
+		retval = drain_slot(dev, stream, &stream->slots[(next_slot + i) % stream->slot_count], to);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	stream->wall_time_ns = tut1_get_time_ns() - start_ns;
+	stream->bytes = element_count * sizeof(float);
+
+exit_failed:
+	/* On failure, make sure the GPU is not still writing to the staging buffers before they are reused */
+	if (!tut1_error_is_success(&retval))
+	{
+		vkDeviceWaitIdle(dev->device);
+		for (uint32_t i = 0; i < stream->slot_count; ++i)
+			stream->slots[i].busy = false;
+	}
+
+	return retval;
+}
+
+tut1_error tut4_stream_file(struct tut2_device *dev, struct tut4_stream *stream, const char *input, const char *output)
+{
+	/*
+	 * The input file is memory-mapped, and so is the output file.  This lets the OS page the data in and out as
+	 * needed, so files much larger than the host memory can be processed too, and saves us a copy through a
+	 * read(2)/write(2) buffer; the data is copied straight from the page cache into the staging buffers and back.
+	 *
+	 * The file is treated as an array of floats.  If its size is not a multiple of 4 bytes, the leftover bytes are
+	 * copied to the output as they are.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	int in_fd = -1, out_fd = -1;
+	void *in_map = MAP_FAILED, *out_map = MAP_FAILED;
+	size_t file_size = 0;
+	size_t element_count;
+	struct stat st;
+
+	stream->bytes = 0;
+	stream->wall_time_ns = 0;
+	stream->wait_time_ns = 0;
+	stream->chunks = 0;
+
+	in_fd = open(input, O_RDONLY);
+	if (in_fd < 0 || fstat(in_fd, &st))
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	file_size = st.st_size;
+
+	out_fd = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0 || ftruncate(out_fd, file_size))
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	/* Nothing to do for an empty file, and mmap() wouldn't accept it anyway */
+	if (file_size == 0)
+		goto exit_failed;
+
+	in_map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+	if (in_map == MAP_FAILED)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+	out_map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+	if (out_map == MAP_FAILED)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_failed;
+	}
+
+	/* Tell the OS we are going through the files front to back, so it would read ahead and drop pages behind us */
+	madvise(in_map, file_size, MADV_SEQUENTIAL);
+	madvise(out_map, file_size, MADV_SEQUENTIAL);
+
+	element_count = file_size / sizeof(float);
+	memcpy((char *)out_map + element_count * sizeof(float), (char *)in_map + element_count * sizeof(float),
+			file_size % sizeof(float));
+
+	retval = tut4_stream_buffer(dev, stream, in_map, out_map, element_count);
+	if (tut1_error_is_success(&retval))
+		stream->bytes = file_size;
+
+exit_failed:
+	if (out_map != MAP_FAILED)
+		munmap(out_map, file_size);
+	if (in_map != MAP_FAILED)
+		munmap(in_map, file_size);
+	if (out_fd >= 0)
+		close(out_fd);
+	if (in_fd >= 0)
+		close(in_fd);
+
+	return retval;
+}
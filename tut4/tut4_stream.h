@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 Shahbaz Youssefi <ShabbyX@gmail.com>
+ *
+ * This file is part of Shabi's Vulkan Tutorials.
+ *
+ * Shabi's Vulkan Tutorials is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Shabi's Vulkan Tutorials is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TUT4_STREAM_H
+#define TUT4_STREAM_H
+
+#include "tut4.h"
+
+/*
+ * A slot of the staging ring.  Each slot has a host-visible staging buffer the input is copied into and the output
+ * is read back from, and a (preferably) device-local buffer the shader works on.
+ */
+struct tut4_stream_slot
+{
+	VkBuffer staging;
+	VkDeviceMemory staging_mem;
+	VkDeviceSize staging_mem_size;
+	VkDeviceSize staging_atom_size;
+	void *staging_map;
+
+	VkBuffer buffer;
+	VkDeviceMemory buffer_mem;
+	VkBufferView buffer_view;
+	VkDescriptorSet set;
+
+	VkCommandBuffer cmd_buffer;
+	VkQueue queue;
+	VkFence fence;
+
+	/* The chunk of the file currently in flight in this slot, if any */
+	bool busy;
+	size_t offset;
+	size_t element_count;
+};
+
+struct tut4_stream
+{
+	struct tut4_stream_slot *slots;
+	uint32_t slot_count;
+	size_t chunk_size;		/* in number of floats */
+
+	VkDescriptorPool set_pool;
+	VkPipeline pipeline;
+	VkPipelineLayout pipeline_layout;
+
+	/* statistics of the last tut4_stream_file() */
+	uint64_t bytes;
+	uint64_t wall_time_ns;
+	uint64_t wait_time_ns;		/* how long the host was blocked waiting for the GPU */
+	uint32_t chunks;
+};
+
+tut1_error tut4_prepare_stream(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut3_pipelines *pipelines,
+		struct tut4_stream *stream, size_t chunk_size, uint32_t slot_count);
+/* Run the shader over `element_count` floats in host memory, chunk by chunk.  `from` and `to` may be the same */
+tut1_error tut4_stream_buffer(struct tut2_device *dev, struct tut4_stream *stream, const float *from, float *to,
+		size_t element_count);
+tut1_error tut4_stream_file(struct tut2_device *dev, struct tut4_stream *stream, const char *input, const char *output);
+void tut4_free_stream(struct tut2_device *dev, struct tut4_stream *stream);
+
+#endif
@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <SDL2/SDL_syswm.h>
 #include <X11/Xlib-xcb.h>
@@ -28,6 +29,18 @@ tut1_error tut6_init_ext(VkInstance *vk, const char *ext_names[], uint32_t ext_c
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
 
+	/*
+	 * If available, VK_KHR_get_physical_device_properties2 is enabled too, for the memory budget.  tut6_get_dev_ext()
+	 * relies on this: if the instance has the extension, it's enabled.
+	 */
+	const char *all_ext_names[ext_count + 1];
+	uint32_t all_ext_count = ext_count;
+	bool has_properties2 = tut1_has_instance_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+	memcpy(all_ext_names, ext_names, ext_count * sizeof *ext_names);
+	if (has_properties2)
+		all_ext_names[all_ext_count++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+
 	/* This function once again, but with a possibility to enable extensions */
 	VkApplicationInfo app_info = {
 		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -42,8 +55,8 @@ tut1_error tut6_init_ext(VkInstance *vk, const char *ext_names[], uint32_t ext_c
 	info = (VkInstanceCreateInfo){
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pApplicationInfo = &app_info,
-		.enabledExtensionCount = ext_count,
-		.ppEnabledExtensionNames = ext_names,
+		.enabledExtensionCount = all_ext_count,
+		.ppEnabledExtensionNames = all_ext_names,
 	};
 
 	res = vkCreateInstance(&info, NULL, vk);
@@ -59,6 +72,9 @@ tut1_error tut6_get_dev_ext(struct tut1_physical_device *phy_dev, struct tut2_de
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
 
+	const char *all_ext_names[ext_count + 1];
+	uint32_t all_ext_count = ext_count;
+
 	/* Here is to hoping we don't have to redo this function again ;) */
 	*dev = (struct tut2_device){0};
 
@@ -94,17 +110,36 @@ tut1_error tut6_get_dev_ext(struct tut1_physical_device *phy_dev, struct tut2_de
 		goto exit_failed;
 	}
 
+	/*
+	 * VK_EXT_memory_budget tells how much of each heap the application can use without hurting itself or the rest
+	 * of the system.  It's enabled if the device supports it, and the instance could enable what it depends on (see
+	 * tut6_init_ext()).  The budget is queried with vkGetPhysicalDeviceMemoryProperties2KHR, which is kept in the
+	 * device for tut7_get_memory_stats().
+	 */
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2 = NULL;
+	if (tut1_has_instance_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+		get_memory_properties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+			vkGetInstanceProcAddr(phy_dev->instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+	bool has_memory_budget = get_memory_properties2 != NULL
+		&& tut1_has_device_extension(phy_dev, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	memcpy(all_ext_names, ext_names, ext_count * sizeof *ext_names);
+	if (has_memory_budget)
+		all_ext_names[all_ext_count++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+
 	VkDeviceCreateInfo dev_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 		.queueCreateInfoCount = *queue_info_count,
 		.pQueueCreateInfos = queue_info,
-		.enabledExtensionCount = ext_count,
-		.ppEnabledExtensionNames = ext_names,
+		.enabledExtensionCount = all_ext_count,
+		.ppEnabledExtensionNames = all_ext_names,
 		.pEnabledFeatures = &phy_dev->features,
 	};
 
 	res = vkCreateDevice(phy_dev->physical_device, &dev_info, NULL, &dev->device);
 	tut1_error_set_vkresult(&retval, res);
+	if (res == 0 && has_memory_budget)
+		dev->get_memory_properties2 = get_memory_properties2;
 
 exit_failed:
 	return retval;
@@ -17,9 +17,325 @@
  * along with Shabi's Vulkan Tutorials.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "tut7.h"
 
+void tut7_get_memory_stats(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut7_heap_stats *stats)
+{
+	/*
+	 * The size of a heap says little about how much of it we can actually use.  Other applications, the
+	 * compositor and the driver itself take their share, and on integrated GPUs the "device-local" heap is just
+	 * system memory.  Going over what's available doesn't necessarily fail either; the driver may start moving
+	 * memory around behind our back, which is terribly slow.
+	 *
+	 * If VK_EXT_memory_budget is enabled (see tut6_get_dev_ext()), the driver tells us how much each heap is used
+	 * by this process and how much it can use.  Otherwise, we can only count what we've allocated ourselves, and
+	 * guess the budget.  Using most, but not all, of the heap is a common guess.
+	 */
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+	};
+	VkPhysicalDeviceMemoryProperties2 memories = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+		.pNext = &budget,
+	};
+
+	if (dev->get_memory_properties2)
+		dev->get_memory_properties2(phy_dev->physical_device, &memories);
+
+	for (uint32_t i = 0; i < phy_dev->memories.memoryHeapCount; ++i)
+	{
+		VkDeviceSize size = phy_dev->memories.memoryHeaps[i].size;
+
+		stats[i] = (struct tut7_heap_stats){
+			.size = size,
+			.current = dev->heap_usage[i],
+			.peak = dev->heap_peak[i],
+			.usage = dev->heap_usage[i],
+			.budget = size / 10 * 8,
+		};
+
+		if (dev->get_memory_properties2)
+		{
+			stats[i].usage = budget.heapUsage[i];
+			stats[i].budget = budget.heapBudget[i];
+			stats[i].budget_from_driver = true;
+		}
+	}
+}
+
+static tut1_error allocate_memory(struct tut1_physical_device *phy_dev, struct tut2_device *dev, VkMemoryRequirements *mem_req,
+		bool host_visible, bool host_cached, bool optional, VkDeviceMemory *mem, uint32_t *mem_heap,
+		VkDeviceSize *non_coherent_atom_size)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	struct tut7_heap_stats stats[VK_MAX_MEMORY_HEAPS];
+	enum tut1_memory_usage usage = TUT1_MEMORY_DEVICE_LOCAL;
+	VkMemoryPropertyFlags required = 0;
+	VkResult res = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	uint32_t mem_index;
+	uint32_t rank = 0;
+
+	*non_coherent_atom_size = 0;
+
+	/*
+	 * Host-coherent memory is simpler to use, but host-cached memory is much faster to read back from.  If the
+	 * memory we end up with is not host-coherent, the application needs to flush and invalidate explicitly, for
+	 * which nonCoherentAtomSize is needed.  See tut4_flush_memory() and tut4_invalidate_memory().
+	 */
+	if (host_visible && host_cached)
+		usage = TUT1_MEMORY_READBACK;
+	else if (host_visible)
+	{
+		usage = TUT1_MEMORY_UPLOAD;
+		required = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	}
+
+	/*
+	 * This is tut4_allocate_memory(), with a twist.  The memory types that suit the usage are tried best first,
+	 * so if for example device-local memory runs out, the object ends up in slower memory instead of not being
+	 * created at all.  Objects that the application can do without (say the finer mipmaps of a texture) shouldn't
+	 * get that far though.  They skip any heap that they would push over budget, so they are demoted to a slower
+	 * heap, and if no heap has room, they are refused before the driver has to give up.  Either way, running out
+	 * of room is reported as VK_ERROR_OUT_OF_DEVICE_MEMORY, and any other error is a real one.
+	 */
+	if (optional)
+		tut7_get_memory_stats(phy_dev, dev, stats);
+
+	while ((mem_index = tut1_find_memory_type(phy_dev, usage, mem_req, required, &rank)) < phy_dev->memories.memoryTypeCount)
+	{
+		*mem_heap = phy_dev->memories.memoryTypes[mem_index].heapIndex;
+		if (optional && stats[*mem_heap].usage + mem_req->size > stats[*mem_heap].budget)
+			continue;
+
+		VkMemoryAllocateInfo mem_info = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = mem_req->size,
+			.memoryTypeIndex = mem_index,
+		};
+
+		res = vkAllocateMemory(dev->device, &mem_info, NULL, mem);
+		if (res != VK_ERROR_OUT_OF_DEVICE_MEMORY)
+			break;
+	}
+
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		return retval;
+
+	dev->heap_usage[*mem_heap] += mem_req->size;
+	if (dev->heap_usage[*mem_heap] > dev->heap_peak[*mem_heap])
+		dev->heap_peak[*mem_heap] = dev->heap_usage[*mem_heap];
+
+	if (host_visible && (phy_dev->memories.memoryTypes[mem_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
+		*non_coherent_atom_size = phy_dev->properties.limits.nonCoherentAtomSize;
+
+	return retval;
+}
+
+static bool out_of_room(tut1_error *err)
+{
+	return err->error.type == TUT1_ERROR_VKRESULT && err->error.vkresult == VK_ERROR_OUT_OF_DEVICE_MEMORY;
+}
+
+/*
+ * The parts of VkSamplerCreateInfo that make a sampler what it is.  The struct itself can't be hashed or compared as
+ * a whole, because of its padding and pNext.  The floats are taken bit by bit; a 0.0 and a -0.0 would make two
+ * different samplers, but that's harmless.
+ */
+#define SAMPLER_KEY_SIZE 16
+
+static void get_sampler_key(const VkSamplerCreateInfo *info, uint32_t key[SAMPLER_KEY_SIZE])
+{
+	key[0] = info->flags;
+	key[1] = info->magFilter;
+	key[2] = info->minFilter;
+	key[3] = info->mipmapMode;
+	key[4] = info->addressModeU;
+	key[5] = info->addressModeV;
+	key[6] = info->addressModeW;
+	memcpy(&key[7], &info->mipLodBias, sizeof key[7]);
+	key[8] = info->anisotropyEnable;
+	memcpy(&key[9], &info->maxAnisotropy, sizeof key[9]);
+	key[10] = info->compareEnable;
+	key[11] = info->compareOp;
+	memcpy(&key[12], &info->minLod, sizeof key[12]);
+	memcpy(&key[13], &info->maxLod, sizeof key[13]);
+	key[14] = info->borderColor;
+	key[15] = info->unnormalizedCoordinates;
+}
+
+static uint64_t hash_sampler_key(const uint32_t key[SAMPLER_KEY_SIZE])
+{
+	/* FNV-1a; there are only a handful of samplers, so anything reasonable would do */
+	const uint8_t *bytes = (const uint8_t *)key;
+	uint64_t hash = 14695981039346656037LLU;
+
+	for (size_t i = 0; i < SAMPLER_KEY_SIZE * sizeof *key; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211LLU;
+
+	return hash;
+}
+
+static struct tut7_sampler *find_sampler_slot(struct tut7_sampler *table, uint32_t table_size, uint64_t hash,
+		const uint32_t key[SAMPLER_KEY_SIZE])
+{
+	/*
+	 * Open addressing with linear probing: start at the slot the hash points to, and go forward until either the
+	 * key or an empty slot is found.  Keys are never removed from the table (only their samplers are destroyed),
+	 * so a probe never stops early at a hole left behind by a removed key.
+	 */
+	for (uint32_t i = hash & (table_size - 1);; i = (i + 1) & (table_size - 1))
+	{
+		uint32_t slot_key[SAMPLER_KEY_SIZE];
+
+		if (!table[i].used)
+			return &table[i];
+		if (table[i].hash != hash)
+			continue;
+
+		get_sampler_key(&table[i].info, slot_key);
+		if (memcmp(slot_key, key, sizeof slot_key) == 0)
+			return &table[i];
+	}
+}
+
+static tut1_error grow_sampler_table(struct tut7_sampler_cache *cache)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t new_size = cache->table_size?cache->table_size * 2:16;
+	struct tut7_sampler *new_table = calloc(new_size, sizeof *new_table);
+
+	if (new_table == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		return retval;
+	}
+
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		struct tut7_sampler *entry = &cache->samplers[i];
+		uint32_t key[SAMPLER_KEY_SIZE];
+
+		if (!entry->used)
+			continue;
+
+		get_sampler_key(&entry->info, key);
+		*find_sampler_slot(new_table, new_size, entry->hash, key) = *entry;
+	}
+
+	free(cache->samplers);
+	cache->samplers = new_table;
+	cache->table_size = new_size;
+
+	return retval;
+}
+
+tut1_error tut7_acquire_sampler(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut7_sampler_cache *cache, const VkSamplerCreateInfo *info, VkSampler *sampler)
+{
+	/*
+	 * Samplers are independent of the images they sample; they only say how to sample.  Most applications need a
+	 * few different ways of sampling, but have many images.  Creating a sampler per image is wasteful, and could
+	 * even fail: there is a limit to how many samplers can exist at the same time (maxSamplerAllocationCount, which
+	 * can be as low as 4000).  So instead, samplers are looked up in a hash table by what they are, and an image
+	 * that needs a sampler identical to an existing one just gets a reference to it.
+	 *
+	 * The cache belongs to whoever uses it, not to the device.  Images that don't share a cache simply don't share
+	 * samplers, and maxSamplerAllocationCount is only checked against the samplers of this cache.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint32_t key[SAMPLER_KEY_SIZE];
+	struct tut7_sampler *entry;
+	VkResult res;
+
+	*sampler = VK_NULL_HANDLE;
+
+	get_sampler_key(info, key);
+	uint64_t hash = hash_sampler_key(key);
+
+	/* Keep the table at most half full, so the probes stay short */
+	if ((cache->key_count + 1) * 2 > cache->table_size)
+	{
+		retval = grow_sampler_table(cache);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	entry = find_sampler_slot(cache->samplers, cache->table_size, hash, key);
+	if (!entry->used)
+	{
+		*entry = (struct tut7_sampler){
+			.used = true,
+			.hash = hash,
+			.info = *info,
+		};
+		entry->info.pNext = NULL;
+		++cache->key_count;
+	}
+
+	/* If the sampler was created before and was released by everyone, it has to be created again */
+	if (entry->ref_count == 0)
+	{
+		if (cache->sampler_count >= phy_dev->properties.limits.maxSamplerAllocationCount)
+		{
+			tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+			goto exit_failed;
+		}
+
+		res = vkCreateSampler(dev->device, &entry->info, NULL, &entry->sampler);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		++cache->sampler_count;
+	}
+
+	++entry->ref_count;
+	*sampler = entry->sampler;
+
+exit_failed:
+	return retval;
+}
+
+void tut7_release_sampler(struct tut2_device *dev, struct tut7_sampler_cache *cache, VkSampler sampler)
+{
+	if (sampler == VK_NULL_HANDLE)
+		return;
+
+	/*
+	 * The table is searched by handle here.  It's only ever as large as the number of different samplers, so that
+	 * is cheap enough, and it saves every user from having to remember how they created the sampler.
+	 */
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		struct tut7_sampler *entry = &cache->samplers[i];
+
+		if (!entry->used || entry->sampler != sampler)
+			continue;
+
+		if (--entry->ref_count == 0)
+		{
+			vkDestroySampler(dev->device, entry->sampler, NULL);
+			entry->sampler = VK_NULL_HANDLE;
+			--cache->sampler_count;
+		}
+		return;
+	}
+}
+
+void tut7_free_sampler_cache(struct tut2_device *dev, struct tut7_sampler_cache *cache)
+{
+	/* Any sampler still in the cache was leaked by its user, but destroy it anyway */
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+		vkDestroySampler(dev->device, cache->samplers[i].sampler, NULL);
+	free(cache->samplers);
+
+	*cache = (struct tut7_sampler_cache){0};
+}
+
 tut1_error tut7_create_images(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
 		struct tut7_image *images, uint32_t image_count)
 {
@@ -203,29 +519,42 @@ tut1_error tut7_create_images(struct tut1_physical_device *phy_dev, struct tut2_
 		 */
 		VkMemoryRequirements mem_req = {0};
 		vkGetImageMemoryRequirements(dev->device, images[i].image, &mem_req);
-		uint32_t mem_index = tut4_find_suitable_memory(phy_dev, dev, &mem_req,
-				images[i].host_visible?
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT:
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		if (mem_index >= phy_dev->memories.memoryTypeCount)
+		tut1_error err = allocate_memory(phy_dev, dev, &mem_req, images[i].host_visible, images[i].host_cached,
+				images[i].optional, &images[i].image_mem, &images[i].mem_heap, &images[i].non_coherent_atom_size);
+		if (!tut1_error_is_success(&err) && images[i].optional && out_of_room(&err))
+		{
+			/* An optional image that didn't fit is simply not there, but other errors are reported as usual */
+			vkDestroyImage(dev->device, images[i].image, NULL);
+			images[i].image = VK_NULL_HANDLE;
+			++successful;
 			continue;
-
-		VkMemoryAllocateInfo mem_info = {
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = mem_req.size,
-			.memoryTypeIndex = mem_index,
-		};
-
-		res = vkAllocateMemory(dev->device, &mem_info, NULL, &images[i].image_mem);
-		tut1_error_sub_set_vkresult(&retval, res);
-		if (res)
+		}
+		tut1_error_sub_merge(&retval, &err);
+		if (!tut1_error_is_success(&err))
 			continue;
+		images[i].mem_size = mem_req.size;
 
 		res = vkBindImageMemory(dev->device, images[i].image, images[i].image_mem, 0);
 		tut1_error_sub_set_vkresult(&retval, res);
 		if (res)
 			continue;
 
+		/*
+		 * Mapping memory is not free; it goes through the kernel to set up the page tables.  There is no limit
+		 * to how long memory can stay mapped though, and the device can use memory while it's mapped.  So
+		 * host-visible memory is mapped once here, and the application writes to and reads from it whenever it
+		 * wants through images[i].map (see tut8_render_fill_image()).  The whole memory is mapped, because if
+		 * it's not host-coherent, the flush and invalidate ranges are rounded up to nonCoherentAtomSize, and
+		 * that must still be inside the mapped range.  Freeing the memory unmaps it.
+		 */
+		if (images[i].host_visible)
+		{
+			res = vkMapMemory(dev->device, images[i].image_mem, 0, VK_WHOLE_SIZE, 0, &images[i].map);
+			tut1_error_sub_set_vkresult(&retval, res);
+			if (res)
+				continue;
+		}
+
 		if (images[i].make_view)
 		{
 			/*
@@ -336,7 +665,7 @@ tut1_error tut7_create_images(struct tut1_physical_device *phy_dev, struct tut2_
 			 *   other features of the sampler must be disabled too.  Needless to say, we will use
 			 *   normalized coordinates.
 			 */
-			VkSamplerCreateInfo sampler_info = {
+			VkSamplerCreateInfo default_sampler_info = {
 				.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
 				.magFilter = VK_FILTER_LINEAR,
 				.minFilter = VK_FILTER_LINEAR,
@@ -350,10 +679,27 @@ tut1_error tut7_create_images(struct tut1_physical_device *phy_dev, struct tut2_
 				.maxLod = 1,
 			};
 
-			res = vkCreateSampler(dev->device, &sampler_info, NULL, &images[i].sampler);
-			tut1_error_sub_set_vkresult(&retval, res);
-			if (res)
-				continue;
+			/*
+			 * The images don't each need their own sampler though.  Those that are sampled the same way can
+			 * share one, which tut7_acquire_sampler() takes care of if the images are given a sampler cache.
+			 * Images can also ask to be sampled differently from the above.
+			 */
+			const VkSamplerCreateInfo *sampler_info = images[i].sampler_info?images[i].sampler_info:&default_sampler_info;
+			if (images[i].sampler_cache)
+			{
+				tut1_error err = tut7_acquire_sampler(phy_dev, dev, images[i].sampler_cache, sampler_info,
+						&images[i].sampler);
+				tut1_error_sub_merge(&retval, &err);
+				if (!tut1_error_is_success(&err))
+					continue;
+			}
+			else
+			{
+				res = vkCreateSampler(dev->device, sampler_info, NULL, &images[i].sampler);
+				tut1_error_sub_set_vkresult(&retval, res);
+				if (res)
+					continue;
+			}
 		}
 
 		++successful;
@@ -409,29 +755,35 @@ tut1_error tut7_create_buffers(struct tut1_physical_device *phy_dev, struct tut2
 
 		VkMemoryRequirements mem_req = {0};
 		vkGetBufferMemoryRequirements(dev->device, buffers[i].buffer, &mem_req);
-		uint32_t mem_index = tut4_find_suitable_memory(phy_dev, dev, &mem_req,
-				buffers[i].host_visible?
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT:
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		if (mem_index >= phy_dev->memories.memoryTypeCount)
+		tut1_error err = allocate_memory(phy_dev, dev, &mem_req, buffers[i].host_visible, buffers[i].host_cached,
+				buffers[i].optional, &buffers[i].buffer_mem, &buffers[i].mem_heap, &buffers[i].non_coherent_atom_size);
+		if (!tut1_error_is_success(&err) && buffers[i].optional && out_of_room(&err))
+		{
+			/* An optional buffer that didn't fit is simply not there, but other errors are reported as usual */
+			vkDestroyBuffer(dev->device, buffers[i].buffer, NULL);
+			buffers[i].buffer = VK_NULL_HANDLE;
+			++successful;
 			continue;
-
-		VkMemoryAllocateInfo mem_info = {
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = mem_req.size,
-			.memoryTypeIndex = mem_index,
-		};
-
-		res = vkAllocateMemory(dev->device, &mem_info, NULL, &buffers[i].buffer_mem);
-		tut1_error_sub_set_vkresult(&retval, res);
-		if (res)
+		}
+		tut1_error_sub_merge(&retval, &err);
+		if (!tut1_error_is_success(&err))
 			continue;
+		buffers[i].mem_size = mem_req.size;
 
 		res = vkBindBufferMemory(dev->device, buffers[i].buffer, buffers[i].buffer_mem, 0);
 		tut1_error_sub_set_vkresult(&retval, res);
 		if (res)
 			continue;
 
+		/* Host-visible memory stays mapped, just like with images */
+		if (buffers[i].host_visible)
+		{
+			res = vkMapMemory(dev->device, buffers[i].buffer_mem, 0, VK_WHOLE_SIZE, 0, &buffers[i].map);
+			tut1_error_sub_set_vkresult(&retval, res);
+			if (res)
+				continue;
+		}
+
 		if (buffers[i].make_view)
 		{
 			/* A buffer view can only be created on uniform and storage texel buffers */
@@ -459,6 +811,33 @@ tut1_error tut7_create_buffers(struct tut1_physical_device *phy_dev, struct tut2
 	return retval;
 }
 
+static tut1_error hash_spirv(const char *spirv_file, uint64_t *hash)
+{
+	/* FNV-1a over the whole file, like the sampler keys above */
+	tut1_error retval = TUT1_ERROR_NONE;
+	uint8_t buffer[4096];
+	size_t read;
+	FILE *fin = fopen(spirv_file, "rb");
+
+	*hash = 14695981039346656037LLU;
+
+	if (fin == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		return retval;
+	}
+
+	while ((read = fread(buffer, 1, sizeof buffer, fin)) > 0)
+		for (size_t i = 0; i < read; ++i)
+			*hash = (*hash ^ buffer[i]) * 1099511628211LLU;
+
+	if (ferror(fin))
+		tut1_error_set_errno(&retval, errno);
+
+	fclose(fin);
+	return retval;
+}
+
 tut1_error tut7_load_shaders(struct tut2_device *dev,
 		struct tut7_shader *shaders, uint32_t shader_count)
 {
@@ -477,6 +856,16 @@ tut1_error tut7_load_shaders(struct tut2_device *dev,
 		if (!tut1_error_is_success(&err))
 			continue;
 
+		/*
+		 * The shader module is just a handle, and once it's destroyed, the same handle may be given to a
+		 * completely different shader.  The hash of the code on the other hand identifies the shader for good.
+		 * This is used by tut8_pipeline_cache in Tutorial 8, to recognize pipelines made from the same shaders.
+		 */
+		err = hash_spirv(shaders[i].spirv_file, &shaders[i].spirv_hash);
+		tut1_error_sub_merge(&retval, &err);
+		if (!tut1_error_is_success(&err))
+			continue;
+
 		++successful;
 	}
 
@@ -812,7 +1201,12 @@ void tut7_free_images(struct tut2_device *dev, struct tut7_image *images, uint32
 		vkDestroyImageView(dev->device, images[i].view, NULL);
 		vkDestroyImage(dev->device, images[i].image, NULL);
 		vkFreeMemory(dev->device, images[i].image_mem, NULL);
-		vkDestroySampler(dev->device, images[i].sampler, NULL);
+		if (images[i].image_mem)
+			dev->heap_usage[images[i].mem_heap] -= images[i].mem_size;
+		if (images[i].sampler_cache)
+			tut7_release_sampler(dev, images[i].sampler_cache, images[i].sampler);
+		else
+			vkDestroySampler(dev->device, images[i].sampler, NULL);
 	}
 }
 
@@ -826,6 +1220,8 @@ void tut7_free_buffers(struct tut2_device *dev, struct tut7_buffer *buffers, uin
 		vkDestroyBufferView(dev->device, buffers[i].view, NULL);
 		vkDestroyBuffer(dev->device, buffers[i].buffer, NULL);
 		vkFreeMemory(dev->device, buffers[i].buffer_mem, NULL);
+		if (buffers[i].buffer_mem)
+			dev->heap_usage[buffers[i].mem_heap] -= buffers[i].mem_size;
 	}
 }
 
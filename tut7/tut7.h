@@ -23,6 +23,28 @@
 #include "../tut6/tut6.h"
 #include "../tut4/tut4.h"
 
+/* A sampler shared by all the images that asked for the same one; see tut7_acquire_sampler() */
+struct tut7_sampler
+{
+	bool used;			/* whether this slot of the hash table holds a key */
+	uint64_t hash;
+	VkSamplerCreateInfo info;
+	VkSampler sampler;		/* VK_NULL_HANDLE once ref_count drops to 0 */
+	uint32_t ref_count;
+};
+
+/*
+ * A hash table of samplers, keyed by their VkSamplerCreateInfo, and how many of them currently exist.  A zeroed
+ * struct is an empty cache, and tut7_free_sampler_cache() frees it.
+ */
+struct tut7_sampler_cache
+{
+	struct tut7_sampler *samplers;
+	uint32_t table_size;
+	uint32_t key_count;
+	uint32_t sampler_count;
+};
+
 struct tut7_image
 {
 	/* inputs */
@@ -35,17 +57,30 @@ struct tut7_image
 	bool make_view;
 	bool will_be_initialized;
 	bool host_visible;
+	bool host_cached;		/* if host_visible, prefer host-cached memory, e.g. for readback */
 	bool multisample;
+	bool optional;			/* if it doesn't fit in the memory budget, rather not create it; see tut7_get_memory_stats() */
 	uint32_t *sharing_queues;
 	uint32_t sharing_queue_count;
+	const VkSamplerCreateInfo *sampler_info;	/* if sampled, how; NULL for linear filtering clamped to edge */
+	struct tut7_sampler_cache *sampler_cache;	/* if sampled, where to share the sampler from; NULL for its own */
 
 	/* outputs */
 
-	/* Vulkan image object */
+	/* Vulkan image object (VK_NULL_HANDLE if optional and didn't fit) */
 	VkImage image;
 	VkDeviceMemory image_mem;
 	VkImageView view;
 
+	/* allocation size and heap, and if host_visible, nonCoherentAtomSize if memory is not host-coherent (0 otherwise) */
+	VkDeviceSize mem_size;
+	uint32_t mem_heap;
+	VkDeviceSize non_coherent_atom_size;
+
+	/* if host_visible: the whole memory, mapped for as long as the image lives */
+	void *map;
+
+	/* if sampled, shared with every other image sampled the same way from sampler_cache; see tut7_acquire_sampler() */
 	VkSampler sampler;
 };
 
@@ -60,15 +95,26 @@ struct tut7_buffer
 	VkShaderStageFlagBits stage;
 	bool make_view;
 	bool host_visible;
+	bool host_cached;		/* if host_visible, prefer host-cached memory, e.g. for readback */
+	bool optional;			/* if it doesn't fit in the memory budget, rather not create it; see tut7_get_memory_stats() */
+	bool dynamic;			/* if a uniform buffer, bind it with an offset given at bind time; see tut8_uniform_ring */
 	uint32_t *sharing_queues;
 	uint32_t sharing_queue_count;
 
 	/* outputs */
 
-	/* Vulkan buffer object */
+	/* Vulkan buffer object (VK_NULL_HANDLE if optional and didn't fit) */
 	VkBuffer buffer;
 	VkDeviceMemory buffer_mem;
 	VkBufferView view;
+
+	/* allocation size and heap, and if host_visible, nonCoherentAtomSize if memory is not host-coherent (0 otherwise) */
+	VkDeviceSize mem_size;
+	uint32_t mem_heap;
+	VkDeviceSize non_coherent_atom_size;
+
+	/* if host_visible: the whole memory, mapped for as long as the buffer lives */
+	void *map;
 };
 
 struct tut7_shader
@@ -81,6 +127,7 @@ struct tut7_shader
 	/* outputs */
 
 	VkShaderModule shader;
+	uint64_t spirv_hash;		/* a hash of the SPIR-V code, which stays meaningful after the module is destroyed */
 };
 
 struct tut7_graphics_buffers
@@ -98,6 +145,17 @@ struct tut7_graphics_buffers
 	VkFramebuffer framebuffer;
 };
 
+/* Memory statistics of a heap */
+struct tut7_heap_stats
+{
+	VkDeviceSize size;		/* the size of the heap */
+	VkDeviceSize current;		/* allocated for tut7 images and buffers */
+	VkDeviceSize peak;		/* the most that was ever allocated for tut7 images and buffers */
+	VkDeviceSize usage;		/* used by the whole process, if the driver says so, otherwise the same as current */
+	VkDeviceSize budget;		/* how much the process can use before things go bad */
+	bool budget_from_driver;	/* whether usage and budget come from VK_EXT_memory_budget or are estimated */
+};
+
 tut1_error tut7_create_images(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
 		struct tut7_image *images, uint32_t image_count);
 tut1_error tut7_create_buffers(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
@@ -110,6 +168,16 @@ tut1_error tut7_create_graphics_buffers(struct tut1_physical_device *phy_dev, st
 tut1_error tut7_get_presentable_queues(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
 		VkSurfaceKHR surface, uint32_t **presentable_queues, uint32_t *presentable_queue_count);
 VkFormat tut7_get_supported_depth_stencil_format(struct tut1_physical_device *phy_dev);
+/* Fill in the statistics of each heap, phy_dev->memories.memoryHeapCount of them */
+void tut7_get_memory_stats(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut7_heap_stats *stats);
+/*
+ * Get a sampler created with `info`, which is created only if no identical sampler already exists.  Every acquired
+ * sampler must be released, and it is destroyed once released as many times as acquired.  `info->pNext` must be NULL.
+ */
+tut1_error tut7_acquire_sampler(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
+		struct tut7_sampler_cache *cache, const VkSamplerCreateInfo *info, VkSampler *sampler);
+void tut7_release_sampler(struct tut2_device *dev, struct tut7_sampler_cache *cache, VkSampler sampler);
+void tut7_free_sampler_cache(struct tut2_device *dev, struct tut7_sampler_cache *cache);
 
 void tut7_free_images(struct tut2_device *dev, struct tut7_image *images, uint32_t image_count);
 void tut7_free_buffers(struct tut2_device *dev, struct tut7_buffer *buffers, uint32_t buffer_count);
@@ -19,8 +19,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include "tut8.h"
 #include "tut8_render.h"
 
@@ -83,16 +85,186 @@ struct render_data
 
 	/* For rendering */
 	VkRenderPass render_pass;
+	struct tut8_resources resources;
+	struct tut8_layout_cache layout_cache;
 	struct tut8_layout layout;
 	struct tut8_pipeline pipeline;
+	struct tut8_pipeline_cache pipeline_cache;
 	VkDescriptorSet desc_set;
 };
 
+#define UPDATE_COST_ITERATIONS 1000
+
+static void measure_update_cost(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut7_buffer *buffer,
+		void *contents, size_t size)
+{
+	/*
+	 * A uniform buffer such as the transformation is typically updated every frame.  Let's see what that costs if
+	 * the memory is mapped and unmapped around every update, like in Tutorial 4, compared to writing to memory that
+	 * stays mapped.  Memory that is already mapped can't be mapped again, so the first case uses a separate buffer
+	 * of the same size, that is not mapped by anyone.  Nothing is rendering, so it's safe to overwrite the
+	 * transformation buffer with the same contents over and over.
+	 */
+	VkBuffer unmapped = VK_NULL_HANDLE;
+	VkDeviceMemory unmapped_mem = VK_NULL_HANDLE;
+	VkDeviceSize unmapped_mem_size, unmapped_atom_size;
+	uint64_t start_ns, map_unmap_ns, persistent_ns;
+	VkResult res;
+
+	tut1_error retval = tut4_create_buffer(phy_dev, dev, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, TUT1_MEMORY_UPLOAD,
+			&unmapped, &unmapped_mem, &unmapped_mem_size, &unmapped_atom_size);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	start_ns = tut1_get_time_ns();
+	for (uint32_t i = 0; i < UPDATE_COST_ITERATIONS; ++i)
+	{
+		void *mem;
+		res = vkMapMemory(dev->device, unmapped_mem, 0, VK_WHOLE_SIZE, 0, &mem);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		memcpy(mem, contents, size);
+		res = tut4_flush_memory(dev, unmapped_mem, unmapped_mem_size, unmapped_atom_size, 0, size);
+		vkUnmapMemory(dev->device, unmapped_mem);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+	map_unmap_ns = tut1_get_time_ns() - start_ns;
+
+	start_ns = tut1_get_time_ns();
+	for (uint32_t i = 0; i < UPDATE_COST_ITERATIONS; ++i)
+	{
+		retval = tut8_render_fill_buffer(dev, buffer, contents, size, "transformation");
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+	persistent_ns = tut1_get_time_ns() - start_ns;
+
+	printf("Updating a %zu-byte uniform buffer: %.2fus with map/unmap, %.2fus with a persistent mapping\n", size,
+			map_unmap_ns / 1000.0 / UPDATE_COST_ITERATIONS, persistent_ns / 1000.0 / UPDATE_COST_ITERATIONS);
+
+exit_failed:
+	vkDestroyBuffer(dev->device, unmapped, NULL);
+	vkFreeMemory(dev->device, unmapped_mem, NULL);
+	if (!tut1_error_is_success(&retval))
+		tut1_error_printf(&retval, "Uniform buffer update cost measurement failed\n");
+}
+
+#define STRESS_SET_COUNT 100000
+#define STRESS_THREAD_COUNT 4
+
+struct stress_thread
+{
+	struct tut2_device *dev;
+	struct tut8_descriptor_allocator *allocator;
+	VkDescriptorSet *sets;
+	uint32_t set_count;
+	tut1_error error;
+};
+
+static void *stress_thread(void *args)
+{
+	struct stress_thread *thread = args;
+	thread->error = tut8_allocate_descriptor_sets(thread->dev, thread->allocator, thread->sets, thread->set_count);
+	return NULL;
+}
+
+static void stress_descriptor_allocator(struct tut2_device *dev, struct tut8_layout *layout)
+{
+	/*
+	 * Let's see how the descriptor set allocator copes with a lot of sets, as if every object of a large scene had
+	 * its own set.  First, one thread allocates them all, which makes the allocator create more and more pools.
+	 * Then, the allocator is reset and the same is done again, which shouldn't create any more pools.  Finally,
+	 * the same number of sets is allocated by a few threads at the same time, each with its own allocator, so
+	 * without any locking.
+	 */
+	struct tut8_descriptor_allocator allocators[STRESS_THREAD_COUNT];
+	struct stress_thread threads[STRESS_THREAD_COUNT];
+	pthread_t thread_ids[STRESS_THREAD_COUNT];
+	bool created[STRESS_THREAD_COUNT];
+	uint64_t start_ns, elapsed_ns;
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	VkDescriptorSet *sets = malloc(STRESS_SET_COUNT * sizeof *sets);
+	if (sets == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		goto exit_bad_malloc;
+	}
+
+	for (uint32_t t = 0; t < STRESS_THREAD_COUNT; ++t)
+		allocators[t] = (struct tut8_descriptor_allocator){
+			.layout = layout,
+		};
+
+	/*
+	 * If some of the allocators fail to be made, the ones that were made still own pools.  The rest are as
+	 * initialized above, with no pools, so freeing them all is safe.
+	 */
+	retval = tut8_make_descriptor_allocators(dev, allocators, STRESS_THREAD_COUNT);
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	for (uint32_t r = 0; r < 2; ++r)
+	{
+		start_ns = tut1_get_time_ns();
+		retval = tut8_allocate_descriptor_sets(dev, &allocators[0], sets, STRESS_SET_COUNT);
+		elapsed_ns = tut1_get_time_ns() - start_ns;
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+
+		printf("%s: %u sets in %.2fms (%.3fus per set) using %u pools\n", r == 0?"Allocating":"Allocating after reset",
+				STRESS_SET_COUNT, elapsed_ns / 1000000.0, elapsed_ns / 1000.0 / STRESS_SET_COUNT,
+				allocators[0].pool_count);
+
+		retval = tut8_reset_descriptor_allocator(dev, &allocators[0]);
+		if (!tut1_error_is_success(&retval))
+			goto exit_failed;
+	}
+
+	start_ns = tut1_get_time_ns();
+	for (uint32_t t = 0; t < STRESS_THREAD_COUNT; ++t)
+	{
+		threads[t] = (struct stress_thread){
+			.dev = dev,
+			.allocator = &allocators[t],
+			.sets = sets + t * (STRESS_SET_COUNT / STRESS_THREAD_COUNT),
+			.set_count = STRESS_SET_COUNT / STRESS_THREAD_COUNT,
+		};
+
+		created[t] = pthread_create(&thread_ids[t], NULL, stress_thread, &threads[t]) == 0;
+		if (!created[t])
+			stress_thread(&threads[t]);
+	}
+	for (uint32_t t = 0; t < STRESS_THREAD_COUNT; ++t)
+	{
+		if (created[t])
+			pthread_join(thread_ids[t], NULL);
+		if (!tut1_error_is_success(&threads[t].error))
+			retval = threads[t].error;
+	}
+	elapsed_ns = tut1_get_time_ns() - start_ns;
+	if (!tut1_error_is_success(&retval))
+		goto exit_failed;
+
+	printf("Allocating with %u threads: %u sets in %.2fms (%.3fus per set)\n", STRESS_THREAD_COUNT,
+			STRESS_SET_COUNT / STRESS_THREAD_COUNT * STRESS_THREAD_COUNT, elapsed_ns / 1000000.0,
+			elapsed_ns / 1000.0 / STRESS_SET_COUNT);
+
+exit_failed:
+	tut8_free_descriptor_allocators(dev, allocators, STRESS_THREAD_COUNT);
+	free(sets);
+exit_bad_malloc:
+	if (!tut1_error_is_success(&retval))
+		tut1_error_printf(&retval, "Descriptor set allocation stress test failed\n");
+}
+
 static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, struct tut2_device *dev,
 		struct tut6_swapchain *swapchain, struct tut7_render_essentials *essentials, struct render_data *render_data)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
 
 	/*
 	 * Here, we're finally going to use the tut7.c functions, that got all sorts of resources for us.  You should
@@ -172,7 +344,8 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 
 	/*
 	 * Now we need to copy our data over to the buffer memories.  We saw how this was done in Tutorial 4; map the
-	 * memory, write the contents, unmap the memory.
+	 * memory, write the contents, unmap the memory.  The buffers are host-visible, so tut7_create_buffers() has
+	 * already mapped them and left them mapped, and only writing the contents remains.
 	 */
 	retval = tut8_render_fill_buffer(dev, &render_data->buffers[BUFFER_VERTICES_STAGING], render_data->vertices, sizeof render_data->vertices, "staging vertex");
 	if (!tut1_error_is_success(&retval))
@@ -236,23 +409,18 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 
 	/*
 	 * The depth/stencil image created by tut7_create_graphics_buffers is in UNDEFINED format, and we need to
-	 * transition it to the DEPTH_STENCIL_OPTIMAL format before we can actually use it.
+	 * transition it to the DEPTH_STENCIL_OPTIMAL format before we can actually use it.  Instead of submitting a
+	 * command buffer and waiting for it just for that, the transition is recorded in the first frame's command
+	 * buffer; see render_loop().
 	 */
-	for (uint32_t i = 0; i < essentials->image_count; ++i)
-	{
-		retval = tut8_render_transition_images(dev, essentials, &render_data->gbuffers[i].depth, 1,
-				VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-				VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, "depth");
-		if (!tut1_error_is_success(&retval))
-			return retval;
-	}
 
 	/*
 	 * Now that we have our resources, we need to specify the layout in which they will be placed, so the shaders
 	 * can pick them up.  tut8_make_graphics_layouts makes the layout for us, and it automatically assigns the
-	 * images and buffers to sequential bindings all in the same set.
+	 * images and buffers to sequential bindings all in the same set.  The resources are kept in render_data, as the
+	 * layout refers to them later, for example when making descriptor set allocators for it.
 	 */
-	struct tut8_resources resources = {
+	render_data->resources = (struct tut8_resources){
 		.buffers = render_data->buffers,
 		.buffer_count = 2,
 		.shaders = render_data->shaders,
@@ -260,7 +428,8 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.render_pass = render_data->render_pass,
 	};
 	render_data->layout = (struct tut8_layout){
-		.resources = &resources,
+		.resources = &render_data->resources,
+		.cache = &render_data->layout_cache,
 	};
 	retval = tut8_make_graphics_layouts(dev, &render_data->layout, 1);
 	if (!tut1_error_is_success(&retval))
@@ -269,6 +438,23 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		return retval;
 	}
 
+	/*
+	 * The layout is looked up in a layout cache, so that identical layouts share the same handles.  With a single
+	 * layout there is nothing to share, so let's see the cache at work by making another layout from the same
+	 * resources.  It should end up with the very same VkDescriptorSetLayout and VkPipelineLayout.  It's freed
+	 * right away, and the cache keeps the handles alive for the first layout.
+	 */
+	struct tut8_layout twin = render_data->layout;
+	retval = tut8_make_graphics_layouts(dev, &twin, 1);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create the second descriptor set or pipeline layout\n");
+		return retval;
+	}
+	if (twin.pipeline_layout != render_data->layout.pipeline_layout || twin.set_layout != render_data->layout.set_layout)
+		printf("Warning: the layout cache did not share identical layouts\n");
+	tut8_free_layouts(dev, &twin, 1);
+
 	/*
 	 * Finally, we can create the pipeline.  We are doing single threaded rendering for now, so the thread count is
 	 * just 1.  There are a set of states we need to define for our pipeline, which tut8_make_graphics_pipelines
@@ -321,8 +507,29 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO,
 		},
 		.thread_count = 1,
+		.cache = &render_data->pipeline_cache,
 	};
 
+	/*
+	 * The pipeline is taken from a pipeline cache (see tut8_pipeline_cache in tut8.h).  With one pipeline, there
+	 * is not much to cache of course, but it shows how it's used.  As soon as everything the pipeline needs is
+	 * known, it can be "prepared", which starts compiling it in the background.  The application can then do
+	 * other things, and tut8_make_graphics_pipelines() finds it in the cache later.
+	 */
+	retval = tut8_create_pipeline_cache(dev, &render_data->pipeline_cache);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create pipeline cache\n");
+		return retval;
+	}
+
+	retval = tut8_prepare_graphics_pipelines(dev, &render_data->pipeline, 1);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not prepare graphics pipeline\n");
+		return retval;
+	}
+
 	retval = tut8_make_graphics_pipelines(dev, &render_data->pipeline, 1);
 	if (!tut1_error_is_success(&retval))
 	{
@@ -330,20 +537,40 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		return retval;
 	}
 
+	/*
+	 * Asking for the very same pipeline again should be a hit in the cache, and give back the same VkPipeline
+	 * without compiling anything.  That's what happens when many objects are drawn the same way.  The second
+	 * tut8_pipeline needs no descriptor set allocators, so its thread_count is 0.  Freeing it leaves the VkPipeline
+	 * alone, as it belongs to the cache.
+	 */
+	uint64_t hits = render_data->pipeline_cache.hits;
+	struct tut8_pipeline again = render_data->pipeline;
+	again.thread_count = 0;
+	retval = tut8_make_graphics_pipelines(dev, &again, 1);
+	if (!tut1_error_is_success(&retval))
+	{
+		tut1_error_printf(&retval, "Could not create the graphics pipeline a second time\n");
+		return retval;
+	}
+	if (render_data->pipeline_cache.hits != hits + 1 || again.pipeline != render_data->pipeline.pipeline)
+		printf("Warning: the pipeline cache did not find the identical pipeline\n");
+	tut8_free_pipelines(dev, &again, 1);
+
+	printf("Pipeline cache: %llu hits, %llu misses, %llu compiled in the background (%llu waited for), %.2fms spent compiling\n",
+			(unsigned long long)render_data->pipeline_cache.hits,
+			(unsigned long long)render_data->pipeline_cache.misses,
+			(unsigned long long)render_data->pipeline_cache.background_compiles,
+			(unsigned long long)render_data->pipeline_cache.waits,
+			render_data->pipeline_cache.compile_time_ns / 1000000.0);
+
 	/*
 	 * Are we there yet?  Almost.  We just need to allocate our descriptor set like in Tutorial 4 and bind our
-	 * resources (only the transformation matrix in this case) to it.
+	 * resources (only the transformation matrix in this case) to it.  Instead of allocating from a pool directly,
+	 * the set is allocated through the descriptor set allocator of the pipeline (for thread 0, being the only
+	 * thread), which takes care of creating more pools if needed.
 	 */
-	VkDescriptorSetAllocateInfo set_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->layout.set_layout,
-	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->pipeline.set_allocators[0], &render_data->desc_set, 1);
+	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Could not allocate descriptor set from pool\n");
 		return retval;
@@ -381,7 +608,9 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	vkDeviceWaitIdle(dev->device);
 
 	tut8_free_pipelines(dev, &render_data->pipeline, 1);
+	tut8_free_pipeline_cache(dev, &render_data->pipeline_cache);
 	tut8_free_layouts(dev, &render_data->layout, 1);
+	tut8_free_layout_cache(dev, &render_data->layout_cache);
 	tut7_free_buffers(dev, render_data->buffers, 2);	/* Note: BUFFER_VERTICES_STAGING is already freed */
 	tut7_free_shaders(dev, render_data->shaders, 2);
 	tut7_free_graphics_buffers(dev, render_data->gbuffers, essentials->image_count, render_data->render_pass);
@@ -389,7 +618,8 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	free(render_data->gbuffers);
 }
 
-static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut6_swapchain *swapchain)
+static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device *dev, struct tut6_swapchain *swapchain,
+		bool descriptor_stress, bool update_cost)
 {
 	int res;
 	tut1_error retval = TUT1_ERROR_NONE;
@@ -407,8 +637,24 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 	if (!tut1_error_is_success(&retval))
 		goto exit_bad_render_data;
 
+	/* If asked for, stress the descriptor set allocator with the layout of this tutorial instead of rendering */
+	if (descriptor_stress)
+	{
+		stress_descriptor_allocator(dev, &render_data.layout);
+		goto exit_bad_render_data;
+	}
+
+	/* Similarly, if asked for, measure the cost of updating the transformation buffer instead of rendering */
+	if (update_cost)
+	{
+		measure_update_cost(phy_dev, dev, &render_data.buffers[BUFFER_TRANSFORMATION], &render_data.transformation,
+				sizeof render_data.transformation);
+		goto exit_bad_render_data;
+	}
+
 	unsigned int frames = 0;
 	time_t before = time(NULL);
+	bool depth_transitioned = false;
 
 	/* Process events from SDL and render.  If process_events returns non-zero, it signals application exit. */
 	while (process_events() == 0)
@@ -429,6 +675,23 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		if (res)
 			break;
 
+		/*
+		 * The first frame transitions the depth/stencil images of all swapchain images, not just the one it
+		 * renders to, all with one barrier.  The frames that come later are submitted after this one, so they
+		 * find their depth/stencil images already in the right layout.
+		 */
+		if (!depth_transitioned)
+		{
+			struct tut7_image depth_images[essentials.image_count];
+			for (uint32_t i = 0; i < essentials.image_count; ++i)
+				depth_images[i] = render_data.gbuffers[i].depth;
+
+			tut8_render_record_transition_images(essentials.cmd_buffer, depth_images, essentials.image_count,
+					VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+					VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+			depth_transitioned = true;
+		}
+
 		/*
 		 * As a reminder, tut7_render_start() starts recording in our command buffer, and tut7_render_finish()
 		 * stops it.  **In a real application, you would certainly want to pre-record your command buffers and
@@ -569,16 +832,22 @@ int main(int argc, char **argv)
 	uint32_t dev_count = 1;
 
 	bool no_vsync = false;
+	bool descriptor_stress = false;
+	bool update_cost = false;
 
 	for (int i = 1; i < argc; ++i)
 	{
-		if (strcmp(argv[1], "--help") == 0)
+		if (strcmp(argv[i], "--help") == 0)
 		{
-			printf("Usage: %s [--no-vsync]\n\n", argv[0]);
+			printf("Usage: %s [--no-vsync] [--descriptor-stress] [--update-cost]\n\n", argv[0]);
 			return 0;
 		}
-		if (strcmp(argv[1], "--no-vsync") == 0)
+		if (strcmp(argv[i], "--no-vsync") == 0)
 			no_vsync = true;
+		if (strcmp(argv[i], "--descriptor-stress") == 0)
+			descriptor_stress = true;
+		if (strcmp(argv[i], "--update-cost") == 0)
+			update_cost = true;
 	}
 
 	/* Fire up Vulkan */
@@ -636,7 +905,7 @@ int main(int argc, char **argv)
 	}
 
 	/* Render loop similar to Tutorial 7 */
-	render_loop(&phy_dev, &dev, &swapchain);
+	render_loop(&phy_dev, &dev, &swapchain, descriptor_stress, update_cost);
 
 	retval = 0;
 
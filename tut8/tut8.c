@@ -19,8 +19,154 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "tut8.h"
 
+static uint32_t *get_layout_key(const VkDescriptorSetLayoutBinding *bindings, uint32_t binding_count,
+		const VkPushConstantRange *push_constants, uint32_t push_constant_count, uint32_t *key_size)
+{
+	/*
+	 * The key of a layout is everything that makes it what it is: its bindings and its push constant ranges.  To
+	 * make the key canonical, the bindings are sorted by their binding number, and the push constant ranges by
+	 * their offset, size and stages.  That way, two layouts with the same contents given in a different order
+	 * still end up with the same key.  Immutable samplers are not used in these tutorials, so they are not part of
+	 * the key.
+	 */
+	VkDescriptorSetLayoutBinding sorted_bindings[binding_count];
+	VkPushConstantRange sorted_push_constants[push_constant_count];
+
+	for (uint32_t i = 0; i < binding_count; ++i)
+	{
+		uint32_t j = i;
+		for (; j > 0 && sorted_bindings[j - 1].binding > bindings[i].binding; --j)
+			sorted_bindings[j] = sorted_bindings[j - 1];
+		sorted_bindings[j] = bindings[i];
+	}
+
+	for (uint32_t i = 0; i < push_constant_count; ++i)
+	{
+		const VkPushConstantRange *range = &push_constants[i];
+		uint32_t j = i;
+		for (; j > 0; --j)
+		{
+			const VkPushConstantRange *prev = &sorted_push_constants[j - 1];
+			if (prev->offset < range->offset
+				|| (prev->offset == range->offset && prev->size < range->size)
+				|| (prev->offset == range->offset && prev->size == range->size && prev->stageFlags <= range->stageFlags))
+				break;
+			sorted_push_constants[j] = *prev;
+		}
+		sorted_push_constants[j] = *range;
+	}
+
+	*key_size = 2 + binding_count * 4 + push_constant_count * 3;
+	uint32_t *key = malloc(*key_size * sizeof *key);
+	if (key == NULL)
+		return NULL;
+
+	uint32_t k = 0;
+	key[k++] = binding_count;
+	for (uint32_t i = 0; i < binding_count; ++i)
+	{
+		key[k++] = sorted_bindings[i].binding;
+		key[k++] = sorted_bindings[i].descriptorType;
+		key[k++] = sorted_bindings[i].descriptorCount;
+		key[k++] = sorted_bindings[i].stageFlags;
+	}
+	key[k++] = push_constant_count;
+	for (uint32_t i = 0; i < push_constant_count; ++i)
+	{
+		key[k++] = sorted_push_constants[i].stageFlags;
+		key[k++] = sorted_push_constants[i].offset;
+		key[k++] = sorted_push_constants[i].size;
+	}
+
+	return key;
+}
+
+static uint64_t hash_key(const uint32_t *key, uint32_t key_size)
+{
+	/* FNV-1a, like the sampler cache in tut7.c.  This is used for the pipeline cache as well */
+	const uint8_t *bytes = (const uint8_t *)key;
+	uint64_t hash = 14695981039346656037LLU;
+
+	for (size_t i = 0; i < key_size * sizeof *key; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211LLU;
+
+	return hash;
+}
+
+static struct tut8_shared_layout *find_layout_slot(struct tut8_shared_layout *table, uint32_t table_size, uint64_t hash,
+		const uint32_t *key, uint32_t key_size)
+{
+	/* Open addressing with linear probing, where keys are never removed; see find_sampler_slot() in tut7.c */
+	for (uint32_t i = hash & (table_size - 1);; i = (i + 1) & (table_size - 1))
+	{
+		if (table[i].key == NULL)
+			return &table[i];
+		if (table[i].hash == hash && table[i].key_size == key_size
+				&& memcmp(table[i].key, key, key_size * sizeof *key) == 0)
+			return &table[i];
+	}
+}
+
+static VkResult grow_layout_table(struct tut8_layout_cache *cache)
+{
+	uint32_t new_size = cache->table_size?cache->table_size * 2:16;
+	struct tut8_shared_layout *new_table = calloc(new_size, sizeof *new_table);
+
+	if (new_table == NULL)
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		struct tut8_shared_layout *entry = &cache->layouts[i];
+
+		if (entry->key == NULL)
+			continue;
+
+		*find_layout_slot(new_table, new_size, entry->hash, entry->key, entry->key_size) = *entry;
+	}
+
+	free(cache->layouts);
+	cache->layouts = new_table;
+	cache->table_size = new_size;
+
+	return VK_SUCCESS;
+}
+
+static VkResult find_shared_layout(struct tut8_layout_cache *cache, uint32_t *key, uint32_t key_size, uint64_t hash,
+		struct tut8_shared_layout **cached)
+{
+	/* The key is taken over by the cache, or freed if the cache already has it */
+
+	/* Keep the table at most half full, so the probes stay short */
+	if ((cache->key_count + 1) * 2 > cache->table_size)
+	{
+		VkResult res = grow_layout_table(cache);
+		if (res)
+		{
+			free(key);
+			return res;
+		}
+	}
+
+	*cached = find_layout_slot(cache->layouts, cache->table_size, hash, key, key_size);
+	if ((*cached)->key == NULL)
+	{
+		**cached = (struct tut8_shared_layout){
+			.key = key,
+			.key_size = key_size,
+			.hash = hash,
+		};
+		++cache->key_count;
+	}
+	else
+		free(key);
+
+	return VK_SUCCESS;
+}
+
 tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layout *layouts, uint32_t layout_count)
 {
 	/*
@@ -35,10 +181,14 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 	for (uint32_t i = 0; i < layout_count; ++i)
 	{
 		struct tut8_layout *layout = &layouts[i];
+		struct tut8_layout_cache *cache = layout->cache;
 		struct tut8_resources *resources = layout->resources;
+		struct tut8_shared_layout own = {0};
+		struct tut8_shared_layout *cached = &own;
 
 		layout->set_layout = NULL;
 		layout->pipeline_layout = NULL;
+		layout->key_hash = 0;
 
 		/*
 		 * In Tutorial 3, we have already seen how to create descriptor set layouts and pipeline layouts.  The
@@ -119,11 +269,19 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 			 *
 			 * The `descriptorCount` is again 1 here as we ignore array types.  `stageFlags` is also
 			 * provided as input similar to images.
+			 *
+			 * On second thought, dynamic uniform buffers are not ignored after all.  If a uniform buffer
+			 * is marked `dynamic`, the offset into the buffer is given when binding the descriptor set.
+			 * That lets many draws (or frames) use different parts of the same buffer with the same
+			 * descriptor set.  See tut8_uniform_ring in tut8_render.h.
 			 */
+			VkDescriptorType uniform_type = resources->buffers[j].dynamic?
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 			set_layout_bindings[binding_count] = (VkDescriptorSetLayoutBinding){
 				.binding = binding_count,
 				.descriptorType = resources->buffers[j].usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT?
-					VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+					uniform_type:
 					VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				.descriptorCount = 1,
 				.stageFlags = resources->buffers[j].stage,
@@ -132,6 +290,49 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 			++binding_count;
 		}
 
+		/*
+		 * Different tut8_resources often end up with the exact same layout; think of many objects each with a
+		 * texture and a transformation.  Creating a new layout for each of them is wasteful, but more
+		 * importantly, pipelines created with different (even if identical) pipeline layouts are not
+		 * guaranteed to be compatible, so a descriptor set bound for one pipeline may have to be bound again
+		 * after switching to another.  So the layouts are looked up in a cache by what they contain, and
+		 * identical layouts share the same handles.  Then pipelines with identical layouts have the same
+		 * VkPipelineLayout, and a descriptor set stays bound across them.
+		 *
+		 * The cache belongs to the application (like the sampler cache of tut7_create_images()).  A layout
+		 * without one simply gets layouts of its own.  Either way, the hash of the key is kept, so that
+		 * tut8_pipeline_cache can recognize identical layouts by what they contain.
+		 */
+		uint32_t key_size;
+		uint32_t *key = get_layout_key(set_layout_bindings, binding_count, resources->push_constants,
+				resources->push_constant_count, &key_size);
+		if (key == NULL)
+		{
+			tut1_error_sub_set_errno(&retval, errno);
+			continue;
+		}
+		layout->key_hash = hash_key(key, key_size);
+
+		if (cache == NULL)
+			free(key);
+		else
+		{
+			res = find_shared_layout(cache, key, key_size, layout->key_hash, &cached);
+			tut1_error_sub_set_vkresult(&retval, res);
+			if (res)
+				continue;
+
+			/* If an identical layout is already alive, just take a reference to it */
+			if (cached->ref_count > 0)
+			{
+				++cached->ref_count;
+				layout->set_layout = cached->set_layout;
+				layout->pipeline_layout = cached->pipeline_layout;
+				++successful;
+				continue;
+			}
+		}
+
 		/*
 		 * Creating a descriptor set layout is done by simply declaring all the bindings.  We already saw this
 		 * in Tutorial 3.
@@ -142,7 +343,7 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 			.pBindings = set_layout_bindings,
 		};
 
-		res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &layout->set_layout);
+		res = vkCreateDescriptorSetLayout(dev->device, &set_layout_info, NULL, &cached->set_layout);
 		tut1_error_sub_set_vkresult(&retval, res);
 		if (res)
 			continue;
@@ -156,15 +357,23 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 		VkPipelineLayoutCreateInfo pipeline_layout_info = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 			.setLayoutCount = 1,
-			.pSetLayouts = &layout->set_layout,
+			.pSetLayouts = &cached->set_layout,
 			.pushConstantRangeCount = resources->push_constant_count,
 			.pPushConstantRanges = resources->push_constants,
 		};
 
-		res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &layout->pipeline_layout);
+		res = vkCreatePipelineLayout(dev->device, &pipeline_layout_info, NULL, &cached->pipeline_layout);
 		tut1_error_sub_set_vkresult(&retval, res);
 		if (res)
+		{
+			vkDestroyDescriptorSetLayout(dev->device, cached->set_layout, NULL);
+			cached->set_layout = NULL;
 			continue;
+		}
+
+		cached->ref_count = 1;
+		layout->set_layout = cached->set_layout;
+		layout->pipeline_layout = cached->pipeline_layout;
 
 		++successful;
 	}
@@ -173,314 +382,1327 @@ tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layou
 	return retval;
 }
 
-tut1_error tut8_make_graphics_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+static VkResult add_descriptor_pool(struct tut2_device *dev, struct tut8_descriptor_allocator *allocator)
 {
-	/*
-	 * Each pipeline we create is going to have a set of shaders bound to it.  This means that if in one scene you
-	 * are going to render objects with different shaders, you would need a separate pipeline for each part of that
-	 * scene.
-	 *
-	 * To create descriptor sets, we need to know what resources will be used by the pipeline and assign correct
-	 * bindings to them.  The tut8_resources struct describes what images, buffers and shaders are going to be
-	 * used.  The buffers should not include index, vertex, and indirect ones as they are bound with special
-	 * commands (more on this later).
-	 */
-	uint32_t successful = 0;
-	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
-
-	for (uint32_t i = 0; i < pipeline_count; ++i)
+	uint32_t max_sets = allocator->sets_per_pool;
+	if (allocator->pool_count > 0)
 	{
-		struct tut8_pipeline *pipeline = &pipelines[i];
-		struct tut8_layout *layout = pipeline->layout;
-		struct tut8_resources *resources = layout->resources;
+		max_sets = allocator->pools[allocator->pool_count - 1].max_sets * 2;
+		if (max_sets > TUT8_MAX_SETS_PER_POOL)
+			max_sets = TUT8_MAX_SETS_PER_POOL;
+	}
 
-		pipeline->pipeline = NULL;
-		pipeline->set_pool = NULL;
+	struct tut8_descriptor_pool *pools = realloc(allocator->pools, (allocator->pool_count + 1) * sizeof *pools);
+	if (pools == NULL)
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	allocator->pools = pools;
 
-		VkGraphicsPipelineCreateInfo pipeline_info;
+	VkDescriptorPoolSize pool_sizes[5];
+	for (uint32_t i = 0; i < allocator->set_size_count; ++i)
+		pool_sizes[i] = (VkDescriptorPoolSize){
+			.type = allocator->set_sizes[i].type,
+			.descriptorCount = allocator->set_sizes[i].descriptorCount * max_sets,
+		};
 
-		/*
-		 * For each stage of the pipeline, one shader must be specified, with some stages being optional (such
-		 * as geometry and tessellation).  Here, we'll trust the user has provided the shaders in the
-		 * `resources` correctly, and we'll create the pipeline stages correspondingly.  Like in Tutorial 3,
-		 * we'll just assume the shader entry point is `main`.
-		 */
-		bool has_tessellation_shader = false;
-		VkPipelineShaderStageCreateInfo stage_info[resources->shader_count];
-		for (uint32_t j = 0; j < resources->shader_count; ++j)
-		{
-			struct tut7_shader *shader = &resources->shaders[j];
+	VkDescriptorPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = max_sets,
+		.poolSizeCount = allocator->set_size_count,
+		.pPoolSizes = pool_sizes,
+	};
 
-			stage_info[j] = (VkPipelineShaderStageCreateInfo){
-				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-				.stage = shader->stage,
-				.module = shader->shader,
-				.pName = "main",
-			};
-			if (shader->stage == VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT || shader->stage == VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT)
-				has_tessellation_shader = true;
-		}
+	struct tut8_descriptor_pool *pool = &allocator->pools[allocator->pool_count];
+	*pool = (struct tut8_descriptor_pool){
+		.max_sets = max_sets,
+	};
 
-		/*
-		 * The stages of the pipeline as computed above are specified, as well as the pipeline layout, the
-		 * render pass describing attachments to the pipeline and the subpass the pipeline would be used in
-		 * (of which we have only one).
-		 *
-		 * Aside from all this, there is a load of "state" information required to define the graphics
-		 * pipeline.  Most of these states are heavily dependent on the actual program, so we'll just take them
-		 * as input and leave their definition to `main()` unless otherwise specified.
-		 *
-		 * - vertex input: this defines vertex input information.  When recording a command buffer, a vertex
-		 *   buffer is bound to provide the actual vertices to the vertex shader.  When creating the graphics
-		 *   pipeline, we need to specify how the buffer contents translate to shader inputs.  For example,
-		 *   take the following glsl declaration:
-		 *
-		 *         layout(location=0) in vec3 in_position;
-		 *         layout(location=1) in vec2 in_texture;
-		 *
-		 *   Then the elements of our vertex buffer would look something like this:
-		 *
-		 *         struct vertex
-		 *         {
-		 *             float position[3];
-		 *             float texture[2];
-		 *         };
-		 *
-		 *   For the pipeline creation therefore, we need to specify that there is going to be 1 vertex buffer
-		 *   (containing both data; this is just an example and there are alternative ways), that each element
-		 *   is `sizeof(struct vertex)` bytes apart, that the input at the first location is `0` bytes into the
-		 *   element while the input at the second location is `sizeof(float[3])` bytes into the element, and
-		 *   what are the formats of the data.
-		 *
-		 * - input assembly: this defines how the vertices are combined to draw shapes.  From OpenGL, you are
-		 *   likely familiar with Points, Lines, Triangles, Triangle Strips, Triangle Fans etc.  These shapes
-		 *   are either disjoint (which Vulkan refers to as a "list" of shapes), or overlap in vertices.  In
-		 *   the later case, if the vertices are accessed using an index list, a special index (0xFFFFFFFF or
-		 *   0xFFFF depending on index size) can be used to restart the shape from that point on.  For example,
-		 *   if you have three triangle fans to draw, you can either bind a vertex buffer, draw a triangle fan,
-		 *   and repeat for the other two, or bind one buffer and use the special index in between the three
-		 *   triangle fan sequence of vertices to get three separate triangle fans all in one go.
-		 *
-		 * - tessellation state: if tessellation shader is used, this defines the number of control points per
-		 *   patch.
-		 *
-		 * - viewport state: this specifies what viewports and scissors are to be used for rendering.  We have
-		 *   the option to make this dynamic, so let's do that and worry about it later.  We still need to
-		 *   specify how many viewports and scissors will be used.
-		 *
-		 * - rasterization state: this controls some knobs on the rasterization automatically done by the
-		 *   device, including which triangle face to draw, whether to fill them or draw them wireframe, what
-		 *   line width to use etc.  We can find sensible values for these, so we'll assume them already.
-		 *
-		 * - multisample state: we are not using multisampling yet, and we'll specify that here.
-		 *
-		 * - depth stencil state: this controls behavior of depth and stencil tests automatically done by the
-		 *   device, such as whether they are enabled and how to compare the values.  Depth testing is good, so
-		 *   let's enable that.  Stencil is nice too, but unnecessary for now, so we'll keep that disabled.
-		 *   Note that if the depth/stencil attachment is not provided, the depth test always passes, so we can
-		 *   always disable depth testing in the future by simply not providing an attachment for it.
-		 *
-		 * - color blend state: if we had multiple color attachments, here is where we would define how all of
-		 *   them get blended to create the final image.  We're using only one color attachment however, so we
-		 *   will just set some defaults for it to not do anything.
-		 *
-		 * Below, we have specified as much information as possible, leaving two details to dynamic setting;
-		 * viewports and scissors.  We must explicitly specify that these parameters are dynamically set when
-		 * recording the command buffer, and they should in fact be set at that time.
-		 */
-		VkPipelineViewportStateCreateInfo viewport_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-			.viewportCount = 1,
-			.scissorCount = 1,
-		};
-		VkPipelineRasterizationStateCreateInfo rasterization_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-			.polygonMode = VK_POLYGON_MODE_FILL,
-			.cullMode = VK_CULL_MODE_BACK_BIT,
-			.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
-			.lineWidth = 1,
-		};
-		VkPipelineMultisampleStateCreateInfo multisample_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-			.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-		};
-		VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-			.depthTestEnable = true,
-			.depthWriteEnable = true,
-			.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL,
-		};
-		VkPipelineColorBlendAttachmentState color_blend_attachments[1] = {
-			[0] = {
-				.blendEnable = false,
-				.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-						| VK_COLOR_COMPONENT_G_BIT
-						| VK_COLOR_COMPONENT_B_BIT
-						| VK_COLOR_COMPONENT_A_BIT,
-			},
-		};
-		VkPipelineColorBlendStateCreateInfo color_blend_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-			.attachmentCount = 1,
-			.pAttachments = color_blend_attachments,
-		};
-		VkDynamicState dynamic_states[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
-		VkPipelineDynamicStateCreateInfo dynamic_state = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-			.dynamicStateCount = 2,
-			.pDynamicStates = dynamic_states,
-		};
+	VkResult res = vkCreateDescriptorPool(dev->device, &pool_info, NULL, &pool->pool);
+	if (res)
+		return res;
 
-		pipeline_info = (VkGraphicsPipelineCreateInfo){
-			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-			.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT,
-			.stageCount = resources->shader_count,
-			.pStages = stage_info,
-			.pVertexInputState = &pipeline->vertex_input_state,
-			.pInputAssemblyState = &pipeline->input_assembly_state,
-			.pTessellationState = has_tessellation_shader?&pipeline->tessellation_state:NULL,
-			.pViewportState = &viewport_state,
-			.pRasterizationState = &rasterization_state,
-			.pMultisampleState = &multisample_state,
-			.pDepthStencilState = &depth_stencil_state,
-			.pColorBlendState = &color_blend_state,
-			.pDynamicState = &dynamic_state,
-			.layout = layout->pipeline_layout,
-			.renderPass = resources->render_pass,
-			.subpass = 0,
-			.basePipelineIndex = 0,
-		};
+	++allocator->pool_count;
+	return VK_SUCCESS;
+}
 
-		/*
-		 * We can now make the pipeline.  In a scene, you may have a handful of different pipelines, and we may
-		 * have other pipelines in other scenes too.  That's a lot of pipelines!  One might think, big deal,
-		 * it's just during startup anyway.  But it seems that it could be a big deal.  There are many objects
-		 * we have to make a lot of, but Vulkan has the idea that creating pipelines in particular is
-		 * expensive.
-		 *
-		 * Vulkan offers a way to avoid rebuilding pipelines, called a Pipeline Cache.  The short version of it
-		 * is that you create a pipeline cache, give it to `vkCreateGraphicsPipelines` which adds built
-		 * pipelines to the cache.  Once done, you store the cache in file.  On next startup, you load the
-		 * cache from file and give it to `vkCreateGraphicsPipelines` which in turn uses it to recover
-		 * already-built pipelines when possible.  There are features in place to take care of versions, change
-		 * of graphics card or driver etc (in either case the cache is invalidated, the pipeline is rebuilt and
-		 * the cache is updated).  By all means, use the pipeline cache!  But it's of little interest to us
-		 * here.  The second argument to `vkCreateGraphicsPipelines` is the pipeline cache.
-		 */
-		res = vkCreateGraphicsPipelines(dev->device, NULL, 1, &pipeline_info, NULL, &pipeline->pipeline);
-		tut1_error_sub_set_vkresult(&retval, res);
-		if (res)
-			continue;
+/*
+ * Everything a graphics pipeline is created from, copied out of a tut8_pipeline.  The limits are the minimum
+ * guaranteed by Vulkan.
+ */
+#define MAX_SHADER_STAGES 5
+#define MAX_VERTEX_BINDINGS 16
+#define MAX_VERTEX_ATTRIBUTES 16
 
-		/*
-		 * Just like in Tutorial 4, we will create a descriptor set pool to allocate the descriptor sets out
-		 * of.  As a reminder, when creating a descriptor pool, we need to specify how many sets can be
-		 * allocated from it (which is thread_count in this case), and for each resource type, how many
-		 * resources of that type can be allocated in total (which is thread_count*R_i where R_i is the number
-		 * of resources we have of some type T_i).
-		 *
-		 * The following code makes the same assumptions as in `tut8_make_graphics_layouts` regarding which
-		 * resources to count, as those are the resources described in the layout.  We had decided to only
-		 * allow combined image samplers, storage images, uniform buffers and storage buffers, so we have four
-		 * resource types to count.
-		 *
-		 * Note: we have so far used the same set of resources for defining descriptor sets for all threads.
-		 * It is important to make sure the threads actually have synchronized access to the resources if they
-		 * are really shared.  For example, if there is one uniform buffer that contains the transformation
-		 * matrices, then one thread shouldn't be updating it while another is using it.  Such resources need
-		 * to be made sure they are exclusively used.  An alternative solution is to make thread_count copies
-		 * of that resource, even though only one of those copies is specified here for the sake of layout and
-		 * pool creations.  Resources that don't need to be updated, for example a texture, can be safely
-		 * shared between threads, as long as the queue families sharing the resource are specified at
-		 * creation time.
-		 */
-		uint32_t image_sampler_count = 0;
-		uint32_t storage_image_count = 0;
-		uint32_t uniform_buffer_count = 0;
-		uint32_t storage_buffer_count = 0;
+struct tut8_pipeline_state
+{
+	VkPipelineShaderStageCreateInfo stages[MAX_SHADER_STAGES];
+	uint64_t spirv_hashes[MAX_SHADER_STAGES];	/* what the modules of `stages` are made from */
+	uint32_t stage_count;
+	bool has_tessellation_shader;
 
-		for (uint32_t j = 0; j < resources->image_count; ++j)
-		{
-			if ((resources->images[j].usage & VK_IMAGE_USAGE_SAMPLED_BIT))
-				++image_sampler_count;
-			else if ((resources->images[j].usage & VK_IMAGE_USAGE_SAMPLED_BIT))
-				++storage_image_count;
-		}
+	VkVertexInputBindingDescription vertex_bindings[MAX_VERTEX_BINDINGS];
+	uint32_t vertex_binding_count;
+	VkVertexInputAttributeDescription vertex_attributes[MAX_VERTEX_ATTRIBUTES];
+	uint32_t vertex_attribute_count;
 
-		for (uint32_t j = 0; j < resources->buffer_count; ++j)
+	VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+	VkPipelineTessellationStateCreateInfo tessellation_state;
+
+	VkPipelineLayout layout;
+	uint64_t layout_hash;
+	VkRenderPass render_pass;
+};
+
+static VkResult get_pipeline_state(struct tut8_pipeline *pipeline, struct tut8_pipeline_state *state)
+{
+	struct tut8_resources *resources = pipeline->layout->resources;
+	const VkPipelineVertexInputStateCreateInfo *vertex_input = &pipeline->vertex_input_state;
+
+	if (resources->shader_count > MAX_SHADER_STAGES
+			|| vertex_input->vertexBindingDescriptionCount > MAX_VERTEX_BINDINGS
+			|| vertex_input->vertexAttributeDescriptionCount > MAX_VERTEX_ATTRIBUTES)
+		return VK_ERROR_TOO_MANY_OBJECTS;
+
+	/*
+	 * The stages, vertex bindings and vertex attributes are kept sorted (by stage, binding and location
+	 * respectively).  The order they are given in makes no difference to Vulkan, so this way two pipelines that are
+	 * the same but listed their shaders in a different order are recognized as the same by tut8_pipeline_cache.
+	 */
+	*state = (struct tut8_pipeline_state){
+		.stage_count = resources->shader_count,
+		.vertex_binding_count = vertex_input->vertexBindingDescriptionCount,
+		.vertex_attribute_count = vertex_input->vertexAttributeDescriptionCount,
+		.input_assembly_state = pipeline->input_assembly_state,
+		.tessellation_state = pipeline->tessellation_state,
+		.layout = pipeline->layout->pipeline_layout,
+		.layout_hash = pipeline->layout->key_hash,
+		.render_pass = resources->render_pass,
+	};
+
+	/*
+	 * For each stage of the pipeline, one shader must be specified, with some stages being optional (such
+	 * as geometry and tessellation).  Here, we'll trust the user has provided the shaders in the
+	 * `resources` correctly, and we'll create the pipeline stages correspondingly.  Like in Tutorial 3,
+	 * we'll just assume the shader entry point is `main`.
+	 */
+	for (uint32_t i = 0; i < resources->shader_count; ++i)
+	{
+		struct tut7_shader *shader = &resources->shaders[i];
+		uint32_t j = i;
+
+		for (; j > 0 && state->stages[j - 1].stage > shader->stage; --j)
 		{
-			if ((resources->buffers[j].usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT))
-				++uniform_buffer_count;
-			else if ((resources->buffers[j].usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
-				++storage_buffer_count;
+			state->stages[j] = state->stages[j - 1];
+			state->spirv_hashes[j] = state->spirv_hashes[j - 1];
 		}
+		state->spirv_hashes[j] = shader->spirv_hash;
+		state->stages[j] = (VkPipelineShaderStageCreateInfo){
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = shader->stage,
+			.module = shader->shader,
+			.pName = "main",
+		};
+		if (shader->stage == VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT || shader->stage == VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT)
+			state->has_tessellation_shader = true;
+	}
 
-		uint32_t pool_size_count = 0;
-		VkDescriptorPoolSize pool_sizes[4];
-		if (image_sampler_count > 0)
-			pool_sizes[pool_size_count++] = (VkDescriptorPoolSize){
-				.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				.descriptorCount = pipeline->thread_count * image_sampler_count,
-			};
+	for (uint32_t i = 0; i < state->vertex_binding_count; ++i)
+	{
+		const VkVertexInputBindingDescription *binding = &vertex_input->pVertexBindingDescriptions[i];
+		uint32_t j = i;
 
-		if (storage_image_count > 0)
-			pool_sizes[pool_size_count++] = (VkDescriptorPoolSize){
-				.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-				.descriptorCount = pipeline->thread_count * storage_image_count,
-			};
+		for (; j > 0 && state->vertex_bindings[j - 1].binding > binding->binding; --j)
+			state->vertex_bindings[j] = state->vertex_bindings[j - 1];
+		state->vertex_bindings[j] = *binding;
+	}
 
-		if (uniform_buffer_count > 0)
-			pool_sizes[pool_size_count++] = (VkDescriptorPoolSize){
-				.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				.descriptorCount = pipeline->thread_count * uniform_buffer_count,
-			};
+	for (uint32_t i = 0; i < state->vertex_attribute_count; ++i)
+	{
+		const VkVertexInputAttributeDescription *attribute = &vertex_input->pVertexAttributeDescriptions[i];
+		uint32_t j = i;
 
-		if (storage_buffer_count > 0)
-			pool_sizes[pool_size_count++] = (VkDescriptorPoolSize){
-				.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				.descriptorCount = pipeline->thread_count * storage_image_count,
-			};
+		for (; j > 0 && state->vertex_attributes[j - 1].location > attribute->location; --j)
+			state->vertex_attributes[j] = state->vertex_attributes[j - 1];
+		state->vertex_attributes[j] = *attribute;
+	}
 
-		VkDescriptorPoolCreateInfo set_info = {
-			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-			.maxSets = pipeline->thread_count,
-			.poolSizeCount = pool_size_count,
-			.pPoolSizes = pool_sizes,
-		};
+	/* These are used as is, so make sure they don't point to anything */
+	state->input_assembly_state.pNext = NULL;
+	state->tessellation_state.pNext = NULL;
 
-		res = vkCreateDescriptorPool(dev->device, &set_info, NULL, &pipeline->set_pool);
-		tut1_error_sub_set_vkresult(&retval, res);
-		if (res)
-			continue;
+	return VK_SUCCESS;
+}
 
-		++successful;
+static VkResult compile_pipeline(struct tut2_device *dev, VkPipelineCache vk_cache, const struct tut8_pipeline_state *state,
+		VkPipeline *pipeline)
+{
+	VkPipelineVertexInputStateCreateInfo vertex_input_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = state->vertex_binding_count,
+		.pVertexBindingDescriptions = state->vertex_bindings,
+		.vertexAttributeDescriptionCount = state->vertex_attribute_count,
+		.pVertexAttributeDescriptions = state->vertex_attributes,
+	};
+
+	/*
+	 * The stages of the pipeline as computed above are specified, as well as the pipeline layout, the
+	 * render pass describing attachments to the pipeline and the subpass the pipeline would be used in
+	 * (of which we have only one).
+	 *
+	 * Aside from all this, there is a load of "state" information required to define the graphics
+	 * pipeline.  Most of these states are heavily dependent on the actual program, so we'll just take them
+	 * as input and leave their definition to `main()` unless otherwise specified.
+	 *
+	 * - vertex input: this defines vertex input information.  When recording a command buffer, a vertex
+	 *   buffer is bound to provide the actual vertices to the vertex shader.  When creating the graphics
+	 *   pipeline, we need to specify how the buffer contents translate to shader inputs.  For example,
+	 *   take the following glsl declaration:
+	 *
+	 *         layout(location=0) in vec3 in_position;
+	 *         layout(location=1) in vec2 in_texture;
+	 *
+	 *   Then the elements of our vertex buffer would look something like this:
+	 *
+	 *         struct vertex
+	 *         {
+	 *             float position[3];
+	 *             float texture[2];
+	 *         };
+	 *
+	 *   For the pipeline creation therefore, we need to specify that there is going to be 1 vertex buffer
+	 *   (containing both data; this is just an example and there are alternative ways), that each element
+	 *   is `sizeof(struct vertex)` bytes apart, that the input at the first location is `0` bytes into the
+	 *   element while the input at the second location is `sizeof(float[3])` bytes into the element, and
+	 *   what are the formats of the data.
+	 *
+	 * - input assembly: this defines how the vertices are combined to draw shapes.  From OpenGL, you are
+	 *   likely familiar with Points, Lines, Triangles, Triangle Strips, Triangle Fans etc.  These shapes
+	 *   are either disjoint (which Vulkan refers to as a "list" of shapes), or overlap in vertices.  In
+	 *   the later case, if the vertices are accessed using an index list, a special index (0xFFFFFFFF or
+	 *   0xFFFF depending on index size) can be used to restart the shape from that point on.  For example,
+	 *   if you have three triangle fans to draw, you can either bind a vertex buffer, draw a triangle fan,
+	 *   and repeat for the other two, or bind one buffer and use the special index in between the three
+	 *   triangle fan sequence of vertices to get three separate triangle fans all in one go.
+	 *
+	 * - tessellation state: if tessellation shader is used, this defines the number of control points per
+	 *   patch.
+	 *
+	 * - viewport state: this specifies what viewports and scissors are to be used for rendering.  We have
+	 *   the option to make this dynamic, so let's do that and worry about it later.  We still need to
+	 *   specify how many viewports and scissors will be used.
+	 *
+	 * - rasterization state: this controls some knobs on the rasterization automatically done by the
+	 *   device, including which triangle face to draw, whether to fill them or draw them wireframe, what
+	 *   line width to use etc.  We can find sensible values for these, so we'll assume them already.
+	 *
+	 * - multisample state: we are not using multisampling yet, and we'll specify that here.
+	 *
+	 * - depth stencil state: this controls behavior of depth and stencil tests automatically done by the
+	 *   device, such as whether they are enabled and how to compare the values.  Depth testing is good, so
+	 *   let's enable that.  Stencil is nice too, but unnecessary for now, so we'll keep that disabled.
+	 *   Note that if the depth/stencil attachment is not provided, the depth test always passes, so we can
+	 *   always disable depth testing in the future by simply not providing an attachment for it.
+	 *
+	 * - color blend state: if we had multiple color attachments, here is where we would define how all of
+	 *   them get blended to create the final image.  We're using only one color attachment however, so we
+	 *   will just set some defaults for it to not do anything.
+	 *
+	 * Below, we have specified as much information as possible, leaving two details to dynamic setting;
+	 * viewports and scissors.  We must explicitly specify that these parameters are dynamically set when
+	 * recording the command buffer, and they should in fact be set at that time.
+	 */
+	VkPipelineViewportStateCreateInfo viewport_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1,
+	};
+	VkPipelineRasterizationStateCreateInfo rasterization_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_BACK_BIT,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.lineWidth = 1,
+	};
+	VkPipelineMultisampleStateCreateInfo multisample_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+	VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = true,
+		.depthWriteEnable = true,
+		.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL,
+	};
+	VkPipelineColorBlendAttachmentState color_blend_attachments[1] = {
+		[0] = {
+			.blendEnable = false,
+			.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+					| VK_COLOR_COMPONENT_G_BIT
+					| VK_COLOR_COMPONENT_B_BIT
+					| VK_COLOR_COMPONENT_A_BIT,
+		},
+	};
+	VkPipelineColorBlendStateCreateInfo color_blend_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = color_blend_attachments,
+	};
+	VkDynamicState dynamic_states[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+	VkPipelineDynamicStateCreateInfo dynamic_state = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = 2,
+		.pDynamicStates = dynamic_states,
+	};
+
+	VkGraphicsPipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT,
+		.stageCount = state->stage_count,
+		.pStages = state->stages,
+		.pVertexInputState = &vertex_input_state,
+		.pInputAssemblyState = &state->input_assembly_state,
+		.pTessellationState = state->has_tessellation_shader?&state->tessellation_state:NULL,
+		.pViewportState = &viewport_state,
+		.pRasterizationState = &rasterization_state,
+		.pMultisampleState = &multisample_state,
+		.pDepthStencilState = &depth_stencil_state,
+		.pColorBlendState = &color_blend_state,
+		.pDynamicState = &dynamic_state,
+		.layout = state->layout,
+		.renderPass = state->render_pass,
+		.subpass = 0,
+		.basePipelineIndex = 0,
+	};
+
+	/*
+	 * We can now make the pipeline.  In a scene, you may have a handful of different pipelines, and we may
+	 * have other pipelines in other scenes too.  That's a lot of pipelines!  One might think, big deal,
+	 * it's just during startup anyway.  But it seems that it could be a big deal.  There are many objects
+	 * we have to make a lot of, but Vulkan has the idea that creating pipelines in particular is
+	 * expensive.
+	 *
+	 * Vulkan offers a way to avoid rebuilding pipelines, called a Pipeline Cache.  The short version of it
+	 * is that you create a pipeline cache, give it to `vkCreateGraphicsPipelines` which adds built
+	 * pipelines to the cache.  Once done, you store the cache in file.  On next startup, you load the
+	 * cache from file and give it to `vkCreateGraphicsPipelines` which in turn uses it to recover
+	 * already-built pipelines when possible.  There are features in place to take care of versions, change
+	 * of graphics card or driver etc (in either case the cache is invalidated, the pipeline is rebuilt and
+	 * the cache is updated).  By all means, use the pipeline cache!  The second argument to
+	 * `vkCreateGraphicsPipelines` is the pipeline cache.  We use one if the pipeline is made through a
+	 * tut8_pipeline_cache (see below), even though we don't store it in a file.
+	 */
+	return vkCreateGraphicsPipelines(dev->device, vk_cache, 1, &pipeline_info, NULL, pipeline);
+}
+
+/* Handles and hashes are put in the key as two 32-bit values, whether the handle is a pointer or a 64-bit integer */
+#define KEY_64BIT(key, k, h)					\
+do {								\
+	uint64_t value_ = 0;					\
+	memcpy(&value_, &(h), sizeof (h));			\
+	(key)[(k)++] = (uint32_t)value_;			\
+	(key)[(k)++] = (uint32_t)(value_ >> 32);		\
+} while (0)
+
+static uint32_t *get_pipeline_key(const struct tut8_pipeline_state *state, uint32_t *key_size)
+{
+	/*
+	 * Like the layout key, the pipeline key is a flat list of everything in the state.  Pointers (such as pName of
+	 * the stages) are not part of it, only what they point to would be, and the entry point is always `main`
+	 * anyway.  The state is already canonical, since get_pipeline_state() sorts everything that can be listed in
+	 * any order.
+	 *
+	 * Handles are not part of the key either where it can be helped.  Once an object is destroyed, its handle can
+	 * be reused for a completely different object, and the cache would then give out a pipeline made for the old
+	 * one.  So the shaders are identified by a hash of their SPIR-V code, and the layout by a hash of its bindings
+	 * and push constants.  Pipelines made with identical layouts can be used with either, so that's all that
+	 * matters.  The render pass is the exception; see tut8_forget_render_pass().
+	 */
+	*key_size = 1 + state->stage_count * 3
+		+ 1 + state->vertex_binding_count * 3
+		+ 1 + state->vertex_attribute_count * 4
+		+ 3 + 1 + 4;
+	uint32_t *key = malloc(*key_size * sizeof *key);
+	if (key == NULL)
+		return NULL;
+
+	uint32_t k = 0;
+	key[k++] = state->stage_count;
+	for (uint32_t i = 0; i < state->stage_count; ++i)
+	{
+		key[k++] = state->stages[i].stage;
+		KEY_64BIT(key, k, state->spirv_hashes[i]);
+	}
+	key[k++] = state->vertex_binding_count;
+	for (uint32_t i = 0; i < state->vertex_binding_count; ++i)
+	{
+		key[k++] = state->vertex_bindings[i].binding;
+		key[k++] = state->vertex_bindings[i].stride;
+		key[k++] = state->vertex_bindings[i].inputRate;
+	}
+	key[k++] = state->vertex_attribute_count;
+	for (uint32_t i = 0; i < state->vertex_attribute_count; ++i)
+	{
+		key[k++] = state->vertex_attributes[i].location;
+		key[k++] = state->vertex_attributes[i].binding;
+		key[k++] = state->vertex_attributes[i].format;
+		key[k++] = state->vertex_attributes[i].offset;
 	}
+	key[k++] = state->input_assembly_state.flags;
+	key[k++] = state->input_assembly_state.topology;
+	key[k++] = state->input_assembly_state.primitiveRestartEnable;
+	key[k++] = state->has_tessellation_shader?state->tessellation_state.patchControlPoints:0;
+	KEY_64BIT(key, k, state->layout_hash);
+	KEY_64BIT(key, k, state->render_pass);
 
-	tut1_error_set_vkresult(&retval, successful == pipeline_count?VK_SUCCESS:VK_INCOMPLETE);
-	return retval;
+	return key;
 }
 
-void tut8_free_layouts(struct tut2_device *dev, struct tut8_layout *layouts, uint32_t layout_count)
+static struct tut8_pipeline_variant **find_variant_slot(struct tut8_pipeline_variant **table, uint32_t table_size,
+		uint64_t hash, const uint32_t *key, uint32_t key_size)
 {
-	vkDeviceWaitIdle(dev->device);
+	/*
+	 * Open addressing with linear probing; see find_sampler_slot() in tut7.c.  Unlike samplers and layouts,
+	 * variants can be removed (see tut8_forget_render_pass()), but the removal shifts the following entries back,
+	 * so there are never holes that would stop a probe early.
+	 */
+	for (uint32_t i = hash & (table_size - 1);; i = (i + 1) & (table_size - 1))
+	{
+		if (table[i] == NULL)
+			return &table[i];
+		if (table[i]->hash == hash && table[i]->key_size == key_size
+				&& memcmp(table[i]->key, key, key_size * sizeof *key) == 0)
+			return &table[i];
+	}
+}
 
-	/* As always... */
-	for (uint32_t i = 0; i < layout_count; ++i)
+static VkResult get_variant(struct tut8_pipeline_cache *cache, const struct tut8_pipeline_state *state,
+		struct tut8_pipeline_variant **variant, bool *added)
+{
+	/*
+	 * Find the variant with this state, or add one (to be compiled by the caller) if there is none.  This is called
+	 * with the lock held.
+	 */
+	uint32_t key_size;
+	uint32_t *key = get_pipeline_key(state, &key_size);
+	if (key == NULL)
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	uint64_t hash = hash_key(key, key_size);
+
+	*added = false;
+
+	/* Keep the table at most half full, so the probes stay short */
+	if ((cache->variant_count + 1) * 2 > cache->table_size)
+	{
+		uint32_t new_size = cache->table_size?cache->table_size * 2:16;
+		struct tut8_pipeline_variant **new_table = calloc(new_size, sizeof *new_table);
+		if (new_table == NULL)
+			goto exit_no_mem;
+
+		for (uint32_t i = 0; i < cache->table_size; ++i)
+			if (cache->variants[i])
+				*find_variant_slot(new_table, new_size, cache->variants[i]->hash,
+						cache->variants[i]->key, cache->variants[i]->key_size) = cache->variants[i];
+
+		free(cache->variants);
+		cache->variants = new_table;
+		cache->table_size = new_size;
+	}
+
+	struct tut8_pipeline_variant **slot = find_variant_slot(cache->variants, cache->table_size, hash, key, key_size);
+	if (*slot)
+	{
+		free(key);
+		*variant = *slot;
+		return VK_SUCCESS;
+	}
+
+	*slot = malloc(sizeof **slot);
+	if (*slot == NULL)
+		goto exit_no_mem;
+
+	**slot = (struct tut8_pipeline_variant){
+		.key = key,
+		.key_size = key_size,
+		.hash = hash,
+		.state = malloc(sizeof *state),
+		.compiling = true,
+	};
+	if ((*slot)->state == NULL)
 	{
-		vkDestroyPipelineLayout(dev->device, layouts[i].pipeline_layout, NULL);
-		vkDestroyDescriptorSetLayout(dev->device, layouts[i].set_layout, NULL);
+		free(*slot);
+		*slot = NULL;
+		goto exit_no_mem;
 	}
+	*(*slot)->state = *state;
+
+	++cache->variant_count;
+	*variant = *slot;
+	*added = true;
+	return VK_SUCCESS;
+
+exit_no_mem:
+	free(key);
+	return VK_ERROR_OUT_OF_HOST_MEMORY;
 }
 
-void tut8_free_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+static void compile_variant(struct tut8_pipeline_cache *cache, struct tut8_pipeline_variant *variant, bool background)
 {
-	vkDeviceWaitIdle(dev->device);
+	/*
+	 * The compilation itself is done without holding the lock, so that lookups of other variants are not blocked
+	 * by it.  Nobody else touches this variant while `compiling` is set.
+	 */
+	VkPipeline pipeline = NULL;
 
-	/* ZZzzzz... */
-	for (uint32_t i = 0; i < pipeline_count; ++i)
+	pthread_mutex_unlock(&cache->lock);
+	uint64_t start_ns = tut1_get_time_ns();
+	VkResult res = compile_pipeline(cache->dev, cache->vk_cache, variant->state, &pipeline);
+	uint64_t elapsed_ns = tut1_get_time_ns() - start_ns;
+	pthread_mutex_lock(&cache->lock);
+
+	variant->pipeline = pipeline;
+	variant->result = res;
+	variant->compiling = false;
+	cache->compile_time_ns += elapsed_ns;
+	if (background)
+		++cache->background_compiles;
+
+	pthread_cond_broadcast(&cache->cond);
+}
+
+static void *background_compiler(void *args)
+{
+	struct tut8_pipeline_cache *cache = args;
+
+	pthread_mutex_lock(&cache->lock);
+	while (true)
+	{
+		while (cache->queue_head == NULL && !cache->quit)
+			pthread_cond_wait(&cache->cond, &cache->lock);
+		if (cache->quit)
+			break;
+
+		struct tut8_pipeline_variant *variant = cache->queue_head;
+		cache->queue_head = variant->next;
+		if (cache->queue_head == NULL)
+			cache->queue_tail = NULL;
+		variant->next = NULL;
+		variant->queued = false;
+
+		compile_variant(cache, variant, true);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return NULL;
+}
+
+tut1_error tut8_create_pipeline_cache(struct tut2_device *dev, struct tut8_pipeline_cache *cache)
+{
+	/*
+	 * Creating pipelines is expensive; it's when the driver compiles the shaders for real, with all the state that
+	 * could affect the generated code.  Applications often ask for the same pipeline many times (think of many
+	 * materials that only differ in their textures), so it pays to notice that a pipeline was already created.
+	 * Even better, when it's known early on what pipelines are going to be needed, they can be compiled in the
+	 * background, so that by the time they are actually needed, they are ready.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	*cache = (struct tut8_pipeline_cache){
+		.dev = dev,
+	};
+
+	VkPipelineCacheCreateInfo cache_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+	};
+	res = vkCreatePipelineCache(dev->device, &cache_info, NULL, &cache->vk_cache);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+
+	/* If the thread cannot be created, tut8_prepare_graphics_pipelines() just compiles right away */
+	cache->thread_running = pthread_create(&cache->thread, NULL, background_compiler, cache) == 0;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut8_prepare_graphics_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+{
+	/*
+	 * Every pipeline that is not already in its cache is queued to be compiled in the background.  Later,
+	 * tut8_make_graphics_pipelines() finds them in the cache, possibly waiting for them to finish compiling.
+	 */
+	uint32_t successful = 0;
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	for (uint32_t i = 0; i < pipeline_count; ++i)
+	{
+		struct tut8_pipeline_cache *cache = pipelines[i].cache;
+		struct tut8_pipeline_state state;
+		struct tut8_pipeline_variant *variant;
+		bool added;
+
+		if (cache == NULL)
+		{
+			++successful;
+			continue;
+		}
+
+		res = get_pipeline_state(&pipelines[i], &state);
+		tut1_error_sub_set_vkresult(&retval, res);
+		if (res)
+			continue;
+
+		pthread_mutex_lock(&cache->lock);
+		res = get_variant(cache, &state, &variant, &added);
+		if (res == VK_SUCCESS && added)
+		{
+			++cache->misses;
+			variant->prepared = true;
+			if (cache->thread_running)
+			{
+				if (cache->queue_tail)
+					cache->queue_tail->next = variant;
+				else
+					cache->queue_head = variant;
+				cache->queue_tail = variant;
+				variant->queued = true;
+				pthread_cond_broadcast(&cache->cond);
+			}
+			else
+				compile_variant(cache, variant, false);
+		}
+		pthread_mutex_unlock(&cache->lock);
+
+		tut1_error_sub_set_vkresult(&retval, res);
+		if (res)
+			continue;
+
+		++successful;
+	}
+
+	tut1_error_set_vkresult(&retval, successful == pipeline_count?VK_SUCCESS:VK_INCOMPLETE);
+	return retval;
+}
+
+static void unqueue_variant(struct tut8_pipeline_cache *cache, struct tut8_pipeline_variant *variant)
+{
+	struct tut8_pipeline_variant *prev = NULL;
+
+	for (struct tut8_pipeline_variant *cur = cache->queue_head; cur != variant; cur = cur->next)
+		prev = cur;
+
+	if (prev)
+		prev->next = variant->next;
+	else
+		cache->queue_head = variant->next;
+	if (cache->queue_tail == variant)
+		cache->queue_tail = prev;
+
+	variant->next = NULL;
+	variant->queued = false;
+}
+
+static VkResult get_cached_pipeline(struct tut8_pipeline_cache *cache, const struct tut8_pipeline_state *state,
+		VkPipeline *pipeline)
+{
+	struct tut8_pipeline_variant *variant;
+	bool added;
+	VkResult res;
+
+	pthread_mutex_lock(&cache->lock);
+
+	res = get_variant(cache, state, &variant, &added);
+	if (res)
+		goto exit_failed;
+
+	/*
+	 * If the variant was tried before and failed, try again.  The objects it was tried with may be long gone, even
+	 * though identical ones exist (they're identified by what they contain, not by their handles), so take the
+	 * caller's state.
+	 */
+	if (!added && !variant->compiling && variant->pipeline == NULL)
+	{
+		*variant->state = *state;
+		variant->compiling = true;
+		added = true;
+	}
+
+	/*
+	 * On a miss, compile the pipeline right here.  Otherwise, the pipeline may still be waiting to be compiled in
+	 * the background.  There is a single background compiler, while tut8_make_graphics_pipelines() may be calling
+	 * this from many threads at once.  Waiting for the background compiler to get to this variant would make all
+	 * those threads take turns, so instead the variant is taken out of the queue and compiled right here.  Only if
+	 * the background compiler has already started on it is there nothing to do but wait for it.  Picking up a
+	 * prepared variant for the first time is not a hit; it was already counted as a miss when it was prepared.
+	 */
+	if (added)
+	{
+		++cache->misses;
+		compile_variant(cache, variant, false);
+	}
+	else
+	{
+		if (!variant->prepared)
+			++cache->hits;
+		if (variant->queued)
+		{
+			unqueue_variant(cache, variant);
+			compile_variant(cache, variant, false);
+		}
+		else
+		{
+			if (variant->compiling)
+				++cache->waits;
+			while (variant->compiling)
+				pthread_cond_wait(&cache->cond, &cache->lock);
+		}
+	}
+	variant->prepared = false;
+
+	res = variant->result;
+	*pipeline = variant->pipeline;
+
+exit_failed:
+	pthread_mutex_unlock(&cache->lock);
+	return res;
+}
+
+static void remove_variant(struct tut8_pipeline_cache *cache, uint32_t slot)
+{
+	/*
+	 * With linear probing, just emptying the slot would cut the probe sequence of any entry after it that was
+	 * pushed past this slot.  So the entries after it are moved back, each to the earliest empty slot that is still
+	 * not before where its probe starts.
+	 */
+	uint32_t mask = cache->table_size - 1;
+	uint32_t hole = slot;
+
+	for (uint32_t i = (slot + 1) & mask; cache->variants[i]; i = (i + 1) & mask)
+	{
+		uint32_t start = cache->variants[i]->hash & mask;
+
+		/* If the probe of this entry starts cyclically in (hole, i], it must stay where it is */
+		if (hole <= i?(start > hole && start <= i):(start > hole || start <= i))
+			continue;
+
+		cache->variants[hole] = cache->variants[i];
+		hole = i;
+	}
+
+	cache->variants[hole] = NULL;
+	--cache->variant_count;
+}
+
+static bool is_compiling_for(struct tut8_pipeline_cache *cache, VkRenderPass render_pass)
+{
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		struct tut8_pipeline_variant *variant = cache->variants[i];
+
+		if (variant && variant->state->render_pass == render_pass && variant->compiling)
+			return true;
+	}
+
+	return false;
+}
+
+void tut8_forget_render_pass(struct tut2_device *dev, struct tut8_pipeline_cache *cache, VkRenderPass render_pass)
+{
+	pthread_mutex_lock(&cache->lock);
+
+	/* Let the background compiler finish (or start and finish) whatever it has with this render pass */
+	while (is_compiling_for(cache, render_pass))
+		pthread_cond_wait(&cache->cond, &cache->lock);
+
+	vkDeviceWaitIdle(dev->device);
+
+	/* A slot is looked at again after a removal, since another entry may have moved into it */
+	for (uint32_t i = 0; i < cache->table_size;)
+	{
+		struct tut8_pipeline_variant *variant = cache->variants[i];
+
+		if (variant == NULL || variant->state->render_pass != render_pass)
+		{
+			++i;
+			continue;
+		}
+
+		vkDestroyPipeline(dev->device, variant->pipeline, NULL);
+		free(variant->key);
+		free(variant->state);
+		free(variant);
+		remove_variant(cache, i);
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void tut8_free_pipeline_cache(struct tut2_device *dev, struct tut8_pipeline_cache *cache)
+{
+	/* Stop the background compiler first; whatever it hasn't started compiling by now is dropped */
+	if (cache->thread_running)
+	{
+		pthread_mutex_lock(&cache->lock);
+		cache->quit = true;
+		pthread_cond_broadcast(&cache->cond);
+		pthread_mutex_unlock(&cache->lock);
+
+		pthread_join(cache->thread, NULL);
+	}
+
+	vkDeviceWaitIdle(dev->device);
+
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		struct tut8_pipeline_variant *variant = cache->variants[i];
+		if (variant == NULL)
+			continue;
+
+		vkDestroyPipeline(dev->device, variant->pipeline, NULL);
+		free(variant->key);
+		free(variant->state);
+		free(variant);
+	}
+	free(cache->variants);
+
+	if (cache->vk_cache)
+	{
+		vkDestroyPipelineCache(dev->device, cache->vk_cache, NULL);
+		pthread_mutex_destroy(&cache->lock);
+		pthread_cond_destroy(&cache->cond);
+	}
+
+	*cache = (struct tut8_pipeline_cache){0};
+}
+
+struct tut8_compile_batch
+{
+	struct tut2_device *dev;
+	struct tut8_pipeline *pipelines;
+	struct tut8_pipeline_state *states;
+	VkResult *results;
+	uint32_t pipeline_count;
+
+	/* the next pipeline nobody has taken yet, and how many threads are still compiling */
+	uint32_t next;
+	uint32_t working;
+};
+
+static void compile_batch(struct tut8_compile_pool *pool, struct tut8_compile_batch *batch)
+{
+	/*
+	 * Called with the lock held.  The pipelines are taken one at a time, so that a thread that happens to get the
+	 * quick ones doesn't sit idle while another is stuck with the slow ones.
+	 */
+	++batch->working;
+	while (batch->next < batch->pipeline_count)
+	{
+		uint32_t i = batch->next++;
+		struct tut8_pipeline *pipeline = &batch->pipelines[i];
+
+		/* If the state couldn't be taken, there's nothing to compile */
+		if (batch->results[i])
+			continue;
+
+		pthread_mutex_unlock(&pool->lock);
+
+		/* Take the pipeline from its cache if it has one, otherwise compile it right away */
+		uint64_t start_ns = tut1_get_time_ns();
+		if (pipeline->cache)
+			batch->results[i] = get_cached_pipeline(pipeline->cache, &batch->states[i], &pipeline->pipeline);
+		else
+			batch->results[i] = compile_pipeline(batch->dev, NULL, &batch->states[i], &pipeline->pipeline);
+		pipeline->compile_time_ns = tut1_get_time_ns() - start_ns;
+
+		pthread_mutex_lock(&pool->lock);
+	}
+	if (--batch->working == 0)
+		pthread_cond_broadcast(&pool->done_cond);
+}
+
+static void *compile_worker(void *args)
+{
+	struct tut8_compile_pool *pool = args;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true)
+	{
+		while (!pool->quit && (pool->batch == NULL || pool->batch->next == pool->batch->pipeline_count))
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+
+		compile_batch(pool, pool->batch);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+tut1_error tut8_create_compile_pool(struct tut8_compile_pool *pool, uint32_t thread_count)
+{
+	/*
+	 * Creating a pipeline takes a while, and the pipelines have nothing to do with each other, so they can be
+	 * created in parallel.  Creating pipelines is thread-safe, including when the same VkPipelineCache is used
+	 * (unless it's created with VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT, which we don't), so all
+	 * that's needed is a few threads that each take some of the pipelines.  Unlike the threads of Tutorial 4,
+	 * these threads are kept around and given more pipelines every time, instead of being created and joined
+	 * each time.  The thread that makes the pipelines always helps, so one less thread is created.  If a thread
+	 * cannot be created, there are just fewer of them.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	if (thread_count == 0)
+	{
+		long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = cpu_count > 0?cpu_count:1;
+	}
+
+	*pool = (struct tut8_compile_pool){0};
+
+	pool->threads = malloc((thread_count - 1) * sizeof *pool->threads);
+	if (pool->threads == NULL && thread_count > 1)
+	{
+		tut1_error_set_errno(&retval, errno);
+		return retval;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (uint32_t i = 0; i + 1 < thread_count; ++i)
+		if (pthread_create(&pool->threads[pool->thread_count], NULL, compile_worker, pool) == 0)
+			++pool->thread_count;
+
+	return retval;
+}
+
+void tut8_free_compile_pool(struct tut8_compile_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint32_t i = 0; i < pool->thread_count; ++i)
+		pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+
+	*pool = (struct tut8_compile_pool){0};
+}
+
+tut1_error tut8_make_graphics_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+{
+	/* Without a pool to compile on, make one just for these pipelines; no more threads than pipelines though */
+	struct tut8_compile_pool pool;
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t thread_count = cpu_count > 0?cpu_count:1;
+
+	if (thread_count > pipeline_count)
+		thread_count = pipeline_count;
+
+	tut1_error retval = tut8_create_compile_pool(&pool, thread_count > 0?thread_count:1);
+	if (!tut1_error_is_success(&retval))
+		return retval;
+
+	retval = tut8_make_graphics_pipelines_on_pool(dev, &pool, pipelines, pipeline_count);
+
+	tut8_free_compile_pool(&pool);
+	return retval;
+}
+
+tut1_error tut8_make_graphics_pipelines_on_pool(struct tut2_device *dev, struct tut8_compile_pool *pool,
+		struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+{
+	/*
+	 * Each pipeline we create is going to have a set of shaders bound to it.  This means that if in one scene you
+	 * are going to render objects with different shaders, you would need a separate pipeline for each part of that
+	 * scene.
+	 *
+	 * To create descriptor sets, we need to know what resources will be used by the pipeline and assign correct
+	 * bindings to them.  The tut8_resources struct describes what images, buffers and shaders are going to be
+	 * used.  The buffers should not include index, vertex, and indirect ones as they are bound with special
+	 * commands (more on this later).
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	/* Nothing to do, and the arrays below would have zero length */
+	if (pipeline_count == 0)
+		return retval;
+
+	uint32_t successful = 0;
+	VkResult results[pipeline_count];
+
+	struct tut8_pipeline_state *states = malloc(pipeline_count * sizeof *states);
+	if (states == NULL)
+	{
+		tut1_error_set_errno(&retval, errno);
+		return retval;
+	}
+
+	for (uint32_t i = 0; i < pipeline_count; ++i)
+	{
+		pipelines[i].pipeline = NULL;
+		pipelines[i].set_allocators = NULL;
+		pipelines[i].compile_time_ns = 0;
+
+		results[i] = get_pipeline_state(&pipelines[i], &states[i]);
+	}
+
+	/*
+	 * The pipelines are handed to the threads of the pool (see tut8_create_compile_pool()), and this thread
+	 * compiles along with them; there's no reason for it to sit idle.  Then, it waits for the pool threads to
+	 * finish what they have taken.
+	 */
+	struct tut8_compile_batch batch = {
+		.dev = dev,
+		.pipelines = pipelines,
+		.states = states,
+		.results = results,
+		.pipeline_count = pipeline_count,
+	};
+
+	pthread_mutex_lock(&pool->lock);
+	pool->batch = &batch;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	compile_batch(pool, &batch);
+	while (batch.working > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+	pool->batch = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	free(states);
+
+	for (uint32_t i = 0; i < pipeline_count; ++i)
+	{
+		struct tut8_pipeline *pipeline = &pipelines[i];
+		struct tut8_layout *layout = pipeline->layout;
+
+		tut1_error_sub_set_vkresult(&retval, results[i]);
+		if (results[i])
+			continue;
+
+		/*
+		 * Just like in Tutorial 4, we need descriptor pools to allocate the descriptor sets out of.  There is
+		 * a set of pools per thread, managed by a descriptor set allocator; see
+		 * tut8_make_descriptor_allocators() below.
+		 *
+		 * Note: we have so far used the same set of resources for defining descriptor sets for all threads.
+		 * It is important to make sure the threads actually have synchronized access to the resources if they
+		 * are really shared.  For example, if there is one uniform buffer that contains the transformation
+		 * matrices, then one thread shouldn't be updating it while another is using it.  Such resources need
+		 * to be made sure they are exclusively used.  An alternative solution is to make thread_count copies
+		 * of that resource, even though only one of those copies is specified here for the sake of layout and
+		 * pool creations.  Resources that don't need to be updated, for example a texture, can be safely
+		 * shared between threads, as long as the queue families sharing the resource are specified at
+		 * creation time.
+		 */
+		if (pipeline->thread_count > 0)
+		{
+			pipeline->set_allocators = malloc(pipeline->thread_count * sizeof *pipeline->set_allocators);
+			if (pipeline->set_allocators == NULL)
+			{
+				tut1_error_sub_set_errno(&retval, errno);
+				continue;
+			}
+
+			for (size_t t = 0; t < pipeline->thread_count; ++t)
+				pipeline->set_allocators[t] = (struct tut8_descriptor_allocator){
+					.layout = layout,
+				};
+
+			tut1_error err = tut8_make_descriptor_allocators(dev, pipeline->set_allocators, pipeline->thread_count);
+			tut1_error_sub_merge(&retval, &err);
+			if (!tut1_error_is_success(&err))
+				continue;
+		}
+
+		++successful;
+	}
+
+	tut1_error_set_vkresult(&retval, successful == pipeline_count?VK_SUCCESS:VK_INCOMPLETE);
+	return retval;
+}
+
+tut1_error tut8_make_descriptor_allocators(struct tut2_device *dev, struct tut8_descriptor_allocator *allocators,
+		uint32_t allocator_count)
+{
+	/*
+	 * As a reminder from Tutorial 4, when creating a descriptor pool, we need to specify how many sets can be
+	 * allocated from it, and for each resource type, how many resources of that type can be allocated in total
+	 * (which is set_count*R_i where R_i is the number of resources we have of some type T_i in one set).
+	 *
+	 * Sizing one pool upfront for everything ever needed is fine when the number of sets is known, for example one
+	 * per thread.  Anything dynamic, such as a set per object per frame, would overflow it sooner or later.  So
+	 * instead, the allocator keeps a list of pools.  When they are all full, another pool is created, twice as
+	 * large as the previous one (up to a limit), so that the number of pools stays small even if many sets are
+	 * allocated.  Pools are never destroyed until the allocator is, but they can all be reset at once, for
+	 * example once a frame is done with its sets.  Resetting a pool is much cheaper than freeing its sets one
+	 * by one, which is why the pools are not created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT.
+	 *
+	 * The following code makes the same assumptions as in `tut8_make_graphics_layouts` regarding which resources
+	 * to count, as those are the resources described in the layout.  We had decided to only allow combined image
+	 * samplers, storage images, uniform buffers (dynamic or not) and storage buffers, so we have five resource
+	 * types to count.
+	 */
+	uint32_t successful = 0;
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	for (uint32_t i = 0; i < allocator_count; ++i)
+	{
+		struct tut8_descriptor_allocator *allocator = &allocators[i];
+		struct tut8_resources *resources = allocator->layout->resources;
+
+		allocator->set_size_count = 0;
+		allocator->pools = NULL;
+		allocator->pool_count = 0;
+		allocator->current_pool = 0;
+		allocator->set_count = 0;
+		if (allocator->sets_per_pool == 0)
+			allocator->sets_per_pool = TUT8_DEFAULT_SETS_PER_POOL;
+
+		uint32_t image_sampler_count = 0;
+		uint32_t storage_image_count = 0;
+		uint32_t uniform_buffer_count = 0;
+		uint32_t dynamic_uniform_buffer_count = 0;
+		uint32_t storage_buffer_count = 0;
+
+		for (uint32_t j = 0; j < resources->image_count; ++j)
+		{
+			if ((resources->images[j].usage & VK_IMAGE_USAGE_SAMPLED_BIT))
+				++image_sampler_count;
+			else if ((resources->images[j].usage & VK_IMAGE_USAGE_STORAGE_BIT))
+				++storage_image_count;
+		}
+
+		for (uint32_t j = 0; j < resources->buffer_count; ++j)
+		{
+			if ((resources->buffers[j].usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) && resources->buffers[j].dynamic)
+				++dynamic_uniform_buffer_count;
+			else if ((resources->buffers[j].usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT))
+				++uniform_buffer_count;
+			else if ((resources->buffers[j].usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+				++storage_buffer_count;
+		}
+
+		struct
+		{
+			VkDescriptorType type;
+			uint32_t count;
+		} counts[5] = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, image_sampler_count, },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, storage_image_count, },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uniform_buffer_count, },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, dynamic_uniform_buffer_count, },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, storage_buffer_count, },
+		};
+
+		for (uint32_t j = 0; j < 5; ++j)
+			if (counts[j].count > 0)
+				allocator->set_sizes[allocator->set_size_count++] = (VkDescriptorPoolSize){
+					.type = counts[j].type,
+					.descriptorCount = counts[j].count,
+				};
+
+		/* Create the first pool right away, so that if creating pools doesn't work at all, it's known early */
+		res = add_descriptor_pool(dev, allocator);
+		tut1_error_sub_set_vkresult(&retval, res);
+		if (res)
+			continue;
+
+		++successful;
+	}
+
+	tut1_error_set_vkresult(&retval, successful == allocator_count?VK_SUCCESS:VK_INCOMPLETE);
+	return retval;
+}
+
+tut1_error tut8_allocate_descriptor_sets(struct tut2_device *dev, struct tut8_descriptor_allocator *allocator,
+		VkDescriptorSet *sets, uint32_t set_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res = VK_SUCCESS;
+
+	for (uint32_t i = 0; i < set_count; ++i)
+	{
+		/*
+		 * Allocate from the current pool, or if that's full, move on to the next one, creating it if it doesn't
+		 * exist.  The pools are sized exactly for their max_sets, so counting the sets is enough to know when a
+		 * pool is full.  Still, the driver may disagree (for example due to fragmentation), and in that case
+		 * the pool is considered full as well.  Note that before Vulkan 1.1 (or VK_KHR_maintenance1), running
+		 * out of pool memory is invalid usage, so the counting is the real protection.
+		 */
+		while (true)
+		{
+			if (allocator->current_pool == allocator->pool_count)
+			{
+				res = add_descriptor_pool(dev, allocator);
+				if (res)
+					goto exit_failed;
+			}
+
+			struct tut8_descriptor_pool *pool = &allocator->pools[allocator->current_pool];
+			if (pool->set_count < pool->max_sets)
+			{
+				VkDescriptorSetAllocateInfo set_info = {
+					.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+					.descriptorPool = pool->pool,
+					.descriptorSetCount = 1,
+					.pSetLayouts = &allocator->layout->set_layout,
+				};
+				res = vkAllocateDescriptorSets(dev->device, &set_info, &sets[i]);
+				if (res == VK_SUCCESS)
+				{
+					++pool->set_count;
+					++allocator->set_count;
+					break;
+				}
+				if (res != VK_ERROR_OUT_OF_POOL_MEMORY_KHR && res != VK_ERROR_FRAGMENTED_POOL)
+					goto exit_failed;
+
+				/*
+				 * If even an empty pool can't give out a set, another pool like it won't either.  That
+				 * happens for example if the layout has a descriptor type the pool sizes don't cover.  Moving
+				 * on would create pools forever, so give up instead.
+				 */
+				if (pool->set_count == 0)
+					goto exit_failed;
+			}
+
+			++allocator->current_pool;
+		}
+	}
+
+exit_failed:
+	tut1_error_set_vkresult(&retval, res);
+	return retval;
+}
+
+tut1_error tut8_reset_descriptor_allocator(struct tut2_device *dev, struct tut8_descriptor_allocator *allocator)
+{
+	/*
+	 * vkResetDescriptorPool frees all the sets allocated from a pool in one go.  The pools themselves are kept, so
+	 * after a few frames, the allocator has as many pools as a frame needs and stops creating new ones.
+	 */
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	for (uint32_t i = 0; i < allocator->pool_count; ++i)
+	{
+		if (allocator->pools[i].set_count == 0)
+			continue;
+
+		res = vkResetDescriptorPool(dev->device, allocator->pools[i].pool, 0);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+
+		allocator->pools[i].set_count = 0;
+	}
+
+	allocator->current_pool = 0;
+	allocator->set_count = 0;
+
+exit_failed:
+	return retval;
+}
+
+void tut8_free_layouts(struct tut2_device *dev, struct tut8_layout *layouts, uint32_t layout_count)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	/*
+	 * The layouts are shared, so they are only destroyed once the last tut8_layout using them is freed.  Like
+	 * samplers in tut7_release_sampler(), the cache is searched by handle.
+	 */
+	for (uint32_t i = 0; i < layout_count; ++i)
+	{
+		struct tut8_layout_cache *cache = layouts[i].cache;
+
+		if (layouts[i].pipeline_layout == NULL)
+			continue;
+
+		if (cache == NULL)
+		{
+			vkDestroyPipelineLayout(dev->device, layouts[i].pipeline_layout, NULL);
+			vkDestroyDescriptorSetLayout(dev->device, layouts[i].set_layout, NULL);
+		}
+
+		for (uint32_t j = 0; cache && j < cache->table_size; ++j)
+		{
+			struct tut8_shared_layout *cached = &cache->layouts[j];
+
+			if (cached->key == NULL || cached->pipeline_layout != layouts[i].pipeline_layout)
+				continue;
+
+			if (--cached->ref_count == 0)
+			{
+				vkDestroyPipelineLayout(dev->device, cached->pipeline_layout, NULL);
+				vkDestroyDescriptorSetLayout(dev->device, cached->set_layout, NULL);
+				cached->pipeline_layout = NULL;
+				cached->set_layout = NULL;
+			}
+			break;
+		}
+
+		layouts[i].pipeline_layout = NULL;
+		layouts[i].set_layout = NULL;
+	}
+}
+
+void tut8_free_layout_cache(struct tut2_device *dev, struct tut8_layout_cache *cache)
+{
+	/* Any layout still in the cache was leaked by its user, but destroy it anyway */
+	for (uint32_t i = 0; i < cache->table_size; ++i)
+	{
+		vkDestroyPipelineLayout(dev->device, cache->layouts[i].pipeline_layout, NULL);
+		vkDestroyDescriptorSetLayout(dev->device, cache->layouts[i].set_layout, NULL);
+		free(cache->layouts[i].key);
+	}
+	free(cache->layouts);
+
+	*cache = (struct tut8_layout_cache){0};
+}
+
+void tut8_free_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	/* ZZzzzz... */
+	for (uint32_t i = 0; i < pipeline_count; ++i)
+	{
+		/* If the pipeline came from a cache, it's the cache that destroys it */
+		if (pipelines[i].cache == NULL)
+			vkDestroyPipeline(dev->device, pipelines[i].pipeline, NULL);
+		if (pipelines[i].set_allocators)
+			tut8_free_descriptor_allocators(dev, pipelines[i].set_allocators, pipelines[i].thread_count);
+		free(pipelines[i].set_allocators);
+	}
+}
+
+void tut8_free_descriptor_allocators(struct tut2_device *dev, struct tut8_descriptor_allocator *allocators,
+		uint32_t allocator_count)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	for (uint32_t i = 0; i < allocator_count; ++i)
 	{
-		vkDestroyPipeline(dev->device, pipelines[i].pipeline, NULL);
-		vkDestroyDescriptorPool(dev->device, pipelines[i].set_pool, NULL);
+		for (uint32_t j = 0; j < allocators[i].pool_count; ++j)
+			vkDestroyDescriptorPool(dev->device, allocators[i].pools[j].pool, NULL);
+		free(allocators[i].pools);
+		allocators[i].pools = NULL;
+		allocators[i].pool_count = 0;
 	}
 }
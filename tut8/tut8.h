@@ -44,17 +44,163 @@ struct tut8_resources
 	VkRenderPass render_pass;
 };
 
+/* A descriptor set layout and pipeline layout shared by all identical tut8_layouts; see tut8_make_graphics_layouts() */
+struct tut8_shared_layout
+{
+	uint32_t *key;			/* the bindings and push constant ranges, NULL if this slot of the hash table is empty */
+	uint32_t key_size;
+	uint64_t hash;
+	VkDescriptorSetLayout set_layout;	/* VK_NULL_HANDLE once ref_count drops to 0 */
+	VkPipelineLayout pipeline_layout;
+	uint32_t ref_count;
+};
+
+/*
+ * A hash table of layouts, keyed by their bindings and push constant ranges.  A zeroed struct is an empty cache, and
+ * tut8_free_layout_cache() frees it.
+ */
+struct tut8_layout_cache
+{
+	struct tut8_shared_layout *layouts;
+	uint32_t table_size;
+	uint32_t key_count;
+};
+
 struct tut8_layout
 {
 	/* inputs */
 
 	struct tut8_resources *resources;
+	struct tut8_layout_cache *cache;	/* where to share the layouts from; NULL for layouts of its own */
 
 	/* outputs */
 
-	/* layouts based on resources */
+	/*
+	 * layouts based on resources, shared with every other tut8_layout with the same bindings and push constants and
+	 * the same cache.  So if two pipelines have the same pipeline_layout, a descriptor set bound for one stays bound for the other.
+	 */
 	VkDescriptorSetLayout set_layout;
 	VkPipelineLayout pipeline_layout;
+
+	/* a hash of the bindings and push constants, which identifies the layout even after it's destroyed */
+	uint64_t key_hash;
+};
+
+/*
+ * A descriptor set allocator for one layout.  Sets are allocated from a list of pools, and whenever they are all
+ * full, a new (larger) pool is added to the list.  An allocator is not thread-safe, but there is no need for it to
+ * be; every thread should have its own, and then no locks are needed at all.
+ */
+#define TUT8_DEFAULT_SETS_PER_POOL 16
+#define TUT8_MAX_SETS_PER_POOL 4096
+
+struct tut8_descriptor_pool
+{
+	VkDescriptorPool pool;
+	uint32_t max_sets;
+	uint32_t set_count;
+};
+
+struct tut8_descriptor_allocator
+{
+	/* inputs */
+
+	struct tut8_layout *layout;
+	uint32_t sets_per_pool;		/* how many sets the first pool holds (0 for default), each new pool twice as many */
+
+	/* outputs */
+
+	/* how many descriptors of each type a set of this layout needs */
+	VkDescriptorPoolSize set_sizes[5];
+	uint32_t set_size_count;
+
+	/* the pools, and the one currently allocated from; the ones before it are full */
+	struct tut8_descriptor_pool *pools;
+	uint32_t pool_count;
+	uint32_t current_pool;
+
+	/* number of sets allocated since the last reset */
+	uint64_t set_count;
+};
+
+/*
+ * A cache of pipeline variants.  Pipelines are looked up by a hash of everything they are created from (shaders,
+ * vertex input, input assembly, tessellation, layout and render pass), so identical requests get the same VkPipeline.
+ * Variants can also be prepared ahead of time with tut8_prepare_graphics_pipelines(), in which case they are compiled
+ * in a background thread while the application goes on with other things.
+ *
+ * The cache owns the pipelines it creates; they are destroyed with tut8_free_pipeline_cache().  Shaders and layouts
+ * are identified by what they contain (see tut7_shader.spirv_hash and tut8_layout.key_hash), so they can be destroyed
+ * and made again while the cache lives on.  Render passes however are identified by their handles, so before a render
+ * pass is destroyed, either the cache must be freed, or the pipelines made with it removed with
+ * tut8_forget_render_pass().
+ */
+struct tut8_pipeline_variant
+{
+	uint32_t *key;
+	uint32_t key_size;
+	uint64_t hash;
+
+	/* what is needed to compile the pipeline, even long after the tut8_pipeline that asked for it is gone */
+	struct tut8_pipeline_state *state;
+
+	VkPipeline pipeline;
+	VkResult result;
+	bool compiling;
+	bool queued;			/* waiting in the queue, i.e. the background compiler hasn't started on it yet */
+	bool prepared;			/* added by tut8_prepare_graphics_pipelines(), and not yet picked up */
+
+	/* the queue of variants to be compiled in the background */
+	struct tut8_pipeline_variant *next;
+};
+
+struct tut8_pipeline_cache
+{
+	struct tut2_device *dev;
+
+	/* the driver's own cache, which helps even when the variants are not identical */
+	VkPipelineCache vk_cache;
+
+	/* hash table of pointers to variants */
+	struct tut8_pipeline_variant **variants;
+	uint32_t table_size;
+	uint32_t variant_count;
+
+	/* the background compiler, and what it has left to compile */
+	pthread_t thread;
+	bool thread_running;
+	bool quit;
+	struct tut8_pipeline_variant *queue_head, *queue_tail;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/*
+	 * statistics.  A variant that is prepared and then made counts as one miss only; `waits` tells how many times
+	 * making a pipeline had to wait for the background compiler, i.e. it wasn't prepared early enough.
+	 */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t waits;
+	uint64_t background_compiles;
+	uint64_t compile_time_ns;
+};
+
+/*
+ * A pool of threads to compile pipelines on, kept around so that making pipelines doesn't create and join threads
+ * every time.  A pool must not be used by more than one tut8_make_graphics_pipelines_on_pool() at a time.
+ */
+struct tut8_compile_batch;
+
+struct tut8_compile_pool
+{
+	pthread_t *threads;
+	uint32_t thread_count;		/* threads created, not counting the one making the pipelines */
+
+	struct tut8_compile_batch *batch;	/* the pipelines currently being made, if any */
+	bool quit;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	/* signaled when there is a new batch, or time to quit */
+	pthread_cond_t done_cond;	/* signaled when the last thread working on a batch is done */
 };
 
 struct tut8_pipeline
@@ -69,19 +215,51 @@ struct tut8_pipeline
 
 	size_t thread_count;
 
+	/* if not NULL, the pipeline is taken from (and owned by) this cache */
+	struct tut8_pipeline_cache *cache;
+
 	/* outputs */
 
 	/* one pipeline per layout (i.e. set of resources) */
 	VkPipeline pipeline;
 
-	/* pool to allocate from */
-	VkDescriptorPool set_pool;
+	/* how long it took to compile the pipeline (or get it from the cache) */
+	uint64_t compile_time_ns;
+
+	/* one descriptor set allocator per thread */
+	struct tut8_descriptor_allocator *set_allocators;
 };
 
 tut1_error tut8_make_graphics_layouts(struct tut2_device *dev, struct tut8_layout *layouts, uint32_t layout_count);
 tut1_error tut8_make_graphics_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count);
+/* Same as above, but compile the pipelines on the threads of `pool` instead of new threads made just for them */
+tut1_error tut8_make_graphics_pipelines_on_pool(struct tut2_device *dev, struct tut8_compile_pool *pool,
+		struct tut8_pipeline *pipelines, uint32_t pipeline_count);
+/* Make a pool of `thread_count` threads (including the caller of tut8_make_graphics_pipelines_on_pool), 0 for one per CPU */
+tut1_error tut8_create_compile_pool(struct tut8_compile_pool *pool, uint32_t thread_count);
+tut1_error tut8_create_pipeline_cache(struct tut2_device *dev, struct tut8_pipeline_cache *cache);
+/* Start compiling the pipelines that are not yet in their cache in the background.  Only `inputs` are used */
+tut1_error tut8_prepare_graphics_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count);
+tut1_error tut8_make_descriptor_allocators(struct tut2_device *dev, struct tut8_descriptor_allocator *allocators,
+		uint32_t allocator_count);
+
+/* Allocate `set_count` sets, adding new pools to the allocator as needed */
+tut1_error tut8_allocate_descriptor_sets(struct tut2_device *dev, struct tut8_descriptor_allocator *allocator,
+		VkDescriptorSet *sets, uint32_t set_count);
+/* Free every set allocated so far at once, e.g. at the end of a frame.  The GPU must no longer be using them */
+tut1_error tut8_reset_descriptor_allocator(struct tut2_device *dev, struct tut8_descriptor_allocator *allocator);
 
 void tut8_free_layouts(struct tut2_device *dev, struct tut8_layout *layouts, uint32_t layout_count);
+void tut8_free_layout_cache(struct tut2_device *dev, struct tut8_layout_cache *cache);
 void tut8_free_pipelines(struct tut2_device *dev, struct tut8_pipeline *pipelines, uint32_t pipeline_count);
+void tut8_free_pipeline_cache(struct tut2_device *dev, struct tut8_pipeline_cache *cache);
+void tut8_free_compile_pool(struct tut8_compile_pool *pool);
+/*
+ * Destroy the pipelines of the cache made with `render_pass`, so the render pass can be destroyed.  Pipelines must not
+ * be made from the cache at the same time.
+ */
+void tut8_forget_render_pass(struct tut2_device *dev, struct tut8_pipeline_cache *cache, VkRenderPass render_pass);
+void tut8_free_descriptor_allocators(struct tut2_device *dev, struct tut8_descriptor_allocator *allocators,
+		uint32_t allocator_count);
 
 #endif
@@ -19,23 +19,54 @@
 
 #include "tut8_render.h"
 
-static tut1_error fill_object(struct tut2_device *dev, VkDeviceMemory to, void *from, size_t size, const char *object, const char *name)
+static tut1_error fill_object(struct tut2_device *dev, VkDeviceMemory to, void *map, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		VkDeviceSize offset, void *from, size_t size, const char *object, const char *name)
 {
-	void *mem = NULL;
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
 
-	res = vkMapMemory(dev->device, to, 0, size, 0, &mem);
+	/*
+	 * The memory is already mapped by tut7_create_buffers() and tut7_create_images(), so filling it is just a memcpy
+	 * and, if the memory is not host-coherent, a flush of the range that was written.
+	 */
+	if (map == NULL || offset + size > mem_size)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_MEMORY_MAP_FAILED);
+		tut1_error_printf(&retval, "The %s %s is not host-visible or is too small\n", name, object);
+		goto exit_failed;
+	}
+
+	memcpy((char *)map + offset, from, size);
+
+	res = tut4_flush_memory(dev, to, mem_size, atom_size, offset, size);
 	tut1_error_set_vkresult(&retval, res);
 	if (res)
+		tut1_error_printf(&retval, "Failed to flush memory of the %s %s\n", name, object);
+
+exit_failed:
+	return retval;
+}
+
+static tut1_error read_object(struct tut2_device *dev, VkDeviceMemory from, void *map, VkDeviceSize mem_size, VkDeviceSize atom_size,
+		void *to, size_t size, const char *object, const char *name)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	if (map == NULL || size > mem_size)
 	{
-		tut1_error_printf(&retval, "Failed to map memory of the %s %s\n", name, object);
+		tut1_error_set_vkresult(&retval, VK_ERROR_MEMORY_MAP_FAILED);
+		tut1_error_printf(&retval, "The %s %s is not host-visible or is too small\n", name, object);
 		goto exit_failed;
 	}
 
-	memcpy(mem, from, size);
-
-	vkUnmapMemory(dev->device, to);
+	/* If the memory is not host-coherent, get rid of stale data in the host caches before reading */
+	res = tut4_invalidate_memory(dev, from, mem_size, atom_size, 0, size);
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		tut1_error_printf(&retval, "Failed to invalidate memory of the %s %s\n", name, object);
+	else
+		memcpy(to, map, size);
 
 exit_failed:
 	return retval;
@@ -43,12 +74,29 @@ exit_failed:
 
 tut1_error tut8_render_fill_buffer(struct tut2_device *dev, struct tut7_buffer *to, void *from, size_t size, const char *name)
 {
-	return fill_object(dev, to->buffer_mem, from, size, "buffer", name);
+	return tut8_render_fill_buffer_at(dev, to, 0, from, size, name);
 }
 
 tut1_error tut8_render_fill_image(struct tut2_device *dev, struct tut7_image *to, void *from, size_t size, const char *name)
 {
-	return fill_object(dev, to->image_mem, from, size, "image", name);
+	return tut8_render_fill_image_at(dev, to, 0, from, size, name);
+}
+
+tut1_error tut8_render_fill_buffer_at(struct tut2_device *dev, struct tut7_buffer *to, VkDeviceSize offset,
+		void *from, size_t size, const char *name)
+{
+	return fill_object(dev, to->buffer_mem, to->map, to->mem_size, to->non_coherent_atom_size, offset, from, size, "buffer", name);
+}
+
+tut1_error tut8_render_fill_image_at(struct tut2_device *dev, struct tut7_image *to, VkDeviceSize offset,
+		void *from, size_t size, const char *name)
+{
+	return fill_object(dev, to->image_mem, to->map, to->mem_size, to->non_coherent_atom_size, offset, from, size, "image", name);
+}
+
+tut1_error tut8_render_read_buffer(struct tut2_device *dev, struct tut7_buffer *from, void *to, size_t size, const char *name)
+{
+	return read_object(dev, from->buffer_mem, from->map, from->mem_size, from->non_coherent_atom_size, to, size, "buffer", name);
 }
 
 static tut1_error copy_object_start(struct tut2_device *dev, struct tut7_render_essentials *essentials, const char *object, const char *name)
@@ -74,6 +122,23 @@ static tut1_error copy_object_end(struct tut2_device *dev, struct tut7_render_es
 	tut1_error retval = TUT1_ERROR_NONE;
 	VkResult res;
 
+	/*
+	 * Waiting on the fence makes sure the copy is done, but not that its writes are visible to the host.  If the
+	 * destination is to be read back, the transfer writes need to be made available to host reads with a barrier.
+	 */
+	VkMemoryBarrier host_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	};
+	vkCmdPipelineBarrier(essentials->cmd_buffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT,
+			0,			/* no flags */
+			1, &host_barrier,	/* our host barrier */
+			0, NULL,		/* no buffer barriers */
+			0, NULL);		/* no image barriers */
+
 	vkEndCommandBuffer(essentials->cmd_buffer);
 
 	res = vkResetFences(dev->device, 1, &essentials->exec_fence);
@@ -165,6 +230,118 @@ tut1_error tut8_render_copy_image_to_buffer(struct tut2_device *dev, struct tut7
 	return copy_object_end(dev, essentials);
 }
 
+static void get_layout_access(VkImageLayout layout, bool is_src, VkAccessFlags *access, VkPipelineStageFlags *stages)
+{
+	/*
+	 * The layout of an image tells a lot about how it's used: a color attachment is written to by the color
+	 * attachment output stage, a texture is read by the shaders, a transfer destination is written to by copies
+	 * and so on.  So from the old layout, we can tell which stages and accesses the transition needs to wait for,
+	 * and from the new layout, which stages and accesses need to wait for the transition.
+	 *
+	 * On the source side, only writes actually need to be made available, so reads are left out of the source
+	 * access mask.  When there is nothing to wait for (an UNDEFINED image has no content worth keeping), the
+	 * source stage is TOP_OF_PIPE, which means don't wait at all.  Likewise, if nothing needs to wait for the
+	 * transition (such as presentation, which is synchronized with semaphores instead), the destination stage
+	 * is BOTTOM_OF_PIPE, which means nothing is blocked.
+	 */
+	switch (layout)
+	{
+	case VK_IMAGE_LAYOUT_UNDEFINED:
+		*access = 0;
+		*stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_PREINITIALIZED:
+		*access = VK_ACCESS_HOST_WRITE_BIT;
+		*stages = VK_PIPELINE_STAGE_HOST_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+		*access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (is_src?0:VK_ACCESS_COLOR_ATTACHMENT_READ_BIT);
+		*stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+		*access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | (is_src?0:VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT);
+		*stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+		*access = is_src?0:VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		*stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+			| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		*access = is_src?0:VK_ACCESS_SHADER_READ_BIT;
+		*stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		*access = is_src?0:VK_ACCESS_TRANSFER_READ_BIT;
+		*stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		*access = VK_ACCESS_TRANSFER_WRITE_BIT;
+		*stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+		*access = 0;
+		*stages = is_src?VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT:VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_GENERAL:
+	default:
+		/* Could be anything, so wait for everything */
+		*access = VK_ACCESS_MEMORY_WRITE_BIT | (is_src?0:VK_ACCESS_MEMORY_READ_BIT);
+		*stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		break;
+	}
+}
+
+void tut8_render_record_transition_images(VkCommandBuffer cmd_buffer, struct tut7_image *images, uint32_t image_count,
+		VkImageLayout from, VkImageLayout to, VkImageAspectFlags aspect)
+{
+	/*
+	 * We have already seen how image transition is done in Tutorial 7.  This is very similar, except the stages
+	 * and accesses are derived from the layouts (see get_layout_access() above), so that the transition waits
+	 * for exactly what it should, and blocks exactly what it should.
+	 *
+	 * vkCmdPipelineBarrier takes an array of image barriers, so all the images are transitioned with one call.
+	 * This matters more than it may seem, because every vkCmdPipelineBarrier call is potentially a pipeline
+	 * stall, while the driver can handle all the barriers given in one call together.
+	 */
+	VkAccessFlags src_access, dst_access;
+	VkPipelineStageFlags src_stages, dst_stages;
+
+	if (image_count == 0)
+		return;
+
+	get_layout_access(from, true, &src_access, &src_stages);
+	get_layout_access(to, false, &dst_access, &dst_stages);
+
+	VkImageMemoryBarrier image_barriers[image_count];
+	for (uint32_t i = 0; i < image_count; ++i)
+		image_barriers[i] = (VkImageMemoryBarrier){
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = src_access,
+			.dstAccessMask = dst_access,
+			.oldLayout = from,
+			.newLayout = to,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = images[i].image,
+			.subresourceRange = {
+				.aspectMask = aspect,
+				.baseMipLevel = 0,
+				.levelCount = VK_REMAINING_MIP_LEVELS,
+				.baseArrayLayer = 0,
+				.layerCount = VK_REMAINING_ARRAY_LAYERS,
+			},
+		};
+
+	vkCmdPipelineBarrier(cmd_buffer,
+			src_stages,
+			dst_stages,
+			0,					/* no flags */
+			0, NULL,				/* no memory barriers */
+			0, NULL,				/* no buffer barriers */
+			image_count, image_barriers);		/* our image transitions */
+}
+
 tut1_error tut8_render_transition_images(struct tut2_device *dev, struct tut7_render_essentials *essentials,
 		struct tut7_image *images, uint32_t image_count,
 		VkImageLayout from, VkImageLayout to, VkImageAspectFlags aspect, const char *name)
@@ -185,39 +362,7 @@ tut1_error tut8_render_transition_images(struct tut2_device *dev, struct tut7_re
 		goto exit_failed;
 	}
 
-	/*
-	 * We have already seen how image transition is done in Tutorial 7.  This is very similar, and in fact simpler,
-	 * because we are only doing the transition in this command buffer submission.  In other words, we don't need
-	 * to think about pipeline stages, or src and dst accesses.
-	 */
-	VkImageMemoryBarrier image_barrier = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.srcAccessMask = 0,
-		.dstAccessMask = 0,
-		.oldLayout = from,
-		.newLayout = to,
-		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.subresourceRange = {
-			.aspectMask = aspect,
-			.baseMipLevel = 0,
-			.levelCount = VK_REMAINING_MIP_LEVELS,
-			.baseArrayLayer = 0,
-			.layerCount = VK_REMAINING_ARRAY_LAYERS,
-		},
-	};
-
-	for (uint32_t i = 0; i < image_count; ++i)
-	{
-		image_barrier.image = images[i].image;
-		vkCmdPipelineBarrier(essentials->cmd_buffer,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-				0,			/* no flags */
-				0, NULL,		/* no memory barriers */
-				0, NULL,		/* no buffer barriers */
-				1, &image_barrier);	/* our image transition */
-	}
+	tut8_render_record_transition_images(essentials->cmd_buffer, images, image_count, from, to, aspect);
 
 	vkEndCommandBuffer(essentials->cmd_buffer);
 
@@ -229,7 +374,7 @@ tut1_error tut8_render_transition_images(struct tut2_device *dev, struct tut7_re
 		goto exit_failed;
 	}
 
-	/* Submit the command buffer to go ahead with the copy, and wait for it to finish */
+	/* Submit the command buffer to go ahead with the transition, and wait for it to finish */
 	VkSubmitInfo submit_info = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
 		.commandBufferCount = 1,
@@ -243,3 +388,315 @@ tut1_error tut8_render_transition_images(struct tut2_device *dev, struct tut7_re
 exit_failed:
 	return retval;
 }
+
+tut1_error tut8_render_init_uniform_ring(struct tut1_physical_device *phy_dev, struct tut8_uniform_ring *ring,
+		struct tut7_buffer *buffer)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+
+	/*
+	 * The offsets given for dynamic uniform buffers must be multiples of minUniformBufferOffsetAlignment, which is
+	 * a power of two (typically somewhere between 16 and 256 bytes).  The buffer must be host-visible so that it's
+	 * persistently mapped, and dynamic so that the descriptor set layout expects an offset.
+	 */
+	*ring = (struct tut8_uniform_ring){
+		.buffer = buffer,
+		.alignment = phy_dev->properties.limits.minUniformBufferOffsetAlignment,
+	};
+	if (ring->alignment == 0)
+		ring->alignment = 1;
+
+	if (buffer->map == NULL || !buffer->dynamic || buffer->size < ring->alignment)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_FEATURE_NOT_PRESENT);
+		tut1_error_printf(&retval, "The uniform ring needs a host-visible and dynamic buffer\n");
+	}
+
+	return retval;
+}
+
+static VkDeviceSize ring_size(struct tut8_uniform_ring *ring)
+{
+	/* Only a multiple of the alignment is used, so that wrapping around keeps the offsets aligned */
+	return ring->buffer->size - ring->buffer->size % ring->alignment;
+}
+
+static VkResult retire_frames(struct tut2_device *dev, struct tut8_uniform_ring *ring, bool wait)
+{
+	/*
+	 * The frames are retired in order, which is also the order they were submitted in.  Once a frame is done, all
+	 * the memory before its end can be reused.  If asked to wait, the oldest frame is waited on; that's what
+	 * happens when the ring is full.
+	 */
+	while (ring->frame_count > 0)
+	{
+		struct tut8_uniform_ring_frame *frame = &ring->frames[ring->first_frame];
+		VkResult res;
+
+		/* A frame without a fence is never retired, and waiting for it would mean waiting forever */
+		if (frame->fence == VK_NULL_HANDLE)
+			return wait?VK_ERROR_TOO_MANY_OBJECTS:VK_SUCCESS;
+
+		if (wait)
+		{
+			do
+			{
+				res = vkWaitForFences(dev->device, 1, &frame->fence, true, 1000000000);
+			} while (res == VK_TIMEOUT);
+			wait = false;
+		}
+		else
+			res = vkGetFenceStatus(dev->device, frame->fence);
+
+		if (res == VK_NOT_READY)
+			break;
+		if (res < 0)
+			return res;
+
+		ring->tail = frame->end;
+		ring->first_frame = (ring->first_frame + 1) % TUT8_MAX_FRAMES_IN_FLIGHT;
+		--ring->frame_count;
+	}
+
+	return VK_SUCCESS;
+}
+
+void tut8_render_ring_begin_frame(struct tut2_device *dev, struct tut8_uniform_ring *ring)
+{
+	retire_frames(dev, ring, false);
+	ring->frame_start = ring->head;
+}
+
+tut1_error tut8_render_ring_push(struct tut2_device *dev, struct tut8_uniform_ring *ring, const void *data, size_t size,
+		uint32_t *offset)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkDeviceSize total = ring_size(ring);
+	VkResult res;
+
+	if (size > total)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+		goto exit_failed;
+	}
+
+	/* Align the allocation, and if it doesn't fit before the end of the buffer, start over from the beginning */
+	uint64_t start = (ring->head + ring->alignment - 1) / ring->alignment * ring->alignment;
+	if (start % total + size > total)
+		start = (start + total - 1) / total * total;
+
+	/*
+	 * If that would overwrite data the GPU may still be using, wait for the oldest frame to finish.  If there are
+	 * no frames to wait for, the current frame alone is using the whole ring, which needs to be made larger.
+	 */
+	while (start + size - ring->tail > total)
+	{
+		if (ring->frame_count == 0)
+		{
+			tut1_error_set_vkresult(&retval, VK_ERROR_TOO_MANY_OBJECTS);
+			goto exit_failed;
+		}
+
+		res = retire_frames(dev, ring, true);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+	/* That's it; a memcpy.  Flushing is done once for the whole frame in tut8_render_ring_end_frame() */
+	memcpy((char *)ring->buffer->map + start % total, data, size);
+
+	*offset = start % total;
+	ring->head = start + size;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut8_render_ring_end_frame(struct tut2_device *dev, struct tut8_uniform_ring *ring, VkFence fence)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	struct tut7_buffer *buffer = ring->buffer;
+	VkDeviceSize total = ring_size(ring);
+	VkResult res = VK_SUCCESS;
+
+	/* If the memory is not host-coherent, flush everything written in this frame.  If it wrapped around, flush it all */
+	if (ring->head > ring->frame_start)
+	{
+		VkDeviceSize start = ring->frame_start % total;
+		VkDeviceSize size = ring->head - ring->frame_start;
+
+		if (start + size > total)
+			res = tut4_flush_memory(dev, buffer->buffer_mem, buffer->mem_size, buffer->non_coherent_atom_size, 0, total);
+		else
+			res = tut4_flush_memory(dev, buffer->buffer_mem, buffer->mem_size, buffer->non_coherent_atom_size, start, size);
+	}
+	tut1_error_set_vkresult(&retval, res);
+	if (res)
+		goto exit_failed;
+
+	/* Make room to remember this frame, if too many frames are already in flight */
+	if (ring->frame_count == TUT8_MAX_FRAMES_IN_FLIGHT)
+	{
+		res = retire_frames(dev, ring, true);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+	ring->frames[(ring->first_frame + ring->frame_count) % TUT8_MAX_FRAMES_IN_FLIGHT] = (struct tut8_uniform_ring_frame){
+		.fence = fence,
+		.end = ring->head,
+	};
+	++ring->frame_count;
+	ring->frame_start = ring->head;
+
+exit_failed:
+	return retval;
+}
+
+tut1_error tut8_render_get_frames(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames, uint32_t frame_count)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	if (frame_count == 0)
+		frame_count = 1;
+	if (frame_count > TUT8_MAX_FRAMES_IN_FLIGHT)
+		frame_count = TUT8_MAX_FRAMES_IN_FLIGHT;
+
+	/*
+	 * The first frame uses what `essentials` already has.  Starting at the last frame means the first call to
+	 * tut8_render_next_frame() lands on that one, for which essentials->first_render is still true.
+	 */
+	*frames = (struct tut8_render_frames){
+		.frames = {
+			[0] = {
+				.cmd_buffer = essentials->cmd_buffer,
+				.sem_post_acquire = essentials->sem_post_acquire,
+				.sem_pre_submit = essentials->sem_pre_submit,
+				.exec_fence = essentials->exec_fence,
+			},
+		},
+		.frame_count = frame_count,
+		.current = frame_count - 1,
+	};
+
+	/*
+	 * tut7_render_get_essentials() took the command buffer of the first queue of a presentable queue family, so
+	 * the extra command buffers are allocated from the pool of the same family.
+	 */
+	for (uint32_t i = 0; i < dev->command_pool_count && frames->pool == VK_NULL_HANDLE; ++i)
+		for (uint32_t j = 0; j < dev->command_pools[i].queue_count; ++j)
+			if (dev->command_pools[i].queues[j] == essentials->present_queue)
+				frames->pool = dev->command_pools[i].pool;
+
+	if (frames->pool == VK_NULL_HANDLE)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_INITIALIZATION_FAILED);
+		goto exit_failed;
+	}
+
+	VkSemaphoreCreateInfo sem_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	};
+	/* The fences start signaled, since there is no previous frame to wait for the first time around */
+	VkFenceCreateInfo fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+	};
+	VkCommandBufferAllocateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = frames->pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+
+	for (uint32_t i = 1; i < frame_count; ++i)
+	{
+		struct tut8_render_frame *frame = &frames->frames[i];
+
+		res = vkAllocateCommandBuffers(dev->device, &buffer_info, &frame->cmd_buffer);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		res = vkCreateSemaphore(dev->device, &sem_info, NULL, &frame->sem_post_acquire);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		res = vkCreateSemaphore(dev->device, &sem_info, NULL, &frame->sem_pre_submit);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+		res = vkCreateFence(dev->device, &fence_info, NULL, &frame->exec_fence);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+			goto exit_failed;
+	}
+
+exit_failed:
+	if (!tut1_error_is_success(&retval))
+		tut1_error_printf(&retval, "Failed to create resources for %u frames in flight\n", frame_count);
+	return retval;
+}
+
+tut1_error tut8_render_next_frame(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames)
+{
+	tut1_error retval = TUT1_ERROR_NONE;
+	VkResult res;
+
+	frames->current = (frames->current + 1) % frames->frame_count;
+	struct tut8_render_frame *frame = &frames->frames[frames->current];
+
+	/*
+	 * The frame's command buffer and semaphores can only be reused once the GPU is done with its previous use.
+	 * tut7_render_start() waits for the same fence, but only after acquiring the next image with the frame's
+	 * semaphore, which the previous use may still be waiting on.
+	 */
+	if (!essentials->first_render)
+	{
+		res = vkWaitForFences(dev->device, 1, &frame->exec_fence, true, 1000000000);
+		tut1_error_set_vkresult(&retval, res);
+		if (res)
+		{
+			tut1_error_printf(&retval, "Wait for frame %u's fence failed\n", frames->current);
+			return retval;
+		}
+	}
+
+	essentials->cmd_buffer = frame->cmd_buffer;
+	essentials->sem_post_acquire = frame->sem_post_acquire;
+	essentials->sem_pre_submit = frame->sem_pre_submit;
+	essentials->exec_fence = frame->exec_fence;
+
+	return retval;
+}
+
+void tut8_render_cleanup_frames(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames)
+{
+	vkDeviceWaitIdle(dev->device);
+
+	if (frames->frame_count > 0)
+	{
+		essentials->cmd_buffer = frames->frames[0].cmd_buffer;
+		essentials->sem_post_acquire = frames->frames[0].sem_post_acquire;
+		essentials->sem_pre_submit = frames->frames[0].sem_pre_submit;
+		essentials->exec_fence = frames->frames[0].exec_fence;
+	}
+
+	for (uint32_t i = 1; i < frames->frame_count; ++i)
+	{
+		struct tut8_render_frame *frame = &frames->frames[i];
+
+		if (frame->cmd_buffer)
+			vkFreeCommandBuffers(dev->device, frames->pool, 1, &frame->cmd_buffer);
+		vkDestroySemaphore(dev->device, frame->sem_post_acquire, NULL);
+		vkDestroySemaphore(dev->device, frame->sem_pre_submit, NULL);
+		vkDestroyFence(dev->device, frame->exec_fence, NULL);
+	}
+
+	*frames = (struct tut8_render_frames){0};
+}
@@ -26,6 +26,17 @@
 /* Fill the contents of a host-visible buffer/image with arbitrary data */
 tut1_error tut8_render_fill_buffer(struct tut2_device *dev, struct tut7_buffer *to, void *from, size_t size, const char *name);
 tut1_error tut8_render_fill_image(struct tut2_device *dev, struct tut7_image *to, void *from, size_t size, const char *name);
+/* Same, but write `size` bytes at `offset`, for example to update only part of a buffer every frame */
+tut1_error tut8_render_fill_buffer_at(struct tut2_device *dev, struct tut7_buffer *to, VkDeviceSize offset,
+		void *from, size_t size, const char *name);
+tut1_error tut8_render_fill_image_at(struct tut2_device *dev, struct tut7_image *to, VkDeviceSize offset,
+		void *from, size_t size, const char *name);
+
+/*
+ * Read back the contents of a host-visible buffer, for example one that tut8_render_copy_buffer() copied to.  Give
+ * host_cached to the buffer on creation for faster readback.
+ */
+tut1_error tut8_render_read_buffer(struct tut2_device *dev, struct tut7_buffer *from, void *to, size_t size, const char *name);
 
 /*
  * Copy a buffer/image to another, for example from a host-visible one to a device-local one.  This uses a command
@@ -43,6 +54,87 @@ tut1_error tut8_render_copy_image_to_buffer(struct tut2_device *dev, struct tut7
 		struct tut7_buffer *to, struct tut7_image *from, VkImageLayout from_layout,
 		VkBufferImageCopy *region, const char *name);
 
+/*
+ * A ring buffer for per-draw uniform data, such as transformations.  Instead of a uniform buffer per object that is
+ * overwritten every frame (while the GPU may still be reading it for the previous frame), every update gets a fresh
+ * part of one big buffer, which is bound as a dynamic uniform buffer with the offset of that part.  The memory used
+ * by a frame is reclaimed once the fence of that frame is signaled.
+ */
+#define TUT8_MAX_FRAMES_IN_FLIGHT 8
+/* A good size for the ring's buffer: room for a few hundred draws (or frames) of data before the ring wraps around */
+#define TUT8_UNIFORM_RING_SIZE (64 * 1024)
+
+struct tut8_uniform_ring
+{
+	/* A host-visible, dynamic uniform buffer created by tut7_create_buffers() */
+	struct tut7_buffer *buffer;
+	VkDeviceSize alignment;
+
+	/*
+	 * Where the next allocation goes, and where the oldest allocation in use is.  These only grow, and the actual
+	 * offset in the buffer is taken modulo the buffer size.
+	 */
+	uint64_t head;
+	uint64_t tail;
+
+	/* The frames in flight: where their allocations end, and the fence that tells when the GPU is done with them */
+	struct tut8_uniform_ring_frame
+	{
+		VkFence fence;
+		uint64_t end;
+	} frames[TUT8_MAX_FRAMES_IN_FLIGHT];
+	uint32_t first_frame;
+	uint32_t frame_count;
+
+	/* Where the current frame's allocations started, to flush them all at once */
+	uint64_t frame_start;
+};
+
+tut1_error tut8_render_init_uniform_ring(struct tut1_physical_device *phy_dev, struct tut8_uniform_ring *ring,
+		struct tut7_buffer *buffer);
+/* Reclaim the memory of the frames the GPU is done with.  Call before pushing data for a new frame */
+void tut8_render_ring_begin_frame(struct tut2_device *dev, struct tut8_uniform_ring *ring);
+/* Copy `size` bytes in the ring, and get the offset to give to vkCmdBindDescriptorSets as dynamic offset */
+tut1_error tut8_render_ring_push(struct tut2_device *dev, struct tut8_uniform_ring *ring, const void *data, size_t size,
+		uint32_t *offset);
+/*
+ * Flush the frame's data, and remember that it's in use until `fence` (given to vkQueueSubmit) is signaled.  With a
+ * VK_NULL_HANDLE fence, the data is kept for good, which is useful for command buffers that are recorded once.
+ */
+tut1_error tut8_render_ring_end_frame(struct tut2_device *dev, struct tut8_uniform_ring *ring, VkFence fence);
+
+/*
+ * tut7_render_essentials has one command buffer, one pair of semaphores and one fence, so every frame waits for the
+ * previous one to finish before it can be recorded.  With a few sets of those, the CPU can record a frame while the
+ * GPU is still busy with the previous ones.  tut8_render_next_frame() waits for the oldest frame to finish, and
+ * switches `essentials` over to its set, so tut7_render_start() and tut7_render_finish() work unchanged and
+ * essentials->exec_fence is always the fence of the current frame.  The first set is the one `essentials` came with.
+ */
+struct tut8_render_frames
+{
+	struct tut8_render_frame
+	{
+		VkCommandBuffer cmd_buffer;
+		VkSemaphore sem_post_acquire;
+		VkSemaphore sem_pre_submit;
+		VkFence exec_fence;
+	} frames[TUT8_MAX_FRAMES_IN_FLIGHT];
+	uint32_t frame_count;
+	uint32_t current;
+
+	/* The pool of the presentable queue's family, which the extra command buffers are allocated from */
+	VkCommandPool pool;
+};
+
+tut1_error tut8_render_get_frames(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames, uint32_t frame_count);
+/* Call before tut7_render_start() */
+tut1_error tut8_render_next_frame(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames);
+/* Give `essentials` its own set back, and destroy the rest */
+void tut8_render_cleanup_frames(struct tut2_device *dev, struct tut7_render_essentials *essentials,
+		struct tut8_render_frames *frames);
+
 /*
  *
  * Transition an image to a new layout.  This uses a command buffer, submits it, and waits for it to finish, so it's
@@ -51,5 +143,11 @@ tut1_error tut8_render_copy_image_to_buffer(struct tut2_device *dev, struct tut7
 tut1_error tut8_render_transition_images(struct tut2_device *dev, struct tut7_render_essentials *essentials,
 		struct tut7_image *images, uint32_t image_count,
 		VkImageLayout from, VkImageLayout to, VkImageAspectFlags aspect, const char *name);
+/*
+ * Record the same transition in a command buffer the caller is already recording (for example the first frame's)
+ * instead of submitting and waiting for it separately.  All images are transitioned with a single barrier.
+ */
+void tut8_render_record_transition_images(VkCommandBuffer cmd_buffer, struct tut7_image *images, uint32_t image_count,
+		VkImageLayout from, VkImageLayout to, VkImageAspectFlags aspect);
 
 #endif
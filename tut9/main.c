@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include "../tut8/tut8_render.h"
@@ -29,6 +30,9 @@
 #define TEXTURE_WIDTH 128
 #define TEXTURE_HEIGHT 128
 
+/* How many frames may be rendering at the same time; see tut8_render_get_frames() */
+#define FRAMES_IN_FLIGHT 3
+
 /*
  * From this tutorial on, the setup and rendering process is similar to Tutorial 8.  Depending on what is being
  * experimented on, bits and pieces would change.  I'll point out where something has changed.
@@ -70,6 +74,7 @@ enum
 	BUFFER_VERTICES = 1,
 	BUFFER_INDICES = 2,
 	BUFFER_VERTICES_STAGING = 3,
+	BUFFER_VERTICES_READBACK = 4,
 };
 enum
 {
@@ -97,10 +102,14 @@ struct render_data
 
 	/* Actual objects used in this tutorial */
 	struct tut7_image images[2];
-	struct tut7_buffer buffers[4];
+	struct tut7_sampler_cache samplers;
+	struct tut7_buffer buffers[5];
 	struct tut7_shader shaders[2];
 	struct tut7_graphics_buffers *gbuffers;
 
+	/* The transformation is written to a new part of this ring every frame */
+	struct tut8_uniform_ring transformation_ring;
+
 	/* For rendering */
 	VkRenderPass render_pass;
 	struct tut8_layout layout;
@@ -112,25 +121,38 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		struct tut6_swapchain *swapchain, struct tut7_render_essentials *essentials, struct render_data *render_data)
 {
 	tut1_error retval = TUT1_ERROR_NONE;
-	VkResult res;
 
 	/* Buffers */
+	/*
+	 * The transformation buffer is a ring of transformations, bound as a dynamic uniform buffer.  See
+	 * tut8_uniform_ring in tut8_render.h.
+	 */
 	render_data->buffers[BUFFER_TRANSFORMATION] = (struct tut7_buffer){
-		.size = sizeof render_data->transformation,
+		.size = TUT8_UNIFORM_RING_SIZE,
 		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 		.stage = VK_SHADER_STAGE_VERTEX_BIT,
 		.host_visible = true,
+		.dynamic = true,
 	};
 
 	render_data->buffers[BUFFER_VERTICES] = (struct tut7_buffer){
 		.size = sizeof render_data->objects.vertices,
-		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		.host_visible = false,
 	};
 	render_data->buffers[BUFFER_VERTICES_STAGING] = render_data->buffers[BUFFER_VERTICES];
 	render_data->buffers[BUFFER_VERTICES_STAGING].usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	render_data->buffers[BUFFER_VERTICES_STAGING].host_visible = true,
 
+	/*
+	 * To make sure the upload worked, the vertex buffer is copied back to a buffer the host reads from.  The host
+	 * reads that memory, so it asks for host-cached memory (see Tutorial 4 for why that matters).
+	 */
+	render_data->buffers[BUFFER_VERTICES_READBACK] = render_data->buffers[BUFFER_VERTICES];
+	render_data->buffers[BUFFER_VERTICES_READBACK].usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	render_data->buffers[BUFFER_VERTICES_READBACK].host_visible = true,
+	render_data->buffers[BUFFER_VERTICES_READBACK].host_cached = true,
+
 	/* To draw in indexed mode, we should have an index before alongside our vertex buffer */
 	render_data->buffers[BUFFER_INDICES] = (struct tut7_buffer){
 		.size = sizeof render_data->objects.indices,
@@ -138,7 +160,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.host_visible = false,
 	};
 
-	retval = tut7_create_buffers(phy_dev, dev, render_data->buffers, 4);
+	retval = tut7_create_buffers(phy_dev, dev, render_data->buffers, 5);
 	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Failed to create vertex, index and transformation buffers\n");
@@ -158,6 +180,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
 		.make_view = true,
 		.host_visible = false,
+		.sampler_cache = &render_data->samplers,
 	};
 	render_data->images[IMAGE_TEXTURE_STAGING] = render_data->images[IMAGE_TEXTURE];
 	render_data->images[IMAGE_TEXTURE_STAGING].usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
@@ -219,13 +242,35 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	retval = tut8_render_fill_buffer(dev, &render_data->buffers[BUFFER_VERTICES_STAGING], render_data->objects.vertices, sizeof render_data->objects.vertices, "staging vertex");
 	if (!tut1_error_is_success(&retval))
 		return retval;
-	retval = tut8_render_fill_buffer(dev, &render_data->buffers[BUFFER_TRANSFORMATION], &render_data->transformation, sizeof render_data->transformation, "transformation");
+	retval = tut8_render_init_uniform_ring(phy_dev, &render_data->transformation_ring, &render_data->buffers[BUFFER_TRANSFORMATION]);
 	if (!tut1_error_is_success(&retval))
 		return retval;
 	retval = tut8_render_copy_buffer(dev, essentials, &render_data->buffers[BUFFER_VERTICES], &render_data->buffers[BUFFER_VERTICES_STAGING],
 			sizeof render_data->objects.vertices, "vertex");
 	if (!tut1_error_is_success(&retval))
 		return retval;
+
+	/*
+	 * Let's read the vertices back from device memory and make sure they arrived intact.  The copy ends with a
+	 * barrier that makes the transfer writes available to the host (see copy_object_end() in tut8_render.c), and
+	 * tut8_render_read_buffer() invalidates the host caches if the memory is not host-coherent.
+	 */
+	retval = tut8_render_copy_buffer(dev, essentials, &render_data->buffers[BUFFER_VERTICES_READBACK], &render_data->buffers[BUFFER_VERTICES],
+			sizeof render_data->objects.vertices, "vertex readback");
+	if (!tut1_error_is_success(&retval))
+		return retval;
+
+	struct objects readback;
+	retval = tut8_render_read_buffer(dev, &render_data->buffers[BUFFER_VERTICES_READBACK], readback.vertices,
+			sizeof readback.vertices, "vertex readback");
+	if (!tut1_error_is_success(&retval))
+		return retval;
+	if (memcmp(readback.vertices, render_data->objects.vertices, sizeof readback.vertices) != 0)
+	{
+		tut1_error_set_vkresult(&retval, VK_ERROR_DEVICE_LOST);
+		tut1_error_printf(&retval, "The vertices read back from the device don't match what was uploaded\n");
+		return retval;
+	}
 	/*
 	 * Since the vertex buffer is bigger than the index buffer, we can use the staging vertex buffer to copy data
 	 * to the index buffer as well.
@@ -430,16 +475,8 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 	}
 
 	/* Descriptor Set */
-	VkDescriptorSetAllocateInfo set_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = render_data->pipeline.set_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &render_data->layout.set_layout,
-	};
-	res = vkAllocateDescriptorSets(dev->device, &set_info, &render_data->desc_set);
-	retval = TUT1_ERROR_NONE;
-	tut1_error_set_vkresult(&retval, res);
-	if (res)
+	retval = tut8_allocate_descriptor_sets(dev, &render_data->pipeline.set_allocators[0], &render_data->desc_set, 1);
+	if (!tut1_error_is_success(&retval))
 	{
 		tut1_error_printf(&retval, "Could not allocate descriptor set from pool\n");
 		return retval;
@@ -451,10 +488,11 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 		.imageView = render_data->images[IMAGE_TEXTURE].view,
 		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 	};
+	/* With a dynamic uniform buffer, the range is the size of one transformation; the offset is given at bind time */
 	VkDescriptorBufferInfo set_write_buffer_info = {
 		.buffer = render_data->buffers[BUFFER_TRANSFORMATION].buffer,
 		.offset = 0,
-		.range = VK_WHOLE_SIZE,
+		.range = sizeof render_data->transformation,
 	};
 	VkWriteDescriptorSet set_write[2] = {
 		[0] = {
@@ -470,7 +508,7 @@ static tut1_error allocate_render_data(struct tut1_physical_device *phy_dev, str
 			.dstSet = render_data->desc_set,
 			.dstBinding = 1,
 			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 			.pBufferInfo = &set_write_buffer_info,
 		},
 	};
@@ -486,7 +524,9 @@ static void free_render_data(struct tut2_device *dev, struct tut7_render_essenti
 	tut8_free_pipelines(dev, &render_data->pipeline, 1);
 	tut8_free_layouts(dev, &render_data->layout, 1);
 	tut7_free_images(dev, render_data->images, 1);
+	tut7_free_sampler_cache(dev, &render_data->samplers);
 	tut7_free_buffers(dev, render_data->buffers, 3);
+	tut7_free_buffers(dev, &render_data->buffers[BUFFER_VERTICES_READBACK], 1);
 	tut7_free_shaders(dev, render_data->shaders, 2);
 	tut7_free_graphics_buffers(dev, render_data->gbuffers, essentials->image_count, render_data->render_pass);
 
@@ -565,6 +605,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 	int res;
 	tut1_error retval = TUT1_ERROR_NONE;
 	struct tut7_render_essentials essentials;
+	struct tut8_render_frames in_flight;
 
 	struct render_data render_data = { .gbuffers = NULL, };
 
@@ -578,6 +619,27 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 	if (!tut1_error_is_success(&retval))
 		goto exit_bad_render_data;
 
+	/*
+	 * Unlike the previous tutorials, let the CPU run ahead of the GPU by a few frames.  Each frame gets its own
+	 * command buffer, semaphores and fence, and only waits for the frame that last used them.  The transformation
+	 * ring below then really has a few frames' worth of data in use at the same time.
+	 */
+	retval = tut8_render_get_frames(dev, &essentials, &in_flight, FRAMES_IN_FLIGHT);
+	if (!tut1_error_is_success(&retval))
+		goto exit_bad_frames;
+
+	/*
+	 * See how much memory that took out of each heap.  With VK_EXT_memory_budget, the driver also says how much
+	 * the whole process uses and may use, otherwise the budget is just a guess.
+	 */
+	struct tut7_heap_stats stats[VK_MAX_MEMORY_HEAPS];
+	tut7_get_memory_stats(phy_dev, dev, stats);
+	for (uint32_t i = 0; i < phy_dev->memories.memoryHeapCount; ++i)
+		printf("Heap %u: %llu bytes allocated (%llu at peak), %llu in use of a%s budget of %llu (heap size: %llu)\n", i,
+				(unsigned long long)stats[i].current, (unsigned long long)stats[i].peak,
+				(unsigned long long)stats[i].usage, stats[i].budget_from_driver?"":"n estimated",
+				(unsigned long long)stats[i].budget, (unsigned long long)stats[i].size);
+
 	unsigned int frames = 0;
 	time_t before = time(NULL);
 
@@ -595,6 +657,25 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 
 		uint32_t image_index;
 
+		/*
+		 * The transformation doesn't change in this tutorial, but if it did (or if there were many objects each
+		 * with their own), it would be written to the ring here, every frame.  Each write goes to a part of the
+		 * ring the GPU is not using, so there is no need to wait for the previous frame to finish first.
+		 */
+		retval = tut8_render_next_frame(dev, &essentials, &in_flight);
+		if (!tut1_error_is_success(&retval))
+			break;
+
+		uint32_t transformation_offset;
+		tut8_render_ring_begin_frame(dev, &render_data.transformation_ring);
+		retval = tut8_render_ring_push(dev, &render_data.transformation_ring, &render_data.transformation,
+				sizeof render_data.transformation, &transformation_offset);
+		if (!tut1_error_is_success(&retval))
+		{
+			tut1_error_printf(&retval, "Failed to write the transformation\n");
+			break;
+		}
+
 		/* We saw all this in Tutorial 8.  Any changes are commented. */
 		res = tut7_render_start(&essentials, dev, swapchain, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &image_index);
 		if (res)
@@ -622,7 +703,7 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		vkCmdBindPipeline(essentials.cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, render_data.pipeline.pipeline);
 
 		vkCmdBindDescriptorSets(essentials.cmd_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				render_data.layout.pipeline_layout, 0, 1, &render_data.desc_set, 0, NULL);
+				render_data.layout.pipeline_layout, 0, 1, &render_data.desc_set, 1, &transformation_offset);
 
 		VkDeviceSize vertices_offset = 0;
 		vkCmdBindVertexBuffers(essentials.cmd_buffer, 0, 1, &render_data.buffers[BUFFER_VERTICES].buffer, &vertices_offset);
@@ -666,8 +747,16 @@ static void render_loop(struct tut1_physical_device *phy_dev, struct tut2_device
 		res = tut7_render_finish(&essentials, dev, swapchain, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, image_index);
 		if (res)
 			break;
+
+		/* The transformation is in use until this frame's fence is signaled */
+		retval = tut8_render_ring_end_frame(dev, &render_data.transformation_ring, essentials.exec_fence);
+		if (!tut1_error_is_success(&retval))
+			break;
 	}
 
+exit_bad_frames:
+	tut8_render_cleanup_frames(dev, &essentials, &in_flight);
+
 exit_bad_render_data:
 	free_render_data(dev, &essentials, &render_data);
 